@@ -0,0 +1,275 @@
+/**
+ * @file compiler_bench.cpp
+ * @brief Compiler throughput per phase on large synthetic programs
+ *
+ * Each workload from synthetic.hpp is written to /tmp once and compiled
+ * with -O through compile_file, with --time-report phases on. Phases are
+ * grouped into:
+ *
+ *   lex        lex                            MB of source per second
+ *   parse      parse                          M AST nodes per second
+ *   optimize   ast_fold, ssa_build and the    M SSA instructions (as built)
+ *              SSA passes                     per second
+ *   codegen    lower, peephole, output        M machine instructions per second
+ *   end_to_end compile_file wall time         ms, file read and write included
+ *
+ * Every figure is the median of the runs. --save writes them as
+ * "<workload>.<metric> <value>" lines, --baseline reads such a file back
+ * and prints the change, + always meaning faster.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+#include <driver.hpp>
+#include <file_utils.hpp>
+#include <thread_pool.hpp>
+#include <timer.hpp>
+#include "synthetic.hpp"
+
+namespace
+{
+
+struct Workload
+{
+    std::string name;
+    std::string source;
+};
+
+struct Metric
+{
+    const char* name;
+    const char* unit;
+    bool higher_is_better;
+};
+
+static const Metric METRICS[] =
+{
+    {"lex",         "MB/s",         true},
+    {"parse",       "Mnodes/s",     true},
+    {"optimize",    "Minsts/s",     true},
+    {"codegen",     "Minsts/s",     true},
+    {"end_to_end",  "ms",           false},
+};
+static constexpr size_t METRIC_COUNT = sizeof (METRICS) / sizeof (METRICS[0]);
+
+struct Options
+{
+    uint32_t scale = 1;
+    int runs = 5;
+    size_t threads = 1;
+    std::string save_path;
+    std::string baseline_path;
+};
+
+std::vector<Workload> workloads (uint32_t scale)
+{
+    return {
+        {"expressions", synthetic_expressions (200 * scale, 40, 9)},
+        {"functions",   synthetic_functions (8000 * scale)},
+        {"loops",       synthetic_loops (300 * scale, 6, 5)},
+        {"calls",       synthetic_calls (40 * scale, 150)},
+    };
+}
+
+double median (std::vector<double> values)
+{
+    std::sort (values.begin (), values.end ());
+    return values[values.size () / 2];
+}
+
+int64_t count_of (const PhaseRecord& phase, const char* key)
+{
+    for (const auto& [name, value] : phase.counts)
+        if (name == key)
+            return value;
+    return 0;
+}
+
+/**
+ * Median of each metric over the runs
+ * Returns nullopt (after printing why) if the workload does not compile
+ */
+std::optional<std::array<double, METRIC_COUNT>> measure (const Workload& workload,
+                                                         const Options& options)
+{
+    std::string in_path = "/tmp/compiler_bench_" + workload.name + ".c";
+    string_to_file (workload.source, in_path);
+
+    CompileOptions compile;
+    compile.optimize = true;
+    compile.time_report = true;
+    std::optional<ThreadPool> pool;
+    if (options.threads != 1)
+        pool.emplace (options.threads);
+
+    std::array<std::vector<double>, METRIC_COUNT> samples;
+    for (int run = 0; run < options.runs; ++run)
+    {
+        ns_t start = get_time_ns ();
+        CompileResult result = compile_file ({in_path, "/tmp/compiler_bench.s"}, compile,
+                                             pool ? &*pool : nullptr);
+        ns_t wall = get_time_ns () - start;
+        if (!result.ok)
+        {
+            std::fprintf (stderr, "%s: %s", workload.name.c_str (), result.errors.c_str ());
+            return std::nullopt;
+        }
+
+        ns_t lex = 0, parse = 0, optimize = 0, codegen = 0;
+        int64_t nodes = 0, ssa_insts = 0, mir_insts = 0;
+        for (const auto& phase : result.report.phases ())
+        {
+            if (phase.name == "lex")
+                lex += phase.ns;
+            else if (phase.name == "parse")
+            {
+                parse += phase.ns;
+                nodes = count_of (phase, "ast_nodes");
+            }
+            else if (phase.name == "ssa_build")
+            {
+                optimize += phase.ns;
+                ssa_insts = count_of (phase, "ssa_insts");
+            }
+            else if (phase.name == "lower")
+            {
+                codegen += phase.ns;
+                mir_insts = count_of (phase, "mir_insts");
+            }
+            else if (phase.name == "peephole" || phase.name == "output")
+                codegen += phase.ns;
+            else
+                optimize += phase.ns;
+        }
+
+        // Per second, in millions (inputs per microsecond)
+        auto rate = [] (double amount, ns_t ns) { return amount / std::max<ns_t> (ns, 1) * 1e3; };
+        samples[0].push_back (rate (static_cast<double> (workload.source.size ()), lex));
+        samples[1].push_back (rate (static_cast<double> (nodes), parse));
+        samples[2].push_back (rate (static_cast<double> (ssa_insts), optimize));
+        samples[3].push_back (rate (static_cast<double> (mir_insts), codegen));
+        samples[4].push_back (wall / 1e6);
+    }
+
+    std::array<double, METRIC_COUNT> medians;
+    for (size_t m = 0; m < METRIC_COUNT; ++m)
+        medians[m] = median (samples[m]);
+    return medians;
+}
+
+/**
+ * "<key> <value>" lines of a saved run
+ */
+std::map<std::string, double> read_baseline (const std::string& path)
+{
+    std::map<std::string, double> values;
+    std::string text = file_to_string (path);
+    size_t pos = 0;
+    while (pos < text.size ())
+    {
+        size_t end = text.find ('\n', pos);
+        if (end == std::string::npos)
+            end = text.size ();
+        std::string line = text.substr (pos, end - pos);
+        size_t space = line.find (' ');
+        if (space != std::string::npos)
+            values[line.substr (0, space)] = std::strtod (line.c_str () + space + 1, nullptr);
+        pos = end + 1;
+    }
+    return values;
+}
+
+/**
+ * Parse flags, nullopt on a bad one
+ */
+std::optional<Options> parse_options (int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string flag {argv[i]};
+        bool has_value = i + 1 < argc;
+        if (flag == "--scale" && has_value)
+            options.scale = static_cast<uint32_t> (std::max (1, std::atoi (argv[++i])));
+        else if (flag == "--runs" && has_value)
+            options.runs = std::max (1, std::atoi (argv[++i]));
+        else if (flag == "-j" && has_value)
+            options.threads = static_cast<size_t> (std::max (0, std::atoi (argv[++i])));
+        else if (flag == "--save" && has_value)
+            options.save_path = argv[++i];
+        else if (flag == "--baseline" && has_value)
+            options.baseline_path = argv[++i];
+        else
+        {
+            std::fprintf (stderr, "Usage: compiler_bench [--scale N] [--runs N] [-j N]"
+                                  " [--save <path>] [--baseline <path>]\n");
+            return std::nullopt;
+        }
+    }
+    return options;
+}
+
+} // namespace
+
+/**
+ * Entry
+ */
+int main (int argc, char* argv[])
+{
+    std::optional<Options> options = parse_options (argc, argv);
+    if (!options)
+        return 1;
+
+    std::map<std::string, double> baseline;
+    if (!options->baseline_path.empty ())
+        baseline = read_baseline (options->baseline_path);
+
+    std::printf ("scale %u, median of %d runs, %zu thread(s)\n", options->scale, options->runs,
+                 options->threads);
+    std::printf ("%-12s %-11s %12s %-9s", "workload", "metric", "value", "unit");
+    if (!baseline.empty ())
+        std::printf (" %12s %8s", "baseline", "change");
+    std::printf ("\n");
+
+    std::string saved;
+    for (const auto& workload : workloads (options->scale))
+    {
+        std::optional<std::array<double, METRIC_COUNT>> values = measure (workload, *options);
+        if (!values)
+            return 1;
+
+        for (size_t m = 0; m < METRIC_COUNT; ++m)
+        {
+            const Metric& metric = METRICS[m];
+            double value = (*values)[m];
+            std::string key = workload.name + "." + metric.name;
+            std::printf ("%-12s %-11s %12.2f %-9s", m == 0 ? workload.name.c_str () : "",
+                         metric.name, value, metric.unit);
+
+            auto base = baseline.find (key);
+            if (base != baseline.end () && base->second > 0 && value > 0)
+            {
+                double change = metric.higher_is_better ? value / base->second
+                                                        : base->second / value;
+                std::printf (" %12.2f %+7.1f%%", base->second, (change - 1) * 100);
+            }
+            std::printf ("\n");
+
+            char line[128];
+            std::snprintf (line, sizeof (line), "%s %.4f\n", key.c_str (), value);
+            saved += line;
+        }
+        std::printf ("%-12s %-11s %12.2f %-9s\n", "", "source", workload.source.size () / 1e6,
+                     "MB");
+    }
+
+    if (!options->save_path.empty ())
+        string_to_file (saved, options->save_path);
+    return 0;
+}
@@ -0,0 +1,179 @@
+/**
+ * @file flat_ast_bench.cpp
+ * @brief Pointer tree vs flat (struct-of-arrays) AST traversal and folding
+ */
+
+#include <cstdio>
+#include <string>
+#include <lexer.hpp>
+#include <parser.hpp>
+#include <optimizer.hpp>
+#include <flat_ast.hpp>
+#include <timer.hpp>
+
+static constexpr size_t TARGET_NODES = 1000000;
+static constexpr int ITERATIONS = 5;
+
+/**
+ * Build a program with roughly TARGET_NODES expression nodes
+ * Each statement mixes foldable and non-foldable subtrees
+ */
+std::string make_source ()
+{
+    // "x + 3 * 4 - (x + 1)" contributes 9 nodes plus the joining '+'
+    static constexpr size_t NODES_PER_TERM = 10;
+    static constexpr size_t TERMS_PER_STMT = 50;
+
+    std::string src = "int main () {\n    int x = 1;\n";
+    size_t nodes = 0;
+    while (nodes < TARGET_NODES)
+    {
+        src += "    x = x";
+        for (size_t t = 0; t < TERMS_PER_STMT; ++t)
+            src += " + x + 3 * 4 - (x + 1)";
+        src += ";\n";
+        nodes += NODES_PER_TERM * TERMS_PER_STMT + 1;
+    }
+    src += "    return x;\n}\n";
+    return src;
+}
+
+Program parse_source (const std::string& src)
+{
+    Lexer lexer {src, false};
+    Parser parser {lexer.get_tokens ()};
+    return parser.parse ();
+}
+
+/********** TRAVERSALS **********/
+/**
+ * Pointer tree: count nodes and sum literals recursively
+ */
+long long walk_tree (const Expr& expr, size_t& count)
+{
+    ++count;
+    return std::visit ([&count] (const auto& node) -> long long
+    {
+        using T = std::decay_t<decltype (node)>;
+
+        if constexpr (std::is_same_v<T, IntLiteral>)
+            return node.value;
+        else if constexpr (std::is_same_v<T, UnaryOp>)
+            return walk_tree (*node.operand, count);
+        else if constexpr (std::is_same_v<T, BinaryOp>)
+            return walk_tree (*node.left, count) + walk_tree (*node.right, count);
+        else if constexpr (std::is_same_v<T, FuncCall>)
+        {
+            long long sum = 0;
+            for (const auto& arg : node.args)
+                sum += walk_tree (*arg, count);
+            return sum;
+        }
+        return 0;
+    }, expr.node);
+}
+
+long long walk_program (const Program& prog, size_t& count)
+{
+    long long sum = 0;
+    for (const auto& func : prog.functions)
+        for (const auto& stmt : func.body.statements)
+        {
+            if (const auto* d = std::get_if<VarDecl> (&stmt.node))
+            {
+                if (d->init.has_value ())
+                    sum += walk_tree (*d->init.value (), count);
+            }
+            else if (const auto* a = std::get_if<Assignment> (&stmt.node))
+                sum += walk_tree (*a->value, count);
+            else if (const auto* r = std::get_if<ReturnStmt> (&stmt.node))
+                sum += walk_tree (*r->value, count);
+        }
+    return sum;
+}
+
+/**
+ * Flat tree: count nodes and sum literals in one linear sweep
+ */
+long long walk_flat (const FlatProgram& flat, size_t& count)
+{
+    long long sum = 0;
+    const FlatExprs& e = flat.exprs;
+    for (size_t i = 0; i < e.size (); ++i)
+        if (e.kind[i] == ExprKind::INT_LITERAL)
+            sum += e.value[i];
+    count += e.size ();
+    return sum;
+}
+
+/**
+ * Run fn ITERATIONS times after setup, report best time in ms
+ */
+template <typename Setup, typename Fn>
+double best_ms (Setup setup, Fn fn)
+{
+    ns_t best = -1;
+    for (int i = 0; i < ITERATIONS; ++i)
+    {
+        auto state = setup ();
+        ns_t start = get_time_ns ();
+        fn (state);
+        ns_t elapsed = get_time_ns () - start;
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+    }
+    return static_cast<double> (best) / 1e6;
+}
+
+/**
+ * Entry
+ */
+int main ()
+{
+    std::string src = make_source ();
+    Program tree = parse_source (src);
+    FlatProgram flat = flatten (tree);
+
+    std::printf ("nodes: %zu\n\n", flat.exprs.size ());
+    std::printf ("%-10s %12s %12s %9s\n", "phase", "tree (ms)", "flat (ms)",
+                 "speedup");
+
+    size_t tree_count = 0, flat_count = 0;
+    long long tree_sum = 0, flat_sum = 0;
+
+    double walk_tree_ms = best_ms ([] { return 0; }, [&] (int)
+    {
+        tree_count = 0;
+        tree_sum = walk_program (tree, tree_count);
+    });
+    double walk_flat_ms = best_ms ([] { return 0; }, [&] (int)
+    {
+        flat_count = 0;
+        flat_sum = walk_flat (flat, flat_count);
+    });
+    std::printf ("%-10s %12.3f %12.3f %8.2fx\n", "traverse",
+                 walk_tree_ms, walk_flat_ms, walk_tree_ms / walk_flat_ms);
+
+    double fold_tree_ms = best_ms ([&] { return parse_source (src); },
+                                   [] (Program& prog)
+    {
+        Optimizer opt;
+        opt.optimize (prog);
+    });
+    double fold_flat_ms = best_ms ([&] { return flat; },
+                                   [] (FlatProgram& copy)
+    {
+        fold_constants (copy);
+    });
+    std::printf ("%-10s %12.3f %12.3f %8.2fx\n", "fold",
+                 fold_tree_ms, fold_flat_ms, fold_tree_ms / fold_flat_ms);
+
+    if (tree_count != flat_count || tree_sum != flat_sum)
+    {
+        std::fprintf (stderr, "mismatch: tree %zu/%lld, flat %zu/%lld\n",
+                      tree_count, tree_sum, flat_count, flat_sum);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,16 @@
+int main ()
+{
+    int total = 0;
+    int i = 1;
+    while (i < 20000)
+    {
+        int j = 1;
+        while (j < 1000)
+        {
+            total = total + i / j - (total / 7) / (j + 3) + i / 10;
+            j = j + 1;
+        }
+        i = i + 1;
+    }
+    return total;
+}
@@ -0,0 +1,21 @@
+int main ()
+{
+    int total = 0;
+    int i = 0;
+    while (i < 3000)
+    {
+        int j = 0;
+        while (j < 3000)
+        {
+            int k = 0;
+            while (k < 20)
+            {
+                total = total + i * j - k * 5 + (i - j) * 3;
+                k = k + 1;
+            }
+            j = j + 1;
+        }
+        i = i + 1;
+    }
+    return total;
+}
@@ -0,0 +1,275 @@
+/**
+ * @file lexer_bench.cpp
+ * @brief Lexer throughput (MB/s): table/SIMD lexer vs the old scalar lexer
+ */
+
+#include <cctype>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <lexer.hpp>
+#include <timer.hpp>
+
+static constexpr size_t TARGET_BYTES = 32 * 1024 * 1024;
+static constexpr int ITERATIONS = 5;
+
+/**
+ * Previous lexer, classifying bytes through <cctype> with a keyword compare
+ * chain. Kept verbatim as the baseline, except tokens go to a sink so the
+ * scan can be timed with or without building the token array.
+ */
+template <typename Sink>
+void scalar_lex (std::string_view input_, Sink& tokens_)
+{
+    size_t i = 0;
+    size_t line = 1;
+    size_t col = 1;
+
+    while (i < input_.size ())
+    {
+        char c = input_[i];
+
+        // Skip whitespace
+        if (std::isspace (c))
+        {
+            if (c == '\n')
+            {
+                line++;
+                col = 1;
+            }
+            else
+            {
+                col++;
+            }
+            i++;
+            continue;
+        }
+
+        // Scan number
+        if (std::isdigit (c))
+        {
+            size_t start = i;
+            size_t start_col = col;
+            while (i < input_.size () && std::isdigit (input_[i]))
+            {
+                i++;
+                col++;
+            }
+            tokens_.push_back ({TokenType::INT_LITERAL,
+                                    {line, start_col},
+                                    std::string_view {input_.data () + start,
+                                                       i - start}});
+            continue;
+        }
+
+        // Scan identifier or keyword
+        if (std::isalpha (c) || c == '_')
+        {
+            size_t start = i;
+            size_t start_col = col;
+            while (i < input_.size ()
+               && (std::isalnum (input_[i]) || input_[i] == '_'))
+            {
+                i++;
+                col++;
+            }
+            std::string_view lexeme {input_.data () + start, i - start};
+
+            TokenType type = TokenType::IDENTIFIER;
+            if (lexeme == "int")         type = TokenType::INT_TYPE;
+            else if (lexeme == "return") type = TokenType::RETURN;
+            else if (lexeme == "if")     type = TokenType::IF;
+            else if (lexeme == "while")  type = TokenType::WHILE;
+
+            tokens_.push_back ({type, {line, start_col}, lexeme});
+            continue;
+        }
+
+        // Two-character operators
+        if (i + 1 < input_.size ())
+        {
+            char next = input_[i + 1];
+            TokenType token_type = TokenType::UNKNOWN;
+
+            if (c == '=' && next == '=') token_type = TokenType::EQ_CMP;
+            if (c == '&' && next == '&') token_type = TokenType::AND_CMP;
+            if (c == '|' && next == '|') token_type = TokenType::OR_CMP;
+            if (c == '!' && next == '=') token_type = TokenType::NE_CMP;
+
+            if (token_type != TokenType::UNKNOWN)
+            {
+                tokens_.push_back ({token_type,
+                                        {line, col},
+                                        std::string_view {input_.data () + i,
+                                                          2}});
+                i += 2;
+                col += 2;
+                continue;
+            }
+        }
+
+        // Single-character operators and punctuation
+        TokenType type = TokenType::UNKNOWN;
+        switch (c)
+        {
+            case '+': type = TokenType::ADD_OP;    break;
+            case '-': type = TokenType::SUB_OP;    break;
+            case '*': type = TokenType::MULT_OP;   break;
+            case '/': type = TokenType::DIV_OP;    break;
+            case '=': type = TokenType::EQ_OP;     break;
+            case '<': type = TokenType::LT_CMP;    break;
+            case '>': type = TokenType::GT_CMP;    break;
+            case '!': type = TokenType::NOT_OP;    break;
+            case ';': type = TokenType::SEMICOLON; break;
+            case '(': type = TokenType::L_PAREN;   break;
+            case ')': type = TokenType::R_PAREN;   break;
+            case '{': type = TokenType::L_BRACE;   break;
+            case '}': type = TokenType::R_BRACE;   break;
+            case ',': type = TokenType::COMMA;     break;
+            default: break;
+        }
+
+        tokens_.push_back ({type,
+                                {line, col},
+                                std::string_view {input_.data () + i, 1}});
+        ++i;
+        ++col;
+    }
+
+    tokens_.push_back ({TokenType::END_OF_FILE,
+                            {line, col},
+                            {}});
+}
+
+struct VectorSink
+{
+    std::vector<Token> tokens {};
+    void push_back (const Token& tok) { tokens.push_back (tok); }
+};
+
+struct CountSink
+{
+    size_t count = 0;
+    void push_back (const Token&) { ++count; }
+};
+
+/**
+ * Build TARGET_BYTES of source with realistic indentation and identifiers
+ */
+std::string make_source ()
+{
+    std::string src;
+    src.reserve (TARGET_BYTES + 512);
+    for (size_t f = 0; src.size () < TARGET_BYTES; ++f)
+    {
+        std::string id = std::to_string (f);
+        src += "int helper_function_" + id + " (int counter, int limit)\n{\n";
+        src += "    int accumulator_value = 0;\n";
+        src += "    while (counter < limit)\n    {\n";
+        src += "        accumulator_value = accumulator_value + counter * 31;\n";
+        src += "        if (accumulator_value == 1000000 || !counter)\n        {\n";
+        src += "            return accumulator_value / 7;\n        }\n";
+        src += "        counter = counter + 1;\n    }\n";
+        src += "    return helper_function_" + id + " (counter, limit - 1);\n}\n\n";
+    }
+    return src;
+}
+
+/**
+ * Best-of-N throughput in MB/s
+ */
+template <typename Fn>
+double best_mbps (size_t bytes, Fn fn)
+{
+    ns_t best = -1;
+    for (int i = 0; i < ITERATIONS; ++i)
+    {
+        ns_t start = get_time_ns ();
+        fn ();
+        ns_t elapsed = get_time_ns () - start;
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+    }
+    return (static_cast<double> (bytes) / (1024.0 * 1024.0))
+         / (static_cast<double> (best) / 1e9);
+}
+
+/**
+ * Entry
+ */
+int main ()
+{
+    std::string src = make_source ();
+
+    VectorSink expected_sink;
+    scalar_lex (src, expected_sink);
+    const std::vector<Token>& expected = expected_sink.tokens;
+    auto got = Lexer {src, false}.take_tokens ();
+    if (got.tokens ().size () != expected.size ())
+    {
+        std::fprintf (stderr, "token count mismatch\n");
+        return 1;
+    }
+    for (size_t i = 0; i < expected.size (); ++i)
+    {
+        const Token& a = expected[i];
+        const Token& b = got.tokens ()[i];
+        if (a.type != b.type || a.lexeme != b.lexeme
+            || a.start.line != b.start.line || a.start.col != b.start.col)
+        {
+            std::fprintf (stderr, "token %zu mismatch\n", i);
+            return 1;
+        }
+    }
+
+    // Scan only: tokens are produced and counted, never stored
+    size_t sink = 0;
+    double scalar_scan = best_mbps (src.size (), [&]
+    {
+        CountSink counter;
+        scalar_lex (src, counter);
+        sink += counter.count;
+    });
+    std::vector<Lexer> lexers;
+    for (int i = 0; i < ITERATIONS; ++i)
+        lexers.emplace_back (src, false);
+    size_t run = 0;
+    double table_scan = best_mbps (src.size (), [&]
+    {
+        Lexer& l = lexers[run++];
+        while (l.next_token ().type != TokenType::END_OF_FILE)
+            ++sink;
+    });
+
+    // Full tokenize into a token array
+    double scalar_vec = best_mbps (src.size (), [&]
+    {
+        VectorSink vec;
+        scalar_lex (src, vec);
+        sink += vec.tokens.size ();
+    });
+    double table_vec = best_mbps (src.size (), [&]
+    {
+        Lexer l {src, false};
+        sink += l.get_tokens ().size ();
+    });
+
+#if defined(__AVX2__)
+    const char* simd = "AVX2";
+#elif defined(__SSE2__)
+    const char* simd = "SSE2";
+#else
+    const char* simd = "none";
+#endif
+
+    std::printf ("input: %.1f MB, %zu tokens, simd: %s\n\n",
+                 src.size () / (1024.0 * 1024.0), expected.size (), simd);
+    std::printf ("%-8s %12s %12s %9s\n", "mode", "scalar MB/s", "table MB/s",
+                 "speedup");
+    std::printf ("%-8s %12.1f %12.1f %8.2fx\n", "scan",
+                 scalar_scan, table_scan, table_scan / scalar_scan);
+    std::printf ("%-8s %12.1f %12.1f %8.2fx\n", "tokenize",
+                 scalar_vec, table_vec, table_vec / scalar_vec);
+
+    return sink == 0;
+}
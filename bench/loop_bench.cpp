@@ -0,0 +1,127 @@
+/**
+ * @file loop_bench.cpp
+ * @brief Loop passes on loop-heavy examples: instructions and run time
+ *
+ * Every example is compiled with -O twice, once with the loop passes off
+ * and once with them on, then assembled and run. Cycles are read with rdtsc
+ * around the whole run, so process start-up is included; the examples loop
+ * for long enough that it does not matter.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/wait.h>
+#include <x86intrin.h>
+#include <lexer.hpp>
+#include <parser.hpp>
+#include <codegen.hpp>
+#include <optimizer.hpp>
+#include <peephole.hpp>
+#include <file_utils.hpp>
+#include <timer.hpp>
+
+static constexpr int ITERATIONS = 5;
+
+static const char* EXAMPLES[] =
+{
+    "examples/loop/loop.c",
+    "examples/nested_loop/nested_loop.c",
+    "examples/strided/strided.c",
+};
+
+struct Measurement
+{
+    size_t insts = 0;       // Static, labels excluded
+    uint64_t cycles = 0;    // Best of ITERATIONS
+    ns_t ns = 0;
+    int status = -1;
+};
+
+/**
+ * Compile with -O and the given loop passes, assemble to bin_path
+ * @return Instruction count, 0 on failure
+ */
+size_t compile (const std::string& path, const LoopOptions& loops,
+                const std::string& bin_path)
+{
+    Lexer lexer {get_full_path (path)};
+    Parser parser {lexer};
+    Program prog = parser.parse ();
+    Optimizer {}.optimize (prog);
+
+    Codegen cg {prog, true, loops};
+    peephole (cg.get_mir ());
+
+    size_t insts = 0;
+    for (const auto& func : cg.get_mir ().functions)
+        for (const auto& inst : func.code)
+            if (inst.op != Opcode::LABEL)
+                ++insts;
+
+    std::string asm_path = bin_path + ".s";
+    string_to_file (cg.get_assembly (), asm_path);
+    std::string cmd = "g++ " + asm_path + " -o " + bin_path + " 2>/dev/null";
+    return system (cmd.c_str ()) == 0 ? insts : 0;
+}
+
+Measurement measure (const std::string& path, const LoopOptions& loops,
+                     const std::string& bin_path)
+{
+    Measurement m;
+    m.insts = compile (path, loops, bin_path);
+    if (m.insts == 0)
+        return m;
+
+    for (int i = 0; i < ITERATIONS; ++i)
+    {
+        ns_t start_ns = get_time_ns ();
+        uint64_t start = __rdtsc ();
+        int status = system (bin_path.c_str ());
+        uint64_t cycles = __rdtsc () - start;
+        ns_t ns = get_time_ns () - start_ns;
+
+        m.status = WEXITSTATUS (status);
+        if (i == 0 || cycles < m.cycles)
+        {
+            m.cycles = cycles;
+            m.ns = ns;
+        }
+    }
+    return m;
+}
+
+/**
+ * Entry
+ */
+int main ()
+{
+    LoopOptions off {false, false, 0, 64, false};
+    LoopOptions on {};
+
+    std::printf ("%-36s %7s %7s %12s %12s %9s\n", "example", "insts", "insts",
+                 "Mcycles", "Mcycles", "speedup");
+    std::printf ("%-36s %7s %7s %12s %12s\n", "", "before", "after",
+                 "before", "after");
+
+    bool ok = true;
+    for (const char* path : EXAMPLES)
+    {
+        Measurement before = measure (path, off, "/tmp/loop_bench_before");
+        Measurement after = measure (path, on, "/tmp/loop_bench_after");
+        if (before.insts == 0 || after.insts == 0 || before.status != after.status)
+        {
+            std::fprintf (stderr, "%s: compile failed or results differ\n", path);
+            ok = false;
+            continue;
+        }
+
+        std::printf ("%-36s %7zu %7zu %12.1f %12.1f %8.2fx  (%.1f -> %.1f ms)\n",
+                     path, before.insts, after.insts, before.cycles / 1e6,
+                     after.cycles / 1e6,
+                     static_cast<double> (before.cycles) / after.cycles,
+                     before.ns / 1e6, after.ns / 1e6);
+    }
+
+    return ok ? 0 : 1;
+}
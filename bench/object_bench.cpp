@@ -0,0 +1,129 @@
+/**
+ * @file object_bench.cpp
+ * @brief Object output: assembly text + as vs the built-in encoder
+ *
+ * Both paths start from the same allocated, peepholed MIR and end with a
+ * .o on disk. The source is a synthetic program of many small functions,
+ * so the output is large enough for the encoder's share to show. Running
+ * the program is then timed as link + exec of that object vs the JIT.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <sys/wait.h>
+#include <lexer.hpp>
+#include <parser.hpp>
+#include <codegen.hpp>
+#include <optimizer.hpp>
+#include <peephole.hpp>
+#include <jit.hpp>
+#include <file_utils.hpp>
+#include <timer.hpp>
+
+static constexpr int FUNCTIONS = 2000;
+static constexpr int ITERATIONS = 5;
+
+/**
+ * Functions with a loop, a branch and some arithmetic each, main calls them
+ * all
+ */
+std::string synthetic_source ()
+{
+    std::string source;
+    for (int i = 0; i < FUNCTIONS; ++i)
+    {
+        std::string n = std::to_string (i);
+        // Recursive, so neither inlined nor removed
+        source += "int f" + n + " (int a, int b) { int s = 0; int i = 0;"
+                  " if (a > 100) { return f" + n + " (a - 1, b); }"
+                  " while (i < a) { s = s + i * " + std::to_string (i % 7 + 2)
+                + " / 3; if (s > b && i != 5) { s = s - b; } i = i + 1; }"
+                  " return s + " + n + "; }\n";
+    }
+    source += "int main () { int s = 0;";
+    for (int i = 0; i < FUNCTIONS; ++i)
+        source += " s = s + f" + std::to_string (i) + " (10, 20);";
+    source += " return s; }\n";
+    return source;
+}
+
+/**
+ * Best-of wall time of fn in ms
+ */
+template <typename Fn>
+double best_ms (Fn fn)
+{
+    ns_t best = 0;
+    for (int i = 0; i < ITERATIONS; ++i)
+    {
+        ns_t start = get_time_ns ();
+        fn ();
+        ns_t elapsed = get_time_ns () - start;
+        if (i == 0 || elapsed < best)
+            best = elapsed;
+    }
+    return best / 1e6;
+}
+
+/**
+ * Entry
+ */
+int main ()
+{
+    std::string source = synthetic_source ();
+    Lexer lexer {source, false};
+    Parser parser {lexer.get_tokens ()};
+    Program prog = parser.parse ();
+    Optimizer {}.optimize (prog);
+
+    std::optional<Codegen> cg;
+    double compile_ms = best_ms ([&]
+    {
+        cg.emplace (prog, true);
+        peephole (cg->get_mir ());
+    });
+
+    bool ok = true;
+    double text_ms = best_ms ([&]
+    {
+        string_to_file (cg->get_assembly (), "/tmp/object_bench.s");
+        ok = ok && system ("as /tmp/object_bench.s -o /tmp/object_bench_as.o") == 0;
+    });
+    double object_ms = best_ms ([&]
+    {
+        string_to_file (cg->get_object (), "/tmp/object_bench.o");
+    });
+
+    int exec_result = 0;
+    double exec_ms = best_ms ([&]
+    {
+        string_to_file (cg->get_object (), "/tmp/object_bench.o");
+        ok = ok && system ("gcc /tmp/object_bench.o -o /tmp/object_bench") == 0;
+        exec_result = WEXITSTATUS (system ("/tmp/object_bench"));
+    });
+    int jit_result = 0;
+    double jit_ms = best_ms ([&]
+    {
+        jit_result = JitModule {cg->get_mir ()}.run_main ();
+    });
+
+    if (!ok || exec_result != (jit_result & 0xFF))
+    {
+        std::fprintf (stderr, "as, gcc or the JIT failed\n");
+        return 1;
+    }
+
+    std::printf ("%d functions, %zu bytes of source\n", FUNCTIONS, source.size ());
+    std::printf ("%-28s %10.2f ms\n", "front end + codegen", compile_ms);
+    std::printf ("%-28s %10.2f ms\n", "print + as", text_ms);
+    std::printf ("%-28s %10.2f ms  (%.1fx)\n", "encode + write (-c)", object_ms,
+                 text_ms / object_ms);
+    std::printf ("%-28s %10.1fx\n", "end to end speedup",
+                 (compile_ms + text_ms) / (compile_ms + object_ms));
+    std::printf ("%-28s %10.2f ms\n", "-c + link + exec", exec_ms);
+    std::printf ("%-28s %10.2f ms  (%.1fx)\n", "jit + run (--run)", jit_ms,
+                 exec_ms / jit_ms);
+    return 0;
+}
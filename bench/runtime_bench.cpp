@@ -0,0 +1,319 @@
+/**
+ * @file runtime_bench.cpp
+ * @brief Speed of the generated code: cycles, instructions and branch misses
+ *        per kernel, with and without -O
+ *
+ * Each kernel in bench/kernels is compiled to assembly, linked with g++ and
+ * run as its own process. The hardware counters are opened on the child
+ * before it execs and switch on at the exec, so they cover the kernel's
+ * process (loader included, which the kernels run long enough to swamp)
+ * and not fork or the harness. rdtsc around the exec is always recorded;
+ * where perf_event_open has no hardware counters (VMs, containers,
+ * perf_event_paranoid > 2) the other columns read n/a. Every figure is the
+ * best of ITERATIONS runs.
+ *
+ * --save writes "<kernel>.<flags>.<counter> <value>" lines. --baseline
+ * compares against such a file and exits with 1 if tsc, cycles or
+ * instructions of any kernel got worse by more than --tolerance percent,
+ * so a Codegen or Optimizer change cannot slow the output down unnoticed.
+ */
+
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <x86intrin.h>
+#include <driver.hpp>
+#include <file_utils.hpp>
+
+static constexpr int ITERATIONS = 5;
+
+static const char* KERNELS[] =
+{
+    "fib",              // Recursive calls
+    "nested_loops",     // Multiply-add in a three-deep while nest
+    "division",         // idiv by loop variables
+};
+
+struct Counters
+{
+    uint64_t tsc = 0;               // Always available
+    bool hardware = false;          // cycles, instructions and branch_misses read
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    uint64_t branch_misses = 0;
+    int status = -1;
+};
+
+struct Counter
+{
+    const char* name;
+    uint64_t Counters::* value;
+    bool hardware;
+    bool checked;                   // Counts towards the regression check
+};
+
+static const Counter COUNTERS[] =
+{
+    {"tsc",             &Counters::tsc,             false,  true},
+    {"cycles",          &Counters::cycles,          true,   true},
+    {"instructions",    &Counters::instructions,    true,   true},
+    {"branch_misses",   &Counters::branch_misses,   true,   false},
+};
+
+/**
+ * User-space hardware counter on pid, in group (-1 opens the leader, which
+ * starts disabled and is enabled by pid's next exec)
+ * @return Descriptor, -1 if the counter is not available
+ */
+int open_counter (uint64_t config, pid_t pid, int group)
+{
+    perf_event_attr attr {};
+    attr.size = sizeof (attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    if (group == -1)
+    {
+        attr.disabled = 1;
+        attr.enable_on_exec = 1;
+    }
+    return static_cast<int> (syscall (SYS_perf_event_open, &attr, pid, -1, group, 0));
+}
+
+/**
+ * Run bin_path once, counting
+ */
+Counters run (const std::string& bin_path)
+{
+    Counters counters;
+    int go[2];
+    if (pipe (go) != 0)
+        return counters;
+
+    // The child waits for the counters to be attached before it execs
+    pid_t child = fork ();
+    if (child == 0)
+    {
+        close (go[1]);
+        char byte;
+        if (read (go[0], &byte, 1) != 1)
+            _exit (127);
+        execl (bin_path.c_str (), bin_path.c_str (), nullptr);
+        _exit (127);
+    }
+    close (go[0]);
+    if (child < 0)
+    {
+        close (go[1]);
+        return counters;
+    }
+
+    int fds[3] = {-1, -1, -1};
+    fds[0] = open_counter (PERF_COUNT_HW_CPU_CYCLES, child, -1);
+    if (fds[0] >= 0)
+    {
+        fds[1] = open_counter (PERF_COUNT_HW_INSTRUCTIONS, child, fds[0]);
+        fds[2] = open_counter (PERF_COUNT_HW_BRANCH_MISSES, child, fds[0]);
+    }
+
+    uint64_t start = __rdtsc ();
+    if (write (go[1], "x", 1) != 1)
+        kill (child, SIGKILL);
+    close (go[1]);
+    int status = 0;
+    waitpid (child, &status, 0);
+    counters.tsc = __rdtsc () - start;
+    counters.status = WIFEXITED (status) ? WEXITSTATUS (status) : -1;
+
+    // The counts stay readable after the child has exited
+    struct
+    {
+        uint64_t count;
+        uint64_t values[3];
+    } group {};
+    if (fds[0] >= 0 && fds[1] >= 0 && fds[2] >= 0
+        && read (fds[0], &group, sizeof (group)) == sizeof (group))
+    {
+        counters.hardware = true;
+        counters.cycles = group.values[0];
+        counters.instructions = group.values[1];
+        counters.branch_misses = group.values[2];
+    }
+    for (int fd : fds)
+        if (fd >= 0)
+            close (fd);
+    return counters;
+}
+
+/**
+ * Compile and link kernel, then the best of ITERATIONS runs
+ * @return status -1 if it did not build
+ */
+Counters measure (const std::string& kernel, bool optimize)
+{
+    std::string bin_path = "/tmp/runtime_bench_" + kernel + (optimize ? "_O" : "");
+    CompileOptions options;
+    options.optimize = optimize;
+    CompileResult result = compile_file ({"bench/kernels/" + kernel + ".c", bin_path + ".s"},
+                                         options);
+    if (!result.ok)
+    {
+        std::fprintf (stderr, "%s", result.errors.c_str ());
+        return {};
+    }
+    std::string cmd = "g++ " + bin_path + ".s -o " + bin_path + " 2>/dev/null";
+    if (system (cmd.c_str ()) != 0)
+        return {};
+
+    Counters best = run (bin_path);
+    for (int i = 1; i < ITERATIONS; ++i)
+    {
+        Counters counters = run (bin_path);
+        for (const Counter& counter : COUNTERS)
+            best.*counter.value = std::min (best.*counter.value, counters.*counter.value);
+        best.hardware = best.hardware && counters.hardware;
+    }
+    return best;
+}
+
+/**
+ * "<key> <value>" lines of a saved run
+ */
+std::map<std::string, double> read_baseline (const std::string& path)
+{
+    std::map<std::string, double> values;
+    std::string text = file_to_string (path);
+    size_t pos = 0;
+    while (pos < text.size ())
+    {
+        size_t end = text.find ('\n', pos);
+        if (end == std::string::npos)
+            end = text.size ();
+        std::string line = text.substr (pos, end - pos);
+        size_t space = line.find (' ');
+        if (space != std::string::npos)
+            values[line.substr (0, space)] = std::strtod (line.c_str () + space + 1, nullptr);
+        pos = end + 1;
+    }
+    return values;
+}
+
+void print_millions (const Counters& counters, uint64_t value)
+{
+    if (counters.hardware)
+        std::printf (" %10.2f", value / 1e6);
+    else
+        std::printf (" %10s", "n/a");
+}
+
+/**
+ * Entry
+ */
+int main (int argc, char* argv[])
+{
+    std::string save_path, baseline_path;
+    double tolerance = 5;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string flag {argv[i]};
+        if (flag == "--save" && i + 1 < argc)
+            save_path = argv[++i];
+        else if (flag == "--baseline" && i + 1 < argc)
+            baseline_path = argv[++i];
+        else if (flag == "--tolerance" && i + 1 < argc)
+            tolerance = std::strtod (argv[++i], nullptr);
+        else
+        {
+            std::fprintf (stderr, "Usage: runtime_bench [--save <path>] [--baseline <path>]"
+                                  " [--tolerance <percent>]\n");
+            return 1;
+        }
+    }
+
+    std::map<std::string, double> baseline;
+    if (!baseline_path.empty ())
+        baseline = read_baseline (baseline_path);
+
+    std::printf ("%-14s %-5s %10s %10s %10s %6s %10s\n", "kernel", "flags", "Mtsc",
+                 "Mcycles", "Minsts", "IPC", "Mbr-miss");
+
+    bool ok = true, hardware = true;
+    std::string saved, regressions;
+    for (const char* kernel : KERNELS)
+    {
+        int status = -1;
+        for (bool optimize : {false, true})
+        {
+            Counters counters = measure (kernel, optimize);
+            const char* flags = optimize ? "-O" : "-O0";
+            if (counters.status < 0 || (optimize && counters.status != status))
+            {
+                std::fprintf (stderr, "%s %s: build failed or result differs\n", kernel, flags);
+                ok = false;
+                continue;
+            }
+            status = counters.status;
+            hardware = hardware && counters.hardware;
+
+            std::printf ("%-14s %-5s %10.2f", kernel, flags, counters.tsc / 1e6);
+            print_millions (counters, counters.cycles);
+            print_millions (counters, counters.instructions);
+            if (counters.hardware)
+                std::printf (" %6.2f", static_cast<double> (counters.instructions)
+                                       / std::max<uint64_t> (counters.cycles, 1));
+            else
+                std::printf (" %6s", "n/a");
+            print_millions (counters, counters.branch_misses);
+            std::printf ("\n");
+
+            for (const Counter& counter : COUNTERS)
+            {
+                if (counter.hardware && !counters.hardware)
+                    continue;
+                double value = static_cast<double> (counters.*counter.value);
+                std::string key = std::string (kernel) + "." + (flags + 1) + "." + counter.name;
+                saved += key + " " + std::to_string (counters.*counter.value) + "\n";
+
+                auto base = baseline.find (key);
+                if (!counter.checked || base == baseline.end () || base->second <= 0)
+                    continue;
+                double change = (value / base->second - 1) * 100;
+                if (change > tolerance)
+                {
+                    char line[160];
+                    std::snprintf (line, sizeof (line), "  %-36s %14.0f -> %14.0f  %+6.1f%%\n",
+                                   key.c_str (), base->second, value, change);
+                    regressions += line;
+                }
+            }
+        }
+    }
+    if (!hardware)
+        std::printf ("(no hardware counters: perf_event_open is unavailable or restricted)\n");
+
+    if (!save_path.empty ())
+        string_to_file (saved, save_path);
+    if (!baseline.empty ())
+    {
+        if (regressions.empty ())
+            std::printf ("No regressions against %s (tolerance %.1f%%)\n", baseline_path.c_str (),
+                         tolerance);
+        else
+        {
+            std::printf ("Regressions against %s (tolerance %.1f%%):\n%s", baseline_path.c_str (),
+                         tolerance, regressions.c_str ());
+            ok = false;
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,208 @@
+/**
+ * @file synthetic.hpp
+ * @brief Generator of large, valid Bit-C programs for benchmarks
+ *
+ * Every program is a pure function of its parameters and seed (the random
+ * source is a fixed xorshift, not <random>, whose distributions differ
+ * between standard libraries), so runs on different machines and compilers
+ * measure the same input. Programs are valid Bit-C: divisors are non-zero
+ * literals and every loop is bounded.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/**
+ * xorshift64*, deterministic everywhere
+ */
+class SyntheticRng
+{
+public:
+    explicit SyntheticRng (uint64_t seed) : state_ (seed * 2685821657736338717ull | 1) {}
+
+    uint64_t next ()
+    {
+        state_ ^= state_ >> 12;
+        state_ ^= state_ << 25;
+        state_ ^= state_ >> 27;
+        return state_ * 2685821657736338717ull;
+    }
+
+    /**
+     * Uniform-ish in [0, bound)
+     */
+    uint32_t below (uint32_t bound)
+    {
+        return static_cast<uint32_t> ((next () >> 32) % bound);
+    }
+
+private:
+    uint64_t state_;
+};
+
+/**
+ * Random expression over a, b, c and small literals, depth levels deep
+ */
+inline void synthetic_expr (std::string& out, SyntheticRng& rng, uint32_t depth)
+{
+    if (depth == 0 || rng.below (8) == 0)
+    {
+        static const char* leaves[] = {"a", "b", "c"};
+        if (rng.below (3) == 0)
+            out += std::to_string (rng.below (100));
+        else
+            out += leaves[rng.below (3)];
+        return;
+    }
+
+    // Division only by non-zero literals
+    uint32_t op = rng.below (6);
+    out += '(';
+    synthetic_expr (out, rng, depth - 1);
+    switch (op)
+    {
+        case 0: case 1: out += " + "; break;
+        case 2:         out += " - "; break;
+        case 3: case 4: out += " * "; break;
+        default:
+            out += " / " + std::to_string (rng.below (15) + 2) + ")";
+            return;
+    }
+    synthetic_expr (out, rng, depth - 1);
+    out += ')';
+}
+
+/**
+ * Deep expression trees: functions of statements whose right-hand
+ * sides are depth levels deep
+ */
+inline std::string synthetic_expressions (uint32_t functions, uint32_t statements,
+                                          uint32_t depth, uint64_t seed = 1)
+{
+    SyntheticRng rng {seed};
+    std::string out;
+    for (uint32_t f = 0; f < functions; ++f)
+    {
+        out += "int e" + std::to_string (f) + " (int a, int b) {\n    int c = a - b;\n";
+        for (uint32_t s = 0; s < statements; ++s)
+        {
+            out += "    c = ";
+            synthetic_expr (out, rng, depth);
+            out += ";\n";
+        }
+        out += "    return c;\n}\n";
+    }
+
+    out += "int main () {\n    int s = 0;\n";
+    for (uint32_t f = 0; f < functions; ++f)
+        out += "    s = s + e" + std::to_string (f) + " (s - " + std::to_string (f % 13)
+             + ", " + std::to_string (f % 7) + ");\n";
+    out += "    return s;\n}\n";
+    return out;
+}
+
+/**
+ * Many small functions with a branch, a loop and a call each
+ */
+inline std::string synthetic_functions (uint32_t functions, uint64_t seed = 1)
+{
+    SyntheticRng rng {seed};
+    std::string out;
+    for (uint32_t f = 0; f < functions; ++f)
+    {
+        std::string n = std::to_string (f);
+        out += "int f" + n + " (int a, int b) {\n"
+               "    int s = 0;\n    int i = 0;\n"
+               "    while (i < a) {\n"
+               "        s = s + i * " + std::to_string (rng.below (9) + 1) + ";\n"
+               "        if (s > b && i != " + std::to_string (rng.below (5)) + ") {\n"
+               "            s = s - b;\n        }\n"
+               "        i = i + 1;\n    }\n";
+        if (f > 0)
+            out += "    if (a > 100) {\n        return f" + std::to_string (rng.below (f))
+                 + " (a - 1, s);\n    }\n";
+        out += "    return s + " + n + ";\n}\n";
+    }
+
+    out += "int main () {\n    int s = 0;\n";
+    for (uint32_t f = 0; f < functions; ++f)
+        out += "    s = s + f" + std::to_string (f) + " (s - 5, 7);\n";
+    out += "    return s;\n}\n";
+    return out;
+}
+
+/**
+ * while loops nested depth deep, repeated nests times per function
+ */
+inline std::string synthetic_loops (uint32_t functions, uint32_t nests, uint32_t depth,
+                                    uint64_t seed = 1)
+{
+    SyntheticRng rng {seed};
+    std::string out;
+    for (uint32_t f = 0; f < functions; ++f)
+    {
+        out += "int l" + std::to_string (f) + " (int a, int b) {\n    int s = 0;\n";
+        for (uint32_t n = 0; n < nests; ++n)
+        {
+            for (uint32_t d = 0; d < depth; ++d)
+            {
+                std::string i = "i" + std::to_string (n) + "_" + std::to_string (d);
+                std::string indent (4 * (d + 1), ' ');
+                out += indent + "int " + i + " = 0;\n"
+                     + indent + "while (" + i + " < " + std::to_string (rng.below (3) + 2)
+                     + ") {\n";
+            }
+            std::string inner (4 * (depth + 1), ' ');
+            out += inner + "s = s + a * " + std::to_string (rng.below (7) + 1)
+                 + " - b / " + std::to_string (rng.below (5) + 2) + ";\n";
+            for (uint32_t d = depth; d-- > 0;)
+            {
+                std::string i = "i" + std::to_string (n) + "_" + std::to_string (d);
+                std::string indent (4 * (d + 1), ' ');
+                out += indent + "    " + i + " = " + i + " + 1;\n" + indent + "}\n";
+            }
+        }
+        out += "    return s;\n}\n";
+    }
+
+    out += "int main () {\n    int s = 0;\n";
+    for (uint32_t f = 0; f < functions; ++f)
+        out += "    s = s + l" + std::to_string (f) + " (2, 3);\n";
+    out += "    return s;\n}\n";
+    return out;
+}
+
+/**
+ * Call chains: function k calls k + 1 (and sometimes k + 2) with computed
+ * arguments, chains links deep, so the call graph is long rather than wide
+ */
+inline std::string synthetic_calls (uint32_t chains, uint32_t links, uint64_t seed = 1)
+{
+    SyntheticRng rng {seed};
+    std::string out;
+    for (uint32_t c = 0; c < chains; ++c)
+    {
+        // Defined callee first, the chain runs from the end backwards
+        std::string prefix = "c" + std::to_string (c) + "_";
+        out += "int " + prefix + std::to_string (links)
+             + " (int a, int b, int c, int d) {\n    return a + b * c - d;\n}\n";
+        for (uint32_t k = links; k-- > 0;)
+        {
+            std::string next = prefix + std::to_string (k + 1);
+            out += "int " + prefix + std::to_string (k) + " (int a, int b, int c, int d) {\n"
+                   "    int x = " + next + " (a + 1, b - " + std::to_string (rng.below (4))
+                 + ", c * 2, d);\n";
+            if (k + 2 <= links && rng.below (3) == 0)
+                out += "    x = x + " + prefix + std::to_string (k + 2) + " (d, c, b, a);\n";
+            out += "    return x / " + std::to_string (rng.below (3) + 2) + ";\n}\n";
+        }
+    }
+
+    out += "int main () {\n    int s = 0;\n";
+    for (uint32_t c = 0; c < chains; ++c)
+        out += "    s = s + c" + std::to_string (c) + "_0 (1, 2, 3, 4);\n";
+    out += "    return s;\n}\n";
+    return out;
+}
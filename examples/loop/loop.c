@@ -0,0 +1,21 @@
+int add (int a, int b)
+{
+    return a + b;
+}
+
+int main ()
+{
+    int i = 0;
+    int sum = 0;
+    while (i < 10)
+    {
+        if (i == 3)
+        {
+            sum = sum + 100;
+        }
+        sum = add (sum, i);
+        i = i + 1;
+    }
+
+    return sum - 100;
+}
@@ -0,0 +1,17 @@
+int main ()
+{
+    int total = 0;
+    int i = 0;
+    while (i < 20000)
+    {
+        int j = 0;
+        while (j < 10000)
+        {
+            total = total + i * 7 + j * 3;
+            j = j + 1;
+        }
+        i = i + 1;
+    }
+
+    return total;
+}
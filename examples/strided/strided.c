@@ -0,0 +1,24 @@
+int step (int n, int scale)
+{
+    int acc = 0;
+    int k = n;
+    while (k > 0)
+    {
+        acc = acc + scale * scale + k * 5;
+        k = k - 1;
+    }
+    return acc;
+}
+
+int main ()
+{
+    int r = 0;
+    int t = 0;
+    while (t < 3000)
+    {
+        r = r + step (60000, t);
+        t = t + 1;
+    }
+
+    return r;
+}
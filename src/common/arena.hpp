@@ -0,0 +1,200 @@
+/**
+ * @file arena.hpp
+ * @brief Bump allocator that frees all of its objects at once
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Bump/arena allocator
+ *
+ * Objects are carved out of large blocks and never freed individually. Every
+ * object lives until release () or the arena's destruction. Objects with
+ * non-trivial destructors are recorded and destroyed in reverse order of
+ * creation when the arena is released.
+ *
+ * Blocks never move, so pointers into the arena stay valid when the arena
+ * itself is moved. reset () frees the objects but keeps the blocks for the
+ * next round of allocations, so an arena reused across compiles stops
+ * calling the system allocator once it has grown to the largest of them.
+ */
+class Arena
+{
+private:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    struct Dtor
+    {
+        void (*destroy) (void*);
+        void* obj;
+    };
+
+    std::vector<std::unique_ptr<std::byte[]>> blocks_ {};      // BLOCK_SIZE each
+    std::vector<std::unique_ptr<std::byte[]>> spare_ {};       // Kept by reset ()
+    std::vector<std::unique_ptr<std::byte[]>> large_ {};       // Oversized requests
+    std::vector<Dtor> dtors_ {};
+    std::byte* cur_ = nullptr;
+    size_t left_ = 0;
+    size_t bytes_used_ = 0;
+
+    /**
+     * Start a new block big enough for size bytes at align
+     */
+    void* allocate_slow (size_t size, size_t align)
+    {
+        // Oversized requests get a dedicated block, keep bumping the old one
+        if (size + align > BLOCK_SIZE)
+        {
+            large_.push_back (std::make_unique<std::byte[]> (size + align));
+            return align_up (large_.back ().get (), align);
+        }
+
+        if (spare_.empty ())
+            blocks_.push_back (std::make_unique<std::byte[]> (BLOCK_SIZE));
+        else
+        {
+            blocks_.push_back (std::move (spare_.back ()));
+            spare_.pop_back ();
+        }
+
+        std::byte* base = blocks_.back ().get ();
+        std::byte* ptr = align_up (base, align);
+        size_t needed = static_cast<size_t> (ptr - base) + size;
+        cur_ = base + needed;
+        left_ = BLOCK_SIZE - needed;
+        return ptr;
+    }
+
+    static std::byte* align_up (std::byte* ptr, size_t align)
+    {
+        auto addr = reinterpret_cast<uintptr_t> (ptr);
+        return ptr + ((align - (addr & (align - 1))) & (align - 1));
+    }
+
+public:
+    Arena () = default;
+    Arena (const Arena&) = delete;
+    Arena& operator = (const Arena&) = delete;
+
+    Arena (Arena&& other) noexcept
+        : blocks_ (std::move (other.blocks_)),
+          spare_ (std::move (other.spare_)),
+          large_ (std::move (other.large_)),
+          dtors_ (std::move (other.dtors_)),
+          cur_ (std::exchange (other.cur_, nullptr)),
+          left_ (std::exchange (other.left_, 0)),
+          bytes_used_ (std::exchange (other.bytes_used_, 0)) {}
+
+    Arena& operator = (Arena&& other) noexcept
+    {
+        if (this != &other)
+        {
+            release ();
+            blocks_ = std::move (other.blocks_);
+            spare_ = std::move (other.spare_);
+            large_ = std::move (other.large_);
+            dtors_ = std::move (other.dtors_);
+            cur_ = std::exchange (other.cur_, nullptr);
+            left_ = std::exchange (other.left_, 0);
+            bytes_used_ = std::exchange (other.bytes_used_, 0);
+        }
+        return *this;
+    }
+
+    ~Arena ()
+    {
+        release ();
+    }
+
+    /**
+     * Allocate raw, uninitialized memory
+     * align must be a power of two
+     */
+    void* allocate (size_t size, size_t align = alignof (std::max_align_t))
+    {
+        bytes_used_ += size;
+
+        if (left_ >= size)
+        {
+            std::byte* ptr = align_up (cur_, align);
+            size_t needed = static_cast<size_t> (ptr - cur_) + size;
+            if (needed <= left_)
+            {
+                cur_ += needed;
+                left_ -= needed;
+                return ptr;
+            }
+        }
+
+        return allocate_slow (size, align);
+    }
+
+    /**
+     * Construct a T in the arena
+     */
+    template <typename T, typename... Args>
+    T* make (Args&&... args)
+    {
+        void* mem = allocate (sizeof (T), alignof (T));
+        T* obj = new (mem) T {std::forward<Args> (args)...};
+
+        if constexpr (!std::is_trivially_destructible_v<T>)
+            dtors_.push_back ({[] (void* p) { static_cast<T*> (p)->~T (); },
+                               obj});
+
+        return obj;
+    }
+
+    /**
+     * Destroy every object and free every block in one go
+     */
+    void release ()
+    {
+        reset ();
+        spare_.clear ();
+    }
+
+    /**
+     * Destroy every object but keep the blocks, which later allocations
+     * reuse before asking for new ones (oversized blocks are freed)
+     */
+    void reset ()
+    {
+        for (auto it = dtors_.rbegin (); it != dtors_.rend (); ++it)
+            it->destroy (it->obj);
+
+        dtors_.clear ();
+        // Reversed, so they are taken back in their original order
+        for (auto it = blocks_.rbegin (); it != blocks_.rend (); ++it)
+            spare_.push_back (std::move (*it));
+        blocks_.clear ();
+        large_.clear ();
+        cur_ = nullptr;
+        left_ = 0;
+        bytes_used_ = 0;
+    }
+
+    /**
+     * Bytes held in blocks, in use or kept by reset ()
+     */
+    size_t bytes_reserved () const
+    {
+        return (blocks_.size () + spare_.size ()) * BLOCK_SIZE;
+    }
+
+    /**
+     * Bytes handed out since the last release (excludes alignment padding)
+     */
+    size_t bytes_used () const
+    {
+        return bytes_used_;
+    }
+};
@@ -6,61 +6,258 @@
 #pragma once
 
 #include <string>
-#include <fstream>
+#include <string_view>
 #include <iostream>
-#include <iterator>
+#include <cerrno>
+#include <memory>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-inline const char* root = "/home/osten/Projects/Compiler/";
+/**
+ * Project root that relative paths are resolved against
+ *
+ * BITC_ROOT overrides the default. It is read once, on first use, and never
+ * changes afterwards, so paths can be resolved from any thread.
+ */
+inline const std::string& project_root ()
+{
+    static const std::string root = [] ()
+    {
+        const char* env = std::getenv ("BITC_ROOT");
+        std::string path = env && *env ? env : "/home/osten/Projects/Compiler/";
+        if (path.back () != '/')
+            path += '/';
+        return path;
+    } ();
+    return root;
+}
 
 /**
  * Get global path with extension of root
  */
 inline std::string get_full_path (const std::string& extension)
 {
-    return std::string {root} + extension;
+    return project_root () + extension;
 }
 
 /**
- * Read file contents into a string
- * Returns empty string on failure
- * 
+ * Read-only source bytes, memory mapped when possible
+ *
+ * Files are mmap'd so a lexer can scan them in place with no copy. If the
+ * file cannot be mapped (pipes, special files) it is read into a single
+ * presized buffer instead. The data pointer never changes when the buffer
+ * is moved.
+ */
+class SourceBuffer
+{
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+    std::unique_ptr<char[]> owned_ {};    // Backing storage when not mapped
+
+    void unmap ()
+    {
+        if (mapped_)
+            munmap (const_cast<char*> (data_), size_);
+        mapped_ = false;
+    }
+
+public:
+    SourceBuffer () = default;
+
+    /**
+     * Copy a string into an owned buffer
+     */
+    explicit SourceBuffer (std::string_view str)
+        : size_ (str.size ()), owned_ (std::make_unique<char[]> (str.size ()))
+    {
+        std::memcpy (owned_.get (), str.data (), str.size ());
+        data_ = owned_.get ();
+    }
+
+    SourceBuffer (const SourceBuffer&) = delete;
+    SourceBuffer& operator = (const SourceBuffer&) = delete;
+
+    SourceBuffer (SourceBuffer&& other) noexcept
+        : data_ (std::exchange (other.data_, nullptr)),
+          size_ (std::exchange (other.size_, 0)),
+          mapped_ (std::exchange (other.mapped_, false)),
+          owned_ (std::move (other.owned_)) {}
+
+    SourceBuffer& operator = (SourceBuffer&& other) noexcept
+    {
+        if (this != &other)
+        {
+            unmap ();
+            data_ = std::exchange (other.data_, nullptr);
+            size_ = std::exchange (other.size_, 0);
+            mapped_ = std::exchange (other.mapped_, false);
+            owned_ = std::move (other.owned_);
+        }
+        return *this;
+    }
+
+    ~SourceBuffer ()
+    {
+        unmap ();
+    }
+
+    /**
+     * Map (or read) an open file descriptor
+     * Returns false on read failure
+     */
+    bool load (int fd)
+    {
+        struct stat st {};
+        if (fstat (fd, &st) != 0)
+            return false;
+
+        // Regular, non-empty files are mapped
+        if (S_ISREG (st.st_mode) && st.st_size > 0)
+        {
+            void* addr = mmap (nullptr, static_cast<size_t> (st.st_size),
+                               PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED)
+            {
+                madvise (addr, static_cast<size_t> (st.st_size),
+                         MADV_SEQUENTIAL);
+                data_ = static_cast<const char*> (addr);
+                size_ = static_cast<size_t> (st.st_size);
+                mapped_ = true;
+                return true;
+            }
+        }
+
+        // Fallback: one read into a presized buffer, growing only if the
+        // size was unknown (pipes report 0)
+        size_t capacity = st.st_size > 0 ? static_cast<size_t> (st.st_size)
+                                         : 4096;
+        owned_ = std::make_unique<char[]> (capacity);
+        size_ = 0;
+        while (true)
+        {
+            ssize_t n = read (fd, owned_.get () + size_, capacity - size_);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                return false;
+            if (n == 0)
+                break;
+
+            size_ += static_cast<size_t> (n);
+            if (size_ == capacity)
+            {
+                auto grown = std::make_unique<char[]> (capacity * 2);
+                std::memcpy (grown.get (), owned_.get (), size_);
+                owned_ = std::move (grown);
+                capacity *= 2;
+            }
+        }
+        data_ = owned_.get ();
+        return true;
+    }
+
+    std::string_view view () const
+    {
+        return {data_, size_};
+    }
+
+    size_t size () const
+    {
+        return size_;
+    }
+
+    bool is_mapped () const
+    {
+        return mapped_;
+    }
+};
+
+/**
+ * Map file contents into a SourceBuffer
+ * Returns an empty buffer on failure and sets error to the reason, which
+ * the caller reports (compile jobs collect it instead of printing)
+ *
  * Assumes path starting with '/' is global, else appends to project root
  */
-inline std::string file_to_string (const std::string& path)
+inline SourceBuffer file_to_buffer (const std::string& path, std::string& error)
 {
     if (path.size () < 1)
-        return "";
+    {
+        error = "Could not open " + path;
+        return {};
+    }
 
     std::string file_path = path[0] == '/' ? path : get_full_path (path);
 
-    std::ifstream file (file_path);
-
-    if (!file.is_open ())
+    int fd = open (file_path.c_str (), O_RDONLY);
+    if (fd < 0)
     {
-        std::cerr << "Error: could not open " << path << std::endl;
+        error = "Could not open " + path;
         return {};
     }
 
-    return {std::istreambuf_iterator<char> {file},
-            std::istreambuf_iterator<char> {}};
+    SourceBuffer buffer;
+    if (!buffer.load (fd))
+    {
+        error = "Could not read " + path;
+        buffer = {};
+    }
+
+    close (fd);
+    return buffer;
+}
+
+/**
+ * Read file contents into a string
+ * Returns empty string (after reporting to std::cerr) on failure
+ * 
+ * Assumes path starting with '/' is global, else appends to project root
+ */
+inline std::string file_to_string (const std::string& path)
+{
+    std::string error;
+    SourceBuffer buffer = file_to_buffer (path, error);
+    if (!error.empty ())
+        std::cerr << "Error: " << error << std::endl;
+    return std::string {buffer.view ()};
 }
 
 /**
  * Overwrites file with string
+ * Returns false (after reporting to std::cerr) if it could not be written
  * 
  * Assumes path starting with '/' is global, else appends to project root
  */
-inline void string_to_file (const std::string& str, const std::string& path)
+inline bool string_to_file (std::string_view str, const std::string& path)
 {
     std::string file_path = path[0] == '/' ? path : get_full_path (path);
 
-    std::ofstream file (file_path);
-
-    if (!file.is_open ())
+    int fd = open (file_path.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
     {
         std::cerr << "Error: could not open " << path << std::endl;
-        return;
+        return false;
     }
 
-    file << str;
-}
\ No newline at end of file
+    // Write straight from the caller's buffer, no stream copy
+    while (!str.empty ())
+    {
+        ssize_t n = write (fd, str.data (), str.size ());
+        if (n <= 0)
+        {
+            std::cerr << "Error: could not write " << path << std::endl;
+            break;
+        }
+        str.remove_prefix (static_cast<size_t> (n));
+    }
+
+    close (fd);
+    return str.empty ();
+}
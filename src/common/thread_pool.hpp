@@ -0,0 +1,265 @@
+/**
+ * @file thread_pool.hpp
+ * @brief Fixed-size work-stealing worker pool
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Worker threads with one task queue each
+ *
+ * A worker takes its newest task first and, once its own queue is empty,
+ * steals the oldest task of another worker. Tasks submitted from a worker go
+ * to that worker's queue, so nested work (a file's functions inside a batch
+ * of files) stays local until someone else is idle. Tasks submitted from
+ * outside are dealt round-robin.
+ *
+ * Waiting inside the pool never blocks a worker: parallel_for runs queued
+ * tasks itself until its own are done. The destructor finishes every
+ * queued task before joining the workers.
+ */
+class ThreadPool
+{
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void ()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues_ {};     // One per worker
+    std::vector<std::thread> workers_ {};
+    std::atomic<size_t> queued_ = 0;        // Tasks waiting in any queue
+    std::atomic<size_t> next_queue_ = 0;    // Round-robin for outside submits
+    std::mutex sleep_mutex_ {};
+    std::condition_variable ready_ {};
+    bool stopping_ = false;
+
+    // Worker the current thread is, if it belongs to a pool
+    static inline thread_local const ThreadPool* current_pool_ = nullptr;
+    static inline thread_local size_t current_index_ = 0;
+
+    /**
+     * Queue index for a new task: the calling worker's own, else the next
+     * in turn
+     */
+    size_t home_queue ()
+    {
+        if (current_pool_ == this)
+            return current_index_;
+        return next_queue_.fetch_add (1, std::memory_order_relaxed) % queues_.size ();
+    }
+
+    void push (std::function<void ()> task)
+    {
+        Queue& queue = *queues_[home_queue ()];
+        {
+            std::lock_guard lock {queue.mutex};
+            queue.tasks.push_back (std::move (task));
+        }
+        queued_.fetch_add (1);
+
+        // Taking the lock orders this against a worker checking queued_
+        {
+            std::lock_guard lock {sleep_mutex_};
+        }
+        ready_.notify_one ();
+    }
+
+    /**
+     * Newest task of queue first, else the oldest of any other queue
+     */
+    bool try_pop (size_t first, std::function<void ()>& task)
+    {
+        for (size_t i = 0; i < queues_.size (); ++i)
+        {
+            Queue& queue = *queues_[(first + i) % queues_.size ()];
+            std::lock_guard lock {queue.mutex};
+            if (queue.tasks.empty ())
+                continue;
+
+            if (i == 0)
+            {
+                task = std::move (queue.tasks.back ());
+                queue.tasks.pop_back ();
+            }
+            else
+            {
+                task = std::move (queue.tasks.front ());
+                queue.tasks.pop_front ();
+            }
+            queued_.fetch_sub (1);
+            return true;
+        }
+        return false;
+    }
+
+    void work (size_t index)
+    {
+        current_pool_ = this;
+        current_index_ = index;
+
+        std::function<void ()> task;
+        while (true)
+        {
+            if (try_pop (index, task))
+            {
+                task ();
+                task = nullptr;
+                continue;
+            }
+
+            std::unique_lock lock {sleep_mutex_};
+            ready_.wait (lock, [this] { return stopping_ || queued_.load () > 0; });
+            if (stopping_ && queued_.load () == 0)
+                return;
+        }
+    }
+
+public:
+    /**
+     * Start threads workers, 0 uses one per hardware thread
+     */
+    explicit ThreadPool (size_t threads = 0)
+    {
+        if (threads == 0)
+            threads = default_threads ();
+        for (size_t i = 0; i < threads; ++i)
+            queues_.push_back (std::make_unique<Queue> ());
+        workers_.reserve (threads);
+        for (size_t i = 0; i < threads; ++i)
+            workers_.emplace_back ([this, i] { work (i); });
+    }
+
+    ThreadPool (const ThreadPool&) = delete;
+    ThreadPool& operator = (const ThreadPool&) = delete;
+
+    ~ThreadPool ()
+    {
+        {
+            std::lock_guard lock {sleep_mutex_};
+            stopping_ = true;
+        }
+        ready_.notify_all ();
+        for (auto& worker : workers_)
+            worker.join ();
+    }
+
+    /**
+     * Queue fn, its result (or exception) is delivered through the future
+     *
+     * Blocking on the future from inside a task can starve the pool, tasks
+     * that wait on other tasks use parallel_for.
+     */
+    template <typename Fn>
+    std::future<std::invoke_result_t<Fn>> submit (Fn fn)
+    {
+        using Result = std::invoke_result_t<Fn>;
+        // std::function needs a copyable callable, the task itself is not
+        auto task = std::make_shared<std::packaged_task<Result ()>> (std::move (fn));
+        std::future<Result> result = task->get_future ();
+        push ([task] { (*task) (); });
+        return result;
+    }
+
+    /**
+     * Run one queued task on the calling thread
+     * Returns false if every queue was empty
+     */
+    bool run_pending_task ()
+    {
+        std::function<void ()> task;
+        if (!try_pop (current_pool_ == this ? current_index_ : 0, task))
+            return false;
+        task ();
+        return true;
+    }
+
+    /**
+     * Call fn (i) for every i in [0, count) and wait for all of them
+     *
+     * The range is split into a few chunks per worker, idle workers steal
+     * the ones not started yet while the caller works through the rest. The
+     * first exception in index order is rethrown once every chunk is done.
+     */
+    template <typename Fn>
+    void parallel_for (size_t count, Fn&& fn)
+    {
+        size_t chunks = std::min (count, size () * 4);
+        if (chunks <= 1)
+        {
+            for (size_t i = 0; i < count; ++i)
+                fn (i);
+            return;
+        }
+
+        std::atomic<size_t> left = chunks;
+        std::vector<std::exception_ptr> errors (chunks);
+        for (size_t c = 0; c < chunks; ++c)
+        {
+            push ([&, c]
+            {
+                try
+                {
+                    for (size_t i = c * count / chunks; i < (c + 1) * count / chunks; ++i)
+                        fn (i);
+                }
+                catch (...)
+                {
+                    errors[c] = std::current_exception ();
+                }
+                left.fetch_sub (1, std::memory_order_release);
+            });
+        }
+
+        // Help instead of blocking, the last chunks may be running elsewhere
+        while (left.load (std::memory_order_acquire) > 0)
+            if (!run_pending_task ())
+                std::this_thread::yield ();
+
+        for (const auto& error : errors)
+            if (error)
+                std::rethrow_exception (error);
+    }
+
+    size_t size () const
+    {
+        return workers_.size ();
+    }
+
+    /**
+     * One per hardware thread, at least 1
+     */
+    static size_t default_threads ()
+    {
+        return std::max (1u, std::thread::hardware_concurrency ());
+    }
+};
+
+/**
+ * parallel_for on pool, or a plain loop when there is none
+ */
+template <typename Fn>
+void for_each_index (ThreadPool* pool, size_t count, Fn&& fn)
+{
+    if (pool)
+        pool->parallel_for (count, std::forward<Fn> (fn));
+    else
+        for (size_t i = 0; i < count; ++i)
+            fn (i);
+}
@@ -59,12 +59,15 @@ inline std::chrono::time_point<steady_clock> ms_to_tp (ms_t ms)
 
 /**
  * Stopwatch class
+ *
+ * Accumulates nanoseconds over any number of start/pause intervals. A new
+ * stopwatch reads 0 until started.
  */
 class Stopwatch
 {
 private:
-    ms_t last_time;
-    ms_t total_time;
+    ns_t last_time = 0;
+    ns_t total_time = 0;
 
     enum StopwatchState
     {
@@ -73,7 +76,7 @@ private:
         NONE
     };
 
-    StopwatchState state;
+    StopwatchState state = StopwatchState::NONE;
 
 public:
     /**
@@ -86,16 +89,20 @@ public:
             return;
 
         state = StopwatchState::STARTED;
-        last_time = get_time_ms ();
+        last_time = get_time_ns ();
     }
 
     /**
      * Pauses the stopwatch and returns the running time since last start call.
+     * Returns 0 if it was not running.
      */
-    ms_t pause ()
+    ns_t pause ()
     {
+        if (state != StopwatchState::STARTED)
+            return ns_t {0};
+
         state = StopwatchState::PAUSED;
-        ms_t interval = get_time_ms () - last_time;
+        ns_t interval = get_time_ns () - last_time;
 
         total_time += interval;
 
@@ -112,18 +119,26 @@ public:
      * Returns total time between starts and pauses.
      * If currently running (start called, not paused), adds cur running time.
      */
-    ms_t read ()
+    ns_t read () const
     {
         switch (state)
         {
             case StopwatchState::NONE:
-                return ms_t {0};
+                return ns_t {0};
             case StopwatchState::PAUSED:
                 return total_time;
             case StopwatchState::STARTED:
-                return total_time + (get_time_ms () - last_time);
+                return total_time + (get_time_ns () - last_time);
         }
 
-        return ms_t {0};
+        return ns_t {0};
+    }
+
+    /**
+     * read () in milliseconds
+     */
+    ms_t read_ms () const
+    {
+        return ns_to_ms (read ());
     }
-};
\ No newline at end of file
+};
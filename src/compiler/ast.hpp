@@ -4,17 +4,21 @@
  * 
  * program
  * └── functions
- *      └── block of statements [declaration | return | if | while | block]
+ *      └── block of statements [declaration | return | if | while | switch |
+ *                               block]
  *           └── expressions
+ *
+ * Expressions and nested blocks are allocated from the Program's arena and
+ * referenced by raw pointer. They live exactly as long as the Program.
  */
 
 #pragma once
 
-#include <memory>
 #include <optional>
 #include <string>
 #include <variant>
 #include <vector>
+#include "arena.hpp"
 
 // Forward declarations for recursive node types
 struct Expr;            // Code that distills into a value
@@ -41,7 +45,7 @@ struct UnaryOp
     };
     
     Op op;
-    std::unique_ptr<Expr> operand;
+    Expr* operand;
 };
 
 struct BinaryOp
@@ -53,14 +57,14 @@ struct BinaryOp
         AND, OR
     };
     Op op;
-    std::unique_ptr<Expr> left;
-    std::unique_ptr<Expr> right;
+    Expr* left;
+    Expr* right;
 };
 
 struct FuncCall
 {
     std::string name;
-    std::vector<std::unique_ptr<Expr>> args;
+    std::vector<Expr*> args;
 };
 
 struct Expr
@@ -72,35 +76,48 @@ struct Expr
 struct VarDecl
 {
     std::string name;
-    std::optional<std::unique_ptr<Expr>> init;
+    std::optional<Expr*> init;
 };
 
 struct Assignment
 {
     std::string name;
-    std::unique_ptr<Expr> value;
+    Expr* value;
 };
 
 struct ReturnStmt
 {
-    std::unique_ptr<Expr> value;
+    Expr* value;
 };
 
 struct IfStmt
 {
-    std::unique_ptr<Expr> condition;
-    std::unique_ptr<Block> then_block;
+    Expr* condition;
+    Block* then_block;
 };
 
 struct WhileStmt
 {
-    std::unique_ptr<Expr> condition;
-    std::unique_ptr<Block> body;
+    Expr* condition;
+    Block* body;
+};
+
+struct SwitchCase
+{
+    std::vector<int> values;    // Labels sharing the body, at least one
+    Block* body;
+};
+
+struct SwitchStmt       // No fallthrough: each body runs alone, then the switch ends
+{
+    Expr* value;
+    std::vector<SwitchCase> cases;
+    Block* default_body;        // nullptr: no default, nothing runs
 };
 
 struct ExprStmt         // Expression, but don't care about value
 {
-    std::unique_ptr<Expr> expression;
+    Expr* expression;
 };
 
 struct Block
@@ -111,7 +128,7 @@ struct Block
 struct Stmt
 {
     std::variant<VarDecl, Assignment, ReturnStmt,
-                 IfStmt, WhileStmt, Block, ExprStmt> node;
+                 IfStmt, WhileStmt, SwitchStmt, Block, ExprStmt> node;
 };
 
 /********** Top-Level **********/
@@ -125,9 +142,12 @@ struct Function
     std::string name;
     std::vector<Param> params;
     Block body;
+    size_t first_token = 0;             // Tokens [first_token, end_token) it
+    size_t end_token = 0;               // was parsed from
 };
 
 struct Program
 {
+    Arena arena;                        // Owns every Expr and nested Block
     std::vector<Function> functions;
 };
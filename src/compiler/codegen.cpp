@@ -1,43 +1,90 @@
 /**
  * @file codegen.cpp
- * @brief Register-based codegen implementation with spill to stack
+ * @brief SSA to machine IR lowering over virtual registers
  */
 
 #include "codegen.hpp"
+#include "elf.hpp"
+#include "encoder.hpp"
+#include "frame.hpp"
+#include "function_cache.hpp"
+#include "regalloc.hpp"
+#include "ssa_opt.hpp"
+#include "thread_pool.hpp"
+#include "time_report.hpp"
+#include <algorithm>
+#include <optional>
 #include <string>
+#include <unordered_map>
+#include <utility>
 
-/**
- * Callee saved scratch registers
- * Keep at 3 for now, handles binary op and dont feel like polluting stack
- */
-static const char* regs_str_64[] = {"rbx", "r12", "r13"};
+static Operand r32 (Reg reg) { return Operand::make_reg (reg, Width::B32); }
+static Operand v32 (uint32_t v) { return Operand::make_vreg (v, Width::B32); }
+static Operand v8 (uint32_t v)  { return Operand::make_vreg (v, Width::B8); }
+static Operand imm (int32_t value) { return Operand::make_imm (value); }
+static Operand label (uint32_t id) { return Operand::make_label (id); }
 
 /**
- * 64-bit register name to its 32-bit version
- * Empty on failure
+ * Multiplier and shift for signed division by a constant, so that
+ * n / d = hi32 (m * n) (+/- n) >> shift, plus one when that is negative
+ * Warren, "Hacker's Delight", 10-1. Expects |d| >= 2.
  */
-static std::string reg32 (const std::string& reg64)
+struct Magic
 {
-    if (reg64 == "rbx") return "ebx";
-    if (reg64 == "r12") return "r12d";
-    if (reg64 == "r13") return "r13d";
-    return "";
+    int32_t multiplier;
+    int32_t shift;
+};
+
+static Magic signed_magic (int32_t d)
+{
+    const uint32_t two31 = 0x80000000u;
+    uint32_t ad = d < 0 ? 0u - static_cast<uint32_t> (d) : static_cast<uint32_t> (d);
+    uint32_t t = two31 + (static_cast<uint32_t> (d) >> 31);
+    uint32_t anc = t - 1 - t % ad;
+    uint32_t q1 = two31 / anc, r1 = two31 - q1 * anc;
+    uint32_t q2 = two31 / ad, r2 = two31 - q2 * ad;
+    uint32_t delta;
+    int32_t p = 31;
+    do
+    {
+        ++p;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc)
+        {
+            ++q1;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad)
+        {
+            ++q2;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    uint32_t m = q2 + 1;
+    if (d < 0)
+        m = 0u - m;
+    return {static_cast<int32_t> (m), p - 32};
 }
 
 /**
- * 64-bit register name to its 8-bit version
- * Empty on failure
+ * k if value is 2^k (as an unsigned pattern), else -1
  */
-static std::string reg8 (const std::string& reg64)
+static int32_t log2_exact (uint32_t value)
 {
-    if (reg64 == "rbx") return "bl";
-    if (reg64 == "r12") return "r12b";
-    if (reg64 == "r13") return "r13b";
-    return "";
+    if (value == 0 || (value & (value - 1)) != 0)
+        return -1;
+    return __builtin_ctz (value);
 }
 
-Codegen::Codegen (const Program& prog)
-    : label_counter_ {2}, next_var_offset_ {0}, reg_used_ {}
+Codegen::Codegen (const Program& prog, bool optimize, const LoopOptions& loops,
+                  ThreadPool* pool, TimeReport* report, FunctionCache* cache,
+                  std::span<const Token> tokens)
+    : pool_ {pool}
 {
     // Scan for main
     bool found_main = false;
@@ -53,467 +100,1009 @@ Codegen::Codegen (const Program& prog)
     if (!found_main)
         throw GenError ("No entry found");
 
-    // Generate assembly for each function
-    for (const auto& func : prog.functions)
-        gen_function (func);
+    // Cache keys and the entries found for them, per function
+    std::vector<uint64_t> keys;
+    std::vector<std::optional<CachedFunction>> hits;
+
+    SsaProgram ssa;
+    if (cache && !optimize && !tokens.empty ())
+    {
+        // A function's tokens decide its code, hits need no SSA at all
+        TimeReport::Phase phase {report, "ssa_build"};
+        size_t count = prog.functions.size ();
+        keys.resize (count);
+        hits.resize (count);
+        std::vector<SsaProgram> parts (count);
+        for_each_index (pool, count, [&] (size_t i)
+        {
+            const Function& func = prog.functions[i];
+            std::span<const Token> range = tokens.subspan (func.first_token,
+                                                           func.end_token - func.first_token);
+            keys[i] = function_key (hash_tokens (range), false, loops);
+            hits[i] = cache->find (keys[i]);
+            if (hits[i])
+                parts[i].functions.emplace_back ();
+            else
+                parts[i] = build_ssa (func);
+        });
+        ssa = merge_parts (parts);
+        if (phase.active ())
+            phase.count ("ssa_insts", static_cast<int64_t> (live_insts (ssa)));
+    }
+    else
+    {
+        {
+            TimeReport::Phase phase {report, "ssa_build"};
+            ssa = build_ssa (prog, pool);
+            if (phase.active ())
+                phase.count ("ssa_insts", static_cast<int64_t> (live_insts (ssa)));
+        }
+        if (optimize && !cache)
+            optimize_ssa (ssa, loops, pool, report);
+        else if (cache)
+        {
+            // Past the interprocedural passes each function stands alone
+            if (optimize)
+                optimize_ssa_program (ssa, pool, report);
+            size_t count = ssa.functions.size ();
+            keys.resize (count);
+            hits.resize (count);
+            for_each_index (pool, count, [&] (size_t i)
+            {
+                keys[i] = function_key (hash_function (ssa.functions[i], ssa.symbols),
+                                        optimize, loops);
+                hits[i] = cache->find (keys[i]);
+            });
+            if (optimize)
+            {
+                std::vector<uint32_t> misses;
+                for (size_t i = 0; i < count; ++i)
+                    if (!hits[i])
+                        misses.push_back (static_cast<uint32_t> (i));
+                optimize_ssa_functions (ssa, misses, loops, pool, report);
+            }
+        }
+    }
+
+    TimeReport::Phase phase {report, "lower"};
+
+    // Label ids are global, each function gets the next range in source order
+    size_t count = ssa.functions.size ();
+    std::vector<uint32_t> first_labels (count);
+    std::vector<uint32_t> label_counts (count);
+    uint32_t next_label = 2;
+    for (size_t i = 0; i < count; ++i)
+    {
+        first_labels[i] = next_label;
+        label_counts[i] = cache && hits[i] ? hits[i]->label_count
+                                           : FunctionCodegen::label_count (ssa.functions[i]);
+        next_label += label_counts[i];
+    }
+
+    // Entries name their call targets, which may be new to this program
+    mir_.symbols = std::move (ssa.symbols);
+    mir_.specialized = optimize;
+    if (cache)
+    {
+        std::unordered_map<std::string, uint32_t> symbol_ids;
+        for (size_t i = 0; i < mir_.symbols.size (); ++i)
+            symbol_ids.emplace (mir_.symbols[i], static_cast<uint32_t> (i));
+        for (auto& hit : hits)
+        {
+            if (!hit)
+                continue;
+            std::vector<uint32_t> ids;
+            for (auto& name : hit->symbols)
+            {
+                auto [it, inserted] = symbol_ids.try_emplace (
+                    name, static_cast<uint32_t> (mir_.symbols.size ()));
+                if (inserted)
+                    mir_.symbols.push_back (name);
+                ids.push_back (it->second);
+            }
+            for (auto& inst : hit->func.code)
+                for (auto& op : inst.ops)
+                    if (op.kind == OperandKind::SYMBOL)
+                        op.value = static_cast<int32_t> (ids[static_cast<uint32_t> (op.value)]);
+        }
+    }
+
+    // Lower each function to MIR into its own slot
+    mir_.functions.resize (count);
+    for_each_index (pool, count, [&] (size_t i)
+    {
+        if (cache && hits[i])
+        {
+            mir_.functions[i] = std::move (hits[i]->func);
+            for (auto& inst : mir_.functions[i].code)
+                for (auto& op : inst.ops)
+                    if (op.kind == OperandKind::LABEL)
+                        op.value += static_cast<int32_t> (first_labels[i]);
+            return;
+        }
+
+        FunctionCodegen {ssa.functions[i], first_labels[i], mir_.functions[i]};
+        if (cache)
+            cache->insert (keys[i], mir_.functions[i], first_labels[i], label_counts[i],
+                           mir_.symbols);
+    });
+
+    for (const auto& hit : hits)
+        cache_hits_ += hit.has_value ();
+
+    if (phase.active ())
+    {
+        int64_t spills = 0;
+        for (const auto& func : mir_.functions)
+            spills += func.spills;
+        phase.count ("functions", static_cast<int64_t> (count));
+        phase.count ("mir_insts", static_cast<int64_t> (inst_count (mir_)));
+        phase.count ("spills", spills);
+        if (cache)
+            phase.count ("cached", static_cast<int64_t> (cache_hits_));
+    }
+}
+
+FunctionCodegen::FunctionCodegen (const SsaFunction& func, uint32_t first_label,
+                                  MFunction& out)
+    : func_ {&out}, ssa_ {nullptr},
+      block_label_ {first_label},
+      epilogue_label_ {first_label + static_cast<uint32_t> (func.blocks.size ())},
+      next_label_ {epilogue_label_ + 1}
+{
+    gen_function (func);
+}
+
+uint32_t FunctionCodegen::label_count (const SsaFunction& func)
+{
+    uint32_t count = static_cast<uint32_t> (func.blocks.size ()) + 1;
+    for (const auto& block : func.blocks)
+        if (block.exit == SsaExit::SWITCH)
+            count += 2 * static_cast<uint32_t> (block.cases.size ());
+    return count;
+}
+
+void FunctionCodegen::emit (Opcode op, Operand a, Operand b, Operand c)
+{
+    func_->code.push_back (MInst {op, {a, b, c}});
+}
+
+void FunctionCodegen::emit_label (uint32_t id)
+{
+    emit (Opcode::LABEL, label (id));
 }
 
-void Codegen::emit (const std::string& line)
+uint32_t FunctionCodegen::new_vreg ()
 {
-    assembly_lines_.push_back (line);
+    return func_->vreg_count++;
 }
 
 /**
- * Return first free scratch register and mark it used, or "" if all busy
+ * Virtual register holding an SSA value, assigned on first sight
  */
-std::string Codegen::alloc_reg ()
+uint32_t FunctionCodegen::vreg (uint32_t value)
 {
-    for (int i = 0; i < 3; ++i)
+    if (vregs_[value] == NO_VALUE)
+        vregs_[value] = new_vreg ();
+    return vregs_[value];
+}
+
+/**
+ * Register every pred writes a phi's operand to before jumping in
+ *
+ * Preds write the phi's own register unless that could clobber a value
+ * still needed: a pred inside the phi's block's dominance region ending in
+ * a branch (the other edge may read the phi's previous value), or phis of
+ * the block feeding each other (copies would need ordering). Then preds
+ * write a temporary the phi copies out at the top of its block.
+ */
+uint32_t FunctionCodegen::phi_temp (uint32_t phi)
+{
+    if (phi_temps_[phi] != NO_VALUE)
+        return phi_temps_[phi];
+
+    auto dominates = [this] (uint32_t a, uint32_t b)
     {
-        if (!reg_used_[i])
-        {
-            reg_used_[i] = true;
-            return regs_str_64[i];
-        }
+        while (b != a && b != 0 && idoms_[b] != NO_VALUE)
+            b = idoms_[b];
+        return b == a || idoms_[b] == NO_VALUE;
+    };
+
+    uint32_t b = ssa_->insts[phi].block;
+    bool direct = true;
+    for (uint32_t pred : ssa_->blocks[b].preds)
+        direct = direct && (ssa_->blocks[pred].exit == SsaExit::JUMP
+                            || !dominates (b, pred));
+
+    for (uint32_t v : ssa_->blocks[b].insts)
+    {
+        if (ssa_->insts[v].op != SsaOp::PHI)
+            break;
+        for (uint32_t arg : ssa_->insts[v].args)
+            direct = direct && !(ssa_->insts[arg].op == SsaOp::PHI
+                                 && ssa_->insts[arg].block == b && arg != v);
     }
-    return "";
+
+    phi_temps_[phi] = direct ? vreg (phi) : new_vreg ();
+    return phi_temps_[phi];
+}
+
+/**
+ * Source operand for value: constants are used as immediates
+ */
+Operand FunctionCodegen::use (uint32_t value)
+{
+    const SsaInst& inst = ssa_->insts[value];
+    if (inst.op == SsaOp::CONST)
+        return imm (inst.imm);
+    return v32 (vreg (value));
+}
+
+/**
+ * Register operand for value: constants are rematerialized right here
+ * instead of being kept live from their definition
+ */
+Operand FunctionCodegen::use_reg (uint32_t value)
+{
+    const SsaInst& inst = ssa_->insts[value];
+    if (inst.op != SsaOp::CONST)
+        return v32 (vreg (value));
+
+    uint32_t v = new_vreg ();
+    emit (Opcode::MOV, v32 (v), imm (inst.imm));
+    return v32 (v);
+}
+
+/**
+ * xmm register of a vector value
+ */
+Operand FunctionCodegen::xmm (uint32_t value) const
+{
+    return Operand::make_xmm (xmms_[value]);
 }
 
 /**
- * Mark a scratch register as free (no-op for empty string)
- */ 
-void Codegen::free_reg (const std::string& reg)
+ * Whether phi's operand from pred index may take the phi's register: it is
+ * a vector op of that pred, which jumps straight back, and neither the pred
+ * after it nor another phi's copy reads the phi
+ */
+static bool updates_in_place (const SsaFunction& func, const SsaBlock& block, size_t index,
+                              uint32_t phi)
 {
-    for (int i = 0; i < 3; ++i)
+    uint32_t next = func.insts[phi].args[index];
+    uint32_t pred = block.preds[index];
+    const SsaBlock& from = func.blocks[pred];
+    if (!is_vector_op (func.insts[next].op) || func.insts[next].block != pred
+        || from.exit != SsaExit::JUMP)
+        return false;
+
+    auto at = std::find (from.insts.begin (), from.insts.end (), next);
+    for (auto it = at + 1; it != from.insts.end (); ++it)
     {
-        if (reg == regs_str_64[i])
-        {
-            reg_used_[i] = false;
-            return;
-        }
+        const auto& args = func.insts[*it].args;
+        if (std::find (args.begin (), args.end (), phi) != args.end ())
+            return false;
     }
+    for (uint32_t other : block.insts)
+    {
+        if (func.insts[other].op != SsaOp::PHI)
+            break;
+        if (other != phi && func.insts[other].args[index] == phi)
+            return false;
+    }
+    return true;
 }
 
-void Codegen::gen_function (const Function& func)
+void FunctionCodegen::gen_function (const SsaFunction& func)
 {
     // Reset per-function state
-    var_offsets_.clear ();
-    next_var_offset_ = -24;   // rbx/r12/r13 in [-8, -24]
-    reg_used_[0] = reg_used_[1] = reg_used_[2] = false;
-    epilogue_label_ = ".Lfunc_" + std::to_string (label_counter_++);
-
-    // Label
-    emit (func.name + ":");
-
-    // Prologue: save fp, and callee-saved regs
-    emit ("    push rbp");
-    emit ("    mov rbp, rsp");
-    emit ("    push rbx");
-    emit ("    push r12");
-    emit ("    push r13");
-
-    // Move parameters from ABI registers into local stack slots
-    if (func.params.size () > 6)
-        throw GenError ("Function '" + func.name + "' has more than 6 parameters");
-
-    static const char* arg_regs[] = {"edi", "esi", "edx", "ecx", "r8d", "r9d"};
-    for (size_t i = 0; i < func.params.size (); ++i)
-    {
-        next_var_offset_ -= 8;
-        var_offsets_[func.params[i].name] = next_var_offset_;
-        emit ("    sub rsp, 8");
-        emit ("    mov DWORD PTR [rbp +" +
-              std::to_string (next_var_offset_) + "], " + arg_regs[i]);
+    ssa_ = &func;
+    vregs_.assign (func.insts.size (), NO_VALUE);
+    phi_temps_.assign (func.insts.size (), NO_VALUE);
+    idoms_ = compute_idoms (func);
+    use_counts_.assign (func.insts.size (), 0);
+    for (const auto& block : func.blocks)
+    {
+        for (uint32_t v : block.insts)
+            for (uint32_t arg : func.insts[v].args)
+                ++use_counts_[arg];
+        if (block.value != NO_VALUE)
+            ++use_counts_[block.value];
     }
 
-    // Body
-    gen_block (func.body);
+    // a + b * {2, 4, 8} becomes one lea when the add is the only reader
+    lea_indexes_.assign (func.insts.size (), false);
+    for (const auto& block : func.blocks)
+    {
+        for (uint32_t v : block.insts)
+        {
+            const SsaInst& inst = func.insts[v];
+            if (inst.op != SsaOp::ADD)
+                continue;
+            for (uint32_t i = 0; i < 2; ++i)
+            {
+                uint32_t base = inst.args[1 - i];
+                uint32_t index = inst.args[i];
+                if (func.insts[base].op != SsaOp::CONST && lea_index (index) != NO_VALUE
+                    && func.insts[index].block == inst.block)
+                {
+                    lea_indexes_[index] = true;
+                    break;
+                }
+            }
+        }
+    }
+    // Vector values are few and short-lived (see vectorize_loops), each
+    // keeps one register for the whole function. A phi's next value shares
+    // the phi's when nothing reads the phi after it: the pred computes it
+    // in place and jumps back.
+    std::vector<bool> vector = vector_values (func);
+    std::vector<uint32_t> shares (func.insts.size (), NO_VALUE);
+    for (const auto& block : func.blocks)
+    {
+        for (uint32_t phi : block.insts)
+        {
+            const SsaInst& inst = func.insts[phi];
+            if (inst.op != SsaOp::PHI)
+                break;
+            if (vector[phi])
+                for (size_t i = 0; i < inst.args.size (); ++i)
+                    if (updates_in_place (func, block, i, phi))
+                        shares[inst.args[i]] = phi;
+        }
+    }
+
+    xmms_.assign (func.insts.size (), NO_VALUE);
+    uint32_t xmm_count = 0;
+    for (uint32_t v = 0; v < func.insts.size (); ++v)
+        if (vector[v] && shares[v] == NO_VALUE && func.insts[v].op != SsaOp::NOP)
+            xmms_[v] = xmm_count++;
+    for (uint32_t v = 0; v < func.insts.size (); ++v)
+        if (shares[v] != NO_VALUE)
+            xmms_[v] = xmms_[shares[v]];
+    if (xmm_count > MAX_VECTOR_VALUES)
+        throw GenError ("Too many vector values in " + func.name);
+
+    *func_ = MFunction {func.name, {}};
+    func_->param_count = func.param_count;
+    tables_.clear ();
+
+    for (uint32_t b = 0; b < func.blocks.size (); ++b)
+        gen_block (b);
+
+    // Common return point jumped to by every returning block
+    emit_label (epilogue_label_);
+    emit (Opcode::RET);
+
+    for (const auto& table : tables_)
+    {
+        emit_label (table.label);
+        for (uint32_t target : table.targets)
+            emit (Opcode::CASE, label (block_label_ + target), label (table.label));
+    }
 
-    // Epilogue: common return label jumped to by all ReturnStmt nodes
-    emit (epilogue_label_ + ":");
-    emit ("    lea rsp, [rbp - 24]");   // restore rsp above saved scratch regs
-    emit ("    pop r13");
-    emit ("    pop r12");
-    emit ("    pop rbx");
-    emit ("    pop rbp");
-    emit ("    ret");
+    // Prologue/epilogue need to know which registers were used
+    allocate_registers (*func_);
+    lower_frame (*func_);
 }
 
-void Codegen::gen_block (const Block& block)
+/**
+ * Comparison the block branches on, when nothing else reads it: it is then
+ * emitted as cmp + jcc at the branch instead of being materialized as 0/1
+ */
+/**
+ * For a multiply by 2, 4 or 8 read by one instruction, the value scaled
+ */
+uint32_t FunctionCodegen::lea_index (uint32_t value) const
 {
-    for (const auto& stmt : block.statements)
-        gen_stmt (stmt);
+    const SsaInst& inst = ssa_->insts[value];
+    if (inst.op != SsaOp::MUL || use_counts_[value] != 1)
+        return NO_VALUE;
+
+    for (uint32_t i = 0; i < 2; ++i)
+    {
+        const SsaInst& factor = ssa_->insts[inst.args[i]];
+        const SsaInst& other = ssa_->insts[inst.args[1 - i]];
+        if (factor.op == SsaOp::CONST && other.op != SsaOp::CONST
+            && (factor.imm == 2 || factor.imm == 4 || factor.imm == 8))
+            return inst.args[1 - i];
+    }
+    return NO_VALUE;
 }
 
-void Codegen::gen_stmt (const Stmt& stmt)
+/**
+ * cmp for a comparison, a constant on the left is swapped to the right
+ * where it can be an immediate
+ * @return The comparison as emitted: LT and GT trade places when swapped
+ */
+SsaOp FunctionCodegen::gen_compare (uint32_t value)
 {
-    std::visit ([this] (const auto& node)
+    const SsaInst& inst = ssa_->insts[value];
+    uint32_t l = inst.args[0];
+    uint32_t r = inst.args[1];
+    SsaOp op = inst.op;
+
+    if (ssa_->insts[l].op == SsaOp::CONST && ssa_->insts[r].op != SsaOp::CONST)
     {
-        using T = std::decay_t<decltype (node)>;
+        std::swap (l, r);
+        if (op == SsaOp::LT)
+            op = SsaOp::GT;
+        else if (op == SsaOp::GT)
+            op = SsaOp::LT;
+    }
+
+    emit (Opcode::CMP, use_reg (l), use (r));
+    return op;
+}
+
+uint32_t FunctionCodegen::branch_compare (uint32_t b) const
+{
+    const SsaBlock& block = ssa_->blocks[b];
+    if (block.exit != SsaExit::BRANCH || use_counts_[block.value] != 1)
+        return NO_VALUE;
+
+    const SsaInst& cond = ssa_->insts[block.value];
+    bool compare = cond.op == SsaOp::EQ || cond.op == SsaOp::NE
+                || cond.op == SsaOp::LT || cond.op == SsaOp::GT;
+    return compare && cond.block == b ? block.value : NO_VALUE;
+}
+
+/**
+ * Call whose result the block returns, the last thing it does: it is
+ * emitted as a jump once the frame is gone, so the callee returns straight
+ * to our caller
+ */
+uint32_t FunctionCodegen::tail_call (uint32_t b) const
+{
+    const SsaBlock& block = ssa_->blocks[b];
+    if (block.exit != SsaExit::RETURN || block.value == NO_VALUE || block.insts.empty ()
+        || block.insts.back () != block.value)
+        return NO_VALUE;
+    return ssa_->insts[block.value].op == SsaOp::CALL ? block.value : NO_VALUE;
+}
+
+void FunctionCodegen::gen_block (uint32_t b)
+{
+    const SsaBlock& block = ssa_->blocks[b];
+    if (b != 0)
+        emit_label (block_label_ + b);
 
-        // Return statement
-        if constexpr (std::is_same_v<T, ReturnStmt>)
+    uint32_t tail = tail_call (b);
+    uint32_t fused = branch_compare (b);
+    SsaOp fused_op = SsaOp::NOP;
+    for (uint32_t v : block.insts)
+    {
+        if (ssa_->insts[v].op == SsaOp::PHI)
         {
-            std::string reg = gen_expr (*node.value);
-            if (!reg.empty ())
-            {
-                emit ("    mov eax, " + reg32 (reg));
-                free_reg (reg);
-            }
-            else
-                emit ("    pop rax");
-            emit ("    jmp " + epilogue_label_);
+            if (xmms_[v] == NO_VALUE && phi_temp (v) != vreg (v))
+                emit (Opcode::MOV, v32 (vreg (v)), v32 (phi_temp (v)));
         }
+        else if (v != fused && v != tail && !lea_indexes_[v])
+            gen_inst (v);
+    }
+
+    // Phi copies are movs, so they may sit between the cmp and its jcc
+    if (fused != NO_VALUE)
+        fused_op = gen_compare (fused);
+
+    gen_phi_copies (b);
+    gen_exit (b, fused_op);
+}
+
+/**
+ * Hand the operands of each successor's phis over. Copies run before the
+ * branch, on both edges; a copy meant for the other edge is dead since that
+ * temporary is only read by its own phi.
+ */
+void FunctionCodegen::gen_phi_copies (uint32_t b)
+{
+    const SsaBlock& block = ssa_->blocks[b];
+    for (uint32_t i = 0; i < succ_count (block); ++i)
+    {
+        uint32_t succ = block.succs[i];
+        if (std::find (block.succs.begin (), block.succs.begin () + i, succ)
+            != block.succs.begin () + i)
+            continue;
+
+        const auto& preds = ssa_->blocks[succ].preds;
+        size_t index = std::find (preds.begin (), preds.end (), b) - preds.begin ();
 
-        // Variable declaration
-        else if constexpr (std::is_same_v<T, VarDecl>)
+        for (uint32_t v : ssa_->blocks[succ].insts)
         {
-            next_var_offset_ -= 8;
-            var_offsets_[node.name] = next_var_offset_;
-            emit ("    sub rsp, 8");
+            const SsaInst& phi = ssa_->insts[v];
+            if (phi.op != SsaOp::PHI)
+                break;
 
-            if (node.init.has_value ())
+            // Vector phis are only ever fed by values of other blocks, over
+            // jumps, so their copies need no temporary
+            if (xmms_[v] != NO_VALUE)
             {
-                std::string reg = gen_expr (*node.init.value ());
-                if (!reg.empty ())
-                {
-                    emit ("    mov DWORD PTR [rbp +" +
-                               std::to_string (next_var_offset_) + "], " +
-                               reg32 (reg));
-                    free_reg (reg);
-                }
-                else
-                {
-                    emit ("    pop rax");
-                    emit ("    mov DWORD PTR [rbp +" +
-                               std::to_string (next_var_offset_) + "], eax");
-                }
+                if (xmms_[v] != xmms_[phi.args[index]])
+                    emit (Opcode::MOVDQA, xmm (v), xmm (phi.args[index]));
+                continue;
             }
+            emit (Opcode::MOV, v32 (phi_temp (v)), use (phi.args[index]));
         }
+    }
+}
+
+void FunctionCodegen::gen_exit (uint32_t b, SsaOp fused_op)
+{
+    const SsaBlock& block = ssa_->blocks[b];
+    switch (block.exit)
+    {
+        case SsaExit::JUMP:
+            if (block.succs[0] != b + 1)
+                emit (Opcode::JMP, label (block_label_ + block.succs[0]));
+            break;
 
-        // Variable assignment
-        else if constexpr (std::is_same_v<T, Assignment>)
+        case SsaExit::BRANCH:
         {
-            std::string reg = gen_expr (*node.value);
-            int offset = var_offsets_.at (node.name);
-            if (!reg.empty ())
+            // Jump on a fused comparison, or on a value tested against zero
+            Opcode jump_if_true = Opcode::JNE;
+            Opcode jump_if_false = Opcode::JE;
+            switch (fused_op)
             {
-                emit ("    mov DWORD PTR [rbp +" + std::to_string (offset) +
-                           "], " + reg32 (reg));
-                free_reg (reg);
+                case SsaOp::EQ: jump_if_true = Opcode::JE;  jump_if_false = Opcode::JNE; break;
+                case SsaOp::NE: jump_if_true = Opcode::JNE; jump_if_false = Opcode::JE;  break;
+                case SsaOp::LT: jump_if_true = Opcode::JL;  jump_if_false = Opcode::JGE; break;
+                case SsaOp::GT: jump_if_true = Opcode::JG;  jump_if_false = Opcode::JLE; break;
+                default:
+                {
+                    Operand cond = use_reg (block.value);
+                    emit (Opcode::TEST, cond, cond);
+                    break;
+                }
             }
-            else
+
+            // Fall through to whichever target comes next, || chains have the
+            // false one there
+            if (block.succs[1] == b + 1 && block.succs[0] != b + 1)
             {
-                emit ("    pop rax");
-                emit ("    mov DWORD PTR [rbp +" + std::to_string (offset)
-                           + "], eax");
+                emit (jump_if_true, label (block_label_ + block.succs[0]));
+                break;
             }
+            emit (jump_if_false, label (block_label_ + block.succs[1]));
+            if (block.succs[0] != b + 1)
+                emit (Opcode::JMP, label (block_label_ + block.succs[0]));
+            break;
         }
 
-        // If statement
-        else if constexpr (std::is_same_v<T, IfStmt>)
-        {
-            std::string else_label = ".L" + std::to_string (label_counter_++);
-            std::string end_label  = ".L" + std::to_string (label_counter_++);
-
-            std::string reg = gen_expr (*node.condition);
-            if (!reg.empty ())
+        case SsaExit::RETURN:
+            if (uint32_t tail = tail_call (b); tail != NO_VALUE)
             {
-                emit ("    test " + reg32 (reg) + ", " + reg32 (reg));
-                free_reg (reg);
+                const SsaInst& call = ssa_->insts[tail];
+                for (size_t i = 0; i < call.args.size (); ++i)
+                    emit (Opcode::MOV, r32 (ARG_REGS[i]), use (call.args[i]));
+                emit (Opcode::TAIL_CALL, Operand::make_symbol (call.imm),
+                      imm (static_cast<int32_t> (call.args.size ())));
+                break;
             }
-            else
-            {
-                emit ("    pop rax");
-                emit ("    test eax, eax");
-            }
-            emit ("    je " + else_label);
+            if (block.value != NO_VALUE)
+                emit (Opcode::MOV, r32 (Reg::RAX), use (block.value));
+            emit (Opcode::JMP, label (epilogue_label_));
+            break;
 
-            gen_block (*node.then_block);
-            emit ("    jmp " + end_label);
+        case SsaExit::SWITCH:
+            gen_switch (b);
+            break;
+    }
+}
 
-            emit (else_label + ":");
-            emit (end_label + ":");
-        }
+/**
+ * Switch exit: the cases sorted by value, lowered by gen_cases
+ */
+void FunctionCodegen::gen_switch (uint32_t b)
+{
+    const SsaBlock& block = ssa_->blocks[b];
+    std::vector<std::pair<int32_t, uint32_t>> cases;
+    for (size_t i = 0; i < block.cases.size (); ++i)
+        cases.emplace_back (block.cases[i], block.succs[i + 1]);
+    std::sort (cases.begin (), cases.end ());
 
-        // While statement
-        else if constexpr (std::is_same_v<T, WhileStmt>)
-        {
-            std::string loop_label = ".L" + std::to_string (label_counter_++);
-            std::string end_label  = ".L" + std::to_string (label_counter_++);
+    gen_cases (b, use_reg (block.value), cases, true);
+}
 
-            emit (loop_label + ":");
-            std::string reg = gen_expr (*node.condition);
-            if (!reg.empty ())
-            {
-                emit ("    test " + reg32 (reg) + ", " + reg32 (reg));
-                free_reg (reg);
-            }
-            else
-            {
-                emit ("    pop rax");
-                emit ("    test eax, eax");
-            }
-            emit ("    je " + end_label);
+/**
+ * Jump to the target of value among sorted cases, or to the default
+ *
+ * Dense cases go through a jump table, a few are compared one by one, and
+ * anything else is split in half on a compare against the middle value.
+ * Only the last piece emitted (last) may fall through to the next block.
+ */
+void FunctionCodegen::gen_cases (uint32_t b, Operand value,
+                                 std::span<const std::pair<int32_t, uint32_t>> cases,
+                                 bool last)
+{
+    uint32_t fallback = ssa_->blocks[b].succs[0];
+    int64_t lo = cases.front ().first;
+    int64_t range = int64_t {cases.back ().first} - lo + 1;
 
-            gen_block (*node.body);
-            emit ("    jmp " + loop_label);
+    if (cases.size () >= SWITCH_TABLE_MIN
+        && range <= static_cast<int64_t> (SWITCH_TABLE_DENSITY * cases.size ()))
+    {
+        // The index is unsigned, so one compare rejects both sides. Every
+        // 32-bit write clears the upper half the table load reads.
+        uint32_t index = new_vreg ();
+        emit (Opcode::MOV, v32 (index), value);
+        if (lo != 0)
+            emit (Opcode::SUB, v32 (index), imm (static_cast<int32_t> (lo)));
+        emit (Opcode::CMP, v32 (index), imm (static_cast<int32_t> (range - 1)));
+        emit (Opcode::JA, label (block_label_ + fallback));
 
-            emit (end_label + ":");
+        JumpTable table {next_label_++, std::vector<uint32_t> (static_cast<size_t> (range),
+                                                               fallback)};
+        for (const auto& [k, target] : cases)
+            table.targets[static_cast<size_t> (k - lo)] = target;
+        emit (Opcode::JMP_TABLE, v32 (index), label (table.label));
+        tables_.push_back (std::move (table));
+        return;
+    }
+
+    if (cases.size () <= SWITCH_LINEAR_MAX)
+    {
+        for (const auto& [k, target] : cases)
+        {
+            emit (Opcode::CMP, value, imm (k));
+            emit (Opcode::JE, label (block_label_ + target));
         }
+        if (!last || fallback != b + 1)
+            emit (Opcode::JMP, label (block_label_ + fallback));
+        return;
+    }
 
-        // Block
-        else if constexpr (std::is_same_v<T, Block>)
+    size_t mid = cases.size () / 2;
+    uint32_t right = next_label_++;
+    emit (Opcode::CMP, value, imm (cases[mid].first));
+    emit (Opcode::JGE, label (right));
+    gen_cases (b, value, cases.first (mid), false);
+    emit_label (right);
+    gen_cases (b, value, cases.subspan (mid), last);
+}
+
+void FunctionCodegen::gen_inst (uint32_t v)
+{
+    const SsaInst& inst = ssa_->insts[v];
+    const auto& args = inst.args;
+
+    auto compare = [&] ()
+    {
+        Opcode setcc = Opcode::SETE;
+        switch (gen_compare (v))
         {
-            gen_block (node);
+            case SsaOp::NE: setcc = Opcode::SETNE; break;
+            case SsaOp::LT: setcc = Opcode::SETL;  break;
+            case SsaOp::GT: setcc = Opcode::SETG;  break;
+            default: break;
         }
+        emit (setcc, v8 (vreg (v)));
+        emit (Opcode::MOVZX, v32 (vreg (v)), v8 (vreg (v)));
+    };
+
+    switch (inst.op)
+    {
+        // Constants are folded into their uses
+        case SsaOp::CONST:
+        case SsaOp::PHI:
+        case SsaOp::NOP:
+            break;
+
+        // Copy parameters out of the ABI registers, the allocator coalesces
+        // these moves when the registers stay free
+        case SsaOp::PARAM:
+            emit (Opcode::MOV, v32 (vreg (v)), r32 (ARG_REGS[inst.imm]));
+            break;
+
+        case SsaOp::NEG:
+            emit (Opcode::MOV, v32 (vreg (v)), use (args[0]));
+            emit (Opcode::NEG, v32 (vreg (v)));
+            break;
 
-        // Expression statement (result discarded)
-        else if constexpr (std::is_same_v<T, ExprStmt>)
+        case SsaOp::NOT:
         {
-            std::string reg = gen_expr (*node.expression);
-            if (reg.empty ())
-                emit ("    pop rax");
-            else
-                free_reg (reg);
+            Operand operand = use_reg (args[0]);
+            emit (Opcode::TEST, operand, operand);
+            emit (Opcode::SETE, v8 (vreg (v)));
+            emit (Opcode::MOVZX, v32 (vreg (v)), v8 (vreg (v)));
+            break;
         }
 
-        // Default
-        else
+        case SsaOp::CALL:
         {
-            throw GenError ("Unsupported statement type");
+            for (size_t i = 0; i < args.size (); ++i)
+                emit (Opcode::MOV, r32 (ARG_REGS[i]), use (args[i]));
+
+            emit (Opcode::CALL, Operand::make_symbol (inst.imm),
+                  imm (static_cast<int32_t> (args.size ())));
+            emit (Opcode::MOV, v32 (vreg (v)), r32 (Reg::RAX));
+            break;
         }
-    }, stmt.node);
+
+        case SsaOp::ADD:
+            gen_add (v);
+            break;
+        case SsaOp::SUB:
+            emit (Opcode::MOV, v32 (vreg (v)), use (args[0]));
+            emit (Opcode::SUB, v32 (vreg (v)), use (args[1]));
+            break;
+        case SsaOp::MUL:
+            gen_mul (v);
+            break;
+        case SsaOp::DIV:
+            gen_div (v);
+            break;
+        case SsaOp::EQ:
+        case SsaOp::NE:
+        case SsaOp::LT:
+        case SsaOp::GT:
+            compare ();
+            break;
+
+        case SsaOp::VSPLAT:
+        case SsaOp::VSTEP:
+        case SsaOp::VSCALAR:
+        case SsaOp::VADD:
+        case SsaOp::VSUB:
+        case SsaOp::VMUL:
+        case SsaOp::VREDUCE:
+            gen_vector (v);
+            break;
+    }
 }
 
 /**
- * Evaluate expr
- * Return the reg holding the result or empty if all registers were busy (val
- * pushed to stack)
+ * Vector ops on xmm registers: lanes are built with movd, pinsrd and
+ * pshufd, added up with two shuffles
  */
-std::string Codegen::gen_expr (const Expr& expr)
+void FunctionCodegen::gen_vector (uint32_t v)
 {
-    return std::visit ([this] (const auto& node) -> std::string
+    const SsaInst& inst = ssa_->insts[v];
+    const auto& args = inst.args;
+
+    switch (inst.op)
     {
-        using T = std::decay_t<decltype (node)>;
+        case SsaOp::VSPLAT:
+            emit (Opcode::MOVD, xmm (v), use_reg (args[0]));
+            emit (Opcode::PSHUFD, xmm (v), xmm (v), imm (0));
+            break;
 
-        // Int literal
-        if constexpr (std::is_same_v<T, IntLiteral>)
-        {
-            std::string dest = alloc_reg ();
-            if (dest.empty ())
-                emit ("    push " + std::to_string (node.value));
-            else
-                emit ("    mov " + reg32 (dest) + ", " + std::to_string (node.value));
-            return dest;
-        }
+        case SsaOp::VSCALAR:
+            emit (Opcode::MOVD, xmm (v), use_reg (args[0]));
+            break;
 
-        // Identifier
-        else if constexpr (std::is_same_v<T, Identifier>)
+        case SsaOp::VSTEP:
         {
-            int offset = var_offsets_.at (node.name);
-            std::string dest = alloc_reg ();
-            if (dest.empty ())
+            Operand base = use_reg (args[0]);
+            emit (Opcode::MOVD, xmm (v), base);
+            for (int32_t lane = 1; lane < 4; ++lane)
             {
-                emit ("    mov eax, DWORD PTR [rbp +" + std::to_string (offset) + "]");
-                emit ("    push rax");
+                uint32_t value = new_vreg ();
+                int32_t offset = static_cast<int32_t> (static_cast<uint32_t> (lane)
+                                                       * static_cast<uint32_t> (inst.imm));
+                emit (Opcode::LEA, v32 (value), base, imm (offset));
+                emit (Opcode::PINSRD, xmm (v), v32 (value), imm (lane));
             }
-            else
-                emit ("    mov " + reg32 (dest) + ", DWORD PTR [rbp +" +
-                      std::to_string (offset) + "]");
-            return dest;
+            break;
         }
 
-        // Unary op
-        else if constexpr (std::is_same_v<T, UnaryOp>)
+        case SsaOp::VADD:
+        case SsaOp::VSUB:
+        case SsaOp::VMUL:
         {
-            std::string operand_reg = gen_expr (*node.operand);
-            if (!operand_reg.empty ())
-            {
-                // Operate in place on the scratch register
-                std::string r  = reg32 (operand_reg);
-                std::string r8 = reg8 (operand_reg);
-                if (node.op == UnaryOp::Op::NEGATE)
-                    emit ("    neg " + r);
-                else if (node.op == UnaryOp::Op::NOT)
-                {
-                    emit ("    test " + r + ", " + r);
-                    emit ("    sete " + r8);
-                    emit ("    movzx " + r + ", " + r8);
-                }
-                return operand_reg;
-            }
+            Opcode op = inst.op == SsaOp::VADD ? Opcode::PADDD
+                      : inst.op == SsaOp::VSUB ? Opcode::PSUBD : Opcode::PMULLD;
+            Operand l = xmm (args[0]);
+            Operand r = xmm (args[1]);
+            Operand dst = xmm (v);
 
-            // Spilled path: use stack
-            emit ("    pop rax");
-            if (node.op == UnaryOp::Op::NEGATE)
-                emit ("    neg eax");
-            else if (node.op == UnaryOp::Op::NOT)
+            // In place on the right operand: swap it over, or go through
+            // the scratch register for a subtract
+            if (dst == r && dst != l)
             {
-                emit ("    test eax, eax");
-                emit ("    sete al");
-                emit ("    movzx eax, al");
+                if (inst.op != SsaOp::VSUB)
+                    std::swap (l, r);
+                else
+                    dst = Operand::make_xmm (VECTOR_SCRATCH);
             }
-            emit ("    push rax");
-            return "";
+            if (dst != l)
+                emit (Opcode::MOVDQA, dst, l);
+            emit (op, dst, r);
+            if (dst != xmm (v))
+                emit (Opcode::MOVDQA, xmm (v), dst);
+            break;
         }
 
-        // Function call
-        else if constexpr (std::is_same_v<T, FuncCall>)
+        case SsaOp::VREDUCE:
         {
-            static const char* arg_regs_64[] = {"rdi", "rsi", "rdx",
-                                                 "rcx", "r8",  "r9"};
+            // Lanes 2 and 3 onto 0 and 1, then lane 1 onto lane 0
+            Operand scratch = Operand::make_xmm (VECTOR_SCRATCH);
+            uint32_t high = new_vreg ();
+            emit (Opcode::PSHUFD, scratch, xmm (args[0]), imm (0x4E));
+            emit (Opcode::PADDD, scratch, xmm (args[0]));
+            emit (Opcode::MOVD, v32 (vreg (v)), scratch);
+            emit (Opcode::PSHUFD, scratch, scratch, imm (0x55));
+            emit (Opcode::MOVD, v32 (high), scratch);
+            emit (Opcode::ADD, v32 (vreg (v)), v32 (high));
+            break;
+        }
 
-            if (node.args.size () > 6)
-                throw GenError ("Call to '" + node.name + "' has more than 6 arguments");
+        default:
+            break;
+    }
+}
 
-            // Evaluate each param and immediately free their regs
-            for (auto& arg : node.args)
-            {
-                std::string arg_reg = gen_expr (*arg);
-                if (!arg_reg.empty ())
-                {
-                    emit ("    push " + arg_reg);
-                    free_reg (arg_reg);
-                }
-            }
+/**
+ * add, or lea when a scaled index was folded in
+ */
+void FunctionCodegen::gen_add (uint32_t v)
+{
+    const auto& args = ssa_->insts[v].args;
+    for (uint32_t i = 0; i < 2; ++i)
+    {
+        if (!lea_indexes_[args[i]])
+            continue;
+        uint32_t factor = lea_index (args[i]);
+        const SsaInst& mul = ssa_->insts[args[i]];
+        int32_t scale = ssa_->insts[mul.args[0] == factor ? mul.args[1] : mul.args[0]].imm;
+        Operand base = use_reg (args[1 - i]);
+        Operand index = use_reg (factor).scaled (static_cast<uint8_t> (scale));
+        emit (Opcode::LEA, v32 (vreg (v)), base, index);
+        return;
+    }
 
-            // Pop args into argument registers in reverse
-            // Was having issues passing straight in with nested funcs?
-            for (int i = static_cast<int> (node.args.size ()) - 1; i >= 0; --i)
-                emit ("    pop " + std::string {arg_regs_64[i]});
+    // A constant goes on the right, where it is an immediate
+    uint32_t l = args[0];
+    uint32_t r = args[1];
+    if (ssa_->insts[l].op == SsaOp::CONST)
+        std::swap (l, r);
+    emit (Opcode::MOV, v32 (vreg (v)), use (l));
+    emit (Opcode::ADD, v32 (vreg (v)), use (r));
+}
 
-            emit ("    call " + node.name);
+/**
+ * Multiplies by a constant become shifts, lea or imul with an immediate
+ */
+void FunctionCodegen::gen_mul (uint32_t v)
+{
+    const auto& args = ssa_->insts[v].args;
+    Operand dst = v32 (vreg (v));
 
-            // Store the return value (rax/eax) into a scratch register or spill
-            std::string dest = alloc_reg ();
-            if (dest.empty ())
-                emit ("    push rax");
-            else
-                emit ("    mov " + reg32 (dest) + ", eax");
-            return dest;
-        }
+    uint32_t x = args[0];
+    uint32_t c = args[1];
+    if (ssa_->insts[x].op == SsaOp::CONST)
+        std::swap (x, c);
+    if (ssa_->insts[c].op != SsaOp::CONST)
+    {
+        emit (Opcode::MOV, dst, use (x));
+        emit (Opcode::IMUL, dst, use_reg (c));
+        return;
+    }
 
-        // Binary op
-        else if constexpr (std::is_same_v<T, BinaryOp>)
-        {
-            // Evaluate left, then right (right eval may use registers left holds)
-            std::string left_reg  = gen_expr (*node.left);
-            std::string right_reg = gen_expr (*node.right);
+    int32_t factor = ssa_->insts[c].imm;
+    uint32_t magnitude = factor < 0 ? 0u - static_cast<uint32_t> (factor)
+                                    : static_cast<uint32_t> (factor);
+    if (factor == 0)
+    {
+        emit (Opcode::MOV, dst, imm (0));
+        return;
+    }
 
-            // Use scratch registers directly wherever available.
-            // Only fall back to eax/ecx when the value was spilled to the stack.
-            // right is popped before left to respect push order (right was pushed last).
-            if (right_reg.empty ())
-                emit ("    pop rcx");
-            std::string r_val = right_reg.empty () ? "ecx" : reg32 (right_reg);
+    // |factor| = m * 2^k with m in {1, 3, 5, 9}, negated afterwards. INT_MIN
+    // is a shift by 31 either way.
+    int32_t shift = __builtin_ctz (magnitude);
+    uint32_t odd = magnitude >> shift;
+    if (odd == 1 || odd == 3 || odd == 5 || odd == 9)
+    {
+        Operand src = use_reg (x);
+        if (odd == 1)
+            emit (Opcode::MOV, dst, src);
+        else
+            emit (Opcode::LEA, dst, src,
+                  src.scaled (static_cast<uint8_t> (odd - 1)));
+        if (shift > 0)
+            emit (Opcode::SHL, dst, imm (shift));
+        if (factor < 0 && factor != INT32_MIN)
+            emit (Opcode::NEG, dst);
+        return;
+    }
 
-            if (left_reg.empty ())
-                emit ("    pop rax");
-            std::string l_val = left_reg.empty () ? "eax" : reg32 (left_reg);
+    emit (Opcode::IMUL_IMM, dst, use_reg (x), imm (factor));
+}
 
-            std::string l8 = left_reg.empty () ? "al" : reg8 (left_reg);
-            std::string r8 = right_reg.empty () ? "cl" : reg8 (right_reg);
+/**
+ * Division by a constant: shifts for powers of two, otherwise a multiply
+ * by the reciprocal. idiv remains for variable divisors, and for 0 and -1
+ * so those still trap.
+ */
+void FunctionCodegen::gen_div (uint32_t v)
+{
+    const auto& args = ssa_->insts[v].args;
+    Operand dst = v32 (vreg (v));
+    const SsaInst& divisor = ssa_->insts[args[1]];
+    int32_t d = divisor.imm;
 
-            switch (node.op)
-            {
-                case BinaryOp::Op::ADD:
-                    emit ("    add " + l_val + ", " + r_val);
-                    break;
-                case BinaryOp::Op::SUB:
-                    emit ("    sub " + l_val + ", " + r_val);
-                    break;
-                case BinaryOp::Op::MUL:
-                    emit ("    imul " + l_val + ", " + r_val);
-                    break;
-                case BinaryOp::Op::DIV:
-                    // idiv requires the dividend in eax, bounce left in
-                    if (l_val != "eax") emit ("    mov eax, " + l_val);
-                    emit ("    cdq");
-                    emit ("    idiv " + r_val);
-                    if (l_val != "eax") emit ("    mov " + l_val + ", eax");
-                    break;
-                case BinaryOp::Op::EQ:
-                    emit ("    cmp " + l_val + ", " + r_val);
-                    emit ("    sete " + l8);
-                    emit ("    movzx " + l_val + ", " + l8);
-                    break;
-                case BinaryOp::Op::NE:
-                    emit ("    cmp " + l_val + ", " + r_val);
-                    emit ("    setne " + l8);
-                    emit ("    movzx " + l_val + ", " + l8);
-                    break;
-                case BinaryOp::Op::LT:
-                    emit ("    cmp " + l_val + ", " + r_val);
-                    emit ("    setl " + l8);
-                    emit ("    movzx " + l_val + ", " + l8);
-                    break;
-                case BinaryOp::Op::GT:
-                    emit ("    cmp " + l_val + ", " + r_val);
-                    emit ("    setg " + l8);
-                    emit ("    movzx " + l_val + ", " + l8);
-                    break;
-                case BinaryOp::Op::AND:
-                    emit ("    test " + l_val + ", " + l_val);
-                    emit ("    setne " + l8);
-                    emit ("    test " + r_val + ", " + r_val);
-                    emit ("    setne " + r8);
-                    emit ("    and " + l8 + ", " + r8);
-                    emit ("    movzx " + l_val + ", " + l8);
-                    break;
-                case BinaryOp::Op::OR:
-                    emit ("    or " + l_val + ", " + r_val);
-                    emit ("    test " + l_val + ", " + l_val);
-                    emit ("    setne " + l8);
-                    emit ("    movzx " + l_val + ", " + l8);
-                    break;
-            }
+    if (divisor.op != SsaOp::CONST || d == 0 || d == -1)
+    {
+        // idiv takes the dividend in edx:eax
+        Operand operand = use_reg (args[1]);
+        emit (Opcode::MOV, r32 (Reg::RAX), use (args[0]));
+        emit (Opcode::CDQ);
+        emit (Opcode::IDIV, operand);
+        emit (Opcode::MOV, dst, r32 (Reg::RAX));
+        return;
+    }
 
-            // Prefer ret in left_reg, then right_reg, then alloc/spill.
-            // After the op, result is in l_val (left_reg's register or eax).
-            if (!left_reg.empty ())
-            {
-                // Result already sits in left_reg.
-                free_reg (right_reg);
-                return left_reg;
-            }
-            if (!right_reg.empty ())
-            {
-                // Left was spilled so result is in eax. Reuse right_reg.
-                emit ("    mov " + r_val + ", eax");
-                return right_reg;
-            }
-            // Both were spilled. Result in eax.
-            std::string dest = alloc_reg ();
-            if (dest.empty ())
-                emit ("    push rax");
-            else
-                emit ("    mov " + reg32 (dest) + ", eax");
-            return dest;
-        }
+    Operand x = use_reg (args[0]);
+    if (d == 1)
+    {
+        emit (Opcode::MOV, dst, x);
+        return;
+    }
 
-        // Default
-        else
-        {
-            throw GenError ("Unsupported expression type");
-            return "";
-        }
+    uint32_t magnitude = d < 0 ? 0u - static_cast<uint32_t> (d) : static_cast<uint32_t> (d);
+    int32_t k = log2_exact (magnitude);
+    if (k > 0)
+    {
+        // Round toward zero: add 2^k - 1 to negative dividends first
+        emit (Opcode::MOV, dst, x);
+        if (k > 1)
+            emit (Opcode::SAR, dst, imm (31));
+        emit (Opcode::SHR, dst, imm (32 - k));
+        emit (Opcode::ADD, dst, x);
+        emit (Opcode::SAR, dst, imm (k));
+        if (d < 0)
+            emit (Opcode::NEG, dst);
+        return;
+    }
 
-    }, expr.node);
+    // q = hi32 (M * x) (+/- x) >> s, plus one if negative
+    Magic magic = signed_magic (d);
+    Operand edx = r32 (Reg::RDX);
+    emit (Opcode::MOV, r32 (Reg::RAX), imm (magic.multiplier));
+    emit (Opcode::IMUL_WIDE, x);
+    if (d > 0 && magic.multiplier < 0)
+        emit (Opcode::ADD, edx, x);
+    else if (d < 0 && magic.multiplier > 0)
+        emit (Opcode::SUB, edx, x);
+    if (magic.shift > 0)
+        emit (Opcode::SAR, edx, imm (magic.shift));
+    emit (Opcode::MOV, dst, edx);
+    emit (Opcode::SHR, dst, imm (31));
+    emit (Opcode::ADD, dst, edx);
 }
 
-std::string Codegen::get_assembly () const
+MProgram& Codegen::get_mir ()
 {
-    std::string assembly_str {};
+    return mir_;
+}
 
-    assembly_str.append (".intel_syntax noprefix\n.global main\n\n");
+std::string_view Codegen::get_assembly ()
+{
+    return get_assembly (out_);
+}
 
-    for (size_t line_num = 0; line_num < assembly_lines_.size (); ++line_num)
+std::string_view Codegen::get_assembly (Emitter& out)
+{
+    out.clear ();
+    if (!pool_)
     {
-        assembly_str.append (assembly_lines_[line_num]);
-        if (line_num < assembly_lines_.size () - 1)
-            assembly_str.append ("\n");
+        print_asm (mir_, out);
+        return out.view ();
     }
 
-    return assembly_str;
+    // Functions print into their own buffers, joined in source order
+    std::vector<Emitter> parts (mir_.functions.size ());
+    pool_->parallel_for (parts.size (), [&] (size_t i)
+    {
+        print_asm (mir_, mir_.functions[i], parts[i]);
+    });
+    print_asm_header (out);
+    for (const auto& part : parts)
+        out.raw (part.view ());
+    return out.view ();
+}
+
+std::string Codegen::get_object ()
+{
+    return write_elf_object (encode (mir_), mir_);
 }
@@ -1,14 +1,21 @@
 /**
  * @file codegen.hpp
- * @brief Emits assembly (.s).
+ * @brief Lowers the AST to machine IR and emits assembly (.s) or objects (.o).
  */
 
 #pragma once
 
-#include <vector>
+#include <span>
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <utility>
+#include <vector>
 #include "ast.hpp"
+#include "emitter.hpp"
+#include "mir.hpp"
+#include "ssa.hpp"
+#include "loop_opt.hpp"
+#include "token.hpp"
 
 /**
  * Codegen error
@@ -20,39 +27,139 @@ public:
         : std::runtime_error (msg) {}
 };
 
+class FunctionCache;
+class ThreadPool;
+class TimeReport;
+
 /**
- * Codegen (register-based expression evaluation with spill to stack)
+ * Lowers one SSA function to MIR over virtual registers, then allocates
+ * registers and lays out its frame
+ *
+ * Functions share nothing but the label numbering, which is fixed before
+ * lowering starts (first_label), so any number can be lowered at once.
  */
-class Codegen
+class FunctionCodegen
 {
 private:
-    size_t label_counter_;
-    std::vector<std::string> assembly_lines_;
+    MFunction* func_;               // Function being lowered
 
-    // Local variable tracking (name to rbp offset)
-    std::unordered_map<std::string, int> var_offsets_;
-    int next_var_offset_;
+    // SSA function being lowered, and its values' virtual registers
+    const SsaFunction* ssa_;
+    std::vector<uint32_t> vregs_;
+    std::vector<uint32_t> phi_temps_;   // Where preds leave a phi's operand
+    std::vector<uint32_t> use_counts_;
+    std::vector<bool> lea_indexes_;     // Multiplies folded into an lea
+    std::vector<uint32_t> xmms_;        // Vector values' registers
+    std::vector<uint32_t> idoms_;
+    uint32_t block_label_;              // Label of block 0, the rest follow
+    uint32_t epilogue_label_;
+    uint32_t next_label_;               // Switch lowering's, after the epilogue
 
-    // Scratch register pool: rbx (0), r12 (1), r13 (2)
-    bool reg_used_[3];
-    std::string epilogue_label_;
+    // Jump tables, emitted after the function's code
+    struct JumpTable
+    {
+        uint32_t label;
+        std::vector<uint32_t> targets;  // Blocks, by value minus the lowest
+    };
+    std::vector<JumpTable> tables_;
 
-    void emit (const std::string& line);
-    std::string alloc_reg ();
-    void free_reg (const std::string& reg);
-    void gen_function (const Function& func);
-    void gen_block (const Block& block);
-    void gen_stmt (const Stmt& stmt);
-    std::string gen_expr (const Expr& expr);
+    void emit (Opcode op, Operand a = {}, Operand b = {}, Operand c = {});
+    void emit_label (uint32_t id);
+    uint32_t new_vreg ();
+    uint32_t vreg (uint32_t value);
+    uint32_t phi_temp (uint32_t phi);
+    Operand use (uint32_t value);
+    Operand use_reg (uint32_t value);
+    Operand xmm (uint32_t value) const;
+    void gen_function (const SsaFunction& func);
+    uint32_t branch_compare (uint32_t block) const;
+    uint32_t tail_call (uint32_t block) const;
+    SsaOp gen_compare (uint32_t value);
+    uint32_t lea_index (uint32_t value) const;
+    void gen_add (uint32_t value);
+    void gen_mul (uint32_t value);
+    void gen_div (uint32_t value);
+    void gen_vector (uint32_t value);
+    void gen_block (uint32_t block);
+    void gen_phi_copies (uint32_t block);
+    void gen_exit (uint32_t block, SsaOp fused_op);
+    void gen_switch (uint32_t block);
+    void gen_cases (uint32_t block, Operand value,
+                    std::span<const std::pair<int32_t, uint32_t>> cases, bool last);
+    void gen_inst (uint32_t value);
 
 public:
+    static constexpr size_t SWITCH_TABLE_MIN = 4;       // Cases for a jump table
+    static constexpr size_t SWITCH_TABLE_DENSITY = 3;   // Max entries per case
+    static constexpr size_t SWITCH_LINEAR_MAX = 3;      // Compares before splitting
+
+    /**
+     * Lower func into out, numbering its labels from first_label
+     */
+    FunctionCodegen (const SsaFunction& func, uint32_t first_label, MFunction& out);
+
+    /**
+     * Labels a function uses: one per block, its epilogue, and two per case
+     * for switch lowering (compare tree nodes and tables)
+     */
+    static uint32_t label_count (const SsaFunction& func);
+};
+
+/**
+ * Codegen (builds SSA from the AST, optionally optimizes it, then lowers
+ * each function with FunctionCodegen)
+ */
+class Codegen
+{
+private:
+    MProgram mir_;
+    Emitter out_;
+    ThreadPool* pool_;
+    size_t cache_hits_ = 0;
+
+public:
+    /**
+     * Program constructor, optimize runs the SSA passes (-O) with the given
+     * loop options
+     *
+     * With a pool, per-function work (SSA construction and passes,
+     * lowering, printing) runs on it. The output is the same either way.
+     * With a report, SSA construction, each SSA pass and lowering are
+     * recorded as phases.
+     *
+     * With a cache, functions found in it are reused and the others added
+     * (see function_cache.hpp), again with the same output. Without -O,
+     * passing the tokens the program was parsed from lets functions be
+     * looked up before their SSA is built.
+     */
+    Codegen (const Program& program, bool optimize = false,
+             const LoopOptions& loops = {}, ThreadPool* pool = nullptr,
+             TimeReport* report = nullptr, FunctionCache* cache = nullptr,
+             std::span<const Token> tokens = {});
+
+    /**
+     * Functions taken from the cache
+     */
+    size_t cache_hits () const { return cache_hits_; }
+
+    /**
+     * Get the lowered machine IR (passes may rewrite it in place)
+     */
+    MProgram& get_mir ();
+
+    /**
+     * Render the machine IR as assembly (valid until the next call)
+     */
+    std::string_view get_assembly ();
+
     /**
-     * Program constructor
+     * Render the machine IR as assembly into out, which is cleared first
+     * (a caller's emitter keeps its capacity from one program to the next)
      */
-    Codegen (const Program& program);
+    std::string_view get_assembly (Emitter& out);
 
     /**
-     * Get generated assembly as a string
+     * Encode the machine IR as a relocatable ELF object, no assembler needed
      */
-    std::string get_assembly () const;
+    std::string get_object ();
 };
@@ -0,0 +1,405 @@
+/**
+ * @file driver.cpp
+ * @brief Whole-file and batch compilation
+ */
+
+#include "driver.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "codegen.hpp"
+#include "optimizer.hpp"
+#include "peephole.hpp"
+#include "file_utils.hpp"
+#include "jit.hpp"
+#include "thread_pool.hpp"
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <variant>
+
+namespace
+{
+
+/**
+ * Functions, statements, blocks and expressions in the AST
+ */
+class NodeCounter
+{
+public:
+    size_t count = 0;
+
+    void program (const Program& prog)
+    {
+        for (const auto& func : prog.functions)
+        {
+            ++count;
+            block (func.body);
+        }
+    }
+
+private:
+    void block (const Block& block)
+    {
+        ++count;
+        for (const auto& s : block.statements)
+            stmt (s);
+    }
+
+    void stmt (const Stmt& s)
+    {
+        ++count;
+        std::visit ([this] (const auto& node)
+        {
+            using T = std::decay_t<decltype (node)>;
+            if constexpr (std::is_same_v<T, VarDecl>)
+            {
+                if (node.init)
+                    expr (**node.init);
+            }
+            else if constexpr (std::is_same_v<T, Assignment>)
+                expr (*node.value);
+            else if constexpr (std::is_same_v<T, ReturnStmt>)
+                expr (*node.value);
+            else if constexpr (std::is_same_v<T, IfStmt>)
+            {
+                expr (*node.condition);
+                block (*node.then_block);
+            }
+            else if constexpr (std::is_same_v<T, WhileStmt>)
+            {
+                expr (*node.condition);
+                block (*node.body);
+            }
+            else if constexpr (std::is_same_v<T, SwitchStmt>)
+            {
+                expr (*node.value);
+                for (const auto& c : node.cases)
+                    block (*c.body);
+                if (node.default_body)
+                    block (*node.default_body);
+            }
+            else if constexpr (std::is_same_v<T, Block>)
+                block (node);
+            else if constexpr (std::is_same_v<T, ExprStmt>)
+                expr (*node.expression);
+        }, s.node);
+    }
+
+    void expr (const Expr& e)
+    {
+        ++count;
+        std::visit ([this] (const auto& node)
+        {
+            using T = std::decay_t<decltype (node)>;
+            if constexpr (std::is_same_v<T, UnaryOp>)
+                expr (*node.operand);
+            else if constexpr (std::is_same_v<T, BinaryOp>)
+            {
+                expr (*node.left);
+                expr (*node.right);
+            }
+            else if constexpr (std::is_same_v<T, FuncCall>)
+                for (const Expr* arg : node.args)
+                    expr (*arg);
+        }, e.node);
+    }
+};
+
+int64_t ast_nodes (const Program& prog)
+{
+    NodeCounter counter;
+    counter.program (prog);
+    return static_cast<int64_t> (counter.count);
+}
+
+/**
+ * Hands a parsed program's arena back to a workspace, reset, however
+ * generate exits (a failed parse has returned it already)
+ */
+struct ArenaReturn
+{
+    Program& program;
+    Workspace* workspace;
+
+    ~ArenaReturn ()
+    {
+        if (!workspace || program.arena.bytes_reserved () == 0)
+            return;
+        program.functions.clear ();
+        workspace->arena = std::move (program.arena);
+        workspace->arena.reset ();
+    }
+};
+
+/**
+ * Front end and codegen (+ peephole with -O) of one file
+ * Returns nullptr after recording a parse error
+ */
+std::unique_ptr<Codegen> generate (Lexer& lexer, const CompileOptions& options,
+                                   ThreadPool* pool, CompileResult& result,
+                                   Workspace* workspace = nullptr)
+{
+    TimeReport* report = options.time_report ? &result.report : nullptr;
+
+    // Tokens are pulled lazily by the parser unless an array is needed: the
+    // report times lexing apart, the cache keys unoptimized functions by
+    // their token ranges
+    bool token_keys = options.cache && !options.optimize;
+    std::span<const Token> tokens;
+
+    Program program;
+    ArenaReturn arena_return {program, workspace};
+    Arena fresh;
+    Arena& arena = workspace ? workspace->arena : fresh;
+    try
+    {
+        if (report || token_keys)
+        {
+            {
+                TimeReport::Phase phase {report, "lex"};
+                tokens = lexer.get_tokens ();
+                phase.count ("tokens", static_cast<int64_t> (tokens.size ()));
+            }
+            TimeReport::Phase phase {report, "parse"};
+            Parser parser {tokens};
+            program = parser.parse (std::move (arena));
+            phase.count ("functions", static_cast<int64_t> (program.functions.size ()));
+            if (phase.active ())
+                phase.count ("ast_nodes", ast_nodes (program));
+        }
+        else
+        {
+            Parser parser {lexer};
+            program = parser.parse (std::move (arena));
+        }
+        result.messages += "Parsing successful: "
+                         + std::to_string (program.functions.size ()) + " function(s)\n";
+    }
+    catch (const ParseError& e)
+    {
+        result.errors += "Parse error [" + std::to_string (e.loc.line) + ":"
+                       + std::to_string (e.loc.col) + "]: " + e.what () + "\n";
+        return nullptr;
+    }
+
+    if (options.optimize)
+    {
+        TimeReport::Phase phase {report, "ast_fold"};
+        Optimizer optimizer {options.opt_level};
+        optimizer.optimize (program, pool);
+        if (phase.active ())
+            phase.count ("ast_nodes", ast_nodes (program));
+        result.messages += "Optimization applied\n";
+    }
+
+    auto codegen = std::make_unique<Codegen> (program, options.optimize, options.loops,
+                                              pool, report, options.cache,
+                                              token_keys ? tokens : std::span<const Token> {});
+    if (options.cache)
+        result.messages += "Reused " + std::to_string (codegen->cache_hits ()) + " of "
+                         + std::to_string (codegen->get_mir ().functions.size ())
+                         + " function(s) from the cache\n";
+    if (options.optimize)
+    {
+        TimeReport::Phase phase {report, "peephole"};
+        phase.count ("removed", static_cast<int64_t> (peephole (codegen->get_mir (), pool)));
+        if (phase.active ())
+            phase.count ("mir_insts", static_cast<int64_t> (inst_count (codegen->get_mir ())));
+    }
+    return codegen;
+}
+
+} // namespace
+
+void set_opt_level (CompileOptions& options, unsigned level)
+{
+    options.optimize = level > 0;
+    options.opt_level = level;
+    if (level == 1)
+    {
+        options.loops.hoist = false;
+        options.loops.strength_reduce = false;
+        options.loops.unroll_factor = 1;
+        options.loops.vectorize = false;
+    }
+}
+
+CompileResult compile_file (const CompileJob& job, const CompileOptions& options,
+                            ThreadPool* pool)
+{
+    CompileResult result {.report = TimeReport {job.in_path}};
+    try
+    {
+        Lexer lexer {job.in_path};
+        if (!lexer.read_error ().empty ())
+        {
+            result.errors += lexer.read_error () + "\n";
+            return result;
+        }
+        std::unique_ptr<Codegen> codegen = generate (lexer, options, pool, result);
+        if (!codegen)
+            return result;
+
+        TimeReport::Phase phase {options.time_report ? &result.report : nullptr, "output"};
+        std::string object = options.object ? codegen->get_object () : std::string {};
+        std::string_view text = options.object ? std::string_view {object}
+                                               : codegen->get_assembly ();
+        phase.count ("bytes", static_cast<int64_t> (text.size ()));
+        if (!string_to_file (text, job.out_path))
+        {
+            result.errors += "Could not write " + job.out_path + "\n";
+            return result;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        result.errors += std::string {"Codegen error: "} + e.what () + "\n";
+        return result;
+    }
+
+    result.ok = true;
+    return result;
+}
+
+CompileResult compile_source (const std::string& source, const CompileOptions& options,
+                              std::string& output, Workspace* workspace, ThreadPool* pool)
+{
+    CompileResult result {.report = TimeReport {"<source>"}};
+    try
+    {
+        Lexer lexer {source, false};
+        std::unique_ptr<Codegen> codegen = generate (lexer, options, pool, result, workspace);
+        if (!codegen)
+            return result;
+
+        TimeReport::Phase phase {options.time_report ? &result.report : nullptr, "output"};
+        if (options.object)
+            output = codegen->get_object ();
+        else
+            output.assign (workspace ? codegen->get_assembly (workspace->text)
+                                     : codegen->get_assembly ());
+        phase.count ("bytes", static_cast<int64_t> (output.size ()));
+    }
+    catch (const std::exception& e)
+    {
+        result.errors += std::string {"Codegen error: "} + e.what () + "\n";
+        return result;
+    }
+
+    result.ok = true;
+    return result;
+}
+
+CompileResult run_file (const std::string& in_path, const CompileOptions& options,
+                        ThreadPool* pool)
+{
+    CompileResult result {.report = TimeReport {in_path}};
+    try
+    {
+        Lexer lexer {in_path};
+        if (!lexer.read_error ().empty ())
+        {
+            result.errors += lexer.read_error () + "\n";
+            return result;
+        }
+        std::unique_ptr<Codegen> codegen = generate (lexer, options, pool, result);
+        if (!codegen)
+            return result;
+        TimeReport* report = options.time_report ? &result.report : nullptr;
+        std::optional<JitModule> module;
+        {
+            TimeReport::Phase phase {report, "jit"};
+            module.emplace (codegen->get_mir ());
+        }
+        TimeReport::Phase phase {report, "run"};
+        result.value = module->run_main ();
+    }
+    catch (const std::exception& e)
+    {
+        result.errors += std::string {"Codegen error: "} + e.what () + "\n";
+        return result;
+    }
+
+    result.ok = true;
+    return result;
+}
+
+std::vector<CompileResult> compile_batch (const std::vector<CompileJob>& jobs,
+                                          const CompileOptions& options,
+                                          size_t threads)
+{
+    // Jobs writing the same file (x.c from two directories into one
+    // --out-dir) would race on it; none of them runs
+    std::unordered_map<std::string, std::vector<size_t>> writers;
+    for (size_t i = 0; i < jobs.size (); ++i)
+    {
+        const std::string& out = jobs[i].out_path;
+        std::string full = out.empty () || out[0] == '/' ? out : get_full_path (out);
+        writers[std::filesystem::path {full}.lexically_normal ().string ()].push_back (i);
+    }
+
+    std::vector<CompileResult> results (jobs.size ());
+    std::vector<bool> skip (jobs.size (), false);
+    for (const auto& [path, indices] : writers)
+    {
+        if (indices.size () < 2)
+            continue;
+        for (size_t i : indices)
+        {
+            size_t other = indices[i == indices[0] ? 1 : 0];
+            results[i].errors = "Output " + jobs[i].out_path + " is also written for "
+                              + jobs[other].in_path + "\n";
+            skip[i] = true;
+        }
+    }
+
+    // Every stage keeps its state in its own objects, files share nothing
+    ThreadPool pool {threads};
+    pool.parallel_for (jobs.size (), [&] (size_t i)
+    {
+        if (!skip[i])
+            results[i] = compile_file (jobs[i], options, &pool);
+    });
+    return results;
+}
+
+std::string output_path (const std::string& in_path, bool object,
+                         const std::string& out_dir)
+{
+    size_t slash = in_path.rfind ('/');
+    size_t name_start = slash == std::string::npos ? 0 : slash + 1;
+    size_t dot = in_path.rfind ('.');
+    size_t stem_end = dot == std::string::npos || dot <= name_start ? in_path.size () : dot;
+
+    std::string stem = in_path.substr (0, stem_end);
+    if (!out_dir.empty ())
+    {
+        stem = stem.substr (name_start);
+        stem = out_dir.back () == '/' ? out_dir + stem : out_dir + "/" + stem;
+    }
+    return stem + (object ? ".o" : ".s");
+}
+
+std::vector<std::string> read_manifest (const std::string& path)
+{
+    std::string text = file_to_string (path);
+    std::vector<std::string> paths;
+
+    size_t pos = 0;
+    while (pos < text.size ())
+    {
+        size_t end = text.find ('\n', pos);
+        if (end == std::string::npos)
+            end = text.size ();
+
+        size_t first = text.find_first_not_of (" \t\r", pos);
+        if (first < end && text[first] != '#')
+        {
+            size_t last = text.find_last_not_of (" \t\r", end - 1);
+            paths.push_back (text.substr (first, last - first + 1));
+        }
+        pos = end + 1;
+    }
+    return paths;
+}
@@ -0,0 +1,132 @@
+/**
+ * @file driver.hpp
+ * @brief Whole-file compilation: one source in, one .s or .o out, singly or
+ *        in batches on a thread pool.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "arena.hpp"
+#include "emitter.hpp"
+#include "loop_opt.hpp"
+#include "time_report.hpp"
+
+class FunctionCache;
+class ThreadPool;
+
+/**
+ * What to produce, shared by every file of a batch
+ */
+struct CompileOptions
+{
+    bool optimize = false;          // -O1, -O2 (-O)
+    unsigned opt_level = 2;         // With optimize, see set_opt_level
+    bool object = false;            // -c: ELF object instead of assembly
+    bool time_report = false;       // --time-report: fill CompileResult::report
+    LoopOptions loops {};
+    FunctionCache* cache = nullptr; // --cache-dir: reuse unchanged functions
+};
+
+/**
+ * Options for -O<level>
+ * 0 optimizes nothing. 1 runs the -O1 AST passes (optimizer.hpp), the
+ * scalar and interprocedural SSA passes and peephole, and turns the loop
+ * passes off. 2 (-O) runs everything with the loop options as they are.
+ */
+void set_opt_level (CompileOptions& options, unsigned level);
+
+/**
+ * One input file and where its output goes
+ */
+struct CompileJob
+{
+    std::string in_path;
+    std::string out_path;
+};
+
+/**
+ * Outcome of one job
+ *
+ * Progress and error messages are collected instead of printed, so jobs
+ * running in parallel do not interleave their output.
+ */
+struct CompileResult
+{
+    bool ok = false;
+    std::string messages {};        // Progress, for stdout
+    std::string errors {};          // Parse and codegen errors, for stderr
+    int value = 0;                  // What main returned, run_file only
+    TimeReport report;              // Phases, with CompileOptions::time_report
+};
+
+/**
+ * Buffers a thread keeps from one compile to the next (the --serve workers)
+ *
+ * The AST arena is reset rather than freed and the assembly text is built
+ * in the same emitter every time, so a stream of compiles stops allocating
+ * either once they have grown to the largest input.
+ */
+struct Workspace
+{
+    Arena arena;
+    Emitter text;
+};
+
+/**
+ * Lex, parse, optimize and generate one file, writing job.out_path
+ * With a pool, the file's functions are optimized and generated in parallel
+ *
+ * With options.time_report the lexer runs to completion before parsing
+ * (normally the parser pulls tokens as it goes), so the two are timed
+ * apart. The report's phases are lex, parse, ast_fold (-O), ssa_build,
+ * the ssa_* passes (-O), lower, peephole (-O) and output (run_file: jit and
+ * run instead of output).
+ * Never throws, failures are reported in the result
+ */
+CompileResult compile_file (const CompileJob& job, const CompileOptions& options,
+                            ThreadPool* pool = nullptr);
+
+/**
+ * compile_file for a source held in memory: the .s or .o bytes are
+ * assigned to output instead of written to a file
+ * With a workspace, the AST arena and the assembly text come from it and
+ * are handed back afterwards
+ * Never throws, failures are reported in the result
+ */
+CompileResult compile_source (const std::string& source, const CompileOptions& options,
+                              std::string& output, Workspace* workspace = nullptr,
+                              ThreadPool* pool = nullptr);
+
+/**
+ * Compile one file into memory and call its main (--run), nothing is
+ * written to disk
+ * Never throws, failures are reported in the result
+ */
+CompileResult run_file (const std::string& in_path, const CompileOptions& options,
+                        ThreadPool* pool = nullptr);
+
+/**
+ * Compile every job on threads workers (0 is one per hardware thread)
+ * Files and the functions within them share the one pool
+ * Results are in job order. Jobs sharing an output path are not compiled,
+ * each fails naming another input that writes there
+ */
+std::vector<CompileResult> compile_batch (const std::vector<CompileJob>& jobs,
+                                          const CompileOptions& options,
+                                          size_t threads = 0);
+
+/**
+ * Output path for a batch input: its extension replaced by .s or .o, in
+ * out_dir if given, else next to the input
+ */
+std::string output_path (const std::string& in_path, bool object,
+                         const std::string& out_dir = {});
+
+/**
+ * Input paths listed in a manifest, one per line
+ * Blank lines and lines starting with '#' are skipped, surrounding
+ * whitespace is trimmed
+ */
+std::vector<std::string> read_manifest (const std::string& path);
@@ -0,0 +1,177 @@
+/**
+ * @file elf.cpp
+ * @brief ELF64 relocatable object writer
+ */
+
+#include "elf.hpp"
+#include <elf.h>
+#include <cstring>
+#include <unordered_map>
+
+namespace
+{
+
+enum Section : uint16_t
+{
+    SEC_NULL,
+    SEC_TEXT,
+    SEC_RELA_TEXT,
+    SEC_SYMTAB,
+    SEC_STRTAB,
+    SEC_SHSTRTAB,
+    SEC_NOTE_STACK,
+    SEC_COUNT
+};
+
+/**
+ * NUL-separated names, offset 0 is the empty name
+ */
+class StringTable
+{
+public:
+    StringTable () : data_ (1, '\0') {}
+
+    uint32_t add (const std::string& name)
+    {
+        uint32_t offset = static_cast<uint32_t> (data_.size ());
+        data_ += name;
+        data_ += '\0';
+        return offset;
+    }
+
+    const std::string& data () const { return data_; }
+
+private:
+    std::string data_;
+};
+
+template <typename T>
+void append (std::string& out, const T& value)
+{
+    out.append (reinterpret_cast<const char*> (&value), sizeof (T));
+}
+
+void align (std::string& out, size_t alignment)
+{
+    out.resize ((out.size () + alignment - 1) / alignment * alignment, '\0');
+}
+
+} // namespace
+
+std::string write_elf_object (const MachineCode& code, const MProgram& prog)
+{
+    // Locals first, as the symbol table requires
+    StringTable strtab;
+    std::vector<Elf64_Sym> symbols (1);     // Index 0 is the null symbol
+    auto add_function = [&] (const FunctionCode& func, unsigned char bind)
+    {
+        Elf64_Sym sym {};
+        sym.st_name = strtab.add (func.name);
+        sym.st_info = ELF64_ST_INFO (bind, STT_FUNC);
+        sym.st_shndx = SEC_TEXT;
+        sym.st_value = func.offset;
+        sym.st_size = func.size;
+        symbols.push_back (sym);
+    };
+
+    for (const auto& func : code.functions)
+        if (func.name != "main")
+            add_function (func, STB_LOCAL);
+    uint32_t first_global = static_cast<uint32_t> (symbols.size ());
+    for (const auto& func : code.functions)
+        if (func.name == "main")
+            add_function (func, STB_GLOBAL);
+
+    std::unordered_map<uint32_t, uint32_t> undefined;   // MIR symbol -> ELF symbol
+    std::vector<Elf64_Rela> relas;
+    for (const auto& reloc : code.relocations)
+    {
+        auto [it, inserted] = undefined.try_emplace (reloc.symbol,
+                                                     static_cast<uint32_t> (symbols.size ()));
+        if (inserted)
+        {
+            Elf64_Sym sym {};
+            sym.st_name = strtab.add (prog.symbols[reloc.symbol]);
+            sym.st_info = ELF64_ST_INFO (STB_GLOBAL, STT_NOTYPE);
+            sym.st_shndx = SHN_UNDEF;
+            symbols.push_back (sym);
+        }
+
+        Elf64_Rela rela {};
+        rela.r_offset = reloc.offset;
+        rela.r_info = ELF64_R_INFO (it->second, R_X86_64_PLT32);
+        rela.r_addend = reloc.addend;
+        relas.push_back (rela);
+    }
+
+    StringTable shstrtab;
+    const char* names[SEC_COUNT] = {"", ".text", ".rela.text", ".symtab", ".strtab",
+                                    ".shstrtab", ".note.GNU-stack"};
+    uint32_t name_offsets[SEC_COUNT] = {};
+    for (int s = 1; s < SEC_COUNT; ++s)
+        name_offsets[s] = shstrtab.add (names[s]);
+
+    // Header, section contents, then the section header table
+    std::string out (sizeof (Elf64_Ehdr), '\0');
+    Elf64_Shdr headers[SEC_COUNT] {};
+    auto place = [&] (Section s, const void* data, size_t size, size_t alignment)
+    {
+        align (out, alignment);
+        headers[s].sh_offset = out.size ();
+        headers[s].sh_size = size;
+        headers[s].sh_addralign = alignment;
+        if (size > 0)
+            out.append (static_cast<const char*> (data), size);
+    };
+
+    place (SEC_TEXT, code.text.data (), code.text.size (), 16);
+    place (SEC_RELA_TEXT, relas.data (), relas.size () * sizeof (Elf64_Rela), 8);
+    place (SEC_SYMTAB, symbols.data (), symbols.size () * sizeof (Elf64_Sym), 8);
+    place (SEC_STRTAB, strtab.data ().data (), strtab.data ().size (), 1);
+    place (SEC_SHSTRTAB, shstrtab.data ().data (), shstrtab.data ().size (), 1);
+    place (SEC_NOTE_STACK, nullptr, 0, 1);
+
+    for (int s = 1; s < SEC_COUNT; ++s)
+        headers[s].sh_name = name_offsets[s];
+
+    headers[SEC_TEXT].sh_type = SHT_PROGBITS;
+    headers[SEC_TEXT].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+
+    headers[SEC_RELA_TEXT].sh_type = SHT_RELA;
+    headers[SEC_RELA_TEXT].sh_flags = SHF_INFO_LINK;
+    headers[SEC_RELA_TEXT].sh_link = SEC_SYMTAB;
+    headers[SEC_RELA_TEXT].sh_info = SEC_TEXT;
+    headers[SEC_RELA_TEXT].sh_entsize = sizeof (Elf64_Rela);
+
+    headers[SEC_SYMTAB].sh_type = SHT_SYMTAB;
+    headers[SEC_SYMTAB].sh_link = SEC_STRTAB;
+    headers[SEC_SYMTAB].sh_info = first_global;
+    headers[SEC_SYMTAB].sh_entsize = sizeof (Elf64_Sym);
+
+    headers[SEC_STRTAB].sh_type = SHT_STRTAB;
+    headers[SEC_SHSTRTAB].sh_type = SHT_STRTAB;
+    headers[SEC_NOTE_STACK].sh_type = SHT_PROGBITS;
+
+    align (out, 8);
+    size_t section_headers = out.size ();
+    for (const auto& header : headers)
+        append (out, header);
+
+    Elf64_Ehdr ehdr {};
+    std::memcpy (ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    ehdr.e_type = ET_REL;
+    ehdr.e_machine = EM_X86_64;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_shoff = section_headers;
+    ehdr.e_ehsize = sizeof (Elf64_Ehdr);
+    ehdr.e_shentsize = sizeof (Elf64_Shdr);
+    ehdr.e_shnum = SEC_COUNT;
+    ehdr.e_shstrndx = SEC_SHSTRTAB;
+    std::memcpy (out.data (), &ehdr, sizeof (ehdr));
+
+    return out;
+}
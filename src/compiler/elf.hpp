@@ -0,0 +1,18 @@
+/**
+ * @file elf.hpp
+ * @brief Relocatable ELF64 object files for x86-64 (used with -c).
+ */
+
+#pragma once
+
+#include <string>
+#include "encoder.hpp"
+
+/**
+ * Object with .text, .rela.text, .symtab and .strtab
+ *
+ * Symbols match the .s output: main is global, the other functions are
+ * local, and call targets outside the program are undefined globals. An
+ * empty .note.GNU-stack marks the stack non-executable.
+ */
+std::string write_elf_object (const MachineCode& code, const MProgram& prog);
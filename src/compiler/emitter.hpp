@@ -0,0 +1,169 @@
+/**
+ * @file emitter.hpp
+ * @brief Appends formatted assembly into a single growable buffer.
+ */
+
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * Stack operand: DWORD PTR [rbp + offset]
+ */
+struct Mem
+{
+    int offset;
+};
+
+/**
+ * Local label: <prefix><id>, e.g. .L12
+ */
+struct Label
+{
+    size_t id;
+    std::string_view prefix = ".L";
+};
+
+/**
+ * Assembly text emitter
+ *
+ * Every instruction is formatted straight into one output buffer, so no
+ * per-line strings are built. Registers and mnemonics are string literals,
+ * immediates and offsets are formatted with to_chars.
+ */
+class Emitter
+{
+private:
+    std::string buf_;
+
+    void put (std::string_view text)
+    {
+        buf_.append (text);
+    }
+
+    void put (int64_t value)
+    {
+        number (value);
+    }
+
+    void put (int value)
+    {
+        number (value);
+    }
+
+    void put (size_t value)
+    {
+        number (static_cast<int64_t> (value));
+    }
+
+    void put (const char* text)
+    {
+        put (std::string_view {text});
+    }
+
+    void put (const std::string& text)
+    {
+        put (std::string_view {text});
+    }
+
+    void put (Mem mem)
+    {
+        buf_.append ("DWORD PTR [rbp ");
+        if (mem.offset < 0)
+        {
+            buf_.append ("- ");
+            put (-static_cast<int64_t> (mem.offset));
+        }
+        else
+        {
+            buf_.append ("+ ");
+            put (mem.offset);
+        }
+        buf_.push_back (']');
+    }
+
+    void put (Label label)
+    {
+        buf_.append (label.prefix);
+        put (label.id);
+    }
+
+public:
+    explicit Emitter (size_t reserve = 4096)
+    {
+        buf_.reserve (reserve);
+    }
+
+    /**
+     * Emit "    mnemonic op0, op1, ..."
+     */
+    template <typename... Ops>
+    void ins (std::string_view mnemonic, const Ops&... ops)
+    {
+        buf_.append ("    ");
+        buf_.append (mnemonic);
+
+        if constexpr (sizeof... (Ops) > 0)
+        {
+            const char* sep = " ";
+            ((buf_.append (sep), put (ops), sep = ", "), ...);
+        }
+        buf_.push_back ('\n');
+    }
+
+    /**
+     * Emit "name:"
+     */
+    void label (std::string_view name)
+    {
+        buf_.append (name);
+        buf_.append (":\n");
+    }
+
+    void label (Label label)
+    {
+        put (label);
+        buf_.append (":\n");
+    }
+
+    /**
+     * Emit raw text (directives, headers)
+     */
+    void raw (std::string_view text)
+    {
+        buf_.append (text);
+    }
+
+    void raw (char c)
+    {
+        buf_.push_back (c);
+    }
+
+    /**
+     * Emit a decimal integer
+     */
+    void number (int64_t value)
+    {
+        char digits[24];
+        auto res = std::to_chars (digits, digits + sizeof (digits), value);
+        buf_.append (digits, res.ptr);
+    }
+
+    void clear ()
+    {
+        buf_.clear ();
+    }
+
+    std::string_view view () const
+    {
+        return buf_;
+    }
+
+    size_t size () const
+    {
+        return buf_.size ();
+    }
+};
@@ -0,0 +1,595 @@
+/**
+ * @file encoder.cpp
+ * @brief x86-64 instruction encoding and jump layout
+ */
+
+#include "encoder.hpp"
+#include "codegen.hpp"
+#include <algorithm>
+#include <initializer_list>
+#include <unordered_map>
+
+namespace
+{
+
+uint8_t low3 (Reg reg) { return static_cast<uint8_t> (reg) & 7; }
+bool is_high (Reg reg)  { return static_cast<uint8_t> (reg) >= 8; }
+bool fits8 (int32_t value) { return value >= -128 && value <= 127; }
+
+/**
+ * spl, bpl, sil and dil only exist with a REX prefix, without one those
+ * encodings mean ah, ch, dh and bh
+ */
+bool needs_rex_byte (const Operand& operand)
+{
+    return operand.is_reg () && operand.width == Width::B8
+        && operand.reg >= Reg::RSP && operand.reg <= Reg::RDI;
+}
+
+void put32 (std::vector<uint8_t>& out, int32_t value)
+{
+    uint32_t bits = static_cast<uint32_t> (value);
+    for (int i = 0; i < 4; ++i)
+        out.push_back (static_cast<uint8_t> (bits >> (8 * i)));
+}
+
+/**
+ * Memory operand: [base + index * scale + disp]
+ */
+struct Address
+{
+    Reg base;
+    Reg index = Reg::NONE;
+    uint8_t scale = 1;
+    int32_t disp = 0;
+};
+
+/**
+ * The r/m side of an instruction: a register or an address
+ */
+struct RegMem
+{
+    bool is_reg;
+    Reg reg = Reg::NONE;
+    Address addr {Reg::NONE};
+    bool rex_byte = false;          // Byte register that needs an empty REX
+};
+
+RegMem reg_mem (const Operand& operand)
+{
+    if (operand.is_reg ())
+        return {true, operand.reg, {Reg::NONE}, needs_rex_byte (operand)};
+    if (operand.is_mem ())
+        return {false, Reg::NONE, {operand.reg, Reg::NONE, 1, operand.value}};
+    throw GenError ("Operand cannot be encoded (not allocated?)");
+}
+
+/**
+ * REX, opcode bytes, ModRM, then SIB and displacement as needed. reg is
+ * the ModRM reg field: a register number or an opcode extension.
+ */
+void put_modrm (std::vector<uint8_t>& out, std::initializer_list<uint8_t> opcode,
+                uint8_t reg, const RegMem& rm, bool wide, bool rex_byte = false)
+{
+    const Address& a = rm.addr;
+    bool sib = !rm.is_reg && (a.index != Reg::NONE || low3 (a.base) == 4);
+
+    uint8_t rex = 0x40;
+    if (wide)
+        rex |= 0x08;
+    if (reg >= 8)
+        rex |= 0x04;
+    if (!rm.is_reg && a.index != Reg::NONE && is_high (a.index))
+        rex |= 0x02;
+    if (is_high (rm.is_reg ? rm.reg : a.base))
+        rex |= 0x01;
+    if (rex != 0x40 || rex_byte || rm.rex_byte)
+        out.push_back (rex);
+
+    out.insert (out.end (), opcode);
+
+    if (rm.is_reg)
+    {
+        out.push_back (static_cast<uint8_t> (0xC0 | (reg & 7) << 3 | low3 (rm.reg)));
+        return;
+    }
+
+    // rbp and r13 as a base always take a displacement
+    uint8_t mod = a.disp == 0 && low3 (a.base) != 5 ? 0 : fits8 (a.disp) ? 1 : 2;
+    out.push_back (static_cast<uint8_t> (mod << 6 | (reg & 7) << 3 | (sib ? 4 : low3 (a.base))));
+    if (sib)
+    {
+        uint8_t scale_bits = a.scale == 8 ? 3 : a.scale == 4 ? 2 : a.scale == 2 ? 1 : 0;
+        uint8_t index = a.index == Reg::NONE ? 4 : low3 (a.index);
+        out.push_back (static_cast<uint8_t> (scale_bits << 6 | index << 3 | low3 (a.base)));
+    }
+    if (mod == 1)
+        out.push_back (static_cast<uint8_t> (a.disp));
+    else if (mod == 2)
+        put32 (out, a.disp);
+}
+
+uint8_t reg_num (const Operand& operand)
+{
+    if (!operand.is_reg ())
+        throw GenError ("Operand cannot be encoded (not allocated?)");
+    return static_cast<uint8_t> (operand.reg);
+}
+
+uint8_t xmm_num (const Operand& operand)
+{
+    if (!operand.is_xmm ())
+        throw GenError ("Operand cannot be encoded (not an xmm register)");
+    return static_cast<uint8_t> (operand.value);
+}
+
+/**
+ * SSE instruction on xmm reg and xmm or general register rm: the 66
+ * prefix goes before REX
+ */
+void put_sse (std::vector<uint8_t>& out, std::initializer_list<uint8_t> opcode,
+              uint8_t reg, Reg rm)
+{
+    out.push_back (0x66);
+    put_modrm (out, opcode, reg, RegMem {true, rm}, false);
+}
+
+/**
+ * add, or, and, sub, cmp: r/m, reg opcode, reg, r/m opcode and the /digit
+ * of the immediate forms
+ */
+struct AluCodes
+{
+    uint8_t rm_reg;
+    uint8_t reg_rm;
+    uint8_t digit;
+};
+
+AluCodes alu_codes (Opcode op)
+{
+    switch (op)
+    {
+        case Opcode::ADD: return {0x01, 0x03, 0};
+        case Opcode::OR:  return {0x09, 0x0B, 1};
+        case Opcode::AND: return {0x21, 0x23, 4};
+        case Opcode::SUB: return {0x29, 0x2B, 5};
+        default:          return {0x39, 0x3B, 7};
+    }
+}
+
+uint8_t condition_code (Opcode op)
+{
+    switch (op)
+    {
+        case Opcode::JE:  case Opcode::SETE:  return 0x4;
+        case Opcode::JNE: case Opcode::SETNE: return 0x5;
+        case Opcode::JL:  case Opcode::SETL:  return 0xC;
+        case Opcode::JGE:                     return 0xD;
+        case Opcode::JLE:                     return 0xE;
+        case Opcode::JA:                      return 0x7;
+        default:                              return 0xF;     // JG, SETG
+    }
+}
+
+/**
+ * jmp_table with a zero displacement to its table, patched once placed:
+ *   lea r11, [rip + table]; movsxd index, [r11 + index * 4];
+ *   add index, r11; jmp index
+ */
+constexpr uint32_t TABLE_DISP_AT = 3;         // After REX, 8D, ModRM
+
+void encode_table_jump (const MInst& inst, std::vector<uint8_t>& out)
+{
+    Reg index = static_cast<Reg> (reg_num (inst.ops[0]));
+    out.insert (out.end (), {0x4C, 0x8D, 0x1D});
+    put32 (out, 0);
+    put_modrm (out, {0x63}, static_cast<uint8_t> (index),
+               RegMem {false, Reg::NONE, {Reg::R11, index, 4, 0}}, true);
+    put_modrm (out, {0x01}, static_cast<uint8_t> (Reg::R11), RegMem {true, index}, true);
+    put_modrm (out, {0xFF}, 4, RegMem {true, index}, false);
+}
+
+/**
+ * Everything but labels, jumps, calls and jump tables: the bytes do not
+ * depend on where the instruction ends up
+ */
+void encode_inst (const MInst& inst, std::vector<uint8_t>& out)
+{
+    const Operand& dst = inst.ops[0];
+    const Operand& src = inst.ops[1];
+    bool wide = dst.width == Width::B64;
+    bool byte = dst.width == Width::B8;
+
+    switch (inst.op)
+    {
+        case Opcode::MOV:
+            if (dst.is_reg () && src.is_imm () && !wide && !byte)
+            {
+                if (is_high (dst.reg))
+                    out.push_back (0x41);
+                out.push_back (static_cast<uint8_t> (0xB8 + low3 (dst.reg)));
+                put32 (out, src.value);
+            }
+            else if (src.is_imm ())
+            {
+                put_modrm (out, {static_cast<uint8_t> (byte ? 0xC6 : 0xC7)}, 0,
+                           reg_mem (dst), wide);
+                if (byte)
+                    out.push_back (static_cast<uint8_t> (src.value));
+                else
+                    put32 (out, src.value);
+            }
+            else if (src.is_reg ())
+                put_modrm (out, {static_cast<uint8_t> (byte ? 0x88 : 0x89)},
+                           reg_num (src), reg_mem (dst), wide, needs_rex_byte (src));
+            else
+                put_modrm (out, {static_cast<uint8_t> (byte ? 0x8A : 0x8B)},
+                           reg_num (dst), reg_mem (src), wide, needs_rex_byte (dst));
+            break;
+
+        case Opcode::MOVZX:
+            put_modrm (out, {0x0F, 0xB6}, reg_num (dst), reg_mem (src), wide);
+            break;
+
+        case Opcode::LEA:
+        {
+            RegMem rm {false};
+            if (src.is_mem ())
+                rm.addr = {src.reg, Reg::NONE, 1, src.value};
+            else if (inst.ops[2].is_imm ())
+                rm.addr = {static_cast<Reg> (reg_num (src)), Reg::NONE, 1, inst.ops[2].value};
+            else
+                rm.addr = {static_cast<Reg> (reg_num (src)),
+                           static_cast<Reg> (reg_num (inst.ops[2])), inst.ops[2].scale, 0};
+            if (rm.addr.index == Reg::RSP)
+                throw GenError ("rsp cannot be an lea index");
+            put_modrm (out, {0x8D}, reg_num (dst), rm, wide);
+            break;
+        }
+
+        case Opcode::PUSH:
+        case Opcode::POP:
+            if (is_high (static_cast<Reg> (reg_num (dst))))
+                out.push_back (0x41);
+            out.push_back (static_cast<uint8_t> ((inst.op == Opcode::PUSH ? 0x50 : 0x58)
+                                                 + low3 (dst.reg)));
+            break;
+
+        case Opcode::ADD:
+        case Opcode::SUB:
+        case Opcode::AND:
+        case Opcode::OR:
+        case Opcode::CMP:
+        {
+            // Byte forms sit one below the 32-bit ones
+            AluCodes codes = alu_codes (inst.op);
+            uint8_t narrow = byte ? 1 : 0;
+            if (src.is_imm () && dst.is_reg (Reg::RAX) && !byte && !fits8 (src.value))
+            {
+                // eax has a form without ModRM
+                if (wide)
+                    out.push_back (0x48);
+                out.push_back (static_cast<uint8_t> (codes.rm_reg + 4));
+                put32 (out, src.value);
+            }
+            else if (src.is_imm ())
+            {
+                bool short_imm = byte || fits8 (src.value);
+                put_modrm (out, {static_cast<uint8_t> (byte ? 0x80 : short_imm ? 0x83 : 0x81)},
+                           codes.digit, reg_mem (dst), wide);
+                if (short_imm)
+                    out.push_back (static_cast<uint8_t> (src.value));
+                else
+                    put32 (out, src.value);
+            }
+            else if (src.is_reg ())
+                put_modrm (out, {static_cast<uint8_t> (codes.rm_reg - narrow)},
+                           reg_num (src), reg_mem (dst), wide,
+                           needs_rex_byte (src));
+            else
+                put_modrm (out, {static_cast<uint8_t> (codes.reg_rm - narrow)},
+                           reg_num (dst), reg_mem (src), wide,
+                           needs_rex_byte (dst));
+            break;
+        }
+
+        case Opcode::TEST:
+            put_modrm (out, {static_cast<uint8_t> (byte ? 0x84 : 0x85)}, reg_num (src),
+                       reg_mem (dst), wide, needs_rex_byte (src));
+            break;
+
+        case Opcode::IMUL:
+            put_modrm (out, {0x0F, 0xAF}, reg_num (dst), reg_mem (src), wide);
+            break;
+
+        case Opcode::IMUL_IMM:
+        {
+            int32_t factor = inst.ops[2].value;
+            put_modrm (out, {static_cast<uint8_t> (fits8 (factor) ? 0x6B : 0x69)},
+                       reg_num (dst), reg_mem (src), wide);
+            if (fits8 (factor))
+                out.push_back (static_cast<uint8_t> (factor));
+            else
+                put32 (out, factor);
+            break;
+        }
+
+        case Opcode::IMUL_WIDE:
+        case Opcode::IDIV:
+        case Opcode::NEG:
+        {
+            uint8_t digit = inst.op == Opcode::IMUL_WIDE ? 5 : inst.op == Opcode::IDIV ? 7 : 3;
+            put_modrm (out, {static_cast<uint8_t> (byte ? 0xF6 : 0xF7)}, digit,
+                       reg_mem (dst), wide);
+            break;
+        }
+
+        case Opcode::SHL:
+        case Opcode::SAR:
+        case Opcode::SHR:
+        {
+            uint8_t digit = inst.op == Opcode::SHL ? 4 : inst.op == Opcode::SAR ? 7 : 5;
+            // By one has its own opcode without the immediate
+            put_modrm (out, {static_cast<uint8_t> (src.value == 1 ? 0xD1 : 0xC1)}, digit,
+                       reg_mem (dst), wide);
+            if (src.value != 1)
+                out.push_back (static_cast<uint8_t> (src.value));
+            break;
+        }
+
+        case Opcode::CDQ:
+            out.push_back (0x99);
+            break;
+
+        case Opcode::SETE:
+        case Opcode::SETNE:
+        case Opcode::SETL:
+        case Opcode::SETG:
+            put_modrm (out, {0x0F, static_cast<uint8_t> (0x90 | condition_code (inst.op))},
+                       0, reg_mem (dst), false);
+            break;
+
+        case Opcode::RET:
+            out.push_back (0xC3);
+            break;
+
+        case Opcode::MOVD:
+            if (dst.is_xmm ())
+                put_sse (out, {0x0F, 0x6E}, xmm_num (dst), static_cast<Reg> (reg_num (src)));
+            else
+                put_sse (out, {0x0F, 0x7E}, xmm_num (src), static_cast<Reg> (reg_num (dst)));
+            break;
+
+        case Opcode::MOVDQA:
+        case Opcode::PADDD:
+        case Opcode::PSUBD:
+        {
+            uint8_t code = inst.op == Opcode::MOVDQA ? 0x6F
+                         : inst.op == Opcode::PADDD ? 0xFE : 0xFA;
+            put_sse (out, {0x0F, code}, xmm_num (dst), static_cast<Reg> (xmm_num (src)));
+            break;
+        }
+
+        case Opcode::PMULLD:
+            put_sse (out, {0x0F, 0x38, 0x40}, xmm_num (dst), static_cast<Reg> (xmm_num (src)));
+            break;
+
+        case Opcode::PSHUFD:
+            put_sse (out, {0x0F, 0x70}, xmm_num (dst), static_cast<Reg> (xmm_num (src)));
+            out.push_back (static_cast<uint8_t> (inst.ops[2].value));
+            break;
+
+        case Opcode::PINSRD:
+            put_sse (out, {0x0F, 0x3A, 0x22}, xmm_num (dst), static_cast<Reg> (reg_num (src)));
+            out.push_back (static_cast<uint8_t> (inst.ops[2].value));
+            break;
+
+        default:
+            throw GenError ("Instruction cannot be encoded");
+    }
+}
+
+/**
+ * One instruction placed in the text section
+ */
+struct Item
+{
+    Opcode op;
+    uint32_t start = 0;             // Fixed bytes, in the encoded buffer
+    uint32_t size = 0;
+    uint32_t target = 0;            // Jumps, tables, entries: item of the label,
+                                    // calls: symbol
+    uint32_t table = 0;             // Entries: item of their table's label
+    bool long_form = false;
+    bool local = false;             // Tail calls: target is the callee's first item
+};
+
+/**
+ * Jumps whose displacement is chosen by size: jumps to labels, and tail
+ * calls within the program
+ */
+bool is_relaxed (const Item& item)
+{
+    return is_jump (item.op) || item.local;
+}
+
+} // namespace
+
+MachineCode encode (const MProgram& prog)
+{
+    std::vector<uint8_t> fixed;
+    std::vector<Item> items;
+    std::vector<uint32_t> function_items;
+    std::unordered_map<int32_t, uint32_t> label_items;
+
+    for (const auto& func : prog.functions)
+    {
+        function_items.push_back (static_cast<uint32_t> (items.size ()));
+        for (const auto& inst : func.code)
+        {
+            Item item {inst.op};
+            if (inst.op == Opcode::LABEL)
+                label_items[inst.ops[0].value] = static_cast<uint32_t> (items.size ());
+            else if (is_jump (inst.op))
+            {
+                item.size = 2;
+                item.target = static_cast<uint32_t> (inst.ops[0].value);
+            }
+            else if (inst.op == Opcode::CALL || inst.op == Opcode::TAIL_CALL)
+            {
+                item.size = 5;
+                item.target = static_cast<uint32_t> (inst.ops[0].value);
+            }
+            else if (inst.op == Opcode::CASE)
+            {
+                item.size = 4;
+                item.target = static_cast<uint32_t> (inst.ops[0].value);
+                item.table = static_cast<uint32_t> (inst.ops[1].value);
+            }
+            else if (inst.op == Opcode::JMP_TABLE)
+            {
+                item.start = static_cast<uint32_t> (fixed.size ());
+                encode_table_jump (inst, fixed);
+                item.size = static_cast<uint32_t> (fixed.size ()) - item.start;
+                item.target = static_cast<uint32_t> (inst.ops[1].value);
+            }
+            else
+            {
+                item.start = static_cast<uint32_t> (fixed.size ());
+                encode_inst (inst, fixed);
+                item.size = static_cast<uint32_t> (fixed.size ()) - item.start;
+            }
+            items.push_back (item);
+        }
+    }
+    function_items.push_back (static_cast<uint32_t> (items.size ()));
+
+    // Resolve label ids to items once
+    auto resolve = [&label_items] (uint32_t& id)
+    {
+        auto it = label_items.find (static_cast<int32_t> (id));
+        if (it == label_items.end ())
+            throw GenError ("Jump to an undefined label");
+        id = it->second;
+    };
+    std::unordered_map<std::string, uint32_t> function_index;
+    for (uint32_t f = 0; f < prog.functions.size (); ++f)
+        function_index[prog.functions[f].name] = f;
+
+    for (auto& item : items)
+    {
+        if (is_jump (item.op) || item.op == Opcode::JMP_TABLE || item.op == Opcode::CASE)
+            resolve (item.target);
+        if (item.op == Opcode::CASE)
+            resolve (item.table);
+
+        // Like the assembler, tail calls to functions in this program are
+        // jumps that start short and grow like any other
+        if (item.op == Opcode::TAIL_CALL)
+        {
+            auto it = function_index.find (prog.symbols[item.target]);
+            if (it != function_index.end ())
+            {
+                item.local = true;
+                item.size = 2;
+                item.target = function_items[it->second];
+            }
+        }
+    }
+
+    // Grow jumps that do not reach until none change. Jumps only grow, so
+    // this ends.
+    std::vector<uint32_t> offsets (items.size () + 1);
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t i = 0; i < items.size (); ++i)
+            offsets[i + 1] = offsets[i] + items[i].size;
+
+        for (size_t i = 0; i < items.size (); ++i)
+        {
+            Item& item = items[i];
+            if (!is_relaxed (item) || item.long_form)
+                continue;
+            int64_t disp = int64_t {offsets[item.target]} - (offsets[i] + 2);
+            if (disp < -128 || disp > 127)
+            {
+                item.long_form = true;
+                item.size = item.op == Opcode::JMP || item.local ? 5 : 6;
+                changed = true;
+            }
+        }
+    }
+
+    MachineCode code;
+    code.text.reserve (offsets.back ());
+    for (uint32_t f = 0; f < prog.functions.size (); ++f)
+    {
+        uint32_t begin = offsets[function_items[f]];
+        code.functions.push_back ({prog.functions[f].name, begin,
+                                   offsets[function_items[f + 1]] - begin});
+    }
+
+    std::vector<uint8_t>& text = code.text;
+    for (size_t i = 0; i < items.size (); ++i)
+    {
+        const Item& item = items[i];
+        uint32_t end = offsets[i] + item.size;
+
+        if (is_relaxed (item))
+        {
+            int32_t disp = static_cast<int32_t> (offsets[item.target]) - static_cast<int32_t> (end);
+            bool jmp = item.op == Opcode::JMP || item.local;
+            uint8_t cc = jmp ? 0 : condition_code (item.op);
+            if (!item.long_form)
+            {
+                text.push_back (jmp ? 0xEB : static_cast<uint8_t> (0x70 | cc));
+                text.push_back (static_cast<uint8_t> (disp));
+            }
+            else
+            {
+                if (jmp)
+                    text.push_back (0xE9);
+                else
+                {
+                    text.push_back (0x0F);
+                    text.push_back (static_cast<uint8_t> (0x80 | cc));
+                }
+                put32 (text, disp);
+            }
+        }
+        else if (item.op == Opcode::CALL || item.op == Opcode::TAIL_CALL)
+        {
+            text.push_back (item.op == Opcode::CALL ? 0xE8 : 0xE9);
+            auto it = function_index.find (prog.symbols[item.target]);
+            if (it != function_index.end ())
+                put32 (text, static_cast<int32_t> (code.functions[it->second].offset)
+                             - static_cast<int32_t> (end));
+            else
+            {
+                code.relocations.push_back ({offsets[i] + 1, item.target, -4});
+                put32 (text, 0);
+            }
+        }
+        else if (item.op == Opcode::CASE)
+            put32 (text, static_cast<int32_t> (offsets[item.target] - offsets[item.table]));
+        else
+        {
+            size_t at = text.size ();
+            text.insert (text.end (), fixed.begin () + item.start,
+                         fixed.begin () + item.start + item.size);
+
+            // rip-relative from the end of the lea
+            if (item.op == Opcode::JMP_TABLE)
+            {
+                std::vector<uint8_t> disp;
+                put32 (disp, static_cast<int32_t> (offsets[item.target])
+                             - static_cast<int32_t> (offsets[i] + TABLE_DISP_AT + 4));
+                std::copy (disp.begin (), disp.end (), text.begin () + static_cast<std::ptrdiff_t> (at + TABLE_DISP_AT));
+            }
+        }
+    }
+
+    return code;
+}
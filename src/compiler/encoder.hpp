@@ -0,0 +1,49 @@
+/**
+ * @file encoder.hpp
+ * @brief x86-64 machine code for allocated MIR (used with -c).
+ *
+ * Covers exactly the instruction forms codegen, the register allocator,
+ * frame lowering and peephole produce. Jumps, tail calls within the
+ * program included, start out in their 2-byte form and grow to rel32 only
+ * when the target is out of range. Calls to functions in the program are
+ * resolved here; calls to anything else are left as relocations. Jump
+ * tables hold offsets from their own start, so they need none.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "mir.hpp"
+
+/**
+ * rel32 call target outside the program: R_X86_64_PLT32 at offset
+ */
+struct Relocation
+{
+    uint32_t offset;
+    uint32_t symbol;                // MProgram::symbols index
+    int32_t addend;
+};
+
+struct FunctionCode
+{
+    std::string name;
+    uint32_t offset;                // Into MachineCode::text
+    uint32_t size;
+};
+
+struct MachineCode
+{
+    std::vector<uint8_t> text;
+    std::vector<FunctionCode> functions;
+    std::vector<Relocation> relocations;
+};
+
+/**
+ * Encode every function into one text section
+ * Throws GenError on an operand form with no encoding here (virtual
+ * registers and frame slots must be gone).
+ */
+MachineCode encode (const MProgram& prog);
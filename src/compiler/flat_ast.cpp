@@ -0,0 +1,436 @@
+/**
+ * @file flat_ast.cpp
+ * @brief Conversion between pointer and flat ASTs, flat folding pass
+ */
+
+#include "flat_ast.hpp"
+#include "optimizer.hpp"
+#include <unordered_map>
+
+/********** FLATTEN **********/
+namespace
+{
+
+class Flattener
+{
+public:
+    FlatProgram flat;
+
+    explicit Flattener (const Program& program)
+    {
+        for (const auto& func : program.functions)
+        {
+            uint32_t first_param = static_cast<uint32_t> (flat.params.size ());
+            for (const auto& param : func.params)
+                flat.params.push_back (intern (param.name));
+
+            NodeId body = add_block (func.body);
+            flat.functions.push_back ({intern (func.name), first_param,
+                                       static_cast<uint32_t> (func.params.size ()),
+                                       body});
+        }
+    }
+
+private:
+    std::unordered_map<std::string, uint32_t> name_ids_;
+
+    uint32_t intern (const std::string& name)
+    {
+        auto [it, inserted] = name_ids_.try_emplace (
+            name, static_cast<uint32_t> (flat.names.size ()));
+        if (inserted)
+            flat.names.push_back (name);
+        return it->second;
+    }
+
+    NodeId push_expr (ExprKind kind, uint8_t op, int32_t value,
+                      NodeId lhs, NodeId rhs)
+    {
+        FlatExprs& e = flat.exprs;
+        e.kind.push_back (kind);
+        e.op.push_back (op);
+        e.value.push_back (value);
+        e.lhs.push_back (lhs);
+        e.rhs.push_back (rhs);
+        return static_cast<NodeId> (e.size () - 1);
+    }
+
+    NodeId push_stmt (StmtKind kind, uint32_t name, NodeId expr, NodeId block)
+    {
+        FlatStmts& s = flat.stmts;
+        s.kind.push_back (kind);
+        s.name.push_back (name);
+        s.expr.push_back (expr);
+        s.block.push_back (block);
+        return static_cast<NodeId> (s.size () - 1);
+    }
+
+    // Children are appended before their parent (post-order)
+    NodeId add_expr (const Expr& expr)
+    {
+        return std::visit ([this] (const auto& node) -> NodeId
+        {
+            using T = std::decay_t<decltype (node)>;
+
+            if constexpr (std::is_same_v<T, IntLiteral>)
+                return push_expr (ExprKind::INT_LITERAL, 0, node.value,
+                                  NO_NODE, NO_NODE);
+
+            else if constexpr (std::is_same_v<T, Identifier>)
+                return push_expr (ExprKind::IDENTIFIER, 0,
+                                  static_cast<int32_t> (intern (node.name)),
+                                  NO_NODE, NO_NODE);
+
+            else if constexpr (std::is_same_v<T, UnaryOp>)
+            {
+                NodeId operand = add_expr (*node.operand);
+                return push_expr (ExprKind::UNARY,
+                                  static_cast<uint8_t> (node.op), 0,
+                                  operand, NO_NODE);
+            }
+
+            else if constexpr (std::is_same_v<T, BinaryOp>)
+            {
+                NodeId left  = add_expr (*node.left);
+                NodeId right = add_expr (*node.right);
+                return push_expr (ExprKind::BINARY,
+                                  static_cast<uint8_t> (node.op), 0,
+                                  left, right);
+            }
+
+            else if constexpr (std::is_same_v<T, FuncCall>)
+            {
+                std::vector<NodeId> args;
+                args.reserve (node.args.size ());
+                for (const auto& arg : node.args)
+                    args.push_back (add_expr (*arg));
+
+                NodeId first = static_cast<NodeId> (flat.call_args.size ());
+                flat.call_args.insert (flat.call_args.end (),
+                                       args.begin (), args.end ());
+                return push_expr (ExprKind::CALL, 0,
+                                  static_cast<int32_t> (intern (node.name)),
+                                  first, static_cast<NodeId> (args.size ()));
+            }
+        }, expr.node);
+    }
+
+    NodeId add_stmt (const Stmt& stmt)
+    {
+        return std::visit ([this] (const auto& node) -> NodeId
+        {
+            using T = std::decay_t<decltype (node)>;
+
+            if constexpr (std::is_same_v<T, VarDecl>)
+            {
+                NodeId init = node.init.has_value ()
+                            ? add_expr (*node.init.value ()) : NO_NODE;
+                return push_stmt (StmtKind::VAR_DECL, intern (node.name),
+                                  init, NO_NODE);
+            }
+            else if constexpr (std::is_same_v<T, Assignment>)
+            {
+                NodeId value = add_expr (*node.value);
+                return push_stmt (StmtKind::ASSIGNMENT, intern (node.name),
+                                  value, NO_NODE);
+            }
+            else if constexpr (std::is_same_v<T, ReturnStmt>)
+                return push_stmt (StmtKind::RETURN, 0,
+                                  add_expr (*node.value), NO_NODE);
+
+            else if constexpr (std::is_same_v<T, ExprStmt>)
+                return push_stmt (StmtKind::EXPR, 0,
+                                  add_expr (*node.expression), NO_NODE);
+
+            else if constexpr (std::is_same_v<T, IfStmt>)
+            {
+                NodeId cond = add_expr (*node.condition);
+                return push_stmt (StmtKind::IF, 0, cond,
+                                  add_block (*node.then_block));
+            }
+            else if constexpr (std::is_same_v<T, WhileStmt>)
+            {
+                NodeId cond = add_expr (*node.condition);
+                return push_stmt (StmtKind::WHILE, 0, cond,
+                                  add_block (*node.body));
+            }
+            else if constexpr (std::is_same_v<T, SwitchStmt>)
+            {
+                NodeId value = add_expr (*node.value);
+                std::vector<NodeId> ids;
+                for (const auto& c : node.cases)
+                {
+                    NodeId body = add_block (*c.body);
+                    uint32_t first = static_cast<uint32_t> (flat.case_values.size ());
+                    flat.case_values.insert (flat.case_values.end (),
+                                             c.values.begin (), c.values.end ());
+                    ids.push_back (push_stmt (StmtKind::CASE, first,
+                                              static_cast<NodeId> (c.values.size ()), body));
+                }
+                if (node.default_body)
+                    ids.push_back (push_stmt (StmtKind::DEFAULT, 0, NO_NODE,
+                                              add_block (*node.default_body)));
+                return push_stmt (StmtKind::SWITCH, 0, value, push_block (ids));
+            }
+            else if constexpr (std::is_same_v<T, Block>)
+                return push_stmt (StmtKind::BLOCK, 0, NO_NODE,
+                                  add_block (node));
+        }, stmt.node);
+    }
+
+    NodeId add_block (const Block& block)
+    {
+        // Nested blocks append their own ids first, so collect then copy
+        std::vector<NodeId> ids;
+        ids.reserve (block.statements.size ());
+        for (const auto& stmt : block.statements)
+            ids.push_back (add_stmt (stmt));
+
+        return push_block (ids);
+    }
+
+    NodeId push_block (const std::vector<NodeId>& ids)
+    {
+        uint32_t first = static_cast<uint32_t> (flat.block_stmts.size ());
+        flat.block_stmts.insert (flat.block_stmts.end (),
+                                 ids.begin (), ids.end ());
+        flat.blocks.push_back ({first, static_cast<uint32_t> (ids.size ())});
+        return static_cast<NodeId> (flat.blocks.size () - 1);
+    }
+};
+
+/********** UNFLATTEN **********/
+class Unflattener
+{
+public:
+    Program program;
+
+    explicit Unflattener (const FlatProgram& flat)
+        : flat_ (flat)
+    {
+        for (const auto& func : flat.functions)
+        {
+            std::vector<Param> params;
+            for (uint32_t i = 0; i < func.param_count; ++i)
+                params.push_back (Param {flat.names[flat.params[func.first_param + i]]});
+
+            program.functions.push_back (
+                Function {flat.names[func.name], std::move (params),
+                          get_block (func.body)});
+        }
+    }
+
+private:
+    const FlatProgram& flat_;
+
+    Expr* get_expr (NodeId id)
+    {
+        const FlatExprs& e = flat_.exprs;
+        Arena& arena = program.arena;
+
+        switch (e.kind[id])
+        {
+            case ExprKind::INT_LITERAL:
+                return arena.make<Expr> (IntLiteral {e.value[id]});
+
+            case ExprKind::IDENTIFIER:
+                return arena.make<Expr> (Identifier {flat_.names[e.value[id]]});
+
+            case ExprKind::UNARY:
+                return arena.make<Expr> (UnaryOp {
+                    static_cast<UnaryOp::Op> (e.op[id]), get_expr (e.lhs[id])});
+
+            case ExprKind::BINARY:
+            {
+                Expr* left  = get_expr (e.lhs[id]);
+                Expr* right = get_expr (e.rhs[id]);
+                return arena.make<Expr> (BinaryOp {
+                    static_cast<BinaryOp::Op> (e.op[id]), left, right});
+            }
+
+            case ExprKind::CALL:
+            {
+                std::vector<Expr*> args;
+                for (NodeId i = 0; i < e.rhs[id]; ++i)
+                    args.push_back (get_expr (flat_.call_args[e.lhs[id] + i]));
+                return arena.make<Expr> (FuncCall {flat_.names[e.value[id]],
+                                                   std::move (args)});
+            }
+        }
+        return nullptr;
+    }
+
+    Stmt get_stmt (NodeId id)
+    {
+        const FlatStmts& s = flat_.stmts;
+        NodeId expr = s.expr[id];
+
+        switch (s.kind[id])
+        {
+            case StmtKind::VAR_DECL:
+            {
+                std::optional<Expr*> init;
+                if (expr != NO_NODE)
+                    init = get_expr (expr);
+                return Stmt {VarDecl {flat_.names[s.name[id]], init}};
+            }
+            case StmtKind::ASSIGNMENT:
+                return Stmt {Assignment {flat_.names[s.name[id]],
+                                         get_expr (expr)}};
+            case StmtKind::RETURN:
+                return Stmt {ReturnStmt {get_expr (expr)}};
+            case StmtKind::EXPR:
+                return Stmt {ExprStmt {get_expr (expr)}};
+            case StmtKind::IF:
+            {
+                Expr* cond = get_expr (expr);
+                return Stmt {IfStmt {cond, program.arena.make<Block> (
+                                               get_block (s.block[id]))}};
+            }
+            case StmtKind::WHILE:
+            {
+                Expr* cond = get_expr (expr);
+                return Stmt {WhileStmt {cond, program.arena.make<Block> (
+                                                  get_block (s.block[id]))}};
+            }
+            case StmtKind::SWITCH:
+            {
+                SwitchStmt node {get_expr (expr), {}, nullptr};
+                const FlatBlock& b = flat_.blocks[s.block[id]];
+                for (uint32_t i = 0; i < b.count; ++i)
+                {
+                    NodeId c = flat_.block_stmts[b.first + i];
+                    Block* body = program.arena.make<Block> (get_block (s.block[c]));
+                    if (s.kind[c] == StmtKind::DEFAULT)
+                    {
+                        node.default_body = body;
+                        continue;
+                    }
+                    auto values = flat_.case_values.begin () + s.name[c];
+                    node.cases.push_back ({{values, values + s.expr[c]}, body});
+                }
+                return Stmt {std::move (node)};
+            }
+            case StmtKind::CASE:
+            case StmtKind::DEFAULT:
+            case StmtKind::BLOCK:
+                break;
+        }
+        return Stmt {get_block (s.block[id])};
+    }
+
+    Block get_block (NodeId id)
+    {
+        const FlatBlock& b = flat_.blocks[id];
+        Block block;
+        block.statements.reserve (b.count);
+        for (uint32_t i = 0; i < b.count; ++i)
+            block.statements.push_back (get_stmt (flat_.block_stmts[b.first + i]));
+        return block;
+    }
+};
+
+} // namespace
+
+FlatProgram flatten (const Program& program)
+{
+    return std::move (Flattener {program}.flat);
+}
+
+Program unflatten (const FlatProgram& flat)
+{
+    return std::move (Unflattener {flat}.program);
+}
+
+/********** FOLDING **********/
+namespace
+{
+
+/**
+ * Body block a switch with the given cases runs for value, NO_NODE if none
+ */
+NodeId switch_target (const FlatProgram& flat, NodeId cases, int32_t value)
+{
+    const FlatStmts& s = flat.stmts;
+    const FlatBlock& b = flat.blocks[cases];
+    NodeId fallback = NO_NODE;
+    for (uint32_t i = 0; i < b.count; ++i)
+    {
+        NodeId c = flat.block_stmts[b.first + i];
+        if (s.kind[c] == StmtKind::DEFAULT)
+        {
+            fallback = s.block[c];
+            continue;
+        }
+        for (uint32_t j = 0; j < s.expr[c]; ++j)
+            if (flat.case_values[s.name[c] + j] == value)
+                return s.block[c];
+    }
+    return fallback;
+}
+
+} // namespace
+
+void fold_constants (FlatProgram& flat)
+{
+    FlatExprs& e = flat.exprs;
+
+    // Operands precede their parents, so one forward sweep folds bottom-up
+    for (size_t i = 0; i < e.size (); ++i)
+    {
+        std::optional<int> val;
+
+        if (e.kind[i] == ExprKind::UNARY)
+        {
+            NodeId a = e.lhs[i];
+            if (e.kind[a] == ExprKind::INT_LITERAL)
+                val = fold_unary (static_cast<UnaryOp::Op> (e.op[i]),
+                                  e.value[a]);
+        }
+        else if (e.kind[i] == ExprKind::BINARY)
+        {
+            NodeId a = e.lhs[i], b = e.rhs[i];
+            if (e.kind[a] == ExprKind::INT_LITERAL
+                && e.kind[b] == ExprKind::INT_LITERAL)
+                val = fold_binary (static_cast<BinaryOp::Op> (e.op[i]),
+                                   e.value[a], e.value[b]);
+        }
+
+        if (val.has_value ())
+        {
+            e.kind[i]  = ExprKind::INT_LITERAL;
+            e.value[i] = val.value ();
+        }
+    }
+
+    // Dead branches: constant true becomes a plain block, false is dropped
+    FlatStmts& s = flat.stmts;
+    for (auto& block : flat.blocks)
+    {
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < block.count; ++i)
+        {
+            NodeId id = flat.block_stmts[block.first + i];
+
+            if (s.kind[id] == StmtKind::IF
+                && e.kind[s.expr[id]] == ExprKind::INT_LITERAL)
+            {
+                if (e.value[s.expr[id]] == 0)
+                    continue;
+                s.kind[id] = StmtKind::BLOCK;
+            }
+            else if (s.kind[id] == StmtKind::SWITCH
+                     && e.kind[s.expr[id]] == ExprKind::INT_LITERAL)
+            {
+                NodeId body = switch_target (flat, s.block[id], e.value[s.expr[id]]);
+                if (body == NO_NODE)
+                    continue;
+                s.kind[id] = StmtKind::BLOCK;
+                s.block[id] = body;
+            }
+
+            flat.block_stmts[block.first + kept++] = id;
+        }
+        block.count = kept;
+    }
+}
@@ -0,0 +1,132 @@
+/**
+ * @file flat_ast.hpp
+ * @brief Flat, index-based AST stored as struct-of-arrays.
+ *
+ * Nodes live in contiguous typed arrays and reference their children by
+ * 32-bit index instead of by pointer. Expressions are stored in post-order:
+ * every operand sits before its parent, so a forward sweep over the arrays
+ * visits children first without recursion.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ast.hpp"
+
+using NodeId = uint32_t;
+static constexpr NodeId NO_NODE = UINT32_MAX;
+
+enum class ExprKind : uint8_t
+{
+    INT_LITERAL,
+    IDENTIFIER,
+    UNARY,
+    BINARY,
+    CALL
+};
+
+enum class StmtKind : uint8_t
+{
+    VAR_DECL,
+    ASSIGNMENT,
+    RETURN,
+    IF,
+    WHILE,
+    SWITCH,
+    CASE,
+    DEFAULT,
+    BLOCK,
+    EXPR
+};
+
+/**
+ * Expression columns, one entry per node
+ *
+ * INT_LITERAL  value = literal
+ * IDENTIFIER   value = name index
+ * UNARY        op = UnaryOp::Op, lhs = operand
+ * BINARY       op = BinaryOp::Op, lhs/rhs = operands
+ * CALL         value = name index, lhs = first call_args slot, rhs = count
+ */
+struct FlatExprs
+{
+    std::vector<ExprKind> kind;
+    std::vector<uint8_t> op;
+    std::vector<int32_t> value;
+    std::vector<NodeId> lhs;
+    std::vector<NodeId> rhs;
+
+    size_t size () const { return kind.size (); }
+};
+
+/**
+ * Statement columns, one entry per statement
+ *
+ * VAR_DECL     name, expr = init (NO_NODE if none)
+ * ASSIGNMENT   name, expr = value
+ * RETURN       expr = value
+ * EXPR         expr = expression
+ * IF, WHILE    expr = condition, block = body
+ * SWITCH       expr = value, block = its CASE statements, then any DEFAULT
+ * CASE         name = first case_values slot, expr = count, block = body
+ * DEFAULT      block = body
+ * BLOCK        block = nested block
+ */
+struct FlatStmts
+{
+    std::vector<StmtKind> kind;
+    std::vector<uint32_t> name;
+    std::vector<NodeId> expr;
+    std::vector<NodeId> block;
+
+    size_t size () const { return kind.size (); }
+};
+
+/**
+ * Range of statement ids in FlatProgram::block_stmts
+ */
+struct FlatBlock
+{
+    uint32_t first;
+    uint32_t count;
+};
+
+struct FlatFunction
+{
+    uint32_t name;
+    uint32_t first_param;         // Range in FlatProgram::params
+    uint32_t param_count;
+    NodeId body;                  // Block index
+};
+
+struct FlatProgram
+{
+    FlatExprs exprs;
+    FlatStmts stmts;
+    std::vector<FlatBlock> blocks;
+    std::vector<NodeId> block_stmts;    // Statement ids, grouped per block
+    std::vector<NodeId> call_args;      // Argument expr ids, grouped per call
+    std::vector<int32_t> case_values;   // Label values, grouped per case
+    std::vector<uint32_t> params;       // Param name ids, grouped per function
+    std::vector<FlatFunction> functions;
+    std::vector<std::string> names;     // Interned identifiers
+};
+
+/**
+ * Convert a pointer tree into flat form
+ */
+FlatProgram flatten (const Program& program);
+
+/**
+ * Convert flat form back into a pointer tree (e.g. for Codegen)
+ */
+Program unflatten (const FlatProgram& flat);
+
+/**
+ * Flat counterpart of Optimizer::optimize: folds constant expressions in one
+ * linear sweep over the expression arrays, then removes dead if branches
+ * and resolves switches on constants
+ */
+void fold_constants (FlatProgram& flat);
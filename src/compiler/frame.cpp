@@ -0,0 +1,119 @@
+/**
+ * @file frame.cpp
+ * @brief Frame layout, prologue, epilogue and slot resolution
+ */
+
+#include "frame.hpp"
+
+/**
+ * System V lets leaf functions use the 128 bytes below rsp without moving it
+ */
+static constexpr int32_t RED_ZONE = 128;
+
+/**
+ * Frame shape, rbp-relative:
+ *
+ *   [rbp + 8]                      return address
+ *   [rbp]                          saved rbp
+ *   [rbp - 8 * saved]              callee-saved registers, in push order
+ *   [rbp - saved_bytes - 4(s+1)]   slot s, 4 bytes each
+ *   rsp = rbp - saved_bytes - reserve
+ *
+ * Without a frame pointer rsp stays right below the saved registers and
+ * slot s is [rsp - 4(s+1)], in the red zone.
+ */
+struct FrameLayout
+{
+    std::vector<Reg> saved;
+    int32_t saved_bytes = 0;
+    int32_t slot_bytes = 0;
+    int32_t reserve = 0;            // Amount for the single sub rsp
+    bool frame_pointer = true;
+
+    Operand slot (int32_t slot, Width width) const
+    {
+        if (!frame_pointer)
+            return Operand::make_mem (-4 * (slot + 1), width, Reg::RSP);
+        return Operand::make_mem (-(saved_bytes + 4 * (slot + 1)), width);
+    }
+};
+
+static FrameLayout layout_frame (const MFunction& func)
+{
+    FrameLayout frame;
+
+    RegMask written = 0;
+    bool makes_calls = false;
+    for (const auto& inst : func.code)
+    {
+        written |= inst_defs (inst);
+        makes_calls |= inst.op == Opcode::CALL;
+    }
+
+    // Callee-saved registers written anywhere in the body
+    for (Reg reg : CALLEE_SAVED_REGS)
+        if (written & reg_bit (reg))
+            frame.saved.push_back (reg);
+
+    frame.saved_bytes = 8 * static_cast<int32_t> (frame.saved.size ());
+    frame.slot_bytes = 4 * static_cast<int32_t> (func.frame_slots);
+
+    if (makes_calls)
+    {
+        // rsp is 16-byte aligned right after push rbp, keep it so at calls
+        int32_t total = frame.saved_bytes + frame.slot_bytes;
+        frame.reserve = frame.slot_bytes + (16 - total % 16) % 16;
+    }
+    else if (frame.slot_bytes > RED_ZONE)
+        frame.reserve = frame.slot_bytes;
+
+    // Calls need rsp aligned and leave the red zone to the callee; a tail
+    // call jumps only once this frame is gone
+    frame.frame_pointer = makes_calls || frame.reserve > 0;
+    return frame;
+}
+
+void lower_frame (MFunction& func)
+{
+    auto r64 = [] (Reg reg) { return Operand::make_reg (reg, Width::B64); };
+
+    FrameLayout frame = layout_frame (func);
+
+    std::vector<MInst> out;
+    out.reserve (func.code.size () + 2 * frame.saved.size () + 6);
+
+    if (frame.frame_pointer)
+    {
+        out.push_back (MInst {Opcode::PUSH, {r64 (Reg::RBP)}});
+        out.push_back (MInst {Opcode::MOV, {r64 (Reg::RBP), r64 (Reg::RSP)}});
+    }
+    for (Reg reg : frame.saved)
+        out.push_back (MInst {Opcode::PUSH, {r64 (reg)}});
+    if (frame.reserve > 0)
+        out.push_back (MInst {Opcode::SUB, {r64 (Reg::RSP),
+                                            Operand::make_imm (frame.reserve)}});
+
+    for (MInst inst : func.code)
+    {
+        for (auto& operand : inst.ops)
+            if (operand.is_frame ())
+                operand = frame.slot (operand.value, operand.width);
+
+        if (inst.op == Opcode::RET || inst.op == Opcode::TAIL_CALL)
+        {
+            if (frame.reserve > 0 && frame.saved.empty ())
+                out.push_back (MInst {Opcode::MOV, {r64 (Reg::RSP), r64 (Reg::RBP)}});
+            else if (frame.reserve > 0)
+                out.push_back (MInst {Opcode::LEA, {r64 (Reg::RSP),
+                    Operand::make_mem (-frame.saved_bytes, Width::B64)}});
+            for (size_t i = frame.saved.size (); i-- > 0;)
+                out.push_back (MInst {Opcode::POP, {r64 (frame.saved[i])}});
+            if (frame.frame_pointer)
+                out.push_back (MInst {Opcode::POP, {r64 (Reg::RBP)}});
+        }
+
+        out.push_back (inst);
+    }
+
+    func.code = std::move (out);
+}
@@ -0,0 +1,20 @@
+/**
+ * @file frame.hpp
+ * @brief Stack frame lowering for allocated machine IR.
+ */
+
+#pragma once
+
+#include "mir.hpp"
+
+/**
+ * Insert prologue and epilogue and resolve frame slots to [rbp - off]
+ *
+ * Only callee-saved registers the allocator actually used are pushed. Slots
+ * are packed at 4 bytes (every value is an int) and reserved with a single
+ * sub rsp, padded so rsp is 16-byte aligned at every call. Leaf functions
+ * whose slots fit in the red zone do not move rsp at all, and do without
+ * rbp: their slots are addressed from rsp. Tail calls leave through the
+ * same epilogue as returns.
+ */
+void lower_frame (MFunction& func);
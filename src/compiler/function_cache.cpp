@@ -0,0 +1,494 @@
+/**
+ * @file function_cache.cpp
+ * @brief Content hashes, the entry encoding and the index and data files
+ */
+
+#include "function_cache.hpp"
+#include <cstring>
+#include <filesystem>
+#include <type_traits>
+#include <sys/file.h>
+
+namespace
+{
+
+constexpr char INDEX_MAGIC[8] = {'B', 'I', 'T', 'C', 'I', 'D', 'X', '1'};
+constexpr char DATA_MAGIC[8] = {'B', 'I', 'T', 'C', 'D', 'A', 'T', '1'};
+
+struct IndexHeader
+{
+    char magic[8];
+    uint64_t stamp;                 // Of the compiler that wrote the files
+    uint64_t count;
+    uint64_t capacity;              // Slots, a power of two
+};
+
+struct Slot
+{
+    uint64_t key;                   // 0 = empty
+    uint64_t offset;                // In the data file
+    uint64_t size;
+};
+
+struct DataHeader
+{
+    char magic[8];
+    uint64_t stamp;
+};
+
+static_assert (std::is_trivially_copyable_v<MInst>, "entries copy MInsts as bytes");
+
+/**
+ * 64-bit words in, one well-mixed hash out
+ */
+class Hasher
+{
+public:
+    void add (uint64_t word)
+    {
+        state_ = (state_ ^ (word * 0xbf58476d1ce4e5b9ull)) * 0x94d049bb133111ebull;
+        state_ ^= state_ >> 31;
+    }
+
+    void add (std::string_view text)
+    {
+        add (text.size ());
+        size_t i = 0;
+        for (; i + 8 <= text.size (); i += 8)
+        {
+            uint64_t word;
+            std::memcpy (&word, text.data () + i, 8);
+            add (word);
+        }
+        uint64_t tail = 0;
+        std::memcpy (&tail, text.data () + i, text.size () - i);
+        add (tail);
+    }
+
+    /**
+     * Final avalanche (murmur3 fmix64), never 0 so it can key a slot
+     */
+    uint64_t get () const
+    {
+        uint64_t h = state_;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h == 0 ? 1 : h;
+    }
+
+private:
+    uint64_t state_ = 0x9e3779b97f4a7c15ull;
+};
+
+/**
+ * The compiler binary, by identity rather than content (like make)
+ */
+uint64_t compiler_stamp ()
+{
+    Hasher hasher;
+    struct stat st {};
+    if (stat ("/proc/self/exe", &st) == 0)
+    {
+        hasher.add (static_cast<uint64_t> (st.st_ino));
+        hasher.add (static_cast<uint64_t> (st.st_size));
+        hasher.add (static_cast<uint64_t> (st.st_mtim.tv_sec));
+        hasher.add (static_cast<uint64_t> (st.st_mtim.tv_nsec));
+    }
+    return hasher.get ();
+}
+
+/**
+ * Map path into buffer, false if it is missing
+ */
+bool map_file (const std::string& path, SourceBuffer& buffer)
+{
+    int fd = open (path.c_str (), O_RDONLY);
+    if (fd < 0)
+        return false;
+    bool ok = buffer.load (fd);
+    close (fd);
+    return ok;
+}
+
+/**
+ * Map the cache files, leaving both empty unless they are well-formed and
+ * written by this compiler
+ */
+void open_files (const std::string& dir, uint64_t stamp, SourceBuffer& index,
+                 SourceBuffer& data)
+{
+    index = {};
+    data = {};
+    if (!map_file (dir + "/index", index) || !map_file (dir + "/data", data))
+        return;
+
+    bool ok = index.size () >= sizeof (IndexHeader) && data.size () >= sizeof (DataHeader);
+    if (ok)
+    {
+        IndexHeader header;
+        std::memcpy (&header, index.view ().data (), sizeof (header));
+        DataHeader data_header;
+        std::memcpy (&data_header, data.view ().data (), sizeof (data_header));
+        ok = std::memcmp (header.magic, INDEX_MAGIC, 8) == 0 && header.stamp == stamp
+             && std::memcmp (data_header.magic, DATA_MAGIC, 8) == 0
+             && data_header.stamp == stamp
+             && header.capacity != 0 && (header.capacity & (header.capacity - 1)) == 0
+             && header.count < header.capacity
+             && index.size () == sizeof (IndexHeader) + header.capacity * sizeof (Slot);
+    }
+    if (!ok)
+    {
+        index = {};
+        data = {};
+    }
+}
+
+const IndexHeader& header_of (const SourceBuffer& index)
+{
+    return *reinterpret_cast<const IndexHeader*> (index.view ().data ());
+}
+
+const Slot* slots_of (const SourceBuffer& index)
+{
+    return reinterpret_cast<const Slot*> (index.view ().data () + sizeof (IndexHeader));
+}
+
+/**
+ * Slot holding key, or the empty one where it would go
+ * Returns nullptr if every slot holds another key (a damaged index)
+ */
+template <typename SlotT>
+SlotT* probe (SlotT* slots, uint64_t capacity, uint64_t key)
+{
+    uint64_t i = key & (capacity - 1);
+    for (uint64_t step = 0; step < capacity; ++step, i = (i + 1) & (capacity - 1))
+        if (slots[i].key == key || slots[i].key == 0)
+            return &slots[i];
+    return nullptr;
+}
+
+/********** Entry encoding **********/
+void put_u32 (std::string& out, uint32_t value)
+{
+    out.append (reinterpret_cast<const char*> (&value), sizeof (value));
+}
+
+void put_string (std::string& out, std::string_view text)
+{
+    put_u32 (out, static_cast<uint32_t> (text.size ()));
+    out += text;
+}
+
+/**
+ * Bounds-checked reads over an entry, every failure sets !ok
+ */
+struct Reader
+{
+    std::string_view bytes;
+    size_t pos = 0;
+    bool ok = true;
+
+    const char* take (size_t count)
+    {
+        if (!ok || bytes.size () - pos < count)
+        {
+            ok = false;
+            return nullptr;
+        }
+        pos += count;
+        return bytes.data () + pos - count;
+    }
+
+    uint32_t u32 ()
+    {
+        uint32_t value = 0;
+        if (const char* p = take (sizeof (value)))
+            std::memcpy (&value, p, sizeof (value));
+        return value;
+    }
+
+    std::string string ()
+    {
+        uint32_t size = u32 ();
+        const char* p = take (size);
+        return p ? std::string {p, size} : std::string {};
+    }
+};
+
+/**
+ * key, label_count, vreg_count, frame_slots, spills, param_count, name,
+ * symbols, code
+ */
+std::string encode (uint64_t key, const MFunction& func, uint32_t first_label,
+                    uint32_t label_count, const std::vector<std::string>& symbols)
+{
+    // Symbols are renumbered in order of first use
+    std::vector<uint32_t> local (symbols.size (), NO_VALUE);
+    std::vector<uint32_t> used;
+    std::vector<MInst> code = func.code;
+    for (auto& inst : code)
+    {
+        for (auto& op : inst.ops)
+        {
+            if (op.kind == OperandKind::LABEL)
+                op.value -= static_cast<int32_t> (first_label);
+            else if (op.kind == OperandKind::SYMBOL)
+            {
+                uint32_t& id = local[static_cast<uint32_t> (op.value)];
+                if (id == NO_VALUE)
+                {
+                    id = static_cast<uint32_t> (used.size ());
+                    used.push_back (static_cast<uint32_t> (op.value));
+                }
+                op.value = static_cast<int32_t> (id);
+            }
+        }
+    }
+
+    std::string out;
+    out.append (reinterpret_cast<const char*> (&key), sizeof (key));
+    put_u32 (out, label_count);
+    put_u32 (out, func.vreg_count);
+    put_u32 (out, func.frame_slots);
+    put_u32 (out, func.spills);
+    put_u32 (out, func.param_count);
+    put_string (out, func.name);
+    put_u32 (out, static_cast<uint32_t> (used.size ()));
+    for (uint32_t symbol : used)
+        put_string (out, symbols[symbol]);
+    put_u32 (out, static_cast<uint32_t> (code.size ()));
+    out.append (reinterpret_cast<const char*> (code.data ()), code.size () * sizeof (MInst));
+    return out;
+}
+
+std::optional<CachedFunction> decode (uint64_t key, std::string_view bytes)
+{
+    Reader in {bytes};
+    uint64_t stored_key = 0;
+    if (const char* p = in.take (sizeof (stored_key)))
+        std::memcpy (&stored_key, p, sizeof (stored_key));
+
+    CachedFunction entry;
+    entry.label_count = in.u32 ();
+    entry.func.vreg_count = in.u32 ();
+    entry.func.frame_slots = in.u32 ();
+    entry.func.spills = in.u32 ();
+    entry.func.param_count = in.u32 ();
+    entry.func.name = in.string ();
+    uint32_t symbol_count = in.u32 ();
+    for (uint32_t i = 0; i < symbol_count && in.ok; ++i)
+        entry.symbols.push_back (in.string ());
+
+    uint32_t inst_count = in.u32 ();
+    const char* code = in.take (static_cast<size_t> (inst_count) * sizeof (MInst));
+    if (!in.ok || stored_key != key || in.pos != bytes.size ())
+        return std::nullopt;
+    entry.func.code.resize (inst_count);
+    std::memcpy (entry.func.code.data (), code, inst_count * sizeof (MInst));
+    return entry;
+}
+
+/**
+ * Write bytes to path.tmp, then rename it over path
+ */
+bool replace_file (const std::string& path, const std::string& bytes)
+{
+    std::string tmp = path + ".tmp";
+    int fd = open (tmp.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    bool ok = write (fd, bytes.data (), bytes.size ()) == static_cast<ssize_t> (bytes.size ());
+    ok = close (fd) == 0 && ok;
+    return ok && rename (tmp.c_str (), path.c_str ()) == 0;
+}
+
+} // namespace
+
+uint64_t hash_tokens (std::span<const Token> tokens)
+{
+    Hasher hasher;
+    for (const Token& token : tokens)
+    {
+        hasher.add (static_cast<uint64_t> (token.type));
+        if (token.type == TokenType::IDENTIFIER || token.type == TokenType::INT_LITERAL)
+            hasher.add (token.lexeme);
+    }
+    return hasher.get ();
+}
+
+uint64_t hash_function (const SsaFunction& func, const std::vector<std::string>& symbols)
+{
+    Hasher hasher;
+    hasher.add (func.name);
+    hasher.add (func.param_count);
+    hasher.add (func.insts.size ());
+    for (const auto& inst : func.insts)
+    {
+        hasher.add (static_cast<uint64_t> (inst.op) | uint64_t {inst.block} << 8);
+        if (inst.op == SsaOp::CALL)
+            hasher.add (symbols[static_cast<uint32_t> (inst.imm)]);
+        else
+            hasher.add (static_cast<uint64_t> (static_cast<uint32_t> (inst.imm)));
+        hasher.add (inst.args.size ());
+        for (uint32_t arg : inst.args)
+            hasher.add (arg);
+    }
+
+    hasher.add (func.blocks.size ());
+    for (const auto& block : func.blocks)
+    {
+        hasher.add (static_cast<uint64_t> (block.exit) | uint64_t {block.value} << 8);
+        hasher.add (block.succs[0] | uint64_t {block.succs[1]} << 32);
+        hasher.add (block.cases.size ());
+        for (size_t i = 0; i < block.cases.size (); ++i)
+            hasher.add (block.succs[i + 1] | uint64_t {static_cast<uint32_t> (block.cases[i])} << 32);
+        hasher.add (block.insts.size ());
+        for (uint32_t inst : block.insts)
+            hasher.add (inst);
+        hasher.add (block.preds.size ());
+        for (uint32_t pred : block.preds)
+            hasher.add (pred);
+    }
+    return hasher.get ();
+}
+
+uint64_t function_key (uint64_t content, bool optimize, const LoopOptions& loops)
+{
+    Hasher hasher;
+    hasher.add (content);
+    hasher.add (optimize);
+    if (optimize)
+    {
+        hasher.add (loops.hoist | uint64_t {loops.strength_reduce} << 1
+                    | uint64_t {loops.vectorize} << 2);
+        hasher.add (loops.unroll_factor | uint64_t {loops.unroll_max_insts} << 32);
+    }
+    return hasher.get ();
+}
+
+FunctionCache::FunctionCache (const std::string& dir)
+    : dir_ (dir.empty () || dir[0] == '/' ? dir : get_full_path (dir)),
+      stamp_ (compiler_stamp ())
+{
+    std::error_code error;
+    std::filesystem::create_directories (dir_, error);
+    open_files (dir_, stamp_, index_, data_);
+}
+
+std::optional<CachedFunction> FunctionCache::find (uint64_t key) const
+{
+    if (index_.size () > 0)
+    {
+        const Slot* slot = probe (slots_of (index_), header_of (index_).capacity, key);
+        if (slot && slot->key == key && slot->offset <= data_.size ()
+            && slot->size <= data_.size () - slot->offset)
+            return decode (key, data_.view ().substr (slot->offset, slot->size));
+    }
+
+    std::lock_guard lock {mutex_};
+    auto it = pending_.find (key);
+    if (it == pending_.end ())
+        return std::nullopt;
+    return decode (key, it->second);
+}
+
+void FunctionCache::insert (uint64_t key, const MFunction& func, uint32_t first_label,
+                            uint32_t label_count, const std::vector<std::string>& symbols)
+{
+    std::string entry = encode (key, func, first_label, label_count, symbols);
+    std::lock_guard lock {mutex_};
+    pending_.try_emplace (key, std::move (entry));
+}
+
+bool FunctionCache::save ()
+{
+    std::lock_guard lock {mutex_};
+    if (pending_.empty ())
+        return true;
+
+    // One writer at a time, across processes too
+    int lock_fd = open ((dir_ + "/lock").c_str (), O_RDWR | O_CREAT, 0644);
+    if (lock_fd < 0)
+        return false;
+    flock (lock_fd, LOCK_EX);
+
+    // Start from the files as they are now, someone may have saved since
+    SourceBuffer index, data;
+    open_files (dir_, stamp_, index, data);
+    std::vector<Slot> slots;
+    if (index.size () > 0)
+    {
+        const Slot* old = slots_of (index);
+        for (uint64_t i = 0; i < header_of (index).capacity; ++i)
+            if (old[i].key != 0)
+                slots.push_back (old[i]);
+    }
+
+    // New entries go after the existing ones, or after a fresh header
+    std::string appended;
+    uint64_t base = data.size ();
+    if (base == 0)
+    {
+        DataHeader header {};
+        std::memcpy (header.magic, DATA_MAGIC, 8);
+        header.stamp = stamp_;
+        appended.append (reinterpret_cast<const char*> (&header), sizeof (header));
+    }
+    for (const auto& [key, entry] : pending_)
+    {
+        const Slot* old = index.size () > 0
+                        ? probe (slots_of (index), header_of (index).capacity, key) : nullptr;
+        if (old && old->key == key)
+            continue;
+        slots.push_back ({key, base + appended.size (), entry.size ()});
+        appended += entry;
+    }
+
+    // The data file only grows; a fresh one replaces a stale one whole
+    bool ok;
+    if (base > 0)
+    {
+        int fd = open ((dir_ + "/data").c_str (), O_WRONLY | O_APPEND);
+        ok = fd >= 0 && write (fd, appended.data (), appended.size ())
+                        == static_cast<ssize_t> (appended.size ());
+        ok = fd >= 0 && close (fd) == 0 && ok;
+    }
+    else
+        ok = replace_file (dir_ + "/data", appended);
+
+    // Half full at most, so probes stay short
+    uint64_t capacity = 1024;
+    while (capacity < slots.size () * 2)
+        capacity *= 2;
+    std::string bytes (sizeof (IndexHeader) + capacity * sizeof (Slot), '\0');
+    IndexHeader header {};
+    std::memcpy (header.magic, INDEX_MAGIC, 8);
+    header.stamp = stamp_;
+    header.count = slots.size ();
+    header.capacity = capacity;
+    std::memcpy (bytes.data (), &header, sizeof (header));
+    Slot* table = reinterpret_cast<Slot*> (bytes.data () + sizeof (IndexHeader));
+    // At most half full, so every key finds its slot
+    for (const Slot& slot : slots)
+        *probe (table, capacity, slot.key) = slot;
+    ok = ok && replace_file (dir_ + "/index", bytes);
+
+    flock (lock_fd, LOCK_UN);
+    close (lock_fd);
+    if (!ok)
+        return false;
+
+    pending_.clear ();
+    open_files (dir_, stamp_, index_, data_);
+    return true;
+}
+
+size_t FunctionCache::size () const
+{
+    std::lock_guard lock {mutex_};
+    size_t count = index_.size () > 0 ? header_of (index_).count : 0;
+    return count + pending_.size ();
+}
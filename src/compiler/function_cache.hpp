@@ -0,0 +1,119 @@
+/**
+ * @file function_cache.hpp
+ * @brief On-disk cache of generated functions, keyed by content (--cache-dir).
+ *
+ * A function's key hashes what its machine code is a function of, plus the
+ * flags. Without -O that is its own tokens: functions are generated
+ * independently, so an unchanged one is reused without building its SSA.
+ * With -O, inlining and argument propagation make a function's code depend
+ * on its callers and callees, so the key is taken after the
+ * interprocedural passes, from the function's SSA; a hit then skips the
+ * per-function passes, lowering and register allocation.
+ *
+ * Entries hold MIR after register allocation and frame lowering (peephole
+ * still runs on every function), with label ids relative to the function
+ * and call targets by name, so an entry fits into any program.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "file_utils.hpp"
+#include "loop_opt.hpp"
+#include "mir.hpp"
+#include "ssa.hpp"
+#include "token.hpp"
+
+/**
+ * A function as stored: labels numbered from 0, SYMBOL operands index
+ * symbols
+ */
+struct CachedFunction
+{
+    MFunction func;
+    uint32_t label_count = 0;
+    std::vector<std::string> symbols;
+};
+
+/**
+ * Content hash of a token range (types and lexemes, not positions)
+ */
+uint64_t hash_tokens (std::span<const Token> tokens);
+
+/**
+ * Content hash of an SSA function, with call targets by name
+ */
+uint64_t hash_function (const SsaFunction& func, const std::vector<std::string>& symbols);
+
+/**
+ * Cache key of a function from its content hash and the flags
+ */
+uint64_t function_key (uint64_t content, bool optimize, const LoopOptions& loops);
+
+/**
+ * Cache directory: an index and a data file
+ *
+ * The index is an open-addressing hash table of (key, offset, size) slots
+ * that is memory mapped and probed in place, so opening the cache reads
+ * nothing and a lookup touches one or two slots however many entries there
+ * are. The data file holds the entries back to back and only ever grows.
+ *
+ * Both files carry a stamp of the compiler binary; a cache written by a
+ * different build is ignored and replaced on the next save. find and insert
+ * are safe from any number of threads (new entries wait in memory until
+ * save); save must not overlap them.
+ */
+class FunctionCache
+{
+public:
+    /**
+     * Open the cache in dir (relative paths are under the project root),
+     * which is created if needed
+     */
+    explicit FunctionCache (const std::string& dir);
+
+    FunctionCache (const FunctionCache&) = delete;
+    FunctionCache& operator = (const FunctionCache&) = delete;
+
+    /**
+     * The entry stored under key, from disk or this run
+     */
+    std::optional<CachedFunction> find (uint64_t key) const;
+
+    /**
+     * Store func, which uses labels [first_label, first_label + label_count)
+     * and calls through symbols
+     */
+    void insert (uint64_t key, const MFunction& func, uint32_t first_label,
+                 uint32_t label_count, const std::vector<std::string>& symbols);
+
+    /**
+     * Add this run's entries to the files
+     *
+     * Entries saved by other processes since this one opened the cache are
+     * kept: both files are re-read under a lock, the data file is
+     * appended to and the index is rewritten and renamed into place.
+     * Returns false if the files could not be written.
+     */
+    bool save ();
+
+    /**
+     * Entries on disk when opened plus the ones inserted since
+     */
+    size_t size () const;
+
+private:
+    std::string dir_;
+    uint64_t stamp_;                // Of this compiler binary
+    SourceBuffer index_ {};         // Mapped, empty if missing or stale
+    SourceBuffer data_ {};
+
+    mutable std::mutex mutex_ {};
+    std::unordered_map<uint64_t, std::string> pending_ {};      // Encoded, not saved yet
+};
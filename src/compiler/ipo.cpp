@@ -0,0 +1,566 @@
+/**
+ * @file ipo.cpp
+ * @brief Call graph, tail recursion, argument propagation, inlining
+ */
+
+#include "ipo.hpp"
+#include "ssa_opt.hpp"
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+
+namespace
+{
+
+/**
+ * Copy callee into caller in place of the call at insts[index] of block,
+ * splitting the block after the call
+ */
+void inline_call (SsaFunction& caller, const SsaFunction& callee, uint32_t block,
+                  size_t index)
+{
+    uint32_t call = caller.blocks[block].insts[index];
+    std::vector<uint32_t> args = caller.insts[call].args;
+    uint32_t count = static_cast<uint32_t> (callee.blocks.size ());
+    uint32_t first = block + 1;         // Callee entry
+    uint32_t rest = first + count;      // Code after the call
+
+    // Make room right after the call's block, so the layout stays in order
+    auto shift = [block, count] (uint32_t& b)
+    {
+        if (b > block)
+            b += count + 1;
+    };
+    for (auto& b : caller.blocks)
+    {
+        for (auto& pred : b.preds)
+            shift (pred);
+        for (uint32_t i = 0; i < succ_count (b); ++i)
+            shift (b.succs[i]);
+    }
+    for (auto& inst : caller.insts)
+        if (inst.op != SsaOp::NOP)
+            shift (inst.block);
+    caller.blocks.insert (caller.blocks.begin () + first, count + 1, SsaBlock {});
+
+    // Everything after the call moves to rest, along with the exit
+    SsaBlock& head = caller.blocks[block];
+    SsaBlock& tail = caller.blocks[rest];
+    tail.insts.assign (head.insts.begin () + static_cast<std::ptrdiff_t> (index) + 1,
+                       head.insts.end ());
+    head.insts.resize (index);
+    for (uint32_t v : tail.insts)
+        caller.insts[v].block = rest;
+
+    tail.exit = head.exit;
+    tail.value = head.value;
+    tail.succs = head.succs;
+    tail.cases = head.cases;
+    for (uint32_t i = 0; i < succ_count (head); ++i)
+        for (auto& pred : caller.blocks[head.succs[i]].preds)
+            if (pred == block)
+                pred = rest;
+    set_jump (head, first);
+
+    // Number the callee's values first: phis may refer forward
+    std::vector<uint32_t> map (callee.insts.size (), NO_VALUE);
+    uint32_t next_id = static_cast<uint32_t> (caller.insts.size ());
+    for (const auto& b : callee.blocks)
+    {
+        for (uint32_t v : b.insts)
+        {
+            const SsaInst& inst = callee.insts[v];
+            map[v] = inst.op == SsaOp::PARAM ? args[static_cast<size_t> (inst.imm)]
+                                             : next_id++;
+        }
+    }
+
+    auto add_const = [&caller] (uint32_t b)
+    {
+        uint32_t id = static_cast<uint32_t> (caller.insts.size ());
+        caller.insts.push_back (SsaInst {SsaOp::CONST, 0, b, {}});
+        caller.blocks[b].insts.push_back (id);
+        return id;
+    };
+
+    std::vector<uint32_t> returns, values;
+    for (uint32_t cb = 0; cb < count; ++cb)
+    {
+        const SsaBlock& from = callee.blocks[cb];
+        uint32_t to_id = first + cb;
+
+        for (uint32_t v : from.insts)
+        {
+            const SsaInst& inst = callee.insts[v];
+            if (inst.op == SsaOp::PARAM)
+                continue;
+
+            SsaInst copy {inst.op, inst.imm, to_id, inst.args};
+            for (auto& arg : copy.args)
+                arg = map[arg];
+            caller.insts.push_back (std::move (copy));
+            caller.blocks[to_id].insts.push_back (map[v]);
+        }
+
+        SsaBlock& to = caller.blocks[to_id];
+        for (uint32_t pred : from.preds)
+            to.preds.push_back (first + pred);
+        if (cb == 0)
+            to.preds.push_back (block);
+
+        if (from.exit == SsaExit::RETURN)
+        {
+            to.exit = SsaExit::JUMP;
+            to.succs[0] = rest;
+            returns.push_back (to_id);
+            values.push_back (from.value == NO_VALUE ? add_const (to_id)
+                                                     : map[from.value]);
+            continue;
+        }
+
+        to.exit = from.exit;
+        to.value = from.value == NO_VALUE ? NO_VALUE : map[from.value];
+        to.succs = from.succs;
+        to.cases = from.cases;
+        for (uint32_t i = 0; i < succ_count (from); ++i)
+            to.succs[i] = first + from.succs[i];
+    }
+
+    // The call's value: one return's value, or a phi over all of them
+    uint32_t result;
+    caller.blocks[rest].preds = returns;
+    if (values.empty ())
+        result = add_const (block);
+    else if (std::all_of (values.begin (), values.end (),
+                          [&values] (uint32_t v) { return v == values[0]; }))
+        result = values[0];
+    else
+    {
+        result = static_cast<uint32_t> (caller.insts.size ());
+        caller.insts.push_back (SsaInst {SsaOp::PHI, 0, rest, values});
+        auto& insts = caller.blocks[rest].insts;
+        insts.insert (insts.begin (), result);
+    }
+
+    std::vector<uint32_t> forward (caller.insts.size ());
+    std::iota (forward.begin (), forward.end (), 0);
+    forward[call] = result;
+    replace_values (caller, forward);
+    caller.insts[call].op = SsaOp::NOP;
+    caller.insts[call].args.clear ();
+}
+
+/**
+ * Whether block returns the value of its last instruction, a call to self
+ * with every argument
+ */
+bool is_tail_recursion (const SsaFunction& func, const SsaBlock& block,
+                        const std::vector<uint32_t>& function_of, uint32_t self)
+{
+    if (block.exit != SsaExit::RETURN || block.value == NO_VALUE || block.insts.empty ()
+        || block.insts.back () != block.value)
+        return false;
+
+    const SsaInst& call = func.insts[block.value];
+    return call.op == SsaOp::CALL && function_of[static_cast<size_t> (call.imm)] == self
+        && call.args.size () == func.param_count;
+}
+
+/**
+ * Give func a loop header right after an entry holding only the
+ * parameters, and make the tail calls jump there
+ */
+size_t loop_tail_calls (SsaFunction& func, const std::vector<uint32_t>& function_of,
+                        uint32_t self)
+{
+    std::vector<uint32_t> tails;
+    for (uint32_t b = 0; b < func.blocks.size (); ++b)
+        if (is_tail_recursion (func, func.blocks[b], function_of, self))
+            tails.push_back (b + 1);
+    if (tails.empty () || !func.blocks[0].preds.empty ())
+        return 0;
+
+    // The old entry becomes the header, block 1
+    for (auto& b : func.blocks)
+    {
+        for (auto& pred : b.preds)
+            ++pred;
+        for (uint32_t i = 0; i < succ_count (b); ++i)
+            ++b.succs[i];
+    }
+    for (auto& inst : func.insts)
+        if (inst.op != SsaOp::NOP)
+            ++inst.block;
+    func.blocks.insert (func.blocks.begin (), SsaBlock {});
+
+    SsaBlock& entry = func.blocks[0];
+    SsaBlock& header = func.blocks[1];
+    std::vector<uint32_t> params (func.param_count, NO_VALUE);
+    for (uint32_t v : header.insts)
+    {
+        if (func.insts[v].op != SsaOp::PARAM)
+            continue;
+        params[static_cast<size_t> (func.insts[v].imm)] = v;
+        func.insts[v].block = 0;
+        entry.insts.push_back (v);
+    }
+    std::erase_if (header.insts, [&func] (uint32_t v)
+    {
+        return func.insts[v].op == SsaOp::PARAM;
+    });
+    set_jump (entry, 1);
+    header.preds.push_back (0);
+
+    // Inside the loop a parameter is its phi
+    std::vector<uint32_t> phis (params.size (), NO_VALUE);
+    std::vector<uint32_t> forward (func.insts.size ());
+    std::iota (forward.begin (), forward.end (), 0);
+    for (size_t i = 0; i < params.size (); ++i)
+    {
+        if (params[i] == NO_VALUE)
+            continue;
+        phis[i] = static_cast<uint32_t> (func.insts.size ());
+        forward[params[i]] = phis[i];
+        func.insts.push_back (SsaInst {SsaOp::PHI, 0, 1, {}});
+    }
+    for (auto& inst : func.insts)
+        for (auto& arg : inst.args)
+            arg = forward[arg];
+    for (auto& block : func.blocks)
+        if (block.value != NO_VALUE)
+            block.value = forward[block.value];
+    for (size_t i = phis.size (); i-- > 0;)
+    {
+        if (phis[i] == NO_VALUE)
+            continue;
+        func.insts[phis[i]].args.push_back (params[i]);
+        header.insts.insert (header.insts.begin (), phis[i]);
+    }
+
+    for (uint32_t t : tails)
+    {
+        SsaBlock& block = func.blocks[t];
+        SsaInst& call = func.insts[block.value];
+        for (size_t i = 0; i < phis.size (); ++i)
+            if (phis[i] != NO_VALUE)
+                func.insts[phis[i]].args.push_back (call.args[i]);
+        call = SsaInst {SsaOp::NOP, 0, 0, {}};
+        block.insts.pop_back ();
+        set_jump (block, 1);
+        header.preds.push_back (t);
+    }
+    return tails.size ();
+}
+
+} // namespace
+
+CallGraph build_call_graph (const SsaProgram& prog)
+{
+    CallGraph graph;
+    size_t count = prog.functions.size ();
+
+    std::unordered_map<std::string, uint32_t> by_name;
+    for (uint32_t f = 0; f < count; ++f)
+        by_name.emplace (prog.functions[f].name, f);
+    for (const auto& symbol : prog.symbols)
+    {
+        auto it = by_name.find (symbol);
+        graph.function_of.push_back (it == by_name.end () ? NO_VALUE : it->second);
+    }
+
+    graph.callees.resize (count);
+    graph.call_sites.assign (count, 0);
+    for (uint32_t f = 0; f < count; ++f)
+    {
+        const SsaFunction& func = prog.functions[f];
+        for (const auto& block : func.blocks)
+        {
+            for (uint32_t v : block.insts)
+            {
+                const SsaInst& inst = func.insts[v];
+                if (inst.op != SsaOp::CALL)
+                    continue;
+                uint32_t callee = graph.function_of[static_cast<size_t> (inst.imm)];
+                if (callee == NO_VALUE)
+                    continue;
+                ++graph.call_sites[callee];
+                graph.callees[f].push_back (callee);
+            }
+        }
+        auto& callees = graph.callees[f];
+        std::sort (callees.begin (), callees.end ());
+        callees.erase (std::unique (callees.begin (), callees.end ()), callees.end ());
+    }
+
+    // Tarjan's strongly connected components, with an explicit stack.
+    // Components complete callees first.
+    graph.recursive.assign (count, false);
+    std::vector<int32_t> order (count, -1);
+    std::vector<int32_t> low (count, 0);
+    std::vector<bool> on_stack (count, false);
+    std::vector<uint32_t> stack;
+    std::vector<std::pair<uint32_t, size_t>> work;
+    int32_t counter = 0;
+
+    auto visit = [&] (uint32_t f)
+    {
+        order[f] = low[f] = counter++;
+        stack.push_back (f);
+        on_stack[f] = true;
+        work.emplace_back (f, 0);
+    };
+
+    for (uint32_t root = 0; root < count; ++root)
+    {
+        if (order[root] >= 0)
+            continue;
+
+        visit (root);
+        while (!work.empty ())
+        {
+            uint32_t f = work.back ().first;
+            size_t next = work.back ().second++;
+            if (next < graph.callees[f].size ())
+            {
+                uint32_t callee = graph.callees[f][next];
+                if (callee == f)
+                    graph.recursive[f] = true;
+                if (order[callee] < 0)
+                    visit (callee);
+                else if (on_stack[callee])
+                    low[f] = std::min (low[f], order[callee]);
+                continue;
+            }
+
+            work.pop_back ();
+            if (!work.empty ())
+            {
+                uint32_t parent = work.back ().first;
+                low[parent] = std::min (low[parent], low[f]);
+            }
+            if (low[f] != order[f])
+                continue;
+
+            // The component is f and everything pushed after it
+            size_t start = stack.size ();
+            while (stack[--start] != f)
+                ;
+            bool cycle = stack.size () - start > 1;
+            for (size_t i = start; i < stack.size (); ++i)
+            {
+                on_stack[stack[i]] = false;
+                graph.recursive[stack[i]] = graph.recursive[stack[i]] || cycle;
+                graph.bottom_up.push_back (stack[i]);
+            }
+            stack.resize (start);
+        }
+    }
+
+    return graph;
+}
+
+uint32_t function_size (const SsaFunction& func)
+{
+    uint32_t size = static_cast<uint32_t> (func.blocks.size ());
+    for (const auto& block : func.blocks)
+        for (uint32_t v : block.insts)
+            if (func.insts[v].op != SsaOp::PARAM && func.insts[v].op != SsaOp::CONST)
+                ++size;
+    return size;
+}
+
+size_t eliminate_tail_recursion (SsaProgram& prog)
+{
+    CallGraph graph = build_call_graph (prog);
+    size_t replaced = 0;
+    for (uint32_t f = 0; f < prog.functions.size (); ++f)
+    {
+        if (!graph.recursive[f])
+            continue;
+        size_t count = loop_tail_calls (prog.functions[f], graph.function_of, f);
+        if (count != 0)
+            optimize_scalar (prog.functions[f]);
+        replaced += count;
+    }
+    return replaced;
+}
+
+size_t propagate_arguments (SsaProgram& prog)
+{
+    CallGraph graph = build_call_graph (prog);
+
+    // Per parameter: the constant seen at every call so far
+    struct Incoming
+    {
+        bool seen = false;
+        bool varying = false;
+        int32_t value = 0;
+    };
+    std::vector<std::vector<Incoming>> incoming (prog.functions.size ());
+    for (size_t f = 0; f < prog.functions.size (); ++f)
+        incoming[f].resize (prog.functions[f].param_count);
+
+    for (uint32_t f = 0; f < prog.functions.size (); ++f)
+    {
+        const SsaFunction& func = prog.functions[f];
+        for (const auto& block : func.blocks)
+        {
+            for (uint32_t v : block.insts)
+            {
+                const SsaInst& call = func.insts[v];
+                if (call.op != SsaOp::CALL)
+                    continue;
+                uint32_t callee = graph.function_of[static_cast<size_t> (call.imm)];
+                if (callee == NO_VALUE)
+                    continue;
+
+                auto& params = incoming[callee];
+                for (size_t i = 0; i < params.size (); ++i)
+                {
+                    if (i >= call.args.size ())
+                    {
+                        params[i].varying = true;
+                        continue;
+                    }
+
+                    // A recursive call passing the parameter through changes nothing
+                    const SsaInst& arg = func.insts[call.args[i]];
+                    if (callee == f && arg.op == SsaOp::PARAM
+                        && static_cast<size_t> (arg.imm) == i)
+                        continue;
+
+                    if (arg.op != SsaOp::CONST)
+                        params[i].varying = true;
+                    else if (!params[i].seen)
+                    {
+                        params[i].seen = true;
+                        params[i].value = arg.imm;
+                    }
+                    else if (params[i].value != arg.imm)
+                        params[i].varying = true;
+                }
+            }
+        }
+    }
+
+    size_t replaced = 0;
+    for (uint32_t f = 0; f < prog.functions.size (); ++f)
+    {
+        SsaFunction& func = prog.functions[f];
+        if (func.name == "main")
+            continue;
+
+        for (const auto& block : func.blocks)
+        {
+            for (uint32_t v : block.insts)
+            {
+                SsaInst& inst = func.insts[v];
+                if (inst.op != SsaOp::PARAM)
+                    continue;
+                const Incoming& in = incoming[f][static_cast<size_t> (inst.imm)];
+                if (in.seen && !in.varying)
+                {
+                    inst.op = SsaOp::CONST;
+                    inst.imm = in.value;
+                    ++replaced;
+                }
+            }
+        }
+    }
+
+    return replaced;
+}
+
+size_t inline_calls (SsaProgram& prog, const InlineOptions& options)
+{
+    CallGraph graph = build_call_graph (prog);
+    size_t inlined = 0;
+
+    for (uint32_t f : graph.bottom_up)
+    {
+        SsaFunction& caller = prog.functions[f];
+        uint32_t caller_size = function_size (caller);
+        size_t before = inlined;
+
+        for (uint32_t b = 0; b < caller.blocks.size (); ++b)
+        {
+            for (size_t i = 0; i < caller.blocks[b].insts.size (); ++i)
+            {
+                const SsaInst& call = caller.insts[caller.blocks[b].insts[i]];
+                if (call.op != SsaOp::CALL)
+                    continue;
+
+                uint32_t target = graph.function_of[static_cast<size_t> (call.imm)];
+                if (target == NO_VALUE || target == f || graph.recursive[target])
+                    continue;
+
+                // The entry takes the call's edge, so it must have no other
+                const SsaFunction& callee = prog.functions[target];
+                if (call.args.size () != callee.param_count
+                    || !callee.blocks[0].preds.empty ())
+                    continue;
+
+                // Constant arguments usually fold much of the copy away
+                uint32_t consts = static_cast<uint32_t> (std::count_if (
+                    call.args.begin (), call.args.end (), [&caller] (uint32_t a)
+                {
+                    return caller.insts[a].op == SsaOp::CONST;
+                }));
+                uint32_t size = function_size (callee);
+                uint32_t limit = graph.call_sites[target] == 1
+                               ? options.single_call_size
+                               : options.max_size + consts * options.const_arg_bonus;
+                if (size > limit || caller_size + size > options.max_caller_size)
+                    continue;
+
+                // Continue after the copy: its calls were already considered
+                inline_call (caller, callee, b, i);
+                caller_size += size;
+                b += static_cast<uint32_t> (callee.blocks.size ());
+                ++inlined;
+                break;
+            }
+        }
+
+        if (inlined != before)
+            optimize_scalar (caller);
+    }
+
+    return inlined;
+}
+
+size_t remove_dead_functions (SsaProgram& prog)
+{
+    CallGraph graph = build_call_graph (prog);
+    std::vector<bool> live (prog.functions.size (), false);
+    std::vector<uint32_t> stack;
+    for (uint32_t f = 0; f < prog.functions.size (); ++f)
+    {
+        if (prog.functions[f].name == "main")
+        {
+            live[f] = true;
+            stack.push_back (f);
+        }
+    }
+
+    while (!stack.empty ())
+    {
+        uint32_t f = stack.back ();
+        stack.pop_back ();
+        for (uint32_t callee : graph.callees[f])
+        {
+            if (!live[callee])
+            {
+                live[callee] = true;
+                stack.push_back (callee);
+            }
+        }
+    }
+
+    size_t index = 0;
+    size_t removed = std::erase_if (prog.functions, [&] (const SsaFunction&)
+    {
+        return !live[index++];
+    });
+    return removed;
+}
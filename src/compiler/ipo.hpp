@@ -0,0 +1,69 @@
+/**
+ * @file ipo.hpp
+ * @brief Interprocedural passes over the SSA IR (run under -O).
+ *
+ * Bit-C functions only see their arguments, so a call can be replaced by a
+ * copy of the callee's CFG, a parameter every call site passes the same
+ * constant for can become that constant, and a function returning its own
+ * call can loop instead. Only main is called from outside.
+ */
+
+#pragma once
+
+#include "ssa.hpp"
+
+struct InlineOptions
+{
+    uint32_t max_size = 24;             // Callees this small are always inlined
+    uint32_t const_arg_bonus = 4;       // Extra size allowed per constant argument
+    uint32_t single_call_size = 96;     // Limit for callees with one call site
+    uint32_t max_caller_size = 1024;    // Callers stop growing past this
+};
+
+struct CallGraph
+{
+    std::vector<uint32_t> function_of;          // Per symbol, NO_VALUE if undefined
+    std::vector<std::vector<uint32_t>> callees; // Per function, no repeats
+    std::vector<uint32_t> call_sites;           // Per function, calls to it
+    std::vector<bool> recursive;                // On a call cycle, self calls included
+    std::vector<uint32_t> bottom_up;            // Callees before their callers
+};
+
+/**
+ * Calls in reachable blocks, with recursion found as strongly connected
+ * components (Tarjan)
+ */
+CallGraph build_call_graph (const SsaProgram& prog);
+
+/**
+ * Size estimate used by the inliner: values that become instructions plus
+ * one per block
+ */
+uint32_t function_size (const SsaFunction& func);
+
+/**
+ * Turn self calls whose value is returned right away into jumps back to a
+ * loop header after the entry, where the parameters become phis. Recursion
+ * that only ever recurses this way is then a loop, and can be inlined.
+ * Functions that changed are re-optimized.
+ * Returns the number of calls replaced.
+ */
+size_t eliminate_tail_recursion (SsaProgram& prog);
+
+/**
+ * Replace parameters that every call site passes the same constant for
+ * Returns the number of parameters replaced.
+ */
+size_t propagate_arguments (SsaProgram& prog);
+
+/**
+ * Inline calls to small non-recursive functions, callees first so their
+ * own calls are already inlined. Callers that changed are re-optimized.
+ * Returns the number of calls inlined.
+ */
+size_t inline_calls (SsaProgram& prog, const InlineOptions& options = {});
+
+/**
+ * Delete functions main can no longer reach
+ */
+size_t remove_dead_functions (SsaProgram& prog);
@@ -0,0 +1,105 @@
+/**
+ * @file jit.cpp
+ * @brief Executable mapping of encoded machine code
+ */
+
+#include "jit.hpp"
+#include "codegen.hpp"
+#include "encoder.hpp"
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <sys/mman.h>
+#include <unistd.h>
+
+JitModule::JitModule (const MProgram& prog)
+    : specialized_ {prog.specialized}
+{
+    MachineCode code = encode (prog);
+    if (!code.relocations.empty ())
+        throw GenError ("Call to undefined function '"
+                        + prog.symbols[code.relocations[0].symbol] + "'");
+
+    // Whole pages, an empty program still maps one
+    size_t page = static_cast<size_t> (sysconf (_SC_PAGESIZE));
+    size_ = std::max<size_t> (1, (code.text.size () + page - 1) / page) * page;
+    void* addr = mmap (nullptr, size_, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+        throw GenError ("Could not map memory for the JIT");
+    code_ = addr;
+
+    std::memcpy (code_, code.text.data (), code.text.size ());
+    if (mprotect (code_, size_, PROT_READ | PROT_EXEC) != 0)
+    {
+        release ();
+        throw GenError ("Could not make JIT memory executable");
+    }
+
+    // Encoded functions are in program order
+    for (size_t i = 0; i < code.functions.size (); ++i)
+        entries_[code.functions[i].name] = {code.functions[i].offset,
+                                            prog.functions[i].param_count};
+}
+
+JitModule::~JitModule ()
+{
+    release ();
+}
+
+JitModule::JitModule (JitModule&& other) noexcept
+    : code_ (std::exchange (other.code_, nullptr)),
+      size_ (std::exchange (other.size_, 0)),
+      specialized_ (other.specialized_),
+      entries_ (std::move (other.entries_)) {}
+
+JitModule& JitModule::operator = (JitModule&& other) noexcept
+{
+    if (this != &other)
+    {
+        release ();
+        code_ = std::exchange (other.code_, nullptr);
+        size_ = std::exchange (other.size_, 0);
+        specialized_ = other.specialized_;
+        entries_ = std::move (other.entries_);
+    }
+    return *this;
+}
+
+void JitModule::release ()
+{
+    if (code_)
+        munmap (code_, size_);
+    code_ = nullptr;
+    size_ = 0;
+}
+
+const void* JitModule::lookup (const std::string& name) const
+{
+    auto it = entries_.find (name);
+    if (it == entries_.end ())
+        return nullptr;
+    return static_cast<const uint8_t*> (code_) + it->second.offset;
+}
+
+int JitModule::call (const std::string& name, std::initializer_list<int> args) const
+{
+    const void* entry = lookup (name);
+    if (!entry)
+        throw GenError ("No function '" + name + "' in the JIT module");
+    if (specialized_ && name != "main")
+        throw GenError ("'" + name + "' was specialized to its callers by -O, only main "
+                        "can be called");
+    uint32_t param_count = entries_.at (name).param_count;
+    if (args.size () != param_count)
+        throw GenError ("'" + name + "' takes " + std::to_string (param_count)
+                        + " argument(s), got " + std::to_string (args.size ()));
+
+    // At most 6 parameters, all in registers
+    int regs[6] = {};
+    std::copy (args.begin (), args.end (), regs);
+
+    using Entry = int (*) (int, int, int, int, int, int);
+    Entry fn = reinterpret_cast<Entry> (const_cast<void*> (entry));
+    return fn (regs[0], regs[1], regs[2], regs[3], regs[4], regs[5]);
+}
@@ -0,0 +1,73 @@
+/**
+ * @file jit.hpp
+ * @brief Run encoded machine code in-process (used with --run).
+ */
+
+#pragma once
+
+#include <initializer_list>
+#include <string>
+#include <unordered_map>
+#include "mir.hpp"
+
+/**
+ * A program's machine code in its own executable mapping
+ *
+ * The code is copied into anonymous memory that is writable only until it
+ * is in place, then switched to read + execute. Bit-C functions take and
+ * return ints in System V registers, so they are called as plain function
+ * pointers. Calls to functions outside the program cannot be resolved and
+ * are rejected up front.
+ *
+ * On a program optimized with -O (MProgram::specialized) only main can be
+ * called: the interprocedural passes compile a function for the calls the
+ * program makes, not for any call. A parameter every call site passes the
+ * same constant for is replaced by that constant, and functions nothing
+ * calls are removed. Build the program without -O to call its functions by
+ * name.
+ */
+class JitModule
+{
+public:
+    /**
+     * Encode and map the program
+     * Throws GenError on encoding failure, unresolved calls or mmap failure
+     */
+    explicit JitModule (const MProgram& prog);
+    ~JitModule ();
+
+    JitModule (const JitModule&) = delete;
+    JitModule& operator = (const JitModule&) = delete;
+    JitModule (JitModule&& other) noexcept;
+    JitModule& operator = (JitModule&& other) noexcept;
+
+    /**
+     * Entry address of a function, nullptr if the program has none by that
+     * name (removed functions included)
+     */
+    const void* lookup (const std::string& name) const;
+
+    /**
+     * Call a function with exactly its parameters' count of arguments and
+     * return its result
+     * Throws GenError if the function does not exist, takes a different
+     * number of arguments, or is not main in a specialized program
+     */
+    int call (const std::string& name, std::initializer_list<int> args = {}) const;
+
+    int run_main () const { return call ("main"); }
+
+private:
+    struct Entry
+    {
+        uint32_t offset;
+        uint32_t param_count;
+    };
+
+    void* code_ = nullptr;
+    size_t size_ = 0;
+    bool specialized_ = false;
+    std::unordered_map<std::string, Entry> entries_;
+
+    void release ();
+};
@@ -1,87 +1,336 @@
 /**
  * @file lexer.cpp
  * @brief lexer implementation
+ *
+ * Bytes are classified through a 256-entry table instead of the locale
+ * dependent <cctype> calls. Whitespace, identifier and number runs are
+ * skipped 16 (SSE2) or 32 (AVX2) bytes at a time, with a scalar tail.
+ * Keywords are recognized with a perfect hash.
  */
 
 #include <lexer.hpp>
+#include <stdexcept>
 #include <string>
-#include <algorithm>
-#include <cctype>
-#include <set>
+#include <array>
+#include <cstdint>
 #include "file_utils.hpp"
 #include "token.hpp"
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/********** CHARACTER CLASSES **********/
+namespace
+{
+
+enum CharClass : uint8_t
+{
+    CC_SPACE   = 1 << 0,
+    CC_NEWLINE = 1 << 1,
+    CC_DIGIT   = 1 << 2,
+    CC_ALPHA   = 1 << 3,    // letters and '_'
+    CC_IDENT   = CC_DIGIT | CC_ALPHA
+};
+
+constexpr std::array<uint8_t, 256> make_char_table ()
+{
+    std::array<uint8_t, 256> table {};
+    for (int c = '0'; c <= '9'; ++c) table[c] = CC_DIGIT;
+    for (int c = 'a'; c <= 'z'; ++c) table[c] = CC_ALPHA;
+    for (int c = 'A'; c <= 'Z'; ++c) table[c] = CC_ALPHA;
+    table['_'] = CC_ALPHA;
+    for (char c : {' ', '\t', '\v', '\f', '\r'}) table[c] = CC_SPACE;
+    table['\n'] = CC_SPACE | CC_NEWLINE;
+    return table;
+}
+
+constexpr std::array<TokenType, 256> make_punct_table ()
+{
+    std::array<TokenType, 256> table {};
+    table.fill (TokenType::UNKNOWN);
+    table['+'] = TokenType::ADD_OP;
+    table['-'] = TokenType::SUB_OP;
+    table['*'] = TokenType::MULT_OP;
+    table['/'] = TokenType::DIV_OP;
+    table['='] = TokenType::EQ_OP;
+    table['<'] = TokenType::LT_CMP;
+    table['>'] = TokenType::GT_CMP;
+    table['!'] = TokenType::NOT_OP;
+    table[';'] = TokenType::SEMICOLON;
+    table['('] = TokenType::L_PAREN;
+    table[')'] = TokenType::R_PAREN;
+    table['{'] = TokenType::L_BRACE;
+    table['}'] = TokenType::R_BRACE;
+    table[','] = TokenType::COMMA;
+    table[':'] = TokenType::COLON;
+    return table;
+}
+
+constexpr auto char_table  = make_char_table ();
+constexpr auto punct_table = make_punct_table ();
+
+inline uint8_t char_class (char c)
+{
+    return char_table[static_cast<unsigned char> (c)];
+}
+
+/********** KEYWORDS **********/
+struct Keyword
+{
+    std::string_view text;
+    TokenType type;
+};
+
+constexpr std::array<Keyword, 8> keywords =
+{{
+    {"int",     TokenType::INT_TYPE},
+    {"return",  TokenType::RETURN},
+    {"if",      TokenType::IF},
+    {"while",   TokenType::WHILE},
+    {"switch",  TokenType::SWITCH},
+    {"case",    TokenType::CASE},
+    {"default", TokenType::DEFAULT},
+    {"break",   TokenType::BREAK},
+}};
+
+constexpr size_t KEYWORD_SLOTS = 16;
+
+/**
+ * Collision-free over the keyword set (checked at compile time below)
+ */
+constexpr size_t keyword_hash (std::string_view s)
+{
+    return (s.size () * 7 + static_cast<unsigned char> (s.front ())
+                          + static_cast<unsigned char> (s.back ()))
+           & (KEYWORD_SLOTS - 1);
+}
+
+constexpr std::array<Keyword, KEYWORD_SLOTS> make_keyword_table ()
+{
+    std::array<Keyword, KEYWORD_SLOTS> table {};
+    for (const auto& kw : keywords)
+    {
+        if (!table[keyword_hash (kw.text)].text.empty ())
+            throw "keyword hash collision";
+        table[keyword_hash (kw.text)] = kw;
+    }
+    return table;
+}
+
+constexpr auto keyword_table = make_keyword_table ();
+
+inline TokenType keyword_or_identifier (std::string_view lexeme)
+{
+    const Keyword& kw = keyword_table[keyword_hash (lexeme)];
+    return kw.text == lexeme ? kw.type : TokenType::IDENTIFIER;
+}
+
+/********** RUN SCANNING **********/
+#if defined(__AVX2__)
+constexpr size_t CHUNK = 32;
+using chunk_t = __m256i;
+
+inline chunk_t load (const char* p)
+{
+    return _mm256_loadu_si256 (reinterpret_cast<const __m256i*> (p));
+}
+inline chunk_t splat (char c)                     { return _mm256_set1_epi8 (c); }
+inline chunk_t eq (chunk_t a, chunk_t b)          { return _mm256_cmpeq_epi8 (a, b); }
+inline chunk_t gt (chunk_t a, chunk_t b)          { return _mm256_cmpgt_epi8 (a, b); }
+inline chunk_t both (chunk_t a, chunk_t b)        { return _mm256_and_si256 (a, b); }
+inline chunk_t either (chunk_t a, chunk_t b)      { return _mm256_or_si256 (a, b); }
+inline uint64_t bits (chunk_t v)
+{
+    return static_cast<uint32_t> (_mm256_movemask_epi8 (v));
+}
+#elif defined(__SSE2__)
+constexpr size_t CHUNK = 16;
+using chunk_t = __m128i;
+
+inline chunk_t load (const char* p)
+{
+    return _mm_loadu_si128 (reinterpret_cast<const __m128i*> (p));
+}
+inline chunk_t splat (char c)                     { return _mm_set1_epi8 (c); }
+inline chunk_t eq (chunk_t a, chunk_t b)          { return _mm_cmpeq_epi8 (a, b); }
+inline chunk_t gt (chunk_t a, chunk_t b)          { return _mm_cmpgt_epi8 (a, b); }
+inline chunk_t both (chunk_t a, chunk_t b)        { return _mm_and_si128 (a, b); }
+inline chunk_t either (chunk_t a, chunk_t b)      { return _mm_or_si128 (a, b); }
+inline uint64_t bits (chunk_t v)
+{
+    return static_cast<uint32_t> (_mm_movemask_epi8 (v));
+}
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+constexpr uint64_t FULL = (uint64_t {1} << CHUNK) - 1;
+
+// Signed byte compares: bytes >= 0x80 are negative and fall outside ranges
+inline chunk_t in_range (chunk_t v, char lo, char hi)
+{
+    return both (gt (v, splat (lo - 1)), gt (splat (hi + 1), v));
+}
+
+inline uint64_t digit_bits (chunk_t v)
+{
+    return bits (in_range (v, '0', '9'));
+}
+
+inline uint64_t ident_bits (chunk_t v)
+{
+    chunk_t lower = either (v, splat (0x20));
+    return bits (either (either (in_range (v, '0', '9'),
+                                 in_range (lower, 'a', 'z')),
+                         eq (v, splat ('_'))));
+}
+
+inline uint64_t space_bits (chunk_t v)
+{
+    return bits (either (eq (v, splat (' ')), in_range (v, '\t', '\r')));
+}
+
+inline uint64_t newline_bits (chunk_t v)
+{
+    return bits (eq (v, splat ('\n')));
+}
+#endif
+
+/**
+ * Length of the run of bytes in class cls starting at i
+ */
+template <uint8_t cls>
+size_t scan_run (std::string_view input, size_t i)
+{
+    size_t start = i;
+
+#if defined(__AVX2__) || defined(__SSE2__)
+    while (i + CHUNK <= input.size ())
+    {
+        chunk_t v = load (input.data () + i);
+        uint64_t hit = cls == CC_DIGIT ? digit_bits (v) : ident_bits (v);
+        if (hit != FULL)
+            return i - start + __builtin_ctzll (~hit);
+        i += CHUNK;
+    }
+#endif
+
+    while (i < input.size () && (char_class (input[i]) & cls))
+        i++;
+
+    return i - start;
+}
+
+/**
+ * Skip whitespace starting at i, tracking line and column
+ * Returns the index of the first non-whitespace byte
+ */
+size_t skip_space (std::string_view input, size_t i, size_t& line, size_t& col)
+{
+#if defined(__AVX2__) || defined(__SSE2__)
+    while (i + CHUNK <= input.size ())
+    {
+        chunk_t v = load (input.data () + i);
+        uint64_t space = space_bits (v);
+        size_t run = space == FULL ? CHUNK : __builtin_ctzll (~space);
+
+        uint64_t nl = newline_bits (v) & ((uint64_t {1} << run) - 1);
+        if (nl)
+        {
+            line += __builtin_popcountll (nl);
+            col = run - (63 - __builtin_clzll (nl));
+        }
+        else
+            col += run;
+
+        i += run;
+        if (run < CHUNK)
+            return i;
+    }
+#endif
+
+    while (i < input.size () && (char_class (input[i]) & CC_SPACE))
+    {
+        if (input[i] == '\n')
+        {
+            line++;
+            col = 1;
+        }
+        else
+            col++;
+        i++;
+    }
+
+    return i;
+}
+
+} // namespace
+
+/********** LEXER **********/
 void Lexer::string_to_tokens ()
 {
-    this->tokens_ = {};
-    size_t i = 0;
-    size_t line = 1;
-    size_t col = 1;
+    std::vector<Token>& tokens = buffer_.tokens_;
+    tokens = {};
+
+    // Source averages well over 4 bytes per token. Reserving address space
+    // up front avoids repeated reallocate-and-copy of a large token array.
+    tokens.reserve (buffer_.source ().size () / 4 + 1);
+    pos_ = 0;
+    line_ = 1;
+    col_ = 1;
+
+    do
+        tokens.push_back (next_token ());
+    while (tokens.back ().type != TokenType::END_OF_FILE);
+}
+
+Token Lexer::next_token ()
+{
+    check_not_taken ();
+    std::string_view input = buffer_.source ();
+    size_t& i = pos_;
+    size_t& line = line_;
+    size_t& col = col_;
 
-    while (i < input_.size ())
+    while (i < input.size ())
     {
-        char c = input_[i];
+        char c = input[i];
+        uint8_t cls = char_class (c);
 
         // Skip whitespace
-        if (std::isspace (c))
+        if (cls & CC_SPACE)
         {
-            if (c == '\n')
-            {
-                line++;
-                col = 1;
-            }
-            else
-            {
-                col++;
-            }
-            i++;
+            i = skip_space (input, i, line, col);
             continue;
         }
 
         // Scan number
-        if (std::isdigit (c))
+        if (cls & CC_DIGIT)
         {
-            size_t start = i;
-            size_t start_col = col;
-            while (i < input_.size () && std::isdigit (input_[i]))
-            {
-                i++;
-                col++;
-            }
-            this->tokens_.push_back ({TokenType::INT_LITERAL,
-                                    {line, start_col},
-                                    std::string_view {input_.data () + start,
-                                                       i - start}});
-            continue;
+            size_t len = scan_run<CC_DIGIT> (input, i);
+            Token tok {TokenType::INT_LITERAL,
+                       {line, col},
+                       std::string_view {input.data () + i, len}};
+            i += len;
+            col += len;
+            return tok;
         }
 
         // Scan identifier or keyword
-        if (std::isalpha (c) || c == '_')
+        if (cls & CC_ALPHA)
         {
-            size_t start = i;
-            size_t start_col = col;
-            while (i < input_.size ()
-               && (std::isalnum (input_[i]) || input_[i] == '_'))
-            {
-                i++;
-                col++;
-            }
-            std::string_view lexeme {input_.data () + start, i - start};
-
-            TokenType type = TokenType::IDENTIFIER;
-            if (lexeme == "int")         type = TokenType::INT_TYPE;
-            else if (lexeme == "return") type = TokenType::RETURN;
-            else if (lexeme == "if")     type = TokenType::IF;
-            else if (lexeme == "while")  type = TokenType::WHILE;
-
-            this->tokens_.push_back ({type, {line, start_col}, lexeme});
-            continue;
+            size_t len = scan_run<CC_IDENT> (input, i);
+            std::string_view lexeme {input.data () + i, len};
+            Token tok {keyword_or_identifier (lexeme), {line, col}, lexeme};
+            i += len;
+            col += len;
+            return tok;
         }
 
         // Two-character operators
-        if (i + 1 < input_.size ())
+        if (i + 1 < input.size ())
         {
-            char next = input_[i + 1];
+            char next = input[i + 1];
             TokenType token_type = TokenType::UNKNOWN;
 
             if (c == '=' && next == '=') token_type = TokenType::EQ_CMP;
@@ -91,68 +340,67 @@ void Lexer::string_to_tokens ()
 
             if (token_type != TokenType::UNKNOWN)
             {
-                this->tokens_.push_back ({token_type,
-                                        {line, col},
-                                        std::string_view {input_.data () + i,
-                                                          2}});
+                Token tok {token_type,
+                           {line, col},
+                           std::string_view {input.data () + i, 2}};
                 i += 2;
                 col += 2;
-                continue;
+                return tok;
             }
         }
 
         // Single-character operators and punctuation
-        TokenType type = TokenType::UNKNOWN;
-        switch (c)
-        {
-            case '+': type = TokenType::ADD_OP;    break;
-            case '-': type = TokenType::SUB_OP;    break;
-            case '*': type = TokenType::MULT_OP;   break;
-            case '/': type = TokenType::DIV_OP;    break;
-            case '=': type = TokenType::EQ_OP;     break;
-            case '<': type = TokenType::LT_CMP;    break;
-            case '>': type = TokenType::GT_CMP;    break;
-            case '!': type = TokenType::NOT_OP;    break;
-            case ';': type = TokenType::SEMICOLON; break;
-            case '(': type = TokenType::L_PAREN;   break;
-            case ')': type = TokenType::R_PAREN;   break;
-            case '{': type = TokenType::L_BRACE;   break;
-            case '}': type = TokenType::R_BRACE;   break;
-            case ',': type = TokenType::COMMA;     break;
-            default: break;
-        }
-
-        this->tokens_.push_back ({type,
-                                {line, col},
-                                std::string_view {input_.data () + i, 1}});
+        Token tok {punct_table[static_cast<unsigned char> (c)],
+                   {line, col},
+                   std::string_view {input.data () + i, 1}};
         ++i;
         ++col;
+        return tok;
     }
 
-    this->tokens_.push_back ({TokenType::END_OF_FILE,
-                            {line, col},
-                            {}});
+    return {TokenType::END_OF_FILE, {line, col}, {}};
 }
 
 Lexer::Lexer (const std::string& in_str, bool file_flag)
-    : tokens_ {}
 {
     if (file_flag)
     {
         this->file_path_ = in_str;
-        this->input_ = file_to_string (in_str);
+        this->buffer_ = TokenBuffer {file_to_buffer (in_str, this->read_error_)};
     }
     else
     {
         this->file_path_ = {};
-        this->input_ = in_str;
+        this->buffer_ = TokenBuffer {SourceBuffer {in_str}};
     }
 }
 
-std::vector<Token> Lexer::get_tokens ()
+std::span<const Token> Lexer::get_tokens ()
+{
+    check_not_taken ();
+    if (this->buffer_.tokens_.empty ())
+        this->string_to_tokens ();
+
+    return buffer_.tokens ();
+}
+
+TokenBuffer Lexer::take_tokens ()
 {
-    if (this->tokens_.empty ())
+    check_not_taken ();
+    if (this->buffer_.tokens_.empty ())
         this->string_to_tokens ();
-    
-    return tokens_;
-}
\ No newline at end of file
+
+    this->taken_ = true;
+    return std::move (buffer_);
+}
+
+void Lexer::check_not_taken () const
+{
+    if (this->taken_)
+        throw std::logic_error ("Lexer used after take_tokens");
+}
+
+const std::string& Lexer::read_error () const
+{
+    return this->read_error_;
+}
@@ -5,9 +5,10 @@
 
 #pragma once
 
+#include <span>
 #include <string>
-#include <vector>
 #include "token.hpp"
+#include "token_buffer.hpp"
 
 /**
  * Converts input into tokens
@@ -16,14 +17,25 @@ class Lexer
 {
 private:
     std::string file_path_;
-    std::string input_;
-    std::vector<Token> tokens_;
+    std::string read_error_;        // Why file_path_ could not be read
+    TokenBuffer buffer_;            // Input source and its tokens
+    bool taken_ = false;            // buffer_ moved out by take_tokens
+
+    // Scan cursor for next_token
+    size_t pos_ = 0;
+    size_t line_ = 1;
+    size_t col_ = 1;
 
     /**
      * Converts input string into tokens
      * Sets empty vector on failure
      */
     void string_to_tokens ();
+
+    /**
+     * Throws std::logic_error once take_tokens has emptied the lexer
+     */
+    void check_not_taken () const;
     
 public:
     /**
@@ -33,6 +45,28 @@ public:
 
     /**
      * Parse input and return tokens
+     * The view is valid while this lexer (or its taken buffer) is alive
+     * Throws std::logic_error after take_tokens
+     */
+    std::span<const Token> get_tokens ();
+
+    /**
+     * Parse input and move the source and tokens out of the lexer
+     * The lexer is spent: get_tokens, take_tokens and next_token then throw
+     * std::logic_error rather than lex an empty source
+     */
+    TokenBuffer take_tokens ();
+
+    /**
+     * Why the input file could not be read, empty if it was (or the input
+     * is a raw string)
+     */
+    const std::string& read_error () const;
+
+    /**
+     * Pull-based mode: scan and return the next token only
+     * Returns END_OF_FILE once input is exhausted, and on every call after.
+     * Lexemes view into this lexer's source, which must stay alive.
      */
-    std::vector<Token> get_tokens ();
+    Token next_token ();
 };
\ No newline at end of file
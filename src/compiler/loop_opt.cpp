@@ -0,0 +1,901 @@
+/**
+ * @file loop_opt.cpp
+ * @brief Loop discovery, invariant hoisting, strength reduction, unrolling
+ */
+
+#include "loop_opt.hpp"
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+
+namespace
+{
+
+/**
+ * Two's complement arithmetic, matching the generated code
+ */
+int32_t wrap_mul (int32_t a, int32_t b)
+{
+    return static_cast<int32_t> (static_cast<uint32_t> (a) * static_cast<uint32_t> (b));
+}
+
+uint32_t add_value (SsaFunction& func, SsaOp op, int32_t imm, uint32_t block,
+                    std::vector<uint32_t> args = {})
+{
+    uint32_t id = static_cast<uint32_t> (func.insts.size ());
+    func.insts.push_back (SsaInst {op, imm, block, std::move (args)});
+    return id;
+}
+
+uint32_t pred_index (const SsaFunction& func, uint32_t block, uint32_t pred)
+{
+    const auto& preds = func.blocks[block].preds;
+    return static_cast<uint32_t> (std::find (preds.begin (), preds.end (), pred)
+                                  - preds.begin ());
+}
+
+/**
+ * Basic induction variable: a header phi stepped by a constant once per
+ * iteration
+ */
+struct InductionVar
+{
+    uint32_t phi;
+    uint32_t init;          // Operand from the preheader
+    uint32_t next;          // Operand from the latch, phi + step
+    int32_t step;
+};
+
+bool find_induction (const SsaFunction& func, const Loop& loop, uint32_t phi,
+                     InductionVar& iv)
+{
+    const SsaInst& inst = func.insts[phi];
+    if (inst.op != SsaOp::PHI || loop.preheader == NO_VALUE || loop.latch == NO_VALUE
+        || inst.args.size () != 2)
+        return false;
+
+    iv.phi = phi;
+    iv.init = inst.args[pred_index (func, loop.header, loop.preheader)];
+    iv.next = inst.args[pred_index (func, loop.header, loop.latch)];
+
+    const SsaInst& next = func.insts[iv.next];
+    if (!loop.contains[next.block] || next.args.size () != 2)
+        return false;
+
+    const SsaInst& l = func.insts[next.args[0]];
+    const SsaInst& r = func.insts[next.args[1]];
+    if (next.op == SsaOp::ADD && next.args[0] == phi && r.op == SsaOp::CONST)
+        iv.step = r.imm;
+    else if (next.op == SsaOp::ADD && next.args[1] == phi && l.op == SsaOp::CONST)
+        iv.step = l.imm;
+    else if (next.op == SsaOp::SUB && next.args[0] == phi && r.op == SsaOp::CONST
+             && r.imm != std::numeric_limits<int32_t>::min ())
+        iv.step = -r.imm;
+    else
+        return false;
+
+    return iv.step != 0;
+}
+
+/**
+ * Insert an empty block at index at, shifting later blocks up by one
+ */
+void insert_block (SsaFunction& func, uint32_t at)
+{
+    auto shift = [at] (uint32_t& b)
+    {
+        if (b >= at)
+            ++b;
+    };
+
+    for (auto& block : func.blocks)
+    {
+        for (auto& pred : block.preds)
+            shift (pred);
+        for (uint32_t i = 0; i < succ_count (block); ++i)
+            shift (block.succs[i]);
+    }
+    for (auto& inst : func.insts)
+        if (inst.op != SsaOp::NOP)
+            shift (inst.block);
+
+    func.blocks.insert (func.blocks.begin () + at, SsaBlock {});
+}
+
+/**
+ * Give the loop a preheader: a new block right before the header that all
+ * edges from outside the loop go through. Phi operands from outside merge
+ * into a phi in the new block when they differ.
+ */
+void insert_preheader (SsaFunction& func, const Loop& loop)
+{
+    uint32_t pre = loop.header;
+    insert_block (func, pre);
+    uint32_t header = pre + 1;
+
+    // Outside edges, in pred order
+    std::vector<size_t> outside;
+    const auto& preds = func.blocks[header].preds;
+    for (size_t p = 0; p < preds.size (); ++p)
+    {
+        uint32_t pred = preds[p];
+        if (!loop.contains[pred >= pre ? pred - 1 : pred])
+            outside.push_back (p);
+    }
+
+    SsaBlock& block = func.blocks[pre];
+    block.exit = SsaExit::JUMP;
+    block.succs[0] = header;
+    for (size_t p : outside)
+    {
+        uint32_t pred = func.blocks[header].preds[p];
+        block.preds.push_back (pred);
+        SsaBlock& from = func.blocks[pred];
+        for (uint32_t i = 0; i < succ_count (from); ++i)
+            if (from.succs[i] == header)
+                from.succs[i] = pre;
+    }
+
+    // Header phis take one operand from the preheader instead
+    std::vector<uint32_t> phis;
+    for (uint32_t v : func.blocks[header].insts)
+    {
+        if (func.insts[v].op != SsaOp::PHI)
+            break;
+        phis.push_back (v);
+    }
+    for (uint32_t phi : phis)
+    {
+        std::vector<uint32_t> incoming;
+        for (size_t p : outside)
+            incoming.push_back (func.insts[phi].args[p]);
+
+        uint32_t arg = incoming[0];
+        if (std::any_of (incoming.begin (), incoming.end (),
+                         [arg] (uint32_t v) { return v != arg; }))
+        {
+            arg = add_value (func, SsaOp::PHI, 0, pre, std::move (incoming));
+            func.blocks[pre].insts.push_back (arg);
+        }
+
+        auto& args = func.insts[phi].args;
+        args[outside[0]] = arg;
+        for (size_t i = outside.size (); i-- > 1;)
+            args.erase (args.begin () + static_cast<std::ptrdiff_t> (outside[i]));
+    }
+
+    auto& header_preds = func.blocks[header].preds;
+    header_preds[outside[0]] = pre;
+    for (size_t i = outside.size (); i-- > 1;)
+        header_preds.erase (header_preds.begin ()
+                            + static_cast<std::ptrdiff_t> (outside[i]));
+}
+
+} // namespace
+
+std::vector<Loop> find_loops (const SsaFunction& func)
+{
+    std::vector<uint32_t> idom = compute_idoms (func);
+    auto dominates = [&idom] (uint32_t a, uint32_t b)
+    {
+        if (idom[b] == NO_VALUE)
+            return false;
+        while (b != a && b != 0)
+            b = idom[b];
+        return b == a;
+    };
+
+    std::vector<Loop> loops;
+    for (uint32_t h = 0; h < func.blocks.size (); ++h)
+    {
+        std::vector<uint32_t> latches;
+        for (uint32_t pred : func.blocks[h].preds)
+            if (dominates (h, pred))
+                latches.push_back (pred);
+        if (latches.empty ())
+            continue;
+
+        // Body: everything reaching a latch backwards without passing h
+        Loop loop {h};
+        loop.contains.assign (func.blocks.size (), false);
+        loop.contains[h] = true;
+        std::vector<uint32_t> stack = latches;
+        while (!stack.empty ())
+        {
+            uint32_t b = stack.back ();
+            stack.pop_back ();
+            if (loop.contains[b] || idom[b] == NO_VALUE)
+                continue;
+            loop.contains[b] = true;
+            for (uint32_t pred : func.blocks[b].preds)
+                stack.push_back (pred);
+        }
+
+        for (uint32_t b = 0; b < func.blocks.size (); ++b)
+            if (loop.contains[b])
+                loop.blocks.push_back (b);
+
+        if (latches.size () == 1)
+            loop.latch = latches[0];
+
+        uint32_t outside = NO_VALUE;
+        size_t outside_count = 0;
+        for (uint32_t pred : func.blocks[h].preds)
+        {
+            if (!loop.contains[pred])
+            {
+                outside = pred;
+                ++outside_count;
+            }
+        }
+        if (outside_count == 1 && func.blocks[outside].exit == SsaExit::JUMP)
+            loop.preheader = outside;
+
+        loops.push_back (std::move (loop));
+    }
+
+    std::stable_sort (loops.begin (), loops.end (), [] (const Loop& a, const Loop& b)
+    {
+        return a.blocks.size () < b.blocks.size ();
+    });
+    return loops;
+}
+
+size_t insert_preheaders (SsaFunction& func)
+{
+    size_t inserted = 0;
+
+    // Indices shift with every insertion, so look the loops up again
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (const Loop& loop : find_loops (func))
+        {
+            const auto& preds = func.blocks[loop.header].preds;
+            bool entered = std::any_of (preds.begin (), preds.end (),
+                                        [&loop] (uint32_t p) { return !loop.contains[p]; });
+            if (loop.preheader != NO_VALUE || !entered)
+                continue;
+
+            insert_preheader (func, loop);
+            ++inserted;
+            changed = true;
+            break;
+        }
+    }
+
+    return inserted;
+}
+
+/********** INVARIANT HOISTING **********/
+size_t hoist_invariants (SsaFunction& func)
+{
+    size_t hoisted = 0;
+
+    // Inner loops first, so values climb out one level at a time
+    for (const Loop& loop : find_loops (func))
+    {
+        if (loop.preheader == NO_VALUE)
+            continue;
+
+        auto invariant = [&] (uint32_t v)
+        {
+            const SsaInst& inst = func.insts[v];
+            if (inst.op == SsaOp::PHI || inst.op == SsaOp::PARAM
+                || has_effects (func, v))
+                return false;
+            return std::none_of (inst.args.begin (), inst.args.end (),
+                                 [&] (uint32_t arg)
+            {
+                return loop.contains[func.insts[arg].block];
+            });
+        };
+
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (uint32_t b : loop.blocks)
+            {
+                auto& insts = func.blocks[b].insts;
+                for (size_t i = 0; i < insts.size ();)
+                {
+                    uint32_t v = insts[i];
+                    if (!invariant (v))
+                    {
+                        ++i;
+                        continue;
+                    }
+
+                    insts.erase (insts.begin () + i);
+                    func.blocks[loop.preheader].insts.push_back (v);
+                    func.insts[v].block = loop.preheader;
+                    ++hoisted;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    return hoisted;
+}
+
+/********** STRENGTH REDUCTION **********/
+size_t reduce_strength (SsaFunction& func)
+{
+    size_t reduced = 0;
+
+    for (const Loop& loop : find_loops (func))
+    {
+        if (loop.preheader == NO_VALUE || loop.latch == NO_VALUE
+            || func.blocks[loop.header].preds.size () != 2)
+            continue;
+
+        uint32_t in_index = pred_index (func, loop.header, loop.preheader);
+        uint32_t back_index = pred_index (func, loop.header, loop.latch);
+
+        std::vector<uint32_t> phis;
+        for (uint32_t v : func.blocks[loop.header].insts)
+        {
+            if (func.insts[v].op != SsaOp::PHI)
+                break;
+            phis.push_back (v);
+        }
+
+        std::vector<uint32_t> forward (func.insts.size ());
+        std::iota (forward.begin (), forward.end (), 0);
+
+        for (uint32_t phi : phis)
+        {
+            InductionVar iv;
+            if (!find_induction (func, loop, phi, iv))
+                continue;
+
+            // iv * k anywhere in the loop, by constant k
+            std::vector<std::pair<uint32_t, int32_t>> uses;
+            for (uint32_t b : loop.blocks)
+            {
+                for (uint32_t v : func.blocks[b].insts)
+                {
+                    const SsaInst& inst = func.insts[v];
+                    if (inst.op != SsaOp::MUL)
+                        continue;
+                    uint32_t other = inst.args[0] == phi ? inst.args[1]
+                                   : inst.args[1] == phi ? inst.args[0] : NO_VALUE;
+                    if (other != NO_VALUE && func.insts[other].op == SsaOp::CONST)
+                        uses.emplace_back (v, func.insts[other].imm);
+                }
+            }
+
+            // One new variable per factor: j = iv * k, stepped by step * k
+            // right after iv itself
+            std::unordered_map<int32_t, uint32_t> scaled;
+            for (auto [mul, k] : uses)
+            {
+                auto it = scaled.find (k);
+                if (it == scaled.end ())
+                {
+                    uint32_t pre = loop.preheader;
+                    uint32_t init;
+                    const SsaInst& init_inst = func.insts[iv.init];
+                    if (init_inst.op == SsaOp::CONST)
+                        init = add_value (func, SsaOp::CONST,
+                                          wrap_mul (init_inst.imm, k), pre);
+                    else
+                    {
+                        uint32_t factor = add_value (func, SsaOp::CONST, k, pre);
+                        init = add_value (func, SsaOp::MUL, 0, pre, {iv.init, factor});
+                        func.blocks[pre].insts.push_back (factor);
+                    }
+                    func.blocks[pre].insts.push_back (init);
+
+                    uint32_t step = add_value (func, SsaOp::CONST,
+                                               wrap_mul (iv.step, k), pre);
+                    func.blocks[pre].insts.push_back (step);
+
+                    uint32_t j = add_value (func, SsaOp::PHI, 0, loop.header, {0, 0});
+                    auto& header = func.blocks[loop.header].insts;
+                    header.insert (header.begin (), j);
+
+                    uint32_t next_block = func.insts[iv.next].block;
+                    uint32_t next = add_value (func, SsaOp::ADD, 0, next_block, {j, step});
+                    auto& insts = func.blocks[next_block].insts;
+                    insts.insert (std::find (insts.begin (), insts.end (), iv.next) + 1,
+                                  next);
+
+                    func.insts[j].args[in_index] = init;
+                    func.insts[j].args[back_index] = next;
+                    it = scaled.emplace (k, j).first;
+                }
+
+                forward[mul] = it->second;
+                ++reduced;
+            }
+        }
+
+        // Values added above map to themselves
+        size_t old_size = forward.size ();
+        forward.resize (func.insts.size ());
+        std::iota (forward.begin () + static_cast<std::ptrdiff_t> (old_size),
+                   forward.end (), static_cast<uint32_t> (old_size));
+        replace_values (func, forward);
+    }
+
+    return reduced;
+}
+
+/********** UNROLLING **********/
+
+/**
+ * Iterations of a header-tested loop `while (iv < bound)` or
+ * `while (iv > bound)` with constant start and step, or -1 if unknown
+ */
+static int64_t trip_count (const SsaFunction& func, const Loop& loop,
+                           InductionVar& iv)
+{
+    const SsaBlock& header = func.blocks[loop.header];
+    const SsaInst& cond = func.insts[header.value];
+    if (cond.op != SsaOp::LT && cond.op != SsaOp::GT)
+        return -1;
+
+    // Normalize to iv < bound or iv > bound
+    bool less = cond.op == SsaOp::LT;
+    uint32_t var = cond.args[0];
+    uint32_t bound = cond.args[1];
+    if (func.insts[var].op == SsaOp::CONST)
+    {
+        std::swap (var, bound);
+        less = !less;
+    }
+
+    if (func.insts[bound].op != SsaOp::CONST || !find_induction (func, loop, var, iv)
+        || func.insts[iv.init].op != SsaOp::CONST)
+        return -1;
+
+    int64_t start = func.insts[iv.init].imm;
+    int64_t limit = func.insts[bound].imm;
+    int64_t step = iv.step;
+
+    int64_t count;
+    if (less && step > 0)
+        count = start < limit ? (limit - start + step - 1) / step : 0;
+    else if (!less && step < 0)
+        count = start > limit ? (start - limit - step - 1) / -step : 0;
+    else
+        return -1;
+
+    // The variable must not wrap on the way
+    int64_t last = start + count * step;
+    if (last < std::numeric_limits<int32_t>::min ()
+        || last > std::numeric_limits<int32_t>::max ())
+        return -1;
+
+    return count;
+}
+
+size_t unroll_loops (SsaFunction& func, uint32_t factor, uint32_t max_insts)
+{
+    size_t unrolled = 0;
+
+    for (const Loop& loop : find_loops (func))
+    {
+        // Header testing the condition, then one body block jumping back
+        uint32_t body = loop.latch;
+        if (loop.blocks.size () != 2 || body == NO_VALUE || body == loop.header
+            || loop.preheader == NO_VALUE)
+            continue;
+
+        const SsaBlock& header = func.blocks[loop.header];
+        if (header.exit != SsaExit::BRANCH || header.succs[0] != body
+            || func.blocks[body].exit != SsaExit::JUMP)
+            continue;
+
+        InductionVar iv;
+        int64_t trips = trip_count (func, loop, iv);
+        if (trips < 2)
+            continue;
+
+        // One iteration: the header's computation, then the body's
+        std::vector<uint32_t> phis, iteration;
+        for (uint32_t v : header.insts)
+            (func.insts[v].op == SsaOp::PHI ? phis : iteration).push_back (v);
+        iteration.insert (iteration.end (), func.blocks[body].insts.begin (),
+                          func.blocks[body].insts.end ());
+
+        // Vector loops already do four iterations at a time, and copies
+        // would need registers of their own
+        if (std::any_of (iteration.begin (), iteration.end (),
+                         [&func] (uint32_t v) { return is_vector_op (func.insts[v].op); }))
+            continue;
+
+        uint32_t size = std::max<uint32_t> (1, static_cast<uint32_t> (iteration.size ()));
+        uint32_t f = std::min (factor, max_insts / size);
+        while (f >= 2 && trips % f != 0)
+            --f;
+        if (f < 2)
+            continue;
+
+        uint32_t back_index = pred_index (func, loop.header, body);
+        std::vector<uint32_t> latch_args;
+        for (uint32_t phi : phis)
+            latch_args.push_back (func.insts[phi].args[back_index]);
+
+        // Copy k sees the phis as the values copy k - 1 sent around
+        std::unordered_map<uint32_t, uint32_t> prev, cur;
+        auto mapped = [] (const std::unordered_map<uint32_t, uint32_t>& map, uint32_t v)
+        {
+            auto it = map.find (v);
+            return it == map.end () ? v : it->second;
+        };
+
+        for (uint32_t k = 1; k < f; ++k)
+        {
+            cur.clear ();
+            for (size_t p = 0; p < phis.size (); ++p)
+                cur[phis[p]] = mapped (prev, latch_args[p]);
+
+            for (uint32_t v : iteration)
+            {
+                SsaInst copy = func.insts[v];
+                copy.block = body;
+                for (auto& arg : copy.args)
+                    arg = mapped (cur, arg);
+
+                uint32_t id = static_cast<uint32_t> (func.insts.size ());
+                func.insts.push_back (std::move (copy));
+                func.blocks[body].insts.push_back (id);
+                cur[v] = id;
+            }
+            prev = std::move (cur);
+        }
+
+        for (size_t p = 0; p < phis.size (); ++p)
+            func.insts[phis[p]].args[back_index] = mapped (prev, latch_args[p]);
+        ++unrolled;
+    }
+
+    return unrolled;
+}
+
+/********** VECTORIZATION **********/
+
+static constexpr uint32_t LANES = 4;
+
+/**
+ * Header phi summing a chain of adds and subtracts
+ */
+struct Sum
+{
+    uint32_t phi;
+    std::vector<uint32_t> chain {};     // From the phi's reader to its latch operand
+};
+
+/**
+ * A loop found vectorizable: its phis, and the values the chains add in
+ * vector form
+ */
+struct VectorPlan
+{
+    InductionVar counter;               // Read by the exit test
+    int64_t trips = 0;
+    std::vector<InductionVar> inductions;
+    std::vector<Sum> sums;
+    std::vector<uint32_t> lanes;        // Operands first
+    size_t registers = 0;               // Vector values the loop will add
+};
+
+static const InductionVar* find_planned (const VectorPlan& plan, uint32_t phi)
+{
+    for (const auto& iv : plan.inductions)
+        if (iv.phi == phi)
+            return &iv;
+    return nullptr;
+}
+
+/**
+ * Add v and what it reads to plan.lanes, false unless it is computed from
+ * induction variables, invariants and constants by adds, subtracts and
+ * multiplies
+ */
+static bool plan_lanes (const SsaFunction& func, const Loop& loop, uint32_t v,
+                        VectorPlan& plan)
+{
+    if (std::find (plan.lanes.begin (), plan.lanes.end (), v) != plan.lanes.end ())
+        return true;
+
+    const SsaInst& inst = func.insts[v];
+    bool invariant = inst.op == SsaOp::CONST || !loop.contains[inst.block];
+    if (!invariant && !find_planned (plan, v))
+    {
+        if (inst.op != SsaOp::ADD && inst.op != SsaOp::SUB && inst.op != SsaOp::MUL)
+            return false;
+        for (uint32_t arg : inst.args)
+            if (!plan_lanes (func, loop, arg, plan))
+                return false;
+    }
+
+    plan.lanes.push_back (v);
+    return true;
+}
+
+static bool plan_vector_loop (const SsaFunction& func, const Loop& loop, VectorPlan& plan)
+{
+    // Header testing the condition, then one body block jumping back
+    uint32_t body = loop.latch;
+    if (loop.blocks.size () != 2 || body == NO_VALUE || body == loop.header
+        || loop.preheader == NO_VALUE)
+        return false;
+
+    const SsaBlock& header = func.blocks[loop.header];
+    if (header.exit != SsaExit::BRANCH || header.succs[0] != body
+        || func.blocks[body].exit != SsaExit::JUMP)
+        return false;
+
+    plan.trips = trip_count (func, loop, plan.counter);
+    if (plan.trips < 2 * LANES)
+        return false;
+
+    std::vector<uint32_t> phis;
+    for (uint32_t v : header.insts)
+    {
+        SsaOp op = func.insts[v].op;
+        if (op == SsaOp::PHI)
+            phis.push_back (v);
+        else if (op != SsaOp::CONST && v != header.value)
+            return false;
+    }
+    for (uint32_t v : func.blocks[body].insts)
+    {
+        SsaOp op = func.insts[v].op;
+        if (op != SsaOp::CONST && op != SsaOp::ADD && op != SsaOp::SUB && op != SsaOp::MUL)
+            return false;
+    }
+
+    // Readers of each value inside the loop
+    std::unordered_map<uint32_t, std::vector<uint32_t>> readers;
+    for (uint32_t b : loop.blocks)
+        for (uint32_t v : func.blocks[b].insts)
+            for (uint32_t arg : func.insts[v].args)
+                readers[arg].push_back (v);
+
+    uint32_t back_index = pred_index (func, loop.header, body);
+    for (uint32_t phi : phis)
+    {
+        InductionVar iv;
+        if (find_induction (func, loop, phi, iv))
+        {
+            plan.inductions.push_back (iv);
+            continue;
+        }
+
+        // Otherwise a sum: every step read once, by the next one, and the
+        // last by the phi alone
+        Sum sum {phi};
+        uint32_t last = func.insts[phi].args[back_index];
+        uint32_t cur = phi;
+        while (true)
+        {
+            const auto& next = readers[cur];
+            if (next.size () != 1)
+                return false;
+            if (cur == last)
+            {
+                if (next[0] != phi)
+                    return false;
+                break;
+            }
+
+            const SsaInst& inst = func.insts[next[0]];
+            bool add = inst.op == SsaOp::ADD && (inst.args[0] == cur) != (inst.args[1] == cur);
+            bool sub = inst.op == SsaOp::SUB && inst.args[0] == cur && inst.args[1] != cur;
+            if (!add && !sub)
+                return false;
+            sum.chain.push_back (next[0]);
+            cur = next[0];
+        }
+        if (sum.chain.empty ())
+            return false;
+        plan.sums.push_back (std::move (sum));
+    }
+    if (plan.sums.empty ())
+        return false;
+
+    for (const Sum& sum : plan.sums)
+    {
+        uint32_t prev = sum.phi;
+        for (uint32_t step : sum.chain)
+        {
+            const SsaInst& inst = func.insts[step];
+            uint32_t other = inst.args[0] == prev ? inst.args[1] : inst.args[0];
+            if (!plan_lanes (func, loop, other, plan))
+                return false;
+            prev = step;
+        }
+        plan.registers += 2 + sum.chain.size ();       // Start, phi, steps
+    }
+
+    // Each induction variable: start, phi, step and next
+    for (uint32_t v : plan.lanes)
+        plan.registers += find_planned (plan, v) ? 4 : 1;
+    return true;
+}
+
+/**
+ * Put the vector loop for plan in front of loop
+ *
+ *   preheader -> vector header <-> vector body
+ *                     |
+ *                vector exit (lane sums) -> header <-> body -> exit
+ *
+ * The vector loop runs the trip count rounded down to a multiple of four,
+ * the original loop starts where it stopped and runs the rest.
+ */
+static void emit_vector_loop (SsaFunction& func, const Loop& loop, const VectorPlan& plan)
+{
+    uint32_t in_index = pred_index (func, loop.header, loop.preheader);
+
+    for (uint32_t i = 0; i < 3; ++i)
+        insert_block (func, loop.header);
+    uint32_t vheader = loop.header;
+    uint32_t vbody = vheader + 1;
+    uint32_t vexit = vheader + 2;
+    uint32_t header = vheader + 3;
+    uint32_t body = loop.latch >= loop.header ? loop.latch + 3 : loop.latch;
+    uint32_t pre = loop.preheader >= loop.header ? loop.preheader + 3 : loop.preheader;
+
+    auto append = [&func] (uint32_t block, SsaOp op, int32_t imm,
+                           std::vector<uint32_t> args = {})
+    {
+        uint32_t v = add_value (func, op, imm, block, std::move (args));
+        func.blocks[block].insts.push_back (v);
+        return v;
+    };
+    auto inside = [&func, header, body] (uint32_t v)
+    {
+        uint32_t b = func.insts[v].block;
+        return func.insts[v].op != SsaOp::CONST && (b == header || b == body);
+    };
+
+    // Vector header phis take their start from the preheader (operand 0)
+    // and the next value from the vector body (operand 1)
+    std::unordered_map<uint32_t, uint32_t> lanes;
+    std::vector<std::pair<uint32_t, uint32_t>> stepped;     // Phi, step in lanes
+    for (uint32_t v : plan.lanes)
+    {
+        if (const InductionVar* iv = find_planned (plan, v))
+        {
+            uint32_t start = append (pre, SsaOp::VSTEP, iv->step, {iv->init});
+            uint32_t stride = append (pre, SsaOp::CONST, wrap_mul (iv->step, LANES));
+            uint32_t step = append (pre, SsaOp::VSPLAT, 0, {stride});
+            lanes[v] = append (vheader, SsaOp::PHI, 0, {start, NO_VALUE});
+            stepped.emplace_back (lanes[v], step);
+        }
+        else if (!inside (v))
+            lanes[v] = append (pre, SsaOp::VSPLAT, 0, {v});
+        else
+        {
+            SsaOp op = func.insts[v].op == SsaOp::ADD ? SsaOp::VADD
+                     : func.insts[v].op == SsaOp::SUB ? SsaOp::VSUB : SsaOp::VMUL;
+            uint32_t l = lanes.at (func.insts[v].args[0]);
+            uint32_t r = lanes.at (func.insts[v].args[1]);
+            lanes[v] = append (vbody, op, 0, {l, r});
+        }
+    }
+    // Sums start with everything in lane 0, the lanes add up at the exit
+    for (const Sum& sum : plan.sums)
+    {
+        uint32_t init = func.insts[sum.phi].args[in_index];
+        uint32_t start = append (pre, SsaOp::VSCALAR, 0, {init});
+        uint32_t phi = append (vheader, SsaOp::PHI, 0, {start, NO_VALUE});
+
+        uint32_t prev = sum.phi;
+        uint32_t cur = phi;
+        for (uint32_t step : sum.chain)
+        {
+            SsaOp op = func.insts[step].op == SsaOp::ADD ? SsaOp::VADD : SsaOp::VSUB;
+            const auto& args = func.insts[step].args;
+            uint32_t other = args[0] == prev ? args[1] : args[0];
+            cur = append (vbody, op, 0, {cur, lanes.at (other)});
+            prev = step;
+        }
+        func.insts[phi].args[1] = cur;
+        func.insts[sum.phi].args[in_index] = append (vexit, SsaOp::VREDUCE, 0, {phi});
+    }
+
+    // Stepped last, codegen can then update the phis in place
+    for (auto [phi, step] : stepped)
+        func.insts[phi].args[1] = append (vbody, SsaOp::VADD, 0, {phi, step});
+
+    // The counter runs whole vectors only
+    const InductionVar& counter = plan.counter;
+    int64_t vector_trips = plan.trips / LANES * LANES;
+    int32_t end = static_cast<int32_t> (func.insts[counter.init].imm
+                                        + vector_trips * counter.step);
+    uint32_t bound = append (pre, SsaOp::CONST, end);
+    uint32_t stride = append (pre, SsaOp::CONST, wrap_mul (counter.step, LANES));
+    uint32_t count = append (vheader, SsaOp::PHI, 0, {counter.init, NO_VALUE});
+    uint32_t test = append (vheader, counter.step > 0 ? SsaOp::LT : SsaOp::GT, 0,
+                            {count, bound});
+    func.insts[count].args[1] = append (vbody, SsaOp::ADD, 0, {count, stride});
+
+    // Where the vector loop leaves each induction variable
+    for (const InductionVar& iv : plan.inductions)
+    {
+        int32_t advance = static_cast<int32_t> (static_cast<uint32_t> (
+            static_cast<uint64_t> (vector_trips) * static_cast<uint32_t> (iv.step)));
+        uint32_t value;
+        if (func.insts[iv.init].op == SsaOp::CONST)
+        {
+            int32_t init = func.insts[iv.init].imm;
+            value = append (vexit, SsaOp::CONST, static_cast<int32_t> (
+                static_cast<uint32_t> (init) + static_cast<uint32_t> (advance)));
+        }
+        else
+        {
+            uint32_t k = append (vexit, SsaOp::CONST, advance);
+            value = append (vexit, SsaOp::ADD, 0, {iv.init, k});
+        }
+        func.insts[iv.phi].args[in_index] = value;
+    }
+
+    SsaBlock& pre_block = func.blocks[pre];
+    for (uint32_t i = 0; i < succ_count (pre_block); ++i)
+        if (pre_block.succs[i] == header)
+            pre_block.succs[i] = vheader;
+
+    SsaBlock& vh = func.blocks[vheader];
+    vh.preds = {pre, vbody};
+    vh.exit = SsaExit::BRANCH;
+    vh.value = test;
+    vh.succs = {vbody, vexit};
+    func.blocks[vbody].preds = {vheader};
+    set_jump (func.blocks[vbody], vheader);
+    func.blocks[vexit].preds = {vheader};
+    set_jump (func.blocks[vexit], header);
+    func.blocks[header].preds[in_index] = vexit;
+}
+
+size_t vectorize_loops (SsaFunction& func)
+{
+    size_t vectorized = 0;
+
+    // Indices shift with every vector loop, so look the loops up again
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        std::vector<bool> vector = vector_values (func);
+        size_t used = static_cast<size_t> (std::count (vector.begin (), vector.end (), true));
+
+        for (const Loop& loop : find_loops (func))
+        {
+            VectorPlan plan;
+            if (!plan_vector_loop (func, loop, plan)
+                || used + plan.registers > MAX_VECTOR_VALUES)
+                continue;
+
+            emit_vector_loop (func, loop, plan);
+            ++vectorized;
+            changed = true;
+            break;
+        }
+    }
+
+    return vectorized;
+}
+
+size_t optimize_loops (SsaFunction& func, const LoopOptions& options)
+{
+    size_t changed = insert_preheaders (func);
+    if (options.hoist)
+        changed += hoist_invariants (func);
+    if (options.strength_reduce)
+        changed += reduce_strength (func);
+    if (options.vectorize)
+        changed += vectorize_loops (func);
+    if (options.unroll_factor > 1)
+        changed += unroll_loops (func, options.unroll_factor, options.unroll_max_insts);
+    return changed;
+}
@@ -0,0 +1,81 @@
+/**
+ * @file loop_opt.hpp
+ * @brief Loop passes over the SSA IR (run under -O).
+ *
+ * Loops are found as natural loops of the CFG, so every while statement is
+ * one loop: a header holding the condition, entered from a preheader and
+ * re-entered from a latch at the end of the body.
+ */
+
+#pragma once
+
+#include "ssa.hpp"
+
+struct LoopOptions
+{
+    bool hoist = true;
+    bool strength_reduce = true;
+    uint32_t unroll_factor = 4;         // 0 or 1 disables unrolling
+    uint32_t unroll_max_insts = 64;     // Size limit of an unrolled body
+    bool vectorize = true;
+};
+
+struct Loop
+{
+    uint32_t header;
+    uint32_t preheader = NO_VALUE;      // Lone outside pred ending in a jump
+    uint32_t latch = NO_VALUE;          // Lone back edge source
+    std::vector<bool> contains {};      // Per block
+    std::vector<uint32_t> blocks {};    // Members in index order
+};
+
+/**
+ * Natural loops, innermost first
+ */
+std::vector<Loop> find_loops (const SsaFunction& func);
+
+/**
+ * Give every loop entered from outside a preheader, splitting the entry
+ * edges with a new block before the header where needed
+ */
+size_t insert_preheaders (SsaFunction& func);
+
+/**
+ * Move values computed from loop-invariant operands to the preheader.
+ * Calls and divisions that may trap stay where they are.
+ */
+size_t hoist_invariants (SsaFunction& func);
+
+/**
+ * Turn multiplies of an induction variable by a constant into a second
+ * induction variable stepped by an add
+ */
+size_t reduce_strength (SsaFunction& func);
+
+/**
+ * Turn single-block loops with a trip count known at compile time (at
+ * least two vectors' worth) that sum values computed from induction
+ * variables and invariants into a loop doing four iterations at a time on
+ * vector lanes, ahead of the original loop for the remaining iterations.
+ * The lanes are added up once the vector loop is done.
+ *
+ * Every header phi must be an induction variable or such a sum: the phi
+ * goes through a chain of adds and subtracts, used by nothing else, back
+ * to itself. The summed values may only add, subtract and multiply
+ * those variables, invariants and constants.
+ */
+size_t vectorize_loops (SsaFunction& func);
+
+/**
+ * Unroll single-block loops with a trip count known at compile time by the
+ * largest factor up to factor that divides it, so no remainder loop is
+ * needed and the intermediate exit tests can be dropped. Vector loops are
+ * left alone.
+ */
+size_t unroll_loops (SsaFunction& func, uint32_t factor, uint32_t max_insts);
+
+/**
+ * Insert preheaders, then run the enabled loop passes, returns the number of
+ * changes
+ */
+size_t optimize_loops (SsaFunction& func, const LoopOptions& options = {});
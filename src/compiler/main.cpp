@@ -3,77 +3,274 @@
  * @brief Compiler entry point.
  */
 
+#include <csignal>
 #include <cstdlib>
 #include <iostream>
-#include <array>
 #include <optional>
-#include <string.h>
-#include <cstring>
-#include "lexer.hpp"
-#include "parser.hpp"
-#include "codegen.hpp"
-#include "optimizer.hpp"
+#include <string>
+#include <vector>
+#include "driver.hpp"
 #include "file_utils.hpp"
-
-static constexpr size_t MAX_PATH_LEN = 128;
+#include "function_cache.hpp"
+#include "server.hpp"
+#include "thread_pool.hpp"
+#include <unistd.h>
 
 /**
  * Input args
  */
 struct Args
 {
-    std::array<char, MAX_PATH_LEN> in_path;
-    std::array<char, MAX_PATH_LEN> out_path;
-    bool optimize = false;
+    std::vector<std::string> in_paths;
+    std::string out_path;           // -o, single input only
+    std::string out_dir;            // --out-dir, batch outputs go here
+    CompileOptions options;
+    bool run = false;               // --run: execute main in-process instead
+    size_t threads = 0;             // -j, 0 is one per hardware thread
+    std::string report_path;        // --time-report=<path>, else stderr
+    std::string cache_dir;          // --cache-dir
+    std::string serve_path;         // --serve: compile requests on this socket
+    std::string connect_path;       // --connect: send the input to this server
+    uint32_t unroll_factor = 0;     // --unroll as given, 0 if not
 };
 
+/**
+ * Parse a non-negative count no larger than max
+ */
+static std::optional<size_t> parse_count (const std::string& text, size_t max)
+{
+    char* end = nullptr;
+    unsigned long value = strtoul (text.c_str (), &end, 10);
+    if (text.empty () || *end != '\0' || value > max)
+        return std::nullopt;
+    return value;
+}
+
 /**
  * Parses args and writes to std::cerr if failure
  * @return Input args if valid, else nullopt
  */
 std::optional<Args> parse_args (int argc, char* argv[])
 {
-    // Check arg count: required 4, optional -O flag makes 5
-    if (argc < 4 || argc > 5)
+    auto usage = [] ()
     {
-        std::cerr << "Usage: ./compiler <in_path> -o <out_path> [-O]" << std::endl;
+        std::cerr << "Usage: ./compiler <in_path> -o <out_path> [-O] [-c] [--unroll=N]\n"
+                  << "       ./compiler <in_path> --run [-O] [--unroll=N]\n"
+                  << "       ./compiler <in_path>... [--manifest <file>] [--out-dir <dir>]"
+                     " [-j N] [-O] [-c] [--unroll=N]\n"
+                  << "       ./compiler --serve <socket> [-j N] [--unroll=N]\n"
+                  << "       ./compiler <in_path> --connect <socket> [-o <out_path>] [-O] [-c]"
+                     " [--unroll=N]\n"
+                  << "-O is -O2, -O1 leaves out the loop passes, --no-vectorize the"
+                     " vectorizer\n"
+                  << "Any form but --connect takes --time-report[=<json_path>] and"
+                     " --cache-dir <dir>"
+                  << std::endl;
         return std::nullopt;
+    };
+
+    Args ret {};
+    unsigned level = 0;             // -O<level>, the last one counts
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string flag {argv[i]};
+        bool has_value = i + 1 < argc;
+        if (flag == "-o" && has_value)
+            ret.out_path = argv[++i];
+        else if (flag == "--out-dir" && has_value)
+            ret.out_dir = argv[++i];
+        else if (flag == "--cache-dir" && has_value)
+            ret.cache_dir = argv[++i];
+        else if (flag == "--serve" && has_value)
+            ret.serve_path = argv[++i];
+        else if (flag == "--connect" && has_value)
+            ret.connect_path = argv[++i];
+        else if (flag == "--manifest" && has_value)
+        {
+            std::vector<std::string> listed = read_manifest (argv[++i]);
+            if (listed.empty ())
+            {
+                std::cerr << "No inputs in manifest " << argv[i] << std::endl;
+                return std::nullopt;
+            }
+            ret.in_paths.insert (ret.in_paths.end (), listed.begin (), listed.end ());
+        }
+        else if (flag == "-O" || flag == "-O2")
+            level = 2;
+        else if (flag == "-O1" || flag == "-O0")
+            level = static_cast<unsigned> (flag[2] - '0');
+        else if (flag == "--no-vectorize")
+            ret.options.loops.vectorize = false;
+        else if (flag == "-c")
+            ret.options.object = true;
+        else if (flag == "--run")
+            ret.run = true;
+        else if (flag == "--time-report" || flag.starts_with ("--time-report="))
+        {
+            ret.options.time_report = true;
+            if (flag.size () > 14)
+                ret.report_path = flag.substr (14);
+        }
+        else if (flag.starts_with ("-j"))
+        {
+            // -j N or -jN, 0 picks one thread per core
+            std::string count = flag.size () > 2 ? flag.substr (2)
+                              : has_value ? std::string {argv[++i]} : "";
+            std::optional<size_t> threads = parse_count (count, 1024);
+            if (!threads)
+            {
+                std::cerr << "Invalid thread count: " << count << std::endl;
+                return std::nullopt;
+            }
+            ret.threads = *threads;
+        }
+        else if (flag.starts_with ("--unroll="))
+        {
+            // Largest unroll factor, 1 disables unrolling
+            std::optional<size_t> factor = parse_count (flag.substr (9), 64);
+            if (!factor)
+            {
+                std::cerr << "Invalid unroll factor: " << flag << std::endl;
+                return std::nullopt;
+            }
+            ret.options.loops.unroll_factor = static_cast<uint32_t> (*factor);
+            ret.unroll_factor = ret.options.loops.unroll_factor;
+        }
+        else if (flag.starts_with ("-"))
+        {
+            std::cerr << "Unknown flag: " << flag << std::endl;
+            return std::nullopt;
+        }
+        else
+            ret.in_paths.push_back (flag);
     }
 
-    // Check file path len
-    std::string in_path {argv[1]};
-    if (in_path.length () > MAX_PATH_LEN - 1)
+    // The server takes its inputs from the socket and each request's level
+    // from the request, so its loop options stay as given; a client leaves
+    // the cache and reports to the server
+    if (!ret.serve_path.empty ())
     {
-        std::cerr << "File path cannot exceed " << MAX_PATH_LEN << " chars"
-                  << std::endl;
-        return std::nullopt;
+        if (!ret.in_paths.empty () || !ret.out_path.empty () || ret.run
+            || !ret.connect_path.empty ())
+            return usage ();
+        return ret;
     }
+    set_opt_level (ret.options, level);
+    if (!ret.connect_path.empty ()
+        && (ret.in_paths.size () != 1 || ret.run || !ret.cache_dir.empty ()
+            || ret.options.time_report))
+        return usage ();
+
+    if (ret.in_paths.empty ())
+        return usage ();
 
-    std::string out_path {argv[3]};
-    if (out_path.length () > MAX_PATH_LEN - 1)
+    // -o and --run name a single file's output
+    if ((!ret.out_path.empty () || ret.run) && ret.in_paths.size () != 1)
     {
-        std::cerr << "File path cannot exceed " << MAX_PATH_LEN << " chars"
-                  << std::endl;
+        std::cerr << (ret.run ? "--run" : "-o") << " takes exactly one input" << std::endl;
         return std::nullopt;
     }
+    if (ret.run && !ret.out_path.empty ())
+        return usage ();
 
-    // Return
-    Args ret {};
-    memcpy (ret.in_path.data (), in_path.c_str (), in_path.size () + 1);
-    memcpy (ret.out_path.data (), out_path.c_str (), out_path.size () + 1);
+    return ret;
+}
+
+/**
+ * Write the --time-report JSON to its file, or stderr
+ */
+static void write_reports (const Args& args, const std::vector<CompileResult>& results)
+{
+    if (!args.options.time_report)
+        return;
+
+    std::vector<TimeReport> reports;
+    for (const auto& result : results)
+        reports.push_back (result.report);
+
+    std::string json = reports_to_json (reports);
+    if (args.report_path.empty ())
+        std::cerr << json;
+    else
+        string_to_file (json, args.report_path);
+}
+
+/**
+ * Add the functions compiled this run to the --cache-dir cache
+ */
+static void save_cache (const Args& args, std::optional<FunctionCache>& cache)
+{
+    if (cache && !cache->save ())
+        std::cerr << "Could not save the cache in " << args.cache_dir << std::endl;
+}
 
-    if (argc == 5)
+static CompileServer* active_server = nullptr;
+
+/**
+ * SIGINT and SIGTERM stop --serve cleanly, so the cache is saved
+ */
+static void stop_server (int)
+{
+    if (active_server)
+        active_server->stop ();
+}
+
+/**
+ * --serve: answer requests until interrupted
+ */
+static int serve (const Args& args, std::optional<FunctionCache>& cache)
+{
+    CompileServer server {args.serve_path, args.options, args.threads};
+    std::string error;
+    if (!server.listen (error))
     {
-        if (std::string {argv[4]} == "-O")
-            ret.optimize = true;
-        else
-        {
-            std::cerr << "Unknown flag: " << argv[4] << std::endl;
-            return std::nullopt;
-        }
+        std::cerr << error << std::endl;
+        return EXIT_FAILURE;
     }
 
-    return ret;
+    active_server = &server;
+    std::signal (SIGINT, stop_server);
+    std::signal (SIGTERM, stop_server);
+    std::cout << "Serving on " << args.serve_path << std::endl;
+    server.run ();
+    active_server = nullptr;
+
+    std::cout << "Served " << server.served () << " request(s)" << std::endl;
+    save_cache (args, cache);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * --connect: compile the input on a running server
+ */
+static int compile_remote (const Args& args, const std::string& out_path)
+{
+    int fd = connect_server (args.connect_path);
+    if (fd < 0)
+    {
+        std::cerr << "No server on " << args.connect_path << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    CompileResult result;
+    std::string output;
+    bool answered = request_compile (fd, file_to_string (args.in_paths[0]), args.options,
+                                     result, output, args.unroll_factor);
+    close (fd);
+    if (!answered)
+    {
+        std::cerr << "Lost the connection to " << args.connect_path << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << result.messages;
+    std::cerr << result.errors;
+    if (result.ok && !string_to_file (output, out_path))
+    {
+        std::cerr << "Could not write " << out_path << std::endl;
+        return EXIT_FAILURE;
+    }
+    return result.ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 /**
@@ -85,44 +282,67 @@ int main (int argc, char* argv[])
     if (!args)
         return EXIT_FAILURE;
 
-    // Get tokens
-    Lexer lexer (std::string {args->in_path.data ()});
-    auto tokens = lexer.get_tokens ();
+    // One file still spreads its functions over the threads, unless -j1
+    std::optional<ThreadPool> pool;
+    if (args->in_paths.size () == 1 && args->threads != 1 && args->connect_path.empty ())
+        pool.emplace (args->threads);
+    ThreadPool* functions = pool ? &*pool : nullptr;
 
-    // Parse tokens
-    Program program;
-    try
+    std::optional<FunctionCache> cache;
+    if (!args->cache_dir.empty ())
     {
-        Parser parser {tokens};
-        program = parser.parse ();
-        std::cout << "Parsing successful: "
-                  << program.functions.size () << " function(s)" << std::endl;
-    }
-    catch (const ParseError& e)
-    {
-        std::cerr << "Parse error [" << e.loc.line << ":"
-                  << e.loc.col << "]: " << e.what () << std::endl;
-        return EXIT_FAILURE;
+        cache.emplace (args->cache_dir);
+        args->options.cache = &*cache;
     }
+    if (!args->serve_path.empty ())
+        return serve (*args, cache);
 
-    // Optimize (optional, enabled with -O)
-    if (args->optimize)
+    if (args->run)
     {
-        Optimizer optimizer;
-        optimizer.optimize (program);
-        std::cout << "Optimization applied" << std::endl;
+        CompileResult result = run_file (args->in_paths[0], args->options, functions);
+        std::cout << result.messages;
+        std::cerr << result.errors;
+        write_reports (*args, {result});
+        save_cache (*args, cache);
+        return result.ok ? result.value : EXIT_FAILURE;
     }
 
-    // Generate assembly
-    try
+    // Outputs follow the inputs' names unless -o gives one
+    std::vector<CompileJob> jobs;
+    for (const auto& in_path : args->in_paths)
+        jobs.push_back ({in_path, args->out_path.empty ()
+                                      ? output_path (in_path, args->options.object,
+                                                     args->out_dir)
+                                      : args->out_path});
+
+    if (!args->connect_path.empty ())
+        return compile_remote (*args, jobs[0].out_path);
+
+    if (jobs.size () == 1)
     {
-        Codegen codegen {program};
-        string_to_file (codegen.get_assembly (), args->out_path.data ());
+        CompileResult result = compile_file (jobs[0], args->options, functions);
+        std::cout << result.messages;
+        std::cerr << result.errors;
+        write_reports (*args, {result});
+        save_cache (*args, cache);
+        return result.ok ? EXIT_SUCCESS : EXIT_FAILURE;
     }
-    catch(const std::exception& e)
+
+    // Batch: files and their functions compile in parallel, reports are
+    // printed in input order
+    std::vector<CompileResult> results = compile_batch (jobs, args->options,
+                                                        args->threads);
+    size_t compiled = 0;
+    for (size_t i = 0; i < results.size (); ++i)
     {
-        std::cerr << "Codegen error: " << e.what() << std::endl;
+        if (results[i].ok)
+            ++compiled;
+        else
+            std::cerr << jobs[i].in_path << ": " << results[i].errors;
     }
+    std::cout << "Compiled " << compiled << "/" << jobs.size () << " file(s)" << std::endl;
+    write_reports (*args, results);
+    save_cache (*args, cache);
 
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+    return compiled == jobs.size () ? EXIT_SUCCESS : EXIT_FAILURE;
+}
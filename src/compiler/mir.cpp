@@ -0,0 +1,386 @@
+/**
+ * @file mir.cpp
+ * @brief Machine IR register sets and Intel-syntax printer
+ */
+
+#include "mir.hpp"
+#include <initializer_list>
+
+namespace
+{
+
+const char* reg_names[REG_COUNT][3] =
+{
+    {"al",   "eax",  "rax"},
+    {"cl",   "ecx",  "rcx"},
+    {"dl",   "edx",  "rdx"},
+    {"bl",   "ebx",  "rbx"},
+    {"spl",  "esp",  "rsp"},
+    {"bpl",  "ebp",  "rbp"},
+    {"sil",  "esi",  "rsi"},
+    {"dil",  "edi",  "rdi"},
+    {"r8b",  "r8d",  "r8"},
+    {"r9b",  "r9d",  "r9"},
+    {"r10b", "r10d", "r10"},
+    {"r11b", "r11d", "r11"},
+    {"r12b", "r12d", "r12"},
+    {"r13b", "r13d", "r13"},
+    {"r14b", "r14d", "r14"},
+    {"r15b", "r15d", "r15"},
+};
+
+const char* mnemonics[] =
+{
+    "",     "mov",  "movzx", "lea",  "push", "pop",  "add",  "sub",
+    "imul", "imul", "imul",  "idiv", "cdq",  "neg",  "shl",  "sar",
+    "shr",  "and",  "or",    "test", "cmp",  "sete", "setne", "setl",
+    "setg", "jmp",  "je",    "jne",  "jl",   "jge",  "jg",   "jle",
+    "ja",   "call", "jmp",   "ret",  "jmp",  ".long", "movd", "movdqa",
+    "pshufd", "pinsrd", "paddd", "psubd", "pmulld",
+};
+
+static_assert (sizeof (mnemonics) / sizeof (mnemonics[0])
+               == static_cast<size_t> (Opcode::PMULLD) + 1,
+               "mnemonic table out of sync with Opcode");
+
+const char* ptr_names[] = {"BYTE PTR ", "DWORD PTR ", "QWORD PTR "};
+
+void put_label (Emitter& out, int32_t id)
+{
+    out.raw (".L");
+    out.number (id);
+}
+
+/**
+ * Register or, before allocation, virtual register inside an address
+ */
+void put_address_reg (Emitter& out, const Operand& operand)
+{
+    if (operand.is_vreg ())
+    {
+        out.raw ("%v");
+        out.number (operand.value);
+    }
+    else
+        out.raw (reg_name (operand.reg, Width::B64));
+}
+
+/**
+ * lea's [base + index * scale] or [base + displacement]
+ */
+void put_address (Emitter& out, const Operand& base, const Operand& extra)
+{
+    out.raw ('[');
+    put_address_reg (out, base);
+    if (extra.is_imm ())
+    {
+        out.raw (extra.value < 0 ? " - " : " + ");
+        out.number (extra.value < 0 ? -static_cast<int64_t> (extra.value)
+                                    : extra.value);
+    }
+    else if (extra.kind != OperandKind::NONE)
+    {
+        out.raw (" + ");
+        put_address_reg (out, extra);
+        if (extra.scale != 1)
+        {
+            out.raw ('*');
+            out.number (extra.scale);
+        }
+    }
+    out.raw (']');
+}
+
+void put_operand (Emitter& out, const MProgram& prog, Opcode op,
+                  const Operand& operand)
+{
+    switch (operand.kind)
+    {
+        case OperandKind::NONE:
+            break;
+
+        case OperandKind::REG:
+            out.raw (reg_name (operand.reg, operand.width));
+            break;
+
+        case OperandKind::IMM:
+            out.number (operand.value);
+            break;
+
+        case OperandKind::MEM:
+            // lea takes a bare address
+            if (op != Opcode::LEA)
+                out.raw (ptr_names[static_cast<size_t> (operand.width)]);
+            out.raw ('[');
+            out.raw (reg_name (operand.reg, Width::B64));
+            out.raw (' ');
+            if (operand.value < 0)
+            {
+                out.raw ("- ");
+                out.number (-static_cast<int64_t> (operand.value));
+            }
+            else
+            {
+                out.raw ("+ ");
+                out.number (operand.value);
+            }
+            out.raw (']');
+            break;
+
+        case OperandKind::LABEL:
+            put_label (out, operand.value);
+            break;
+
+        case OperandKind::SYMBOL:
+            out.raw (prog.symbols[operand.value]);
+            break;
+
+        // Only seen when printing MIR before allocation
+        case OperandKind::VREG:
+            out.raw ("%v");
+            out.number (operand.value);
+            if (operand.width == Width::B8)
+                out.raw (".b");
+            break;
+
+        case OperandKind::FRAME:
+            out.raw (ptr_names[static_cast<size_t> (operand.width)]);
+            out.raw ("[frame ");
+            out.number (operand.value);
+            out.raw (']');
+            break;
+
+        case OperandKind::XMM:
+            out.raw ("xmm");
+            out.number (operand.value);
+            break;
+    }
+}
+
+constexpr RegMask mask_of (std::initializer_list<Reg> regs)
+{
+    RegMask mask = 0;
+    for (Reg reg : regs)
+        mask |= RegMask {1} << static_cast<unsigned> (reg);
+    return mask;
+}
+
+constexpr RegMask CALLER_SAVED = mask_of ({Reg::RAX, Reg::RCX, Reg::RDX,
+                                           Reg::RSI, Reg::RDI, Reg::R8,
+                                           Reg::R9,  Reg::R10, Reg::R11});
+constexpr RegMask CALLEE_SAVED = mask_of ({Reg::RBX, Reg::RBP, Reg::R12,
+                                           Reg::R13, Reg::R14, Reg::R15});
+
+/**
+ * Physical registers in explicit operands with the given access
+ */
+RegMask explicit_regs (const MInst& inst, uint8_t access)
+{
+    RegMask mask = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+        const Operand& operand = inst.ops[i];
+        if (operand.is_reg () && (operand_access (inst.op, i) & access))
+            mask |= reg_bit (operand.reg);
+        else if (operand.is_mem () && (access & ACCESS_USE))
+            mask |= reg_bit (operand.reg);     // Address base
+    }
+    return mask;
+}
+
+} // namespace
+
+uint8_t operand_access (Opcode op, int index)
+{
+    switch (op)
+    {
+        case Opcode::MOV:
+        case Opcode::MOVZX:
+        case Opcode::LEA:
+        case Opcode::IMUL_IMM:
+        case Opcode::MOVD:
+        case Opcode::MOVDQA:
+        case Opcode::PSHUFD:
+            return index == 0 ? ACCESS_DEF : ACCESS_USE;
+        case Opcode::ADD:
+        case Opcode::SUB:
+        case Opcode::IMUL:
+        case Opcode::SHL:
+        case Opcode::SAR:
+        case Opcode::SHR:
+        case Opcode::AND:
+        case Opcode::OR:
+        case Opcode::PINSRD:
+        case Opcode::PADDD:
+        case Opcode::PSUBD:
+        case Opcode::PMULLD:
+            return index == 0 ? ACCESS_USE | ACCESS_DEF : ACCESS_USE;
+        case Opcode::NEG:
+            return index == 0 ? ACCESS_USE | ACCESS_DEF : 0;
+        case Opcode::SETE:
+        case Opcode::SETNE:
+        case Opcode::SETL:
+        case Opcode::SETG:
+        case Opcode::POP:
+            return index == 0 ? ACCESS_DEF : 0;
+        case Opcode::TEST:
+        case Opcode::CMP:
+            return ACCESS_USE;
+        case Opcode::PUSH:
+        case Opcode::IMUL_WIDE:
+        case Opcode::IDIV:
+        case Opcode::JMP_TABLE:
+            return index == 0 ? ACCESS_USE : 0;
+        default:
+            return 0;
+    }
+}
+
+RegMask inst_uses (const MInst& inst)
+{
+    RegMask rsp = reg_bit (Reg::RSP);
+    RegMask mask = explicit_regs (inst, ACCESS_USE);
+
+    switch (inst.op)
+    {
+        case Opcode::PUSH:
+        case Opcode::POP:
+            return mask | rsp;
+        case Opcode::IMUL_WIDE:
+            return mask | reg_bit (Reg::RAX);
+        case Opcode::IDIV:
+            return mask | reg_bit (Reg::RAX) | reg_bit (Reg::RDX);
+        case Opcode::CDQ:
+            return reg_bit (Reg::RAX);
+        case Opcode::CALL:
+            for (int32_t i = 0; i < inst.ops[1].value; ++i)
+                mask |= reg_bit (ARG_REGS[i]);
+            return mask | rsp;
+        case Opcode::TAIL_CALL:
+            for (int32_t i = 0; i < inst.ops[1].value; ++i)
+                mask |= reg_bit (ARG_REGS[i]);
+            return mask | CALLEE_SAVED | rsp;
+        case Opcode::RET:
+            return reg_bit (Reg::RAX) | CALLEE_SAVED | rsp;
+        default:
+            return mask;
+    }
+}
+
+RegMask inst_defs (const MInst& inst)
+{
+    RegMask rsp = reg_bit (Reg::RSP);
+    RegMask mask = explicit_regs (inst, ACCESS_DEF);
+
+    switch (inst.op)
+    {
+        case Opcode::PUSH:
+        case Opcode::POP:
+            return mask | rsp;
+        case Opcode::IMUL_WIDE:
+        case Opcode::IDIV:
+            return reg_bit (Reg::RAX) | reg_bit (Reg::RDX);
+        case Opcode::CDQ:
+            return reg_bit (Reg::RDX);
+        case Opcode::CALL:
+            return CALLER_SAVED;
+        case Opcode::JMP_TABLE:
+            // The index is overwritten with the entry
+            return explicit_regs (inst, ACCESS_USE) | reg_bit (Reg::R11);
+        default:
+            return mask;
+    }
+}
+
+const char* reg_name (Reg reg, Width width)
+{
+    return reg_names[static_cast<size_t> (reg)][static_cast<size_t> (width)];
+}
+
+size_t inst_count (const MProgram& prog)
+{
+    size_t count = 0;
+    for (const auto& func : prog.functions)
+        for (const auto& inst : func.code)
+            if (inst.op != Opcode::LABEL)
+                ++count;
+    return count;
+}
+
+void print_asm_header (Emitter& out)
+{
+    out.raw (".intel_syntax noprefix\n.global main\n\n");
+}
+
+void print_asm (const MProgram& prog, const MFunction& func, Emitter& out)
+{
+    out.label (func.name);
+
+    for (const auto& inst : func.code)
+    {
+        if (inst.op == Opcode::LABEL)
+        {
+            put_label (out, inst.ops[0].value);
+            out.raw (":\n");
+            continue;
+        }
+
+        // Table entries are offsets from the table, so they need no
+        // relocation
+        if (inst.op == Opcode::CASE)
+        {
+            out.raw ("    .long ");
+            put_label (out, inst.ops[0].value);
+            out.raw (" - ");
+            put_label (out, inst.ops[1].value);
+            out.raw ('\n');
+            continue;
+        }
+
+        if (inst.op == Opcode::JMP_TABLE)
+        {
+            Operand index = inst.ops[0];
+            index.width = Width::B64;
+            out.raw ("    lea r11, [rip + ");
+            put_label (out, inst.ops[1].value);
+            out.raw ("]\n    movsxd ");
+            put_operand (out, prog, inst.op, index);
+            out.raw (", DWORD PTR ");
+            put_address (out, Operand::make_reg (Reg::R11), index.scaled (4));
+            out.raw ("\n    add ");
+            put_operand (out, prog, inst.op, index);
+            out.raw (", r11\n    jmp ");
+            put_operand (out, prog, inst.op, index);
+            out.raw ('\n');
+            continue;
+        }
+
+        out.raw ("    ");
+        out.raw (mnemonics[static_cast<size_t> (inst.op)]);
+        if (inst.op == Opcode::LEA && !inst.ops[1].is_mem ())
+        {
+            out.raw (' ');
+            put_operand (out, prog, inst.op, inst.ops[0]);
+            out.raw (", ");
+            put_address (out, inst.ops[1], inst.ops[2]);
+            out.raw ('\n');
+            continue;
+        }
+
+        // call's second operand is its argument count, not printed
+        int count = inst.op == Opcode::CALL || inst.op == Opcode::TAIL_CALL ? 1 : 3;
+        for (int i = 0; i < count && inst.ops[i].kind != OperandKind::NONE; ++i)
+        {
+            out.raw (i == 0 ? " " : ", ");
+            put_operand (out, prog, inst.op, inst.ops[i]);
+        }
+        out.raw ('\n');
+    }
+}
+
+void print_asm (const MProgram& prog, Emitter& out)
+{
+    print_asm_header (out);
+    for (const auto& func : prog.functions)
+        print_asm (prog, func, out);
+}
@@ -0,0 +1,281 @@
+/**
+ * @file mir.hpp
+ * @brief Machine-level IR: x86-64 instructions with typed operands.
+ *
+ * Codegen lowers the SSA IR into MIR over virtual registers, the register
+ * allocator and frame lowering turn it into real x86-64, passes may rewrite
+ * it, and print_asm renders it as Intel-syntax text.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "emitter.hpp"
+
+/**
+ * General purpose registers, in hardware encoding order
+ */
+enum class Reg : uint8_t
+{
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8,  R9,  R10, R11, R12, R13, R14, R15,
+    NONE
+};
+
+static constexpr size_t REG_COUNT = 16;
+
+enum class Width : uint8_t
+{
+    B8,
+    B32,
+    B64
+};
+
+enum class Opcode : uint8_t
+{
+    LABEL,          // Pseudo: ops[0] = label
+    MOV,
+    MOVZX,
+    LEA,            // ops[1] = base: [rbp + value] or a register, then
+                    // ops[2] = index register (times its scale) or displacement
+    PUSH,
+    POP,
+    ADD,
+    SUB,
+    IMUL,
+    IMUL_IMM,       // ops[0] = ops[1] * ops[2] (immediate)
+    IMUL_WIDE,      // edx:eax = eax * ops[0]
+    IDIV,
+    CDQ,
+    NEG,
+    SHL,
+    SAR,
+    SHR,
+    AND,
+    OR,
+    TEST,
+    CMP,
+    SETE,
+    SETNE,
+    SETL,
+    SETG,
+    JMP,
+    JE,
+    JNE,
+    JL,
+    JGE,
+    JG,
+    JLE,
+    JA,             // Unsigned, for range checks
+    CALL,           // ops[0] = symbol, ops[1] = argument count
+    TAIL_CALL,      // Like call, but jumps after the epilogue: the callee
+                    // returns to this function's caller
+    RET,
+    JMP_TABLE,      // Jump through ops[1]'s entry ops[0] (an unsigned index,
+                    // clobbered); r11 holds the table address
+    CASE,           // Data: entry of table ops[1], label ops[0] minus the
+                    // table's address
+
+    // SSE on four int lanes (pinsrd and pmulld need SSE4.1)
+    MOVD,           // Lane 0 of an xmm register from a register (the others
+                    // cleared), or back
+    MOVDQA,
+    PSHUFD,         // ops[0] lane i = ops[1] lane (ops[2] >> 2i & 3)
+    PINSRD,         // ops[0] lane ops[2] = ops[1]
+    PADDD,
+    PSUBD,
+    PMULLD
+};
+
+enum class OperandKind : uint8_t
+{
+    NONE,
+    REG,
+    IMM,
+    MEM,            // [reg + value], reg is rbp, or rsp without a frame
+    LABEL,          // .L<value>
+    SYMBOL,         // MProgram::symbols[value]
+    VREG,           // Virtual register <value>, before allocation
+    FRAME,          // Stack slot <value>, before frame lowering
+    XMM             // xmm<value>, never allocated
+};
+
+/**
+ * Instruction operand (8 bytes)
+ */
+struct Operand
+{
+    OperandKind kind = OperandKind::NONE;
+    Width width = Width::B32;
+    Reg reg = Reg::NONE;
+    uint8_t scale = 1;              // As an lea index: 1, 2, 4 or 8
+    int32_t value = 0;
+
+    static Operand make_reg (Reg r, Width w = Width::B32)
+    {
+        return {OperandKind::REG, w, r, 1, 0};
+    }
+
+    static Operand make_imm (int32_t v)
+    {
+        return {OperandKind::IMM, Width::B32, Reg::NONE, 1, v};
+    }
+
+    static Operand make_mem (int32_t offset, Width w = Width::B32, Reg base = Reg::RBP)
+    {
+        return {OperandKind::MEM, w, base, 1, offset};
+    }
+
+    static Operand make_label (uint32_t id)
+    {
+        return {OperandKind::LABEL, Width::B64, Reg::NONE, 1,
+                static_cast<int32_t> (id)};
+    }
+
+    static Operand make_symbol (uint32_t id)
+    {
+        return {OperandKind::SYMBOL, Width::B64, Reg::NONE, 1,
+                static_cast<int32_t> (id)};
+    }
+
+    static Operand make_vreg (uint32_t id, Width w = Width::B32)
+    {
+        return {OperandKind::VREG, w, Reg::NONE, 1, static_cast<int32_t> (id)};
+    }
+
+    static Operand make_frame (uint32_t slot, Width w = Width::B32)
+    {
+        return {OperandKind::FRAME, w, Reg::NONE, 1, static_cast<int32_t> (slot)};
+    }
+
+    static Operand make_xmm (uint32_t id)
+    {
+        return {OperandKind::XMM, Width::B32, Reg::NONE, 1, static_cast<int32_t> (id)};
+    }
+
+    /**
+     * This register as an lea index times scale
+     */
+    Operand scaled (uint8_t s) const
+    {
+        Operand index = *this;
+        index.scale = s;
+        return index;
+    }
+
+    bool is_reg () const { return kind == OperandKind::REG; }
+    bool is_reg (Reg r) const { return kind == OperandKind::REG && reg == r; }
+    bool is_imm () const { return kind == OperandKind::IMM; }
+    bool is_mem () const { return kind == OperandKind::MEM; }
+    bool is_label () const { return kind == OperandKind::LABEL; }
+    bool is_vreg () const { return kind == OperandKind::VREG; }
+    bool is_frame () const { return kind == OperandKind::FRAME; }
+    bool is_xmm () const { return kind == OperandKind::XMM; }
+
+    bool operator == (const Operand&) const = default;
+};
+
+/**
+ * One instruction, destination first (Intel order)
+ * Only lea, imul_imm, pshufd and pinsrd use the third operand.
+ */
+struct MInst
+{
+    Opcode op;
+    Operand ops[3] {};
+
+    bool operator == (const MInst&) const = default;
+};
+
+struct MFunction
+{
+    std::string name;
+    std::vector<MInst> code;
+    uint32_t vreg_count = 0;
+    uint32_t frame_slots = 0;       // 4-byte spill slots
+    uint32_t spills = 0;            // Virtual registers living in those slots
+    uint32_t param_count = 0;
+};
+
+struct MProgram
+{
+    std::vector<MFunction> functions;
+    std::vector<std::string> symbols;   // Call targets
+    bool specialized = false;           // Interprocedural passes ran (-O): only
+                                        // main still takes any caller's arguments
+};
+
+/**
+ * Set of registers, bit i = Reg i
+ */
+using RegMask = uint32_t;
+
+inline RegMask reg_bit (Reg reg)
+{
+    return reg == Reg::NONE ? 0 : RegMask {1} << static_cast<unsigned> (reg);
+}
+
+/**
+ * System V argument registers, in order
+ */
+static constexpr Reg ARG_REGS[] = {Reg::RDI, Reg::RSI, Reg::RDX,
+                                   Reg::RCX, Reg::R8,  Reg::R9};
+
+/**
+ * Vector values get xmm0 to xmm14 (see MAX_VECTOR_VALUES), xmm15 is scratch
+ * for the lane sums. Nothing is live in them across a call.
+ */
+static constexpr uint32_t VECTOR_SCRATCH = 15;
+
+static constexpr Reg CALLEE_SAVED_REGS[] = {Reg::RBX, Reg::R12, Reg::R13,
+                                            Reg::R14, Reg::R15};
+
+/**
+ * True for jmp and the conditional jumps (not jmp_table, which has a
+ * table of targets)
+ */
+inline bool is_jump (Opcode op)
+{
+    return op >= Opcode::JMP && op <= Opcode::JA;
+}
+
+/**
+ * How an instruction accesses its explicit operand ops[index]
+ * setcc counts as a full write: its result is always zero-extended next.
+ */
+static constexpr uint8_t ACCESS_USE = 1;
+static constexpr uint8_t ACCESS_DEF = 2;
+
+uint8_t operand_access (Opcode op, int index);
+
+/**
+ * Physical registers read / written by an instruction, explicit and
+ * implicit. call reads its argument registers and writes the caller-saved
+ * set, ret reads rax and the callee-saved set, jmp_table writes its index
+ * and r11.
+ */
+RegMask inst_uses (const MInst& inst);
+RegMask inst_defs (const MInst& inst);
+
+/**
+ * Register name at the given width, e.g. (RBX, B32) -> "ebx"
+ */
+const char* reg_name (Reg reg, Width width);
+
+/**
+ * Instructions in a program, labels excluded
+ */
+size_t inst_count (const MProgram& prog);
+
+/**
+ * Render MIR as Intel-syntax assembly
+ */
+void print_asm (const MProgram& prog, Emitter& out);
+
+/**
+ * The pieces of print_asm: the file header, then each function in turn
+ */
+void print_asm_header (Emitter& out);
+void print_asm (const MProgram& prog, const MFunction& func, Emitter& out);
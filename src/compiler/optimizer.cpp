@@ -4,101 +4,166 @@
  */
 
 #include "optimizer.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <utility>
 #include <variant>
 
+/********** OPERATOR EVALUATION **********/
+namespace
+{
+
 /**
- * Folds constant int expressions and cleans dead branches
+ * Bit-C ints wrap: do the arithmetic unsigned and convert back
  */
-void Optimizer::optimize (Program& program)
+int wrap (uint32_t val)
 {
-    for (auto& func : program.functions)
-        opt_function (func);
+    return static_cast<int> (val);
+}
+
 }
 
-/********** PRIVATE HELPERS **********/
-void Optimizer::opt_function (Function& func)
+std::optional<int> fold_unary (UnaryOp::Op op, int val)
 {
-    opt_block (func.body);
+    switch (op)
+    {
+        case UnaryOp::Op::NEGATE: return wrap (0u - static_cast<uint32_t> (val));
+        case UnaryOp::Op::NOT:    return val != 0 ? 0 : 1;
+    }
+    return std::nullopt;
 }
 
-void Optimizer::opt_block (Block& block)
+std::optional<int> fold_binary (BinaryOp::Op op, int l, int r)
 {
-    std::vector<Stmt> new_stmts;
-    for (auto& stmt : block.statements)
+    uint32_t ul = static_cast<uint32_t> (l);
+    uint32_t ur = static_cast<uint32_t> (r);
+    switch (op)
     {
-        auto replacements = opt_stmt (stmt);
-        for (auto& s : replacements)
-            new_stmts.push_back (std::move (s));
+        case BinaryOp::Op::ADD: return wrap (ul + ur);
+        case BinaryOp::Op::SUB: return wrap (ul - ur);
+        case BinaryOp::Op::MUL: return wrap (ul * ur);
+        // Like a zero divisor, INT_MIN / -1 traps in idiv: leave it to run time
+        case BinaryOp::Op::DIV: return r != 0 && !(l == INT_MIN && r == -1)
+                                       ? std::optional<int> {l / r}
+                                       : std::nullopt;
+        case BinaryOp::Op::EQ:  return l == r ? 1 : 0;
+        case BinaryOp::Op::NE:  return l != r ? 1 : 0;
+        case BinaryOp::Op::LT:  return l <  r ? 1 : 0;
+        case BinaryOp::Op::GT:  return l >  r ? 1 : 0;
+        case BinaryOp::Op::AND: return (l && r) ? 1 : 0;
+        case BinaryOp::Op::OR:  return (l || r) ? 1 : 0;
     }
-    block.statements = std::move (new_stmts);
+    return std::nullopt;
 }
 
-std::vector<Stmt> Optimizer::opt_stmt (Stmt& stmt)
+/********** PASS MANAGER **********/
+void PassManager::add (std::unique_ptr<AstPass> pass, unsigned level)
 {
-    bool replaced = false;
-    std::vector<Stmt> replacements;
+    passes_.push_back ({std::move (pass), level});
+}
 
-    std::visit ([this, &replaced, &replacements] (auto& node)
+bool PassManager::enable (std::string_view name, bool on)
+{
+    for (auto& entry : passes_)
     {
-        using T = std::decay_t<decltype (node)>;
-
-        if constexpr (std::is_same_v<T, VarDecl>)
+        if (entry.pass->name () == name)
         {
-            if (node.init.has_value ())
-                fold_expr (*node.init);
+            entry.on = on;
+            return true;
         }
-        else if constexpr (std::is_same_v<T, Assignment>)
-        {
-            fold_expr (node.value);
-        }
-        else if constexpr (std::is_same_v<T, ReturnStmt>)
-        {
-            fold_expr (node.value);
-        }
-        else if constexpr (std::is_same_v<T, IfStmt>)
-        {
-            // Fold condition first, then recurse into the body
-            auto val = fold_expr (node.condition);
-            opt_block (*node.then_block);
+    }
+    return false;
+}
 
-            if (val.has_value ())
-            {
-                replaced = true;
-                if (val.value () != 0)
-                {
-                    // If always true: inline the block
-                    replacements.push_back (
-                        Stmt {Block {std::move (node.then_block->statements)}});
-                }
-                // Always false: give no replacement
-            }
-        }
-        else if constexpr (std::is_same_v<T, WhileStmt>)
-        {
-            fold_expr (node.condition);
-            opt_block (*node.body);
-        }
-        else if constexpr (std::is_same_v<T, Block>)
-        {
-            opt_block (node);
-        }
-        else if constexpr (std::is_same_v<T, ExprStmt>)
+bool PassManager::enabled (std::string_view name, unsigned level) const
+{
+    for (const auto& entry : passes_)
+        if (entry.pass->name () == name)
+            return entry.on && level >= entry.level;
+    return false;
+}
+
+std::vector<std::string_view> PassManager::names () const
+{
+    std::vector<std::string_view> names;
+    for (const auto& entry : passes_)
+        names.push_back (entry.pass->name ());
+    return names;
+}
+
+size_t PassManager::run (Function& func, unsigned level) const
+{
+    size_t rounds = 0;
+    while (rounds < MAX_ROUNDS)
+    {
+        bool changed = false;
+        for (const auto& entry : passes_)
+            if (entry.on && level >= entry.level)
+                changed |= run_block (*entry.pass, func.body);
+        if (!changed)
+            break;
+        ++rounds;
+    }
+    return rounds;
+}
+
+bool PassManager::run_block (const AstPass& pass, Block& block) const
+{
+    // Kept statements slide down over removed ones, in place
+    std::vector<Stmt>& stmts = block.statements;
+    bool changed = false;
+    size_t kept = 0;
+    for (size_t i = 0; i < stmts.size (); ++i)
+    {
+        changed |= run_nested (pass, stmts[i]);
+        Rewrite rewrite = pass.stmt (stmts[i]);
+        if (rewrite == Rewrite::REMOVED)
         {
-            fold_expr (node.expression);
+            changed = true;
+            continue;
         }
-    }, stmt.node);
-
-    if (replaced)
-        return replacements;
+        changed |= rewrite == Rewrite::CHANGED;
+        if (kept != i)
+            stmts[kept] = std::move (stmts[i]);
+        ++kept;
+    }
+    stmts.erase (stmts.begin () + static_cast<std::ptrdiff_t> (kept), stmts.end ());
+    return pass.block (block) || changed;
+}
 
-    std::vector<Stmt> result;
-    result.push_back (std::move (stmt));
-    return result;
+bool PassManager::run_nested (const AstPass& pass, Stmt& stmt) const
+{
+    if (auto* node = std::get_if<IfStmt> (&stmt.node))
+        return run_block (pass, *node->then_block);
+    if (auto* node = std::get_if<WhileStmt> (&stmt.node))
+        return run_block (pass, *node->body);
+    if (auto* node = std::get_if<SwitchStmt> (&stmt.node))
+    {
+        bool changed = false;
+        for (auto& c : node->cases)
+            changed |= run_block (pass, *c.body);
+        if (node->default_body)
+            changed |= run_block (pass, *node->default_body);
+        return changed;
+    }
+    if (auto* node = std::get_if<Block> (&stmt.node))
+        return run_block (pass, *node);
+    return false;
 }
 
-std::optional<int> Optimizer::fold_expr (std::unique_ptr<Expr>& expr)
+/********** PASSES **********/
+namespace
 {
-    std::optional<int> result = std::visit ([this] (auto& node) -> std::optional<int>
+
+/**
+ * Fold constants in expr in place
+ * Returns the value if the whole expression is constant
+ */
+std::optional<int> fold_expr (Expr* expr, bool& changed)
+{
+    std::optional<int> result = std::visit ([&changed] (auto& node) -> std::optional<int>
     {
         using T = std::decay_t<decltype (node)>;
 
@@ -113,48 +178,317 @@ std::optional<int> Optimizer::fold_expr (std::unique_ptr<Expr>& expr)
         else if constexpr (std::is_same_v<T, FuncCall>)
         {
             for (auto& arg : node.args)
-                fold_expr (arg);
+                fold_expr (arg, changed);
             return std::nullopt;
         }
         else if constexpr (std::is_same_v<T, UnaryOp>)
         {
-            auto val = fold_expr (node.operand);
+            auto val = fold_expr (node.operand, changed);
             if (!val) return std::nullopt;
-            switch (node.op)
-            {
-                case UnaryOp::Op::NEGATE: return -val.value ();
-                case UnaryOp::Op::NOT:    return val.value () != 0 ? 0 : 1;
-            }
-            return std::nullopt;
+            return fold_unary (node.op, val.value ());
         }
         else if constexpr (std::is_same_v<T, BinaryOp>)
         {
-            auto lval = fold_expr (node.left);
-            auto rval = fold_expr (node.right);
+            auto lval = fold_expr (node.left, changed);
+            auto rval = fold_expr (node.right, changed);
             if (!lval || !rval) return std::nullopt;
-            int l = lval.value (), r = rval.value ();
-            switch (node.op)
-            {
-                case BinaryOp::Op::ADD: return l + r;
-                case BinaryOp::Op::SUB: return l - r;
-                case BinaryOp::Op::MUL: return l * r;
-                case BinaryOp::Op::DIV: return r != 0 ? std::optional<int> {l / r}
-                                                       : std::nullopt;
-                case BinaryOp::Op::EQ:  return l == r ? 1 : 0;
-                case BinaryOp::Op::NE:  return l != r ? 1 : 0;
-                case BinaryOp::Op::LT:  return l <  r ? 1 : 0;
-                case BinaryOp::Op::GT:  return l >  r ? 1 : 0;
-                case BinaryOp::Op::AND: return (l && r) ? 1 : 0;
-                case BinaryOp::Op::OR:  return (l || r) ? 1 : 0;
-            }
-            return std::nullopt;
+            return fold_binary (node.op, lval.value (), rval.value ());
         }
         return std::nullopt;
     }, expr->node);
 
-    // If value is foldable, fold it!
+    // If value is foldable, fold it! Node is rewritten in place, the folded
+    // children stay in the program arena until it is released
     if (result.has_value () && !std::holds_alternative<IntLiteral> (expr->node))
-        expr = std::make_unique<Expr> (Expr {IntLiteral {result.value ()}});
+    {
+        expr->node = IntLiteral {result.value ()};
+        changed = true;
+    }
 
     return result;
 }
+
+/**
+ * Constant int value of expr if it is a literal
+ */
+std::optional<int> literal (const Expr* expr)
+{
+    if (auto* lit = std::get_if<IntLiteral> (&expr->node))
+        return lit->value;
+    return std::nullopt;
+}
+
+/**
+ * Folds constant int expressions
+ */
+class FoldPass : public AstPass
+{
+public:
+    std::string_view name () const override { return "fold"; }
+
+    Rewrite stmt (Stmt& stmt) const override
+    {
+        bool changed = false;
+        std::visit ([&changed] (auto& node)
+        {
+            using T = std::decay_t<decltype (node)>;
+
+            if constexpr (std::is_same_v<T, VarDecl>)
+            {
+                if (node.init.has_value ())
+                    fold_expr (*node.init, changed);
+            }
+            else if constexpr (std::is_same_v<T, Assignment>
+                            || std::is_same_v<T, ReturnStmt>)
+                fold_expr (node.value, changed);
+            else if constexpr (std::is_same_v<T, IfStmt>
+                            || std::is_same_v<T, WhileStmt>)
+                fold_expr (node.condition, changed);
+            else if constexpr (std::is_same_v<T, SwitchStmt>)
+                fold_expr (node.value, changed);
+            else if constexpr (std::is_same_v<T, ExprStmt>)
+                fold_expr (node.expression, changed);
+        }, stmt.node);
+        return changed ? Rewrite::CHANGED : Rewrite::KEPT;
+    }
+};
+
+/**
+ * Body a switch runs for value, nullptr if none
+ */
+Block* switch_target (const SwitchStmt& node, int value)
+{
+    for (const auto& c : node.cases)
+        for (int v : c.values)
+            if (v == value)
+                return c.body;
+    return node.default_body;
+}
+
+/**
+ * Ifs and switches on a constant: the body that runs becomes a block, an
+ * if that never runs goes
+ */
+class BranchPass : public AstPass
+{
+public:
+    std::string_view name () const override { return "branches"; }
+
+    Rewrite stmt (Stmt& stmt) const override
+    {
+        Block* taken = nullptr;
+        if (auto* node = std::get_if<IfStmt> (&stmt.node))
+        {
+            std::optional<int> val = literal (node->condition);
+            if (!val)
+                return Rewrite::KEPT;
+            taken = *val != 0 ? node->then_block : nullptr;
+        }
+        else if (auto* node = std::get_if<SwitchStmt> (&stmt.node))
+        {
+            std::optional<int> val = literal (node->value);
+            if (!val)
+                return Rewrite::KEPT;
+            taken = switch_target (*node, *val);
+        }
+        else
+            return Rewrite::KEPT;
+
+        if (!taken)
+            return Rewrite::REMOVED;
+
+        // Still a block of its own: its declarations stay scoped
+        Block body {std::move (taken->statements)};
+        stmt.node = std::move (body);
+        return Rewrite::CHANGED;
+    }
+};
+
+/**
+ * Code that cannot run: loops whose condition is false from the start and
+ * whatever follows a return in the same block
+ */
+class UnreachablePass : public AstPass
+{
+public:
+    std::string_view name () const override { return "unreachable"; }
+
+    Rewrite stmt (Stmt& stmt) const override
+    {
+        auto* node = std::get_if<WhileStmt> (&stmt.node);
+        std::optional<int> val = node ? literal (node->condition) : std::nullopt;
+        return val == 0 ? Rewrite::REMOVED : Rewrite::KEPT;
+    }
+
+    bool block (Block& block) const override
+    {
+        std::vector<Stmt>& stmts = block.statements;
+        for (size_t i = 0; i + 1 < stmts.size (); ++i)
+        {
+            if (std::holds_alternative<ReturnStmt> (stmts[i].node))
+            {
+                stmts.erase (stmts.begin () + static_cast<std::ptrdiff_t> (i + 1), stmts.end ());
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+/**
+ * Whether stmt, or anything nested in it, declares or assigns name
+ */
+bool writes (const Stmt& stmt, const std::string& name)
+{
+    auto any = [&name] (const Block& block)
+    {
+        for (const auto& s : block.statements)
+            if (writes (s, name))
+                return true;
+        return false;
+    };
+
+    return std::visit ([&] (const auto& node)
+    {
+        using T = std::decay_t<decltype (node)>;
+
+        if constexpr (std::is_same_v<T, VarDecl> || std::is_same_v<T, Assignment>)
+            return node.name == name;
+        else if constexpr (std::is_same_v<T, IfStmt>)
+            return any (*node.then_block);
+        else if constexpr (std::is_same_v<T, WhileStmt>)
+            return any (*node.body);
+        else if constexpr (std::is_same_v<T, SwitchStmt>)
+        {
+            for (const auto& c : node.cases)
+                if (any (*c.body))
+                    return true;
+            return node.default_body && any (*node.default_body);
+        }
+        else if constexpr (std::is_same_v<T, Block>)
+            return any (node);
+        else
+            return false;
+    }, stmt.node);
+}
+
+/**
+ * The variable and constant of if (x == K) or if (K == x)
+ */
+struct CaseTest
+{
+    Expr* variable;
+    int value;
+};
+
+std::optional<CaseTest> case_test (const Stmt& stmt)
+{
+    auto* node = std::get_if<IfStmt> (&stmt.node);
+    auto* cmp = node ? std::get_if<BinaryOp> (&node->condition->node) : nullptr;
+    if (!cmp || cmp->op != BinaryOp::Op::EQ)
+        return std::nullopt;
+
+    for (auto [var, k] : {std::pair {cmp->left, cmp->right}, std::pair {cmp->right, cmp->left}})
+    {
+        std::optional<int> value = literal (k);
+        if (value && std::holds_alternative<Identifier> (var->node))
+            return CaseTest {var, *value};
+    }
+    return std::nullopt;
+}
+
+/**
+ * Runs of if (x == K) { ... } on one variable become a switch when at most
+ * one of them can run: the constants differ and no body writes x. Codegen
+ * lowers a switch to a jump table or a compare tree instead of one test per
+ * if.
+ */
+class SwitchPass : public AstPass
+{
+public:
+    static constexpr size_t MIN_CASES = 3;
+
+    std::string_view name () const override { return "switches"; }
+
+    Rewrite stmt (Stmt&) const override { return Rewrite::KEPT; }
+
+    bool block (Block& block) const override
+    {
+        std::vector<Stmt>& stmts = block.statements;
+        bool changed = false;
+        size_t kept = 0;
+        for (size_t i = 0; i < stmts.size ();)
+        {
+            size_t end = chain_end (stmts, i);
+            if (end - i < MIN_CASES)
+            {
+                if (kept != i)
+                    stmts[kept] = std::move (stmts[i]);
+                ++kept;
+                ++i;
+                continue;
+            }
+
+            // The tested expressions, literals and bodies stay in the arena
+            SwitchStmt node {case_test (stmts[i])->variable, {}, nullptr};
+            for (; i < end; ++i)
+                node.cases.push_back ({{case_test (stmts[i])->value},
+                                       std::get<IfStmt> (stmts[i].node).then_block});
+            stmts[kept++] = Stmt {std::move (node)};
+            changed = true;
+        }
+        stmts.erase (stmts.begin () + static_cast<std::ptrdiff_t> (kept), stmts.end ());
+        return changed;
+    }
+
+private:
+    /**
+     * End of the run of case tests starting at first (first if none)
+     */
+    static size_t chain_end (const std::vector<Stmt>& stmts, size_t first)
+    {
+        std::optional<CaseTest> head = case_test (stmts[first]);
+        if (!head)
+            return first;
+
+        const std::string& name = std::get<Identifier> (head->variable->node).name;
+        std::vector<int> seen;
+        size_t i = first;
+        for (; i < stmts.size (); ++i)
+        {
+            std::optional<CaseTest> test = case_test (stmts[i]);
+            if (!test || std::get<Identifier> (test->variable->node).name != name
+                || std::find (seen.begin (), seen.end (), test->value) != seen.end ())
+                break;
+
+            // A body that writes x could make a later test true as well
+            seen.push_back (test->value);
+            if (writes (stmts[i], name))
+            {
+                ++i;
+                break;
+            }
+        }
+        return i;
+    }
+};
+
+} // namespace
+
+/********** OPTIMIZER **********/
+Optimizer::Optimizer (unsigned level)
+    : level_ {level}
+{
+    passes_.add (std::make_unique<FoldPass> (), 1);
+    passes_.add (std::make_unique<BranchPass> (), 1);
+    passes_.add (std::make_unique<UnreachablePass> (), 2);
+    passes_.add (std::make_unique<SwitchPass> (), 2);
+}
+
+void Optimizer::optimize (Program& program, ThreadPool* pool)
+{
+    for_each_index (pool, program.functions.size (), [&] (size_t i)
+    {
+        passes_.run (program.functions[i], level_);
+    });
+}
@@ -1,26 +1,139 @@
 /**
  * @file optimizer.hpp
- * @brief Optional AST optimization passes.
+ * @brief Optional AST optimization passes, run by a pass manager.
+ *
+ * A pass looks at one statement at a time (and optionally at a block as a
+ * whole); the PassManager does the walking. It visits the statements of
+ * every block in place, nested ones before the statement holding them, and
+ * compacts the block over removed statements, so a walk that changes
+ * nothing moves and allocates nothing. The enabled passes are repeated
+ * until a round changes nothing.
  */
 
 #pragma once
 
 #include "ast.hpp"
+#include <memory>
 #include <optional>
+#include <string_view>
 #include <vector>
 
-class Optimizer
+class ThreadPool;
+
+/**
+ * Evaluate an operator on constant operands
+ * Returns nullopt if the result is not a compile-time constant (div by zero)
+ */
+std::optional<int> fold_unary (UnaryOp::Op op, int val);
+std::optional<int> fold_binary (BinaryOp::Op op, int l, int r);
+
+/**
+ * What a pass did with one statement
+ */
+enum class Rewrite
+{
+    KEPT,           // Untouched
+    CHANGED,        // Rewritten in place
+    REMOVED,        // To be dropped from its block
+};
+
+/**
+ * One AST rewrite
+ *
+ * Functions are optimized in parallel, so a pass keeps no state between
+ * calls.
+ */
+class AstPass
 {
 public:
-    void optimize (Program& program);
+    virtual ~AstPass () = default;
+
+    virtual std::string_view name () const = 0;
+
+    /**
+     * Rewrite stmt, whose nested blocks have been visited already
+     */
+    virtual Rewrite stmt (Stmt& stmt) const = 0;
+
+    /**
+     * Rewrite a block once its statements have been visited
+     * Returns whether anything changed
+     */
+    virtual bool block (Block&) const { return false; }
+};
+
+/**
+ * Registered passes and the levels that enable them
+ */
+class PassManager
+{
+public:
+    static constexpr size_t MAX_ROUNDS = 8;
+
+    /**
+     * Append pass, enabled at level and above
+     */
+    void add (std::unique_ptr<AstPass> pass, unsigned level = 1);
+
+    /**
+     * Switch the named pass on or off at every level
+     * Returns false if no pass has that name
+     */
+    bool enable (std::string_view name, bool on);
+
+    /**
+     * Whether the named pass runs at level
+     */
+    bool enabled (std::string_view name, unsigned level) const;
+
+    /**
+     * Names in registration (and running) order
+     */
+    std::vector<std::string_view> names () const;
+
+    /**
+     * Run the passes enabled at level over func, in order, until a round
+     * changes nothing or MAX_ROUNDS
+     * Returns the rounds that changed something
+     */
+    size_t run (Function& func, unsigned level) const;
 
 private:
-    void opt_function (Function& func);
-    void opt_block    (Block& block);
+    struct Entry
+    {
+        std::unique_ptr<AstPass> pass;
+        unsigned level;
+        bool on = true;             // enable () override
+    };
+
+    std::vector<Entry> passes_ {};
+
+    bool run_block (const AstPass& pass, Block& block) const;
+    bool run_nested (const AstPass& pass, Stmt& stmt) const;
+};
 
-    // Returns replacement stmts: empty = remove, one/more = substitute
-    std::vector<Stmt> opt_stmt (Stmt& stmt);
+/**
+ * The AST passes of -O1 and -O2
+ *
+ * -O1: fold (constant expressions) and branches (ifs and switches on
+ * constants). -O2 adds unreachable (statements after a return, loops that
+ * never run) and switches (runs of if (x == K) turned into a switch).
+ * More passes plug in through passes ().
+ */
+class Optimizer
+{
+public:
+    explicit Optimizer (unsigned level = 2);
+
+    /**
+     * Optimize every function, in parallel with a pool (functions share no
+     * AST nodes)
+     */
+    void optimize (Program& program, ThreadPool* pool = nullptr);
 
-    // Folds constants in-place and returns constant value if whole expr is constant
-    std::optional<int> fold_expr (std::unique_ptr<Expr>& expr);
+    PassManager& passes () { return passes_; }
+
+private:
+    unsigned level_;
+    PassManager passes_ {};
 };
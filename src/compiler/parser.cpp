@@ -4,28 +4,57 @@
  */
 
 #include "parser.hpp"
+#include <climits>
 #include <sstream>
+#include <unordered_set>
 
-Parser::Parser (const std::vector<Token>& tokens)
+Parser::Parser (std::span<const Token> tokens)
     : tokens_ (tokens) {}
 
+Parser::Parser (Lexer& lexer)
+    : lexer_ (&lexer)
+{
+    fill ();
+}
+
 /********** TOKEN NAVIGATION **********/
+const Token& Parser::at (size_t index) const
+{
+    if (lexer_)
+        return ring_[index % RING_SIZE];
+
+    return tokens_[index];
+}
+
+void Parser::fill ()
+{
+    while (pulled_ <= current_ + 1)
+    {
+        ring_[pulled_ % RING_SIZE] = lexer_->next_token ();
+        pulled_++;
+    }
+}
+
 const Token& Parser::peek () const
 {
-    return tokens_[current_];
+    return at (current_);
 }
 
 const Token& Parser::next ()
 {
     if (!is_at_end ())
+    {
         current_++;
+        if (lexer_)
+            fill ();
+    }
 
     return prev ();
 }
 
 const Token& Parser::prev () const
 {
-    return tokens_[current_ - 1];
+    return at (current_ - 1);
 }
 
 bool Parser::is_at_end () const
@@ -41,6 +70,14 @@ bool Parser::check (TokenType type) const
     return peek ().type == type;
 }
 
+bool Parser::check_next (TokenType type) const
+{
+    if (!lexer_ && current_ + 1 >= tokens_.size ())
+        return false;
+
+    return at (current_ + 1).type == type;
+}
+
 bool Parser::match (TokenType type)
 {
     if (check (type))
@@ -60,44 +97,38 @@ const Token& Parser::expect (TokenType type, const std::string& msg)
 }
 
 /********** EXPRESSIONS **********/
-std::unique_ptr<Expr> Parser::expression ()
+Expr* Parser::expression ()
 {
     return logic_or ();     // Precedence climbing
 }
 
-std::unique_ptr<Expr> Parser::logic_or ()
+Expr* Parser::logic_or ()
 {
     auto left = logic_and ();
 
     while (match (TokenType::OR_CMP))
     {
         auto right = logic_and ();
-        auto bin = std::make_unique<Expr> ();
-        bin->node = BinaryOp {BinaryOp::Op::OR,
-                              std::move (left), std::move (right)};
-        left = std::move (bin);
+        left = make_expr (BinaryOp {BinaryOp::Op::OR, left, right});
     }
 
     return left;
 }
 
-std::unique_ptr<Expr> Parser::logic_and ()
+Expr* Parser::logic_and ()
 {
     auto left = comparison ();
 
     while (match (TokenType::AND_CMP))
     {
         auto right = comparison ();
-        auto bin = std::make_unique<Expr> ();
-        bin->node = BinaryOp {BinaryOp::Op::AND,
-                              std::move (left), std::move (right)};
-        left = std::move (bin);
+        left = make_expr (BinaryOp {BinaryOp::Op::AND, left, right});
     }
 
     return left;
 }
 
-std::unique_ptr<Expr> Parser::comparison ()
+Expr* Parser::comparison ()
 {
     auto left = addition ();
 
@@ -111,15 +142,13 @@ std::unique_ptr<Expr> Parser::comparison ()
         else break;
 
         auto right = addition ();
-        auto bin = std::make_unique<Expr> ();
-        bin->node = BinaryOp {op, std::move (left), std::move (right)};
-        left = std::move (bin);
+        left = make_expr (BinaryOp {op, left, right});
     }
 
     return left;
 }
 
-std::unique_ptr<Expr> Parser::addition ()
+Expr* Parser::addition ()
 {
     auto left = multiplication ();
 
@@ -131,15 +160,13 @@ std::unique_ptr<Expr> Parser::addition ()
         else break;
 
         auto right = multiplication ();
-        auto bin = std::make_unique<Expr> ();
-        bin->node = BinaryOp {op, std::move (left), std::move (right)};
-        left = std::move (bin);
+        left = make_expr (BinaryOp {op, left, right});
     }
 
     return left;
 }
 
-std::unique_ptr<Expr> Parser::multiplication ()
+Expr* Parser::multiplication ()
 {
     auto left = unary ();
 
@@ -151,44 +178,36 @@ std::unique_ptr<Expr> Parser::multiplication ()
         else break;
 
         auto right = unary ();
-        auto bin = std::make_unique<Expr> ();
-        bin->node = BinaryOp {op, std::move (left), std::move (right)};
-        left = std::move (bin);
+        left = make_expr (BinaryOp {op, left, right});
     }
 
     return left;
 }
 
-std::unique_ptr<Expr> Parser::unary ()
+Expr* Parser::unary ()
 {
     if (match (TokenType::SUB_OP))
     {
         auto operand = unary ();
-        auto expr = std::make_unique<Expr> ();
-        expr->node = UnaryOp {UnaryOp::Op::NEGATE, std::move (operand)};
-        return expr;
+        return make_expr (UnaryOp {UnaryOp::Op::NEGATE, operand});
     }
 
     if (match (TokenType::NOT_OP))
     {
         auto operand = unary ();
-        auto expr = std::make_unique<Expr> ();
-        expr->node = UnaryOp {UnaryOp::Op::NOT, std::move (operand)};
-        return expr;
+        return make_expr (UnaryOp {UnaryOp::Op::NOT, operand});
     }
 
     return primary ();
 }
 
-std::unique_ptr<Expr> Parser::primary ()
+Expr* Parser::primary ()
 {
     // Integer literal
     if (match (TokenType::INT_LITERAL))
     {
-        auto expr = std::make_unique<Expr> ();
         int value = std::stoi (std::string {prev ().lexeme});
-        expr->node = IntLiteral {value};
-        return expr;
+        return make_expr (IntLiteral {value});
     }
 
     // Identifier or function call
@@ -199,7 +218,7 @@ std::unique_ptr<Expr> Parser::primary ()
         // Function call: identifier followed by '('
         if (match (TokenType::L_PAREN))
         {
-            std::vector<std::unique_ptr<Expr>> args;
+            std::vector<Expr*> args;
 
             if (!check (TokenType::R_PAREN))
             {
@@ -210,14 +229,10 @@ std::unique_ptr<Expr> Parser::primary ()
 
             expect (TokenType::R_PAREN, "expected ')' after arguments");
 
-            auto expr = std::make_unique<Expr> ();
-            expr->node = FuncCall {std::move (name), std::move (args)};
-            return expr;
+            return make_expr (FuncCall {std::move (name), std::move (args)});
         }
 
-        auto expr = std::make_unique<Expr> ();
-        expr->node = Identifier {std::move (name)};
-        return expr;
+        return make_expr (Identifier {std::move (name)});
     }
 
     // Parenthesized expression
@@ -246,6 +261,12 @@ Stmt Parser::statement ()
     if (check (TokenType::WHILE))
         return while_statement ();
 
+    if (check (TokenType::SWITCH))
+        return switch_statement ();
+
+    if (check (TokenType::BREAK))
+        throw ParseError ("'break' only ends a switch case", peek ().start);
+
     if (check (TokenType::L_BRACE))
     {
         auto b = block ();
@@ -266,35 +287,33 @@ Stmt Parser::declaration ()
     if (name.length () > MAX_ID_LEN)
         throw ParseError ("identifier exceeds maximum length", name_tok.start);
 
-    std::optional<std::unique_ptr<Expr>> init;
+    std::optional<Expr*> init;
 
     if (match (TokenType::EQ_OP))
         init = expression ();
 
     expect (TokenType::SEMICOLON, "expected ';' after declaration");
 
-    return Stmt {VarDecl {std::move (name), std::move (init)}};
+    return Stmt {VarDecl {std::move (name), init}};
 }
 
 Stmt Parser::assignment_or_expr_stmt ()
 {
     // Lookahead: IDENTIFIER followed by '=' means assignment
-    if (check (TokenType::IDENTIFIER)
-        && current_ + 1 < tokens_.size ()
-        && tokens_[current_ + 1].type == TokenType::EQ_OP)
+    if (check (TokenType::IDENTIFIER) && check_next (TokenType::EQ_OP))
     {
         const Token& name_tok = next ();
         std::string name {name_tok.lexeme};
         next (); // consume '='
         auto value = expression ();
         expect (TokenType::SEMICOLON, "expected ';' after assignment");
-        return Stmt {Assignment {std::move (name), std::move (value)}};
+        return Stmt {Assignment {std::move (name), value}};
     }
 
     // Otherwise it's an expression statement
     auto expr = expression ();
     expect (TokenType::SEMICOLON, "expected ';' after expression");
-    return Stmt {ExprStmt {std::move (expr)}};
+    return Stmt {ExprStmt {expr}};
 }
 
 Stmt Parser::return_statement ()
@@ -302,7 +321,7 @@ Stmt Parser::return_statement ()
     expect (TokenType::RETURN, "expected 'return'");
     auto value = expression ();
     expect (TokenType::SEMICOLON, "expected ';' after return value");
-    return Stmt {ReturnStmt {std::move (value)}};
+    return Stmt {ReturnStmt {value}};
 }
 
 Stmt Parser::if_statement ()
@@ -311,8 +330,8 @@ Stmt Parser::if_statement ()
     expect (TokenType::L_PAREN, "expected '(' after 'if'");
     auto condition = expression ();
     expect (TokenType::R_PAREN, "expected ')' after if condition");
-    auto then_block = std::make_unique<Block> (block ());
-    return Stmt {IfStmt {std::move (condition), std::move (then_block)}};
+    Block* then_block = arena_->make<Block> (block ());
+    return Stmt {IfStmt {condition, then_block}};
 }
 
 Stmt Parser::while_statement ()
@@ -321,8 +340,93 @@ Stmt Parser::while_statement ()
     expect (TokenType::L_PAREN, "expected '(' after 'while'");
     auto condition = expression ();
     expect (TokenType::R_PAREN, "expected ')' after while condition");
-    auto body = std::make_unique<Block> (block ());
-    return Stmt {WhileStmt {std::move (condition), std::move (body)}};
+    Block* body = arena_->make<Block> (block ());
+    return Stmt {WhileStmt {condition, body}};
+}
+
+/**
+ * switch (value) { case K: ... break; default: ... }
+ * Labels with nothing between them share a body. Every body but the last
+ * ends in break or return: there is no fallthrough.
+ */
+Stmt Parser::switch_statement ()
+{
+    expect (TokenType::SWITCH, "expected 'switch'");
+    expect (TokenType::L_PAREN, "expected '(' after 'switch'");
+    auto value = expression ();
+    expect (TokenType::R_PAREN, "expected ')' after switch value");
+    expect (TokenType::L_BRACE, "expected '{' after switch value");
+
+    SwitchStmt node {value, {}, nullptr};
+    std::unordered_set<int> seen;
+    bool open = false;              // The last body would fall through
+    while (!check (TokenType::R_BRACE) && !is_at_end ())
+    {
+        Location where = peek ().start;
+        if (!check (TokenType::CASE) && !check (TokenType::DEFAULT))
+            throw ParseError ("expected 'case' or 'default'", where);
+        if (open)
+            throw ParseError ("case falls through, end it with 'break' or 'return'", where);
+
+        std::vector<int> values;
+        bool is_default = false;
+        while (check (TokenType::CASE) || check (TokenType::DEFAULT))
+        {
+            Location label = peek ().start;
+            if (match (TokenType::CASE))
+            {
+                int v = case_value ();
+                if (!seen.insert (v).second)
+                    throw ParseError ("duplicate case value", label);
+                values.push_back (v);
+            }
+            else
+            {
+                next ();
+                if (is_default || node.default_body)
+                    throw ParseError ("duplicate default", label);
+                is_default = true;
+            }
+            expect (TokenType::COLON, "expected ':' after case label");
+        }
+
+        std::vector<Stmt> stmts;
+        while (!check (TokenType::CASE) && !check (TokenType::DEFAULT)
+               && !check (TokenType::R_BRACE) && !check (TokenType::BREAK) && !is_at_end ())
+            stmts.push_back (statement ());
+
+        open = stmts.empty () || !std::holds_alternative<ReturnStmt> (stmts.back ().node);
+        if (match (TokenType::BREAK))
+        {
+            expect (TokenType::SEMICOLON, "expected ';' after 'break'");
+            open = false;
+        }
+
+        // Cases sharing the default's body go there anyway
+        Block* body = arena_->make<Block> (Block {std::move (stmts)});
+        if (is_default)
+            node.default_body = body;
+        else
+            node.cases.push_back ({std::move (values), body});
+    }
+
+    expect (TokenType::R_BRACE, "expected '}' after switch cases");
+    return Stmt {std::move (node)};
+}
+
+/**
+ * Integer literal of a case label, optionally negated
+ */
+int Parser::case_value ()
+{
+    bool negative = match (TokenType::SUB_OP);
+    const Token& tok = expect (TokenType::INT_LITERAL, "expected integer case value");
+    long long value = std::stoll (std::string {tok.lexeme});
+    if (negative)
+        value = -value;
+    if (value < INT_MIN || value > INT_MAX)
+        throw ParseError ("case value out of range", tok.start);
+    return static_cast<int> (value);
 }
 
 Block Parser::block ()
@@ -341,6 +445,7 @@ Block Parser::block ()
 /********** FUNCTIONS **********/
 Function Parser::function ()
 {
+    size_t first_token = current_;
     expect (TokenType::INT_TYPE, "expected 'int' return type");
 
     const Token& name_tok = expect (TokenType::IDENTIFIER,
@@ -374,15 +479,28 @@ Function Parser::function ()
 
     auto body = block ();
 
-    return Function {std::move (name), std::move (params), std::move (body)};
+    return Function {std::move (name), std::move (params), std::move (body),
+                     first_token, current_};
 }
 
-Program Parser::parse ()
+Program Parser::parse (Arena&& arena)
 {
     Program program;
+    program.arena = std::move (arena);
+    arena_ = &program.arena;
 
-    while (!is_at_end ())
-        program.functions.push_back (function ());
+    try
+    {
+        while (!is_at_end ())
+            program.functions.push_back (function ());
+    }
+    catch (const ParseError&)
+    {
+        program.functions.clear ();
+        arena = std::move (program.arena);
+        arena.reset ();
+        throw;
+    }
 
     return program;
 }
@@ -5,11 +5,14 @@
 
 #pragma once
 
+#include <array>
 #include <cstdlib>
+#include <span>
 #include <stdexcept>
 #include <string>
 #include <vector>
 #include "token.hpp"
+#include "lexer.hpp"
 #include "ast.hpp"
 
 static constexpr size_t MAX_ID_LEN = 32;
@@ -32,36 +35,66 @@ public:
 class Parser
 {
 public:
-    explicit Parser (const std::vector<Token>& tokens);
+    /**
+     * Borrow a token stream, the tokens must outlive the parser
+     */
+    explicit Parser (std::span<const Token> tokens);
+
+    /**
+     * Pull tokens lazily from a lexer through a small lookahead ring, so no
+     * token array is ever built. The lexer must outlive the parser.
+     */
+    explicit Parser (Lexer& lexer);
 
     /**
      * Parse entire token stream into a Program
+     * The program's arena takes over arena, blocks it kept from a reset
+     * included; on a parse error they go back to arena, reset
      */
-    Program parse ();
+    Program parse (Arena&& arena = {});
 
 private:
-    std::vector<Token> tokens_;
+    // prev, current and one lookahead token are live, one slot spare
+    static constexpr size_t RING_SIZE = 4;
+
+    std::span<const Token> tokens_;
+    Lexer* lexer_ = nullptr;              // Set in streaming mode
+    std::array<Token, RING_SIZE> ring_ {};
+    size_t pulled_ = 0;                   // Tokens pulled from lexer_
     size_t current_ = 0;
+    Arena* arena_ = nullptr;              // Arena of the Program being built
+
+    /**
+     * Allocate an expression node from the program arena
+     */
+    template <typename T>
+    Expr* make_expr (T&& node)
+    {
+        return arena_->make<Expr> (std::forward<T> (node));
+    }
 
     /********** TOKEN NAVIGATION **********/
+    const Token& at (size_t index) const; // Token by absolute index
+    void fill ();                         // Pull until cur + 1 is buffered
     const Token& peek () const;           // Look at cur token
     const Token& next ();                 // Move to next token
     const Token& prev () const;           // Move to prev token
     bool is_at_end () const;              // Check if at end of file
     bool check (TokenType type) const;    // Check current token type
+    bool check_next (TokenType type) const; // Check token after current
     bool match (TokenType type);          // Check cur token, next if suc
     const Token& expect (TokenType type,  // Check cur token for type, err on fail
                          const std::string& msg);
 
     /********** EXPRESSIONS **********/
-    std::unique_ptr<Expr> expression ();
-    std::unique_ptr<Expr> logic_or ();
-    std::unique_ptr<Expr> logic_and ();
-    std::unique_ptr<Expr> comparison ();
-    std::unique_ptr<Expr> addition ();
-    std::unique_ptr<Expr> multiplication ();
-    std::unique_ptr<Expr> unary ();
-    std::unique_ptr<Expr> primary ();
+    Expr* expression ();
+    Expr* logic_or ();
+    Expr* logic_and ();
+    Expr* comparison ();
+    Expr* addition ();
+    Expr* multiplication ();
+    Expr* unary ();
+    Expr* primary ();
 
     /********** STATEMENTS **********/
     Stmt statement ();
@@ -70,6 +103,8 @@ private:
     Stmt return_statement ();
     Stmt if_statement ();
     Stmt while_statement ();
+    Stmt switch_statement ();
+    int case_value ();
     Block block ();
 
     /********** FUNCTION **********/
@@ -0,0 +1,336 @@
+/**
+ * @file peephole.cpp
+ * @brief Machine IR peephole patterns
+ */
+
+#include "peephole.hpp"
+#include "thread_pool.hpp"
+#include <atomic>
+#include <unordered_map>
+
+namespace
+{
+
+/**
+ * Answers "is reg read before it is overwritten" from a code position,
+ * following jumps
+ */
+class Liveness
+{
+public:
+    explicit Liveness (const std::vector<MInst>& code)
+        : code_ (code)
+    {
+        for (size_t i = 0; i < code.size (); ++i)
+            if (code[i].op == Opcode::LABEL)
+                labels_[code[i].ops[0].value] = i;
+    }
+
+    bool live_at (size_t pos, Reg reg) const
+    {
+        RegMask bit = reg_bit (reg);
+        std::vector<bool> visited (code_.size () + 1);
+        std::vector<size_t> work {pos};
+
+        while (!work.empty ())
+        {
+            size_t p = work.back ();
+            work.pop_back ();
+
+            for (; p < code_.size () && !visited[p]; ++p)
+            {
+                visited[p] = true;
+                const MInst& inst = code_[p];
+
+                // Its targets are in a table, assume any of them reads reg
+                if (inst_uses (inst) & bit || inst.op == Opcode::JMP_TABLE)
+                    return true;
+                if (inst_defs (inst) & bit)
+                    break;
+
+                if (is_jump (inst.op))
+                {
+                    work.push_back (target (inst));
+                    if (inst.op == Opcode::JMP)
+                        break;
+                }
+                else if (inst.op == Opcode::RET || inst.op == Opcode::TAIL_CALL)
+                    break;
+            }
+        }
+        return false;
+    }
+
+    size_t target (const MInst& jump) const
+    {
+        auto it = labels_.find (jump.ops[0].value);
+        return it == labels_.end () ? code_.size () : it->second;
+    }
+
+private:
+    const std::vector<MInst>& code_;
+    std::unordered_map<int32_t, size_t> labels_;
+};
+
+bool same_reg (const Operand& a, const Operand& b)
+{
+    return a.is_reg () && b.is_reg () && a.reg == b.reg && a.width == b.width;
+}
+
+/**
+ * Can op take src directly as its second operand
+ */
+bool folds_operand (const MInst& inst, const Operand& src)
+{
+    switch (inst.op)
+    {
+        case Opcode::ADD:
+        case Opcode::SUB:
+        case Opcode::AND:
+        case Opcode::OR:
+        case Opcode::CMP:
+            return inst.ops[0].is_reg ();
+        case Opcode::IMUL:
+            // Two-operand imul only has a r, r/m form
+            return inst.ops[0].is_reg () && src.is_mem ();
+        default:
+            return false;
+    }
+}
+
+/**
+ * Does the instruction look at the flags left by the one before it
+ */
+bool reads_flags (const MInst& inst)
+{
+    switch (inst.op)
+    {
+        case Opcode::JE:
+        case Opcode::JNE:
+        case Opcode::JL:
+        case Opcode::JG:
+        case Opcode::JLE:
+        case Opcode::JGE:
+        case Opcode::JA:
+        case Opcode::SETE:
+        case Opcode::SETNE:
+        case Opcode::SETL:
+        case Opcode::SETG:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Conditional jump taken when the setcc result is zero
+ */
+Opcode inverse_jump (Opcode setcc)
+{
+    switch (setcc)
+    {
+        case Opcode::SETE:  return Opcode::JNE;
+        case Opcode::SETNE: return Opcode::JE;
+        case Opcode::SETL:  return Opcode::JGE;
+        case Opcode::SETG:  return Opcode::JLE;
+        default:            return Opcode::LABEL;
+    }
+}
+
+/**
+ * Try every pattern at c[i]
+ * Appends the replacement to out and returns the number of instructions
+ * consumed, or 0 if nothing matched
+ */
+size_t rewrite (const std::vector<MInst>& c, size_t i, const Liveness& live,
+                std::vector<MInst>& out)
+{
+    const MInst& inst = c[i];
+    const MInst* next = i + 1 < c.size () ? &c[i + 1] : nullptr;
+
+    // Unreachable: anything between an unconditional transfer and a label
+    if (i > 0 && (c[i - 1].op == Opcode::JMP || c[i - 1].op == Opcode::RET
+                  || c[i - 1].op == Opcode::TAIL_CALL || c[i - 1].op == Opcode::JMP_TABLE)
+        && inst.op != Opcode::LABEL)
+        return 1;
+
+    switch (inst.op)
+    {
+        case Opcode::MOV:
+        {
+            const Operand& dst = inst.ops[0];
+            const Operand& src = inst.ops[1];
+
+            // mov r, r
+            if (same_reg (dst, src))
+                return 1;
+
+            if (!next || !dst.is_reg ())
+                break;
+
+            // mov x, imm/mem / op y, x with x dead afterwards -> op y, imm/mem
+            if ((src.is_imm () || src.is_mem ()) && folds_operand (*next, src)
+                && same_reg (next->ops[1], dst) && !next->ops[0].is_reg (dst.reg)
+                && !live.live_at (i + 2, dst.reg))
+            {
+                out.push_back (MInst {next->op, {next->ops[0], src}});
+                return 2;
+            }
+
+            // mov x, a / add x, b  ->  lea x, [a + b], when the flags are unused
+            bool flags_read = i + 2 < c.size () && reads_flags (c[i + 2]);
+            if (src.is_reg () && !flags_read && same_reg (next->ops[0], dst)
+                && ((next->op == Opcode::ADD
+                     && (next->ops[1].is_imm ()
+                         || (next->ops[1].is_reg () && !next->ops[1].is_reg (dst.reg))))
+                    || (next->op == Opcode::SUB && next->ops[1].is_imm ()
+                        && next->ops[1].value != INT32_MIN)))
+            {
+                Operand extra = next->ops[1];
+                if (next->op == Opcode::SUB)
+                    extra.value = -extra.value;
+                out.push_back (MInst {Opcode::LEA, {dst, src, extra}});
+                return 2;
+            }
+
+            if (next->op != Opcode::MOV)
+                break;
+
+            // mov a, b / mov b, a
+            if (src.is_reg () && same_reg (next->ops[0], src)
+                && same_reg (next->ops[1], dst))
+            {
+                out.push_back (inst);
+                return 2;
+            }
+
+            // mov x, src / mov y, x with x dead afterwards
+            if (same_reg (next->ops[1], dst)
+                && !(next->ops[0].is_mem () && src.is_mem ())
+                && !live.live_at (i + 2, dst.reg))
+            {
+                out.push_back (MInst {Opcode::MOV, {next->ops[0], src}});
+                return 2;
+            }
+            break;
+        }
+
+        case Opcode::PUSH:
+        {
+            // push x, then only moves that leave x and rsp alone, then pop y
+            const Operand& val = inst.ops[0];
+            RegMask x = val.is_reg () ? reg_bit (val.reg) : 0;
+            RegMask rsp = reg_bit (Reg::RSP);
+
+            size_t j = i + 1;
+            while (j < c.size ()
+                   && (c[j].op == Opcode::MOV || c[j].op == Opcode::MOVZX)
+                   && !(inst_defs (c[j]) & x)
+                   && !((inst_uses (c[j]) | inst_defs (c[j])) & rsp))
+                ++j;
+
+            if (j == c.size () || c[j].op != Opcode::POP)
+                break;
+
+            Reg y = c[j].ops[0].reg;
+            for (size_t k = i + 1; k < j; ++k)
+                if ((inst_uses (c[k]) | inst_defs (c[k])) & reg_bit (y))
+                    return 0;
+
+            out.insert (out.end (), c.begin () + i + 1, c.begin () + j);
+            // Values are 32-bit, so the narrower move is enough
+            if (!val.is_reg (y))
+                out.push_back (MInst {Opcode::MOV, {
+                    Operand::make_reg (y),
+                    val.is_reg () ? Operand::make_reg (val.reg) : val}});
+            return j - i + 1;
+        }
+
+        case Opcode::JMP:
+        {
+            // Jump over nothing but labels, one of which is the target
+            for (size_t j = i + 1; j < c.size () && c[j].op == Opcode::LABEL; ++j)
+                if (c[j].ops[0] == inst.ops[0])
+                    return 1;
+            break;
+        }
+
+        case Opcode::SETE:
+        case Opcode::SETNE:
+        case Opcode::SETL:
+        case Opcode::SETG:
+        {
+            // setcc x8 / movzx x, x8 / test x, x / je L  ->  j!cc L
+            if (i + 3 >= c.size ())
+                break;
+
+            const MInst& ext  = c[i + 1];
+            const MInst& test = c[i + 2];
+            const MInst& jump = c[i + 3];
+            Reg x = inst.ops[0].reg;
+
+            if (ext.op != Opcode::MOVZX || !same_reg (ext.ops[1], inst.ops[0])
+                || !ext.ops[0].is_reg (x)
+                || test.op != Opcode::TEST || !same_reg (test.ops[0], ext.ops[0])
+                || !same_reg (test.ops[1], ext.ops[0])
+                || jump.op != Opcode::JE)
+                break;
+
+            if (live.live_at (i + 4, x) || live.live_at (live.target (jump), x))
+                break;
+
+            out.push_back (MInst {inverse_jump (inst.op), {jump.ops[0]}});
+            return 4;
+        }
+
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+} // namespace
+
+size_t peephole (MFunction& func)
+{
+    size_t removed = 0;
+    bool changed = true;
+
+    // Every pattern shrinks the code, so this terminates
+    while (changed)
+    {
+        changed = false;
+        const std::vector<MInst>& code = func.code;
+        Liveness live {code};
+
+        std::vector<MInst> out;
+        out.reserve (code.size ());
+        for (size_t i = 0; i < code.size ();)
+        {
+            size_t consumed = rewrite (code, i, live, out);
+            if (consumed > 0)
+            {
+                changed = true;
+                i += consumed;
+            }
+            else
+                out.push_back (code[i++]);
+        }
+
+        removed += code.size () - out.size ();
+        func.code = std::move (out);
+    }
+
+    return removed;
+}
+
+size_t peephole (MProgram& prog, ThreadPool* pool)
+{
+    std::atomic<size_t> removed = 0;
+    for_each_index (pool, prog.functions.size (), [&] (size_t i)
+    {
+        removed.fetch_add (peephole (prog.functions[i]), std::memory_order_relaxed);
+    });
+    return removed;
+}
@@ -0,0 +1,31 @@
+/**
+ * @file peephole.hpp
+ * @brief Pattern-based cleanup of machine IR (enabled with -O).
+ */
+
+#pragma once
+
+#include "mir.hpp"
+
+class ThreadPool;
+
+/**
+ * Rewrite short instruction windows until nothing changes:
+ *
+ *   mov r, r                          -> (removed)
+ *   mov a, b / mov b, a               -> mov a, b
+ *   mov x, src / mov y, x  (x dead)   -> mov y, src
+ *   mov x, imm / op y, x   (x dead)   -> op y, imm   (also memory)
+ *   mov x, a / add x, b               -> lea x, [a + b]  (also sub imm)
+ *   push x ... pop y                  -> ... mov y, x
+ *   jmp L / L:                        -> L:
+ *   setcc x / movzx / test x / je L   -> j!cc L  (x dead after)
+ *
+ * Returns the number of instructions removed
+ */
+size_t peephole (MFunction& func);
+
+/**
+ * Every function of prog, in parallel with a pool
+ */
+size_t peephole (MProgram& prog, ThreadPool* pool = nullptr);
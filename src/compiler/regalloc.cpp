@@ -0,0 +1,490 @@
+/**
+ * @file regalloc.cpp
+ * @brief Liveness, live intervals and linear scan allocation
+ */
+
+#include "regalloc.hpp"
+#include <algorithm>
+#include <unordered_map>
+
+namespace
+{
+
+/**
+ * Half-open range of positions. Instruction i uses its operands at 2i and
+ * defines its results at 2i + 1, so a move's source and destination may
+ * share a register.
+ */
+struct Range
+{
+    uint32_t from;
+    uint32_t to;
+};
+
+using Ranges = std::vector<Range>;
+
+bool overlaps (const Ranges& a, const Ranges& b)
+{
+    size_t i = 0, j = 0;
+    while (i < a.size () && j < b.size ())
+    {
+        if (a[i].to <= b[j].from)
+            ++i;
+        else if (b[j].to <= a[i].from)
+            ++j;
+        else
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Add disjoint ranges to a sorted, disjoint list
+ */
+void merge_into (Ranges& occ, const Ranges& ranges)
+{
+    Ranges merged;
+    merged.reserve (occ.size () + ranges.size ());
+    std::merge (occ.begin (), occ.end (), ranges.begin (), ranges.end (),
+                std::back_inserter (merged),
+                [] (const Range& a, const Range& b) { return a.from < b.from; });
+    occ = std::move (merged);
+}
+
+/**
+ * Physical registers tracked by liveness: everything the allocator may hand
+ * out, plus the argument and return registers used for fixed intervals.
+ * Callee-saved registers are not tracked, frame lowering preserves them.
+ */
+constexpr Reg TRACKED_REGS[] = {Reg::RAX, Reg::RCX, Reg::RDX, Reg::RSI,
+                                Reg::RDI, Reg::R8,  Reg::R9};
+
+/**
+ * Allocation order: caller-saved first (free to use), then callee-saved
+ * (costs a save/restore). r10/r11 are reserved for spill reloads.
+ */
+constexpr Reg ALLOC_ORDER[] = {Reg::RAX, Reg::RCX, Reg::RDX, Reg::RSI,
+                               Reg::RDI, Reg::R8,  Reg::R9,  Reg::RBX,
+                               Reg::R12, Reg::R13, Reg::R14, Reg::R15};
+
+constexpr Reg SPILL_SCRATCH[] = {Reg::R10, Reg::R11};
+
+class Allocator
+{
+public:
+    explicit Allocator (MFunction& func)
+        : func_ (func), code_ (func.code),
+          reg_count_ (REG_COUNT + func.vreg_count)
+    {
+        for (Reg reg : TRACKED_REGS)
+            tracked_ |= reg_bit (reg);
+
+        intervals_.resize (reg_count_);
+        build_blocks ();
+        solve_liveness ();
+        build_intervals ();
+        scan ();
+        rewrite ();
+    }
+
+private:
+    struct Block
+    {
+        uint32_t first;               // Instruction range [first, last]
+        uint32_t last;
+        std::vector<uint32_t> succs;
+        std::vector<uint64_t> gen;    // Used before defined
+        std::vector<uint64_t> kill;   // Defined
+        std::vector<uint64_t> live_in;
+        std::vector<uint64_t> live_out;
+    };
+
+    MFunction& func_;
+    std::vector<MInst>& code_;
+    size_t reg_count_;                // Physical ids, then virtual ids
+    RegMask tracked_ = 0;
+
+    std::vector<Block> blocks_;
+    std::vector<Ranges> intervals_;
+    std::vector<std::vector<uint32_t>> hints_;   // Move partners per id
+
+    static constexpr Reg SPILLED = Reg::NONE;
+    std::vector<Reg> assigned_;       // Per virtual register
+    std::vector<uint32_t> slot_;      // Frame slot when spilled
+
+    /********** OPERANDS **********/
+    static uint32_t vreg_id (const Operand& operand)
+    {
+        return REG_COUNT + static_cast<uint32_t> (operand.value);
+    }
+
+    /**
+     * Call fn (id) for every tracked register the instruction reads (ACCESS_USE)
+     * or writes (ACCESS_DEF)
+     */
+    template <typename Fn>
+    void for_each (const MInst& inst, uint8_t access, Fn fn) const
+    {
+        RegMask phys = (access == ACCESS_USE ? inst_uses (inst)
+                                             : inst_defs (inst)) & tracked_;
+        for (uint32_t r = 0; phys; ++r, phys >>= 1)
+            if (phys & 1)
+                fn (r);
+
+        for (int i = 0; i < 3; ++i)
+            if (inst.ops[i].is_vreg () && (operand_access (inst.op, i) & access))
+                fn (vreg_id (inst.ops[i]));
+    }
+
+    static void set (std::vector<uint64_t>& bits, uint32_t id)
+    {
+        bits[id / 64] |= uint64_t {1} << (id % 64);
+    }
+
+    static bool test (const std::vector<uint64_t>& bits, uint32_t id)
+    {
+        return bits[id / 64] >> (id % 64) & 1;
+    }
+
+    /********** LIVENESS **********/
+    void build_blocks ()
+    {
+        std::unordered_map<int32_t, uint32_t> label_block;
+        std::unordered_map<int32_t, std::vector<int32_t>> table_targets;
+        size_t words = (reg_count_ + 63) / 64;
+
+        for (uint32_t i = 0; i < code_.size (); ++i)
+        {
+            bool starts = blocks_.empty () || code_[i].op == Opcode::LABEL
+                       || is_jump (code_[i - 1].op)
+                       || code_[i - 1].op == Opcode::RET
+                       || code_[i - 1].op == Opcode::TAIL_CALL
+                       || code_[i - 1].op == Opcode::JMP_TABLE;
+            if (starts)
+                blocks_.push_back (Block {i, i, {}, std::vector<uint64_t> (words),
+                                          std::vector<uint64_t> (words),
+                                          std::vector<uint64_t> (words),
+                                          std::vector<uint64_t> (words)});
+            blocks_.back ().last = i;
+            if (code_[i].op == Opcode::LABEL)
+                label_block[code_[i].ops[0].value] =
+                    static_cast<uint32_t> (blocks_.size () - 1);
+            if (code_[i].op == Opcode::CASE)
+                table_targets[code_[i].ops[1].value].push_back (code_[i].ops[0].value);
+        }
+
+        for (uint32_t b = 0; b < blocks_.size (); ++b)
+        {
+            Block& block = blocks_[b];
+            const MInst& end = code_[block.last];
+
+            if (is_jump (end.op))
+                block.succs.push_back (label_block.at (end.ops[0].value));
+            if (end.op == Opcode::JMP_TABLE)
+                for (int32_t target : table_targets[end.ops[1].value])
+                    block.succs.push_back (label_block.at (target));
+            if (end.op != Opcode::JMP && end.op != Opcode::RET && end.op != Opcode::TAIL_CALL
+                && end.op != Opcode::JMP_TABLE
+                && b + 1 < blocks_.size ())
+                block.succs.push_back (b + 1);
+
+            for (uint32_t i = block.first; i <= block.last; ++i)
+            {
+                for_each (code_[i], ACCESS_USE, [&] (uint32_t id)
+                {
+                    if (!test (block.kill, id))
+                        set (block.gen, id);
+                });
+                for_each (code_[i], ACCESS_DEF, [&] (uint32_t id)
+                {
+                    set (block.kill, id);
+                });
+            }
+        }
+    }
+
+    void solve_liveness ()
+    {
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (size_t b = blocks_.size (); b-- > 0;)
+            {
+                Block& block = blocks_[b];
+                for (uint32_t s : block.succs)
+                    for (size_t w = 0; w < block.live_out.size (); ++w)
+                        block.live_out[w] |= blocks_[s].live_in[w];
+
+                for (size_t w = 0; w < block.live_in.size (); ++w)
+                {
+                    uint64_t in = block.gen[w]
+                                | (block.live_out[w] & ~block.kill[w]);
+                    if (in != block.live_in[w])
+                    {
+                        block.live_in[w] = in;
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * Ranges are built backwards, so each list grows towards lower
+     * positions and is reversed at the end
+     */
+    void add_range (uint32_t id, uint32_t from, uint32_t to)
+    {
+        Ranges& ranges = intervals_[id];
+        if (!ranges.empty () && ranges.back ().from <= to)
+        {
+            ranges.back ().from = std::min (ranges.back ().from, from);
+            ranges.back ().to   = std::max (ranges.back ().to, to);
+        }
+        else
+            ranges.push_back ({from, to});
+    }
+
+    void build_intervals ()
+    {
+        hints_.resize (reg_count_);
+
+        for (size_t b = blocks_.size (); b-- > 0;)
+        {
+            const Block& block = blocks_[b];
+            uint32_t block_from = 2 * block.first;
+            uint32_t block_to   = 2 * (block.last + 1);
+
+            for (uint32_t id = 0; id < reg_count_; ++id)
+                if (test (block.live_out, id))
+                    add_range (id, block_from, block_to);
+
+            for (uint32_t i = block.last + 1; i-- > block.first;)
+            {
+                const MInst& inst = code_[i];
+
+                for_each (inst, ACCESS_DEF, [&] (uint32_t id)
+                {
+                    Ranges& ranges = intervals_[id];
+                    if (!ranges.empty () && ranges.back ().from <= 2 * i + 1
+                        && ranges.back ().to > 2 * i + 1)
+                        ranges.back ().from = 2 * i + 1;
+                    else
+                        add_range (id, 2 * i + 1, 2 * i + 2);
+                });
+                for_each (inst, ACCESS_USE, [&] (uint32_t id)
+                {
+                    add_range (id, block_from, 2 * i + 1);
+                });
+
+                record_hint (inst);
+            }
+        }
+
+        for (auto& ranges : intervals_)
+            std::reverse (ranges.begin (), ranges.end ());
+    }
+
+    void record_hint (const MInst& inst)
+    {
+        if (inst.op != Opcode::MOV)
+            return;
+
+        auto id_of = [] (const Operand& operand) -> int64_t
+        {
+            if (operand.is_vreg ())
+                return vreg_id (operand);
+            if (operand.is_reg ())
+                return static_cast<int64_t> (operand.reg);
+            return -1;
+        };
+
+        const int64_t regs = static_cast<int64_t> (REG_COUNT);
+        int64_t a = id_of (inst.ops[0]);
+        int64_t b = id_of (inst.ops[1]);
+        if (a < 0 || b < 0 || (a < regs && b < regs))
+            return;
+
+        hints_[a].push_back (static_cast<uint32_t> (b));
+        hints_[b].push_back (static_cast<uint32_t> (a));
+    }
+
+    /********** LINEAR SCAN **********/
+    std::vector<Ranges> occupied_;    // Per physical register, sorted
+
+    bool fits (Reg reg, const Ranges& ranges) const
+    {
+        return !overlaps (occupied_[static_cast<size_t> (reg)], ranges);
+    }
+
+    void occupy (Reg reg, const Ranges& ranges)
+    {
+        merge_into (occupied_[static_cast<size_t> (reg)], ranges);
+    }
+
+    void scan ()
+    {
+        occupied_.resize (REG_COUNT);
+        for (Reg reg : TRACKED_REGS)
+            occupied_[static_cast<size_t> (reg)] =
+                intervals_[static_cast<size_t> (reg)];
+
+        // Intervals in order of their start
+        std::vector<uint32_t> order;
+        for (uint32_t v = 0; v < func_.vreg_count; ++v)
+            if (!intervals_[REG_COUNT + v].empty ())
+                order.push_back (v);
+        std::sort (order.begin (), order.end (), [this] (uint32_t a, uint32_t b)
+        {
+            return intervals_[REG_COUNT + a].front ().from
+                 < intervals_[REG_COUNT + b].front ().from;
+        });
+
+        assigned_.assign (func_.vreg_count, SPILLED);
+        slot_.assign (func_.vreg_count, 0);
+
+        for (uint32_t v : order)
+        {
+            const Ranges& ranges = intervals_[REG_COUNT + v];
+            Reg choice = SPILLED;
+
+            // Move partner's register first, so the move disappears
+            for (uint32_t partner : hints_[REG_COUNT + v])
+            {
+                Reg reg = partner < REG_COUNT ? static_cast<Reg> (partner)
+                                              : assigned_[partner - REG_COUNT];
+                if (reg != SPILLED && is_allocatable (reg) && fits (reg, ranges))
+                {
+                    choice = reg;
+                    break;
+                }
+            }
+
+            for (Reg reg : ALLOC_ORDER)
+            {
+                if (choice != SPILLED)
+                    break;
+                if (fits (reg, ranges))
+                    choice = reg;
+            }
+
+            if (choice == SPILLED)
+            {
+                slot_[v] = spill_slot (ranges);
+                ++func_.spills;
+            }
+            else
+                occupy (choice, ranges);
+            assigned_[v] = choice;
+        }
+    }
+
+    /**
+     * First frame slot whose occupants are all dead while v is live
+     */
+    std::vector<Ranges> slot_occupied_;
+
+    uint32_t spill_slot (const Ranges& ranges)
+    {
+        uint32_t slot = 0;
+        while (slot < slot_occupied_.size ()
+               && overlaps (slot_occupied_[slot], ranges))
+            ++slot;
+
+        if (slot == slot_occupied_.size ())
+        {
+            slot_occupied_.emplace_back ();
+            func_.frame_slots = static_cast<uint32_t> (slot_occupied_.size ());
+        }
+
+        merge_into (slot_occupied_[slot], ranges);
+        return slot;
+    }
+
+    static bool is_allocatable (Reg reg)
+    {
+        return std::find (std::begin (ALLOC_ORDER), std::end (ALLOC_ORDER), reg)
+            != std::end (ALLOC_ORDER);
+    }
+
+    /********** REWRITE **********/
+    void rewrite ()
+    {
+        std::vector<MInst> out;
+        out.reserve (code_.size ());
+
+        for (MInst inst : code_)
+        {
+            bool spilled[3];
+            for (int i = 0; i < 3; ++i)
+                spilled[i] = inst.ops[i].is_vreg ()
+                          && assigned_[inst.ops[i].value] == SPILLED;
+
+            // A move can address one slot directly
+            bool direct = inst.op == Opcode::MOV && !(spilled[0] && spilled[1])
+                       && !inst.ops[1].is_mem ();
+            bool same = spilled[0] && spilled[1]
+                     && inst.ops[0].value == inst.ops[1].value;
+
+            MInst after {Opcode::LABEL};
+            bool store = false;
+
+            for (int i = 0; i < 3; ++i)
+            {
+                Operand& operand = inst.ops[i];
+                if (!operand.is_vreg ())
+                    continue;
+
+                uint32_t v = static_cast<uint32_t> (operand.value);
+                Width width = operand.width;
+                uint8_t scale = operand.scale;
+                if (!spilled[i])
+                {
+                    operand = Operand::make_reg (assigned_[v], width).scaled (scale);
+                    continue;
+                }
+
+                Operand slot = Operand::make_frame (slot_[v], width);
+                if (direct || (inst.op == Opcode::MOV && i == 1))
+                {
+                    operand = slot;
+                    continue;
+                }
+
+                // Otherwise go through a scratch register. A third operand
+                // shares the first one's: that is only ever written, after
+                // the sources are read.
+                Operand scratch = Operand::make_reg (SPILL_SCRATCH[same ? 0 : i % 2],
+                                                     width).scaled (scale);
+                uint8_t access = operand_access (inst.op, i);
+                if ((access & ACCESS_USE) && !(same && i == 1))
+                    out.push_back (MInst {Opcode::MOV, {scratch, slot}});
+                if (access & ACCESS_DEF)
+                {
+                    after = MInst {Opcode::MOV, {slot, scratch}};
+                    store = true;
+                }
+                operand = scratch;
+            }
+
+            // Coalesced moves vanish
+            if (inst.op == Opcode::MOV && inst.ops[0].is_reg ()
+                && inst.ops[0] == inst.ops[1])
+                continue;
+
+            out.push_back (inst);
+            if (store)
+                out.push_back (after);
+        }
+
+        code_ = std::move (out);
+    }
+};
+
+} // namespace
+
+void allocate_registers (MFunction& func)
+{
+    Allocator {func};
+}
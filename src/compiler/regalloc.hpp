@@ -0,0 +1,21 @@
+/**
+ * @file regalloc.hpp
+ * @brief Linear scan register allocation over machine IR.
+ */
+
+#pragma once
+
+#include "mir.hpp"
+
+/**
+ * Assign every virtual register in func to a physical register
+ *
+ * Live intervals (with holes) come from block-level liveness over the MIR.
+ * Physical registers named explicitly (argument setup, call clobbers, idiv)
+ * become fixed intervals that virtual registers must not overlap, so a value
+ * live across a call lands in a callee-saved register. Moves between a pair
+ * of registers are coalesced when the hinted register is free. Intervals
+ * that fit nowhere are spilled to frame slots, with r10/r11 reserved for
+ * reloading them. Spilled values whose intervals do not overlap share a slot.
+ */
+void allocate_registers (MFunction& func);
@@ -0,0 +1,408 @@
+/**
+ * @file server.cpp
+ * @brief Compile server and client
+ */
+
+#include "server.hpp"
+#include "file_utils.hpp"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace
+{
+
+constexpr time_t SEND_TIMEOUT_SECONDS = 30;
+
+std::string socket_file (const std::string& path)
+{
+    return path[0] == '/' ? path : get_full_path (path);
+}
+
+/**
+ * Address of a socket path, false if it does not fit
+ */
+bool make_address (const std::string& path, sockaddr_un& addr)
+{
+    addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.empty () || path.size () >= sizeof (addr.sun_path))
+        return false;
+    std::memcpy (addr.sun_path, path.c_str (), path.size () + 1);
+    return true;
+}
+
+/**
+ * Read exactly size bytes, false on error or end of stream
+ */
+bool read_all (int fd, void* data, size_t size)
+{
+    auto* bytes = static_cast<char*> (data);
+    while (size > 0)
+    {
+        ssize_t n = recv (fd, bytes, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        bytes += n;
+        size -= static_cast<size_t> (n);
+    }
+    return true;
+}
+
+/**
+ * Write all of data, false on error (a closed peer is no signal)
+ */
+bool write_all (int fd, const void* data, size_t size)
+{
+    auto* bytes = static_cast<const char*> (data);
+    while (size > 0)
+    {
+        ssize_t n = send (fd, bytes, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        bytes += n;
+        size -= static_cast<size_t> (n);
+    }
+    return true;
+}
+
+/**
+ * Read a size-prefixed piece into out, keeping its capacity
+ */
+bool read_string (int fd, size_t size, std::string& out)
+{
+    out.resize (size);
+    return read_all (fd, out.data (), size);
+}
+
+} // namespace
+
+CompileServer::CompileServer (const std::string& socket_path, const CompileOptions& defaults,
+                              size_t threads)
+    : path_ {socket_file (socket_path)}, defaults_ {defaults}, pool_ {threads}
+{
+    // Neither end may block: stop () can run inside a signal handler, and a
+    // worker must not wait on run's thread
+    if (pipe2 (wake_, O_CLOEXEC | O_NONBLOCK) != 0)
+        wake_[0] = wake_[1] = -1;
+    if (pipe2 (done_, O_CLOEXEC | O_NONBLOCK) != 0)
+        done_[0] = done_[1] = -1;
+}
+
+CompileServer::~CompileServer ()
+{
+    if (listen_fd_ >= 0)
+    {
+        close (listen_fd_);
+        unlink (path_.c_str ());
+    }
+    for (int fd : wake_)
+        if (fd >= 0)
+            close (fd);
+    for (int fd : done_)
+        if (fd >= 0)
+            close (fd);
+}
+
+bool CompileServer::listen (std::string& error)
+{
+    sockaddr_un addr;
+    if (!make_address (path_, addr))
+    {
+        error = "Socket path too long: " + path_;
+        return false;
+    }
+    if (wake_[0] < 0 || done_[0] < 0)
+    {
+        error = "Could not create the wake-up pipes";
+        return false;
+    }
+
+    // A socket file nobody answers on is left over from a server that died
+    int probe = connect_server (path_);
+    if (probe >= 0)
+    {
+        close (probe);
+        error = "A server is already listening on " + path_;
+        return false;
+    }
+    unlink (path_.c_str ());
+
+    listen_fd_ = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0 || bind (listen_fd_, reinterpret_cast<sockaddr*> (&addr), sizeof (addr)) != 0
+        || ::listen (listen_fd_, SOMAXCONN) != 0)
+    {
+        error = "Could not listen on " + path_ + ": " + std::strerror (errno);
+        if (listen_fd_ >= 0)
+            close (listen_fd_);
+        listen_fd_ = -1;
+        return false;
+    }
+    return true;
+}
+
+void CompileServer::run ()
+{
+    std::vector<pollfd> fds;
+    while (listen_fd_ >= 0)
+    {
+        // The listening socket, both pipes, then every connection not on a
+        // worker
+        fds.assign ({{listen_fd_, POLLIN, 0}, {wake_[0], POLLIN, 0}, {done_[0], POLLIN, 0}});
+        for (const auto& [fd, connection] : connections_)
+            if (!connection.busy)
+                fds.push_back ({fd, POLLIN, 0});
+
+        if (poll (fds.data (), fds.size (), -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (fds[1].revents)
+            break;
+        if (fds[2].revents)
+            collect_finished ();
+
+        for (size_t i = 3; i < fds.size (); ++i)
+        {
+            if (!fds[i].revents)
+                continue;
+            int fd = fds[i].fd;
+            Connection& connection = connections_.at (fd);
+            if (!receive (fd, connection))
+            {
+                close (fd);
+                connections_.erase (fd);
+                continue;
+            }
+            if (connection.header_read < sizeof (ServeRequest)
+                || connection.source_read < connection.request.source_size)
+                continue;
+
+            // Complete: the worker has the connection until it answers
+            connection.busy = true;
+            std::erase_if (handlers_, [] (const std::future<void>& handler)
+            {
+                return handler.wait_for (std::chrono::seconds {0}) == std::future_status::ready;
+            });
+            handlers_.push_back (pool_.submit ([this, fd, &connection]
+            {
+                serve_request (fd, connection);
+            }));
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            int fd = accept4 (listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0)
+            {
+                // A client that stops reading its answer frees the worker
+                timeval timeout {SEND_TIMEOUT_SECONDS, 0};
+                setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof (timeout));
+                connections_.emplace (fd, Connection {});
+            }
+        }
+    }
+
+    // Requests on workers get their answer; idle connections and partial
+    // requests see the end of the stream
+    for (auto& handler : handlers_)
+        handler.wait ();
+    handlers_.clear ();
+    {
+        std::lock_guard lock {mutex_};
+        finished_.clear ();
+    }
+    for (const auto& [fd, connection] : connections_)
+        close (fd);
+    connections_.clear ();
+
+    if (listen_fd_ >= 0)
+    {
+        close (listen_fd_);
+        unlink (path_.c_str ());
+        listen_fd_ = -1;
+    }
+}
+
+void CompileServer::stop ()
+{
+    // write is async-signal-safe; a full pipe has a wake-up pending anyway
+    ssize_t written = write (wake_[1], "x", 1);
+    (void) written;
+}
+
+size_t CompileServer::served () const
+{
+    std::lock_guard lock {mutex_};
+    return served_;
+}
+
+bool CompileServer::receive (int fd, Connection& connection)
+{
+    ServeRequest& request = connection.request;
+    while (true)
+    {
+        char* target;
+        size_t size;
+        bool header = connection.header_read < sizeof (request);
+        if (header)
+        {
+            target = reinterpret_cast<char*> (&request) + connection.header_read;
+            size = sizeof (request) - connection.header_read;
+        }
+        else
+        {
+            // Stop at the end of this request, the next one waits its turn
+            size = request.source_size - connection.source_read;
+            if (size == 0)
+                return true;
+            target = connection.source.data () + connection.source_read;
+        }
+
+        ssize_t n = recv (fd, target, size, MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+        if (n <= 0)
+            return false;
+
+        if (!header)
+        {
+            connection.source_read += static_cast<size_t> (n);
+            continue;
+        }
+        connection.header_read += static_cast<size_t> (n);
+        if (connection.header_read < sizeof (request))
+            continue;
+        if (request.magic != SERVE_REQUEST_MAGIC || request.source_size > SERVE_MAX_SOURCE)
+            return false;
+        connection.source.resize (request.source_size);
+    }
+}
+
+void CompileServer::serve_request (int fd, Connection& connection)
+{
+    // Kept by this worker across requests and connections
+    thread_local Workspace workspace;
+    thread_local std::string output;
+
+    const ServeRequest& request = connection.request;
+    CompileOptions options = defaults_;
+    options.object = request.flags & SERVE_OBJECT;
+    options.time_report = false;
+    if (request.unroll_factor != 0)
+        options.loops.unroll_factor = request.unroll_factor;
+    if (request.flags & SERVE_NO_VECTORIZE)
+        options.loops.vectorize = false;
+    set_opt_level (options, !(request.flags & SERVE_OPTIMIZE) ? 0
+                            : request.flags & SERVE_LEVEL_1 ? 1 : 2);
+
+    CompileResult result = compile_source (connection.source, options, output, &workspace);
+    if (!result.ok)
+        output.clear ();
+
+    {
+        std::lock_guard lock {mutex_};
+        ++served_;
+    }
+
+    ServeResponse response;
+    response.ok = result.ok;
+    response.messages_size = static_cast<uint32_t> (result.messages.size ());
+    response.errors_size = static_cast<uint32_t> (result.errors.size ());
+    response.output_size = output.size ();
+    bool usable = write_all (fd, &response, sizeof (response))
+               && write_all (fd, result.messages.data (), result.messages.size ())
+               && write_all (fd, result.errors.data (), result.errors.size ())
+               && write_all (fd, output.data (), output.size ());
+
+    connection.header_read = 0;
+    connection.source_read = 0;
+    {
+        std::lock_guard lock {mutex_};
+        finished_.emplace_back (fd, usable);
+    }
+    ssize_t written = write (done_[1], "x", 1);
+    (void) written;
+}
+
+void CompileServer::collect_finished ()
+{
+    char drain[64];
+    while (read (done_[0], drain, sizeof (drain)) > 0)
+        ;
+
+    std::vector<std::pair<int, bool>> finished;
+    {
+        std::lock_guard lock {mutex_};
+        finished.swap (finished_);
+    }
+    for (auto [fd, usable] : finished)
+    {
+        if (usable)
+        {
+            connections_.at (fd).busy = false;
+            continue;
+        }
+        close (fd);
+        connections_.erase (fd);
+    }
+}
+
+int connect_server (const std::string& socket_path)
+{
+    sockaddr_un addr;
+    if (!make_address (socket_file (socket_path), addr))
+        return -1;
+    int fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect (fd, reinterpret_cast<sockaddr*> (&addr), sizeof (addr)) != 0)
+    {
+        close (fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool request_compile (int fd, const std::string& source, const CompileOptions& options,
+                      CompileResult& result, std::string& output, uint32_t unroll_factor)
+{
+    if (source.size () > SERVE_MAX_SOURCE)
+        return false;
+
+    ServeRequest request;
+    if (options.optimize)
+        request.flags |= SERVE_OPTIMIZE;
+    if (options.object)
+        request.flags |= SERVE_OBJECT;
+    if (options.optimize && options.opt_level == 1)
+        request.flags |= SERVE_LEVEL_1;
+    if (!options.loops.vectorize)
+        request.flags |= SERVE_NO_VECTORIZE;
+    request.unroll_factor = unroll_factor;
+    request.source_size = static_cast<uint32_t> (source.size ());
+
+    ServeResponse response;
+    if (!write_all (fd, &request, sizeof (request)) || !write_all (fd, source.data (), source.size ())
+        || !read_all (fd, &response, sizeof (response)) || response.magic != SERVE_RESPONSE_MAGIC)
+        return false;
+
+    result.ok = response.ok != 0;
+    return read_string (fd, response.messages_size, result.messages)
+        && read_string (fd, response.errors_size, result.errors)
+        && read_string (fd, response.output_size, output);
+}
@@ -0,0 +1,173 @@
+/**
+ * @file server.hpp
+ * @brief Long-lived compile server on a Unix domain socket (--serve), and
+ *        the client side of its protocol (--connect).
+ *
+ * A build that runs the compiler thousands of times pays process startup,
+ * a cold function cache and fresh allocations every time. The server pays
+ * them once: each request carries a source buffer and flags and is answered
+ * with the assembly or object bytes, compiled on a worker that keeps its
+ * Workspace (AST arena, assembly text) from one request to the next.
+ *
+ * Protocol, native byte order (the socket never leaves the machine): a
+ * ServeRequest header and source_size bytes of source, answered by a
+ * ServeResponse header followed by the messages, errors and output. A
+ * connection carries any number of requests, one after another; separate
+ * connections are served concurrently.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "driver.hpp"
+#include "thread_pool.hpp"
+
+static constexpr uint32_t SERVE_REQUEST_MAGIC = 0x51435442;    // "BTCQ"
+static constexpr uint32_t SERVE_RESPONSE_MAGIC = 0x52435442;   // "BTCR"
+static constexpr uint32_t SERVE_MAX_SOURCE = 256u << 20;
+
+enum ServeFlags : uint32_t
+{
+    SERVE_OPTIMIZE = 1 << 0,        // -O
+    SERVE_OBJECT = 1 << 1,          // -c
+    SERVE_LEVEL_1 = 1 << 2,         // -O1 rather than -O2, with SERVE_OPTIMIZE
+    SERVE_NO_VECTORIZE = 1 << 3,    // --no-vectorize
+};
+
+struct ServeRequest
+{
+    uint32_t magic = SERVE_REQUEST_MAGIC;
+    uint32_t flags = 0;             // ServeFlags
+    uint32_t unroll_factor = 0;     // --unroll, 0 keeps the server's
+    uint32_t source_size = 0;
+};
+
+struct ServeResponse
+{
+    uint32_t magic = SERVE_RESPONSE_MAGIC;
+    uint32_t ok = 0;
+    uint32_t messages_size = 0;
+    uint32_t errors_size = 0;
+    uint64_t output_size = 0;
+};
+
+/**
+ * Compile server
+ *
+ * run's thread polls the listening socket and every idle connection, and
+ * reads requests without blocking. Only a request whose header and source
+ * have all arrived goes to a pool worker, which compiles it and writes the
+ * answer; the connection is then polled again. An idle or slow client holds
+ * a descriptor, never a worker. A request's functions are compiled on its
+ * worker alone: requests are the unit of parallelism. A malformed request
+ * closes its connection, nothing else.
+ */
+class CompileServer
+{
+public:
+    /**
+     * Serve on socket_path (relative paths are under the project root) with
+     * threads workers (0 is one per hardware thread). defaults supply what
+     * a request does not carry: loop options and the cache. The loop options
+     * are those of -O2, before set_opt_level; each request's level is
+     * applied to a copy.
+     */
+    CompileServer (const std::string& socket_path, const CompileOptions& defaults,
+                   size_t threads = 0);
+    ~CompileServer ();
+
+    CompileServer (const CompileServer&) = delete;
+    CompileServer& operator = (const CompileServer&) = delete;
+
+    /**
+     * Bind the socket, replacing a stale one
+     * Returns false with a reason if the path is too long, another server
+     * is listening on it or it cannot be bound
+     */
+    bool listen (std::string& error);
+
+    /**
+     * Accept and serve connections until stop (), then wait for the
+     * requests in progress and remove the socket
+     */
+    void run ();
+
+    /**
+     * Make run return; safe from any thread and from a signal handler
+     */
+    void stop ();
+
+    /**
+     * Requests compiled so far
+     */
+    size_t served () const;
+
+private:
+    /**
+     * An open connection and the request being read from it
+     */
+    struct Connection
+    {
+        ServeRequest request {};
+        size_t header_read = 0;
+        size_t source_read = 0;
+        std::string source {};      // Keeps its capacity between requests
+        bool busy = false;          // On a worker, not polled
+    };
+
+    std::string path_;
+    CompileOptions defaults_;
+    ThreadPool pool_;
+    int listen_fd_ = -1;
+    int wake_[2] = {-1, -1};        // stop () writes to wake_[1]
+    int done_[2] = {-1, -1};        // Workers write to done_[1] after answering
+
+    // Only run's thread touches these
+    std::unordered_map<int, Connection> connections_ {};
+    std::vector<std::future<void>> handlers_ {};
+
+    mutable std::mutex mutex_ {};
+    std::vector<std::pair<int, bool>> finished_ {};  // Answered: fd, still usable
+    size_t served_ = 0;
+
+    /**
+     * Read what has arrived on fd without blocking
+     * Returns false if the connection is closed or the request malformed
+     */
+    bool receive (int fd, Connection& connection);
+
+    /**
+     * Compile connection's complete request and write the answer (on a
+     * worker)
+     */
+    void serve_request (int fd, Connection& connection);
+
+    /**
+     * Poll again the connections workers have answered on, close the
+     * broken ones
+     */
+    void collect_finished ();
+};
+
+/**
+ * Connect to the server on socket_path
+ * @return Descriptor, -1 if nothing is listening there
+ */
+int connect_server (const std::string& socket_path);
+
+/**
+ * Send one compile request on fd and wait for the answer
+ * options.optimize, opt_level, object and vectorize are sent, and
+ * unroll_factor unless it is 0 (the server's is kept); output gets the .s or
+ * .o bytes
+ * Returns false if the connection failed, the result is then unset
+ */
+bool request_compile (int fd, const std::string& source, const CompileOptions& options,
+                      CompileResult& result, std::string& output,
+                      uint32_t unroll_factor = 0);
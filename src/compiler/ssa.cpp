@@ -0,0 +1,949 @@
+/**
+ * @file ssa.cpp
+ * @brief SSA construction from the AST and CFG utilities
+ */
+
+#include "ssa.hpp"
+#include "codegen.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+#include <utility>
+
+namespace
+{
+
+SsaOp binary_op (BinaryOp::Op op)
+{
+    switch (op)
+    {
+        case BinaryOp::Op::ADD: return SsaOp::ADD;
+        case BinaryOp::Op::SUB: return SsaOp::SUB;
+        case BinaryOp::Op::MUL: return SsaOp::MUL;
+        case BinaryOp::Op::DIV: return SsaOp::DIV;
+        case BinaryOp::Op::EQ:  return SsaOp::EQ;
+        case BinaryOp::Op::NE:  return SsaOp::NE;
+        case BinaryOp::Op::LT:  return SsaOp::LT;
+        case BinaryOp::Op::GT:  return SsaOp::GT;
+        case BinaryOp::Op::AND:
+        case BinaryOp::Op::OR:  break;     // Control flow, see gen_cond
+    }
+    return SsaOp::NOP;
+}
+
+class SsaBuilder
+{
+public:
+    explicit SsaBuilder (SsaProgram& prog)
+        : prog_ (prog) {}
+
+    SsaFunction build (const Function& func);
+
+private:
+    SsaProgram& prog_;
+    std::unordered_map<std::string, uint32_t> symbol_ids_;
+
+    SsaFunction func_;
+    uint32_t block_ = 0;            // Block receiving new instructions
+    uint32_t undef_ = NO_VALUE;     // Value of variables read before a write
+
+    // Variables are numbered per declaration, so shadowing gets a fresh one
+    std::unordered_map<std::string, uint32_t> vars_;
+    uint32_t var_count_ = 0;
+
+    // Value of each variable at the end of each block, and phis waiting for
+    // their block to be sealed (all preds known)
+    std::vector<std::unordered_map<uint32_t, uint32_t>> defs_;
+    std::vector<bool> sealed_;
+    std::vector<std::vector<std::pair<uint32_t, uint32_t>>> incomplete_;
+
+    // Branch edges still waiting for their target: (block, succ index)
+    using Edges = std::vector<std::pair<uint32_t, uint32_t>>;
+    struct CondExits
+    {
+        Edges if_true;
+        Edges if_false;
+    };
+
+    uint32_t new_block ();
+    void add_edge (uint32_t from, uint32_t to);
+    void seal (uint32_t block);
+    void jump (uint32_t target);
+    void branch (uint32_t cond, CondExits& exits);
+    void patch (const Edges& edges, uint32_t target);
+    uint32_t value (SsaOp op, int32_t imm = 0, std::vector<uint32_t> args = {});
+    uint32_t new_phi (uint32_t block);
+    uint32_t undef ();
+    uint32_t symbol (const std::string& name);
+    uint32_t lookup (const std::string& name) const;
+
+    void write_var (uint32_t var, uint32_t block, uint32_t val);
+    uint32_t read_var (uint32_t var, uint32_t block);
+    uint32_t read_var_recursive (uint32_t var, uint32_t block);
+    void add_phi_operands (uint32_t var, uint32_t phi);
+
+    void gen_block (const Block& block);
+    void gen_stmt (const Stmt& stmt);
+    uint32_t gen_expr (const Expr& expr);
+    CondExits gen_cond (const Expr& expr);
+    uint32_t gen_logical (const BinaryOp& node);
+};
+
+SsaFunction SsaBuilder::build (const Function& func)
+{
+    if (func.params.size () > 6)
+        throw GenError ("Function '" + func.name + "' has more than 6 parameters");
+
+    // Reset per-function state
+    func_ = SsaFunction {func.name, static_cast<uint32_t> (func.params.size ()), {}, {}};
+    undef_ = NO_VALUE;
+    vars_.clear ();
+    var_count_ = 0;
+    defs_.clear ();
+    sealed_.clear ();
+    incomplete_.clear ();
+
+    block_ = new_block ();
+    seal (block_);
+
+    for (size_t i = 0; i < func.params.size (); ++i)
+    {
+        uint32_t var = var_count_++;
+        vars_[func.params[i].name] = var;
+        write_var (var, block_, value (SsaOp::PARAM, static_cast<int32_t> (i)));
+    }
+
+    // Falling off the end leaves the last block's RETURN without a value
+    gen_block (func.body);
+
+    remove_trivial_phis (func_);
+    return std::move (func_);
+}
+
+uint32_t SsaBuilder::new_block ()
+{
+    func_.blocks.emplace_back ();
+    defs_.emplace_back ();
+    sealed_.push_back (false);
+    incomplete_.emplace_back ();
+    return static_cast<uint32_t> (func_.blocks.size () - 1);
+}
+
+void SsaBuilder::add_edge (uint32_t from, uint32_t to)
+{
+    func_.blocks[to].preds.push_back (from);
+}
+
+/**
+ * Every pred of block is known, complete its waiting phis
+ */
+void SsaBuilder::seal (uint32_t block)
+{
+    auto waiting = std::move (incomplete_[block]);
+    for (auto [var, phi] : waiting)
+        add_phi_operands (var, phi);
+    sealed_[block] = true;
+}
+
+/**
+ * End the current block with a jump to target
+ */
+void SsaBuilder::jump (uint32_t target)
+{
+    SsaBlock& block = func_.blocks[block_];
+    block.exit = SsaExit::JUMP;
+    block.succs[0] = target;
+    add_edge (block_, target);
+}
+
+/**
+ * End the current block with a branch on cond. Both targets are filled in
+ * by patch once they exist.
+ */
+void SsaBuilder::branch (uint32_t cond, CondExits& exits)
+{
+    SsaBlock& block = func_.blocks[block_];
+    block.exit = SsaExit::BRANCH;
+    block.value = cond;
+    exits.if_true.push_back ({block_, 0});
+    exits.if_false.push_back ({block_, 1});
+}
+
+void SsaBuilder::patch (const Edges& edges, uint32_t target)
+{
+    for (auto [block, succ] : edges)
+    {
+        func_.blocks[block].succs[succ] = target;
+        add_edge (block, target);
+    }
+}
+
+uint32_t SsaBuilder::value (SsaOp op, int32_t imm, std::vector<uint32_t> args)
+{
+    uint32_t id = static_cast<uint32_t> (func_.insts.size ());
+    func_.insts.push_back (SsaInst {op, imm, block_, std::move (args)});
+    func_.blocks[block_].insts.push_back (id);
+    return id;
+}
+
+/**
+ * Empty phi at the head of block, after any existing ones
+ */
+uint32_t SsaBuilder::new_phi (uint32_t block)
+{
+    uint32_t id = static_cast<uint32_t> (func_.insts.size ());
+    func_.insts.push_back (SsaInst {SsaOp::PHI, 0, block, {}});
+
+    auto& insts = func_.blocks[block].insts;
+    auto pos = std::find_if (insts.begin (), insts.end (), [this] (uint32_t v)
+    {
+        return func_.insts[v].op != SsaOp::PHI;
+    });
+    insts.insert (pos, id);
+    return id;
+}
+
+/**
+ * Zero constant at the head of the entry, shared by every undefined read
+ */
+uint32_t SsaBuilder::undef ()
+{
+    if (undef_ == NO_VALUE)
+    {
+        undef_ = static_cast<uint32_t> (func_.insts.size ());
+        func_.insts.push_back (SsaInst {SsaOp::CONST, 0, 0, {}});
+        auto& entry = func_.blocks[0].insts;
+        entry.insert (entry.begin (), undef_);
+    }
+    return undef_;
+}
+
+/**
+ * Intern a call target name
+ */
+uint32_t SsaBuilder::symbol (const std::string& name)
+{
+    auto [it, inserted] = symbol_ids_.try_emplace (
+        name, static_cast<uint32_t> (prog_.symbols.size ()));
+    if (inserted)
+        prog_.symbols.push_back (name);
+    return it->second;
+}
+
+uint32_t SsaBuilder::lookup (const std::string& name) const
+{
+    auto it = vars_.find (name);
+    if (it == vars_.end ())
+        throw GenError ("Unknown variable '" + name + "'");
+    return it->second;
+}
+
+/********** VARIABLE RENAMING **********/
+void SsaBuilder::write_var (uint32_t var, uint32_t block, uint32_t val)
+{
+    defs_[block][var] = val;
+}
+
+uint32_t SsaBuilder::read_var (uint32_t var, uint32_t block)
+{
+    auto it = defs_[block].find (var);
+    if (it != defs_[block].end ())
+        return it->second;
+    return read_var_recursive (var, block);
+}
+
+uint32_t SsaBuilder::read_var_recursive (uint32_t var, uint32_t block)
+{
+    uint32_t val;
+    const auto& preds = func_.blocks[block].preds;
+
+    if (!sealed_[block])
+    {
+        // Preds still missing, fill the phi in once they are known
+        val = new_phi (block);
+        incomplete_[block].emplace_back (var, val);
+    }
+    else if (preds.empty ())
+        val = undef ();
+    else if (preds.size () == 1)
+        val = read_var (var, preds[0]);
+    else
+    {
+        // Write first to break cycles through loops
+        val = new_phi (block);
+        write_var (var, block, val);
+        add_phi_operands (var, val);
+    }
+
+    write_var (var, block, val);
+    return val;
+}
+
+void SsaBuilder::add_phi_operands (uint32_t var, uint32_t phi)
+{
+    uint32_t block = func_.insts[phi].block;
+    std::vector<uint32_t> args;
+    args.reserve (func_.blocks[block].preds.size ());
+
+    // Index loop: reads may add blocks' phis and grow insts
+    for (size_t i = 0; i < func_.blocks[block].preds.size (); ++i)
+        args.push_back (read_var (var, func_.blocks[block].preds[i]));
+
+    func_.insts[phi].args = std::move (args);
+}
+
+/********** AST WALK **********/
+void SsaBuilder::gen_block (const Block& block)
+{
+    for (const auto& stmt : block.statements)
+        gen_stmt (stmt);
+}
+
+void SsaBuilder::gen_stmt (const Stmt& stmt)
+{
+    std::visit ([this] (const auto& node)
+    {
+        using T = std::decay_t<decltype (node)>;
+
+        // Return statement, anything after it lands in an unreachable block
+        if constexpr (std::is_same_v<T, ReturnStmt>)
+        {
+            uint32_t val = gen_expr (*node.value);
+            func_.blocks[block_].exit = SsaExit::RETURN;
+            func_.blocks[block_].value = val;
+
+            block_ = new_block ();
+            seal (block_);
+        }
+
+        // Variable declaration
+        else if constexpr (std::is_same_v<T, VarDecl>)
+        {
+            uint32_t val = node.init.has_value () ? gen_expr (*node.init.value ())
+                                                  : undef ();
+            uint32_t var = var_count_++;
+            vars_[node.name] = var;
+            write_var (var, block_, val);
+        }
+
+        // Variable assignment
+        else if constexpr (std::is_same_v<T, Assignment>)
+        {
+            uint32_t val = gen_expr (*node.value);
+            write_var (lookup (node.name), block_, val);
+        }
+
+        // If statement, blocks are numbered in source order so lowering can
+        // lay them out as they come
+        else if constexpr (std::is_same_v<T, IfStmt>)
+        {
+            CondExits cond = gen_cond (*node.condition);
+            uint32_t then_block = new_block ();
+            patch (cond.if_true, then_block);
+            seal (then_block);
+
+            block_ = then_block;
+            gen_block (*node.then_block);
+            uint32_t end_block = new_block ();
+            jump (end_block);
+
+            patch (cond.if_false, end_block);
+            seal (end_block);
+            block_ = end_block;
+        }
+
+        // While statement, the header is sealed once the back edge exists
+        else if constexpr (std::is_same_v<T, WhileStmt>)
+        {
+            uint32_t header = new_block ();
+            jump (header);
+            block_ = header;
+
+            CondExits cond = gen_cond (*node.condition);
+            uint32_t body = new_block ();
+            patch (cond.if_true, body);
+            seal (body);
+
+            block_ = body;
+            gen_block (*node.body);
+            jump (header);
+            seal (header);
+
+            uint32_t end_block = new_block ();
+            patch (cond.if_false, end_block);
+            seal (end_block);
+            block_ = end_block;
+        }
+
+        // Switch statement: one edge per case value into its body, the
+        // default edge into the default body or straight to the end
+        else if constexpr (std::is_same_v<T, SwitchStmt>)
+        {
+            uint32_t val = gen_expr (*node.value);
+            uint32_t head = block_;
+            func_.blocks[head].exit = SsaExit::SWITCH;
+            func_.blocks[head].value = val;
+
+            Edges to_end;
+            auto gen_body = [&] (const Block& body, const std::vector<int>& values)
+            {
+                uint32_t b = new_block ();
+                SsaBlock& block = func_.blocks[head];
+                if (values.empty ())
+                {
+                    block.succs[0] = b;
+                    add_edge (head, b);
+                }
+                for (int v : values)
+                {
+                    block.cases.push_back (v);
+                    block.succs.push_back (b);
+                    add_edge (head, b);
+                }
+                seal (b);
+
+                block_ = b;
+                gen_block (body);
+                func_.blocks[block_].exit = SsaExit::JUMP;
+                to_end.push_back ({block_, 0});
+            };
+
+            func_.blocks[head].succs.resize (1);
+            for (const auto& c : node.cases)
+                gen_body (*c.body, c.values);
+            if (node.default_body)
+                gen_body (*node.default_body, {});
+            else
+                to_end.push_back ({head, 0});
+
+            uint32_t end_block = new_block ();
+            patch (to_end, end_block);
+            seal (end_block);
+            block_ = end_block;
+        }
+
+        // Block
+        else if constexpr (std::is_same_v<T, Block>)
+        {
+            gen_block (node);
+        }
+
+        // Expression statement (result discarded)
+        else if constexpr (std::is_same_v<T, ExprStmt>)
+        {
+            gen_expr (*node.expression);
+        }
+
+        // Default
+        else
+        {
+            throw GenError ("Unsupported statement type");
+        }
+    }, stmt.node);
+}
+
+uint32_t SsaBuilder::gen_expr (const Expr& expr)
+{
+    return std::visit ([this] (const auto& node) -> uint32_t
+    {
+        using T = std::decay_t<decltype (node)>;
+
+        // Int literal
+        if constexpr (std::is_same_v<T, IntLiteral>)
+        {
+            return value (SsaOp::CONST, node.value);
+        }
+
+        // Identifier
+        else if constexpr (std::is_same_v<T, Identifier>)
+        {
+            return read_var (lookup (node.name), block_);
+        }
+
+        // Unary op
+        else if constexpr (std::is_same_v<T, UnaryOp>)
+        {
+            uint32_t operand = gen_expr (*node.operand);
+            SsaOp op = node.op == UnaryOp::Op::NEGATE ? SsaOp::NEG : SsaOp::NOT;
+            return value (op, 0, {operand});
+        }
+
+        // Function call
+        else if constexpr (std::is_same_v<T, FuncCall>)
+        {
+            if (node.args.size () > 6)
+                throw GenError ("Call to '" + node.name + "' has more than 6 arguments");
+
+            std::vector<uint32_t> args;
+            args.reserve (node.args.size ());
+            for (auto& arg : node.args)
+                args.push_back (gen_expr (*arg));
+
+            return value (SsaOp::CALL, static_cast<int32_t> (symbol (node.name)),
+                          std::move (args));
+        }
+
+        // Binary op, && and || only evaluate their right side when needed
+        else if constexpr (std::is_same_v<T, BinaryOp>)
+        {
+            if (node.op == BinaryOp::Op::AND || node.op == BinaryOp::Op::OR)
+                return gen_logical (node);
+
+            uint32_t l = gen_expr (*node.left);
+            uint32_t r = gen_expr (*node.right);
+            return value (binary_op (node.op), 0, {l, r});
+        }
+
+        // Default
+        else
+        {
+            throw GenError ("Unsupported expression type");
+            return NO_VALUE;
+        }
+    }, expr.node);
+}
+
+/**
+ * Lower a condition straight to branches: && and || jump past their right
+ * side once the left decides, ! swaps the targets. Anything else is
+ * evaluated and branched on.
+ */
+SsaBuilder::CondExits SsaBuilder::gen_cond (const Expr& expr)
+{
+    if (const auto* node = std::get_if<BinaryOp> (&expr.node);
+        node && (node->op == BinaryOp::Op::AND || node->op == BinaryOp::Op::OR))
+    {
+        bool is_and = node->op == BinaryOp::Op::AND;
+        CondExits left = gen_cond (*node->left);
+
+        uint32_t rhs = new_block ();
+        patch (is_and ? left.if_true : left.if_false, rhs);
+        seal (rhs);
+        block_ = rhs;
+
+        CondExits right = gen_cond (*node->right);
+        Edges& decided = is_and ? left.if_false : left.if_true;
+        Edges& merged = is_and ? right.if_false : right.if_true;
+        merged.insert (merged.end (), decided.begin (), decided.end ());
+        return right;
+    }
+
+    if (const auto* node = std::get_if<UnaryOp> (&expr.node);
+        node && node->op == UnaryOp::Op::NOT)
+    {
+        CondExits exits = gen_cond (*node->operand);
+        std::swap (exits.if_true, exits.if_false);
+        return exits;
+    }
+
+    CondExits exits;
+    branch (gen_expr (expr), exits);
+    return exits;
+}
+
+/**
+ * && or || as a value: edges where the left side decided bring in 0 (&&)
+ * or 1 (||), the right side brings its own truth value
+ */
+uint32_t SsaBuilder::gen_logical (const BinaryOp& node)
+{
+    bool is_and = node.op == BinaryOp::Op::AND;
+
+    // Defined before any branch so they dominate every edge into the join
+    uint32_t zero = value (SsaOp::CONST, 0);
+    uint32_t decided = is_and ? zero : value (SsaOp::CONST, 1);
+
+    CondExits left = gen_cond (*node.left);
+    uint32_t rhs = new_block ();
+    patch (is_and ? left.if_true : left.if_false, rhs);
+    seal (rhs);
+    block_ = rhs;
+
+    uint32_t right = gen_expr (*node.right);
+    SsaOp op = func_.insts[right].op;
+    bool boolean = op == SsaOp::EQ || op == SsaOp::NE || op == SsaOp::LT
+                || op == SsaOp::GT || op == SsaOp::NOT;
+    if (!boolean)
+        right = value (SsaOp::NE, 0, {right, zero});
+
+    // The right side's edge comes first, the rest were decided on the left
+    uint32_t join = new_block ();
+    jump (join);
+    patch (is_and ? left.if_false : left.if_true, join);
+    seal (join);
+    block_ = join;
+
+    uint32_t phi = new_phi (join);
+    auto& args = func_.insts[phi].args;
+    args.assign (func_.blocks[join].preds.size (), decided);
+    args[0] = right;
+    return phi;
+}
+
+} // namespace
+
+SsaProgram build_ssa (const Function& func)
+{
+    SsaProgram part;
+    SsaBuilder builder {part};
+    part.functions.push_back (builder.build (func));
+    return part;
+}
+
+SsaProgram build_ssa (const Program& program, ThreadPool* pool)
+{
+    // Each function numbers its own call targets
+    size_t count = program.functions.size ();
+    std::vector<SsaProgram> parts (count);
+    for_each_index (pool, count, [&] (size_t i)
+    {
+        parts[i] = build_ssa (program.functions[i]);
+    });
+
+    return merge_parts (parts);
+}
+
+SsaProgram merge_parts (std::vector<SsaProgram>& parts)
+{
+    size_t count = parts.size ();
+    SsaProgram prog;
+    prog.functions.reserve (count);
+    std::unordered_map<std::string, uint32_t> symbol_ids;
+    for (auto& part : parts)
+    {
+        std::vector<int32_t> ids;
+        ids.reserve (part.symbols.size ());
+        for (auto& name : part.symbols)
+        {
+            auto [it, inserted] = symbol_ids.try_emplace (
+                name, static_cast<uint32_t> (prog.symbols.size ()));
+            if (inserted)
+                prog.symbols.push_back (std::move (name));
+            ids.push_back (static_cast<int32_t> (it->second));
+        }
+
+        SsaFunction& func = part.functions[0];
+        for (auto& inst : func.insts)
+            if (inst.op == SsaOp::CALL)
+                inst.imm = ids[inst.imm];
+        prog.functions.push_back (std::move (func));
+    }
+
+    return prog;
+}
+
+/********** CFG UTILITIES **********/
+std::vector<bool> vector_values (const SsaFunction& func)
+{
+    std::vector<bool> vector (func.insts.size (), false);
+    for (uint32_t v = 0; v < func.insts.size (); ++v)
+    {
+        SsaOp op = func.insts[v].op;
+        vector[v] = is_vector_op (op) && op != SsaOp::VREDUCE;
+    }
+
+    // Phis of phis, around loops
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (uint32_t v = 0; v < func.insts.size (); ++v)
+        {
+            const SsaInst& inst = func.insts[v];
+            if (inst.op != SsaOp::PHI || vector[v])
+                continue;
+            if (std::any_of (inst.args.begin (), inst.args.end (),
+                             [&vector] (uint32_t arg) { return vector[arg]; }))
+            {
+                vector[v] = true;
+                changed = true;
+            }
+        }
+    }
+    return vector;
+}
+
+bool has_effects (const SsaFunction& func, uint32_t v)
+{
+    const SsaInst& inst = func.insts[v];
+    if (inst.op == SsaOp::CALL)
+        return true;
+    if (inst.op != SsaOp::DIV)
+        return false;
+
+    const SsaInst& divisor = func.insts[inst.args[1]];
+    return divisor.op != SsaOp::CONST || divisor.imm == 0 || divisor.imm == -1;
+}
+
+void replace_values (SsaFunction& func, std::vector<uint32_t>& forward)
+{
+    auto resolve = [&forward] (uint32_t v)
+    {
+        uint32_t root = v;
+        while (forward[root] != root)
+            root = forward[root];
+        while (forward[v] != root)
+            v = std::exchange (forward[v], root);
+        return root;
+    };
+
+    for (auto& inst : func.insts)
+        for (auto& arg : inst.args)
+            arg = resolve (arg);
+
+    for (auto& block : func.blocks)
+    {
+        if (block.value != NO_VALUE)
+            block.value = resolve (block.value);
+
+        std::erase_if (block.insts, [&] (uint32_t v)
+        {
+            return forward[v] != v;
+        });
+    }
+
+    for (uint32_t v = 0; v < func.insts.size (); ++v)
+    {
+        if (forward[v] != v)
+        {
+            func.insts[v].op = SsaOp::NOP;
+            func.insts[v].args.clear ();
+        }
+    }
+}
+
+size_t remove_trivial_phis (SsaFunction& func)
+{
+    std::vector<uint32_t> forward (func.insts.size ());
+    std::iota (forward.begin (), forward.end (), 0);
+
+    auto resolve = [&forward] (uint32_t v)
+    {
+        while (forward[v] != v)
+            v = forward[v];
+        return v;
+    };
+
+    size_t removed = 0;
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (auto& block : func.blocks)
+        {
+            for (uint32_t phi : block.insts)
+            {
+                SsaInst& inst = func.insts[phi];
+                if (inst.op != SsaOp::PHI)
+                    break;
+                if (forward[phi] != phi)
+                    continue;
+
+                uint32_t same = NO_VALUE;
+                bool trivial = true;
+                for (uint32_t arg : inst.args)
+                {
+                    arg = resolve (arg);
+                    if (arg == phi || arg == same)
+                        continue;
+                    if (same != NO_VALUE)
+                    {
+                        trivial = false;
+                        break;
+                    }
+                    same = arg;
+                }
+
+                if (!trivial || same == NO_VALUE)
+                    continue;
+
+                forward[phi] = same;
+                ++removed;
+                changed = true;
+            }
+        }
+    }
+
+    if (removed > 0)
+        replace_values (func, forward);
+    return removed;
+}
+
+void remove_pred (SsaFunction& func, uint32_t target, size_t index)
+{
+    SsaBlock& block = func.blocks[target];
+    block.preds.erase (block.preds.begin () + index);
+
+    for (uint32_t v : block.insts)
+    {
+        SsaInst& inst = func.insts[v];
+        if (inst.op != SsaOp::PHI)
+            break;
+        inst.args.erase (inst.args.begin () + index);
+    }
+}
+
+size_t remove_unreachable_blocks (SsaFunction& func)
+{
+    size_t count = func.blocks.size ();
+    std::vector<bool> reached (count, false);
+    std::vector<uint32_t> stack {0};
+    reached[0] = true;
+
+    while (!stack.empty ())
+    {
+        const SsaBlock& block = func.blocks[stack.back ()];
+        stack.pop_back ();
+        for (uint32_t i = 0; i < succ_count (block); ++i)
+        {
+            if (!reached[block.succs[i]])
+            {
+                reached[block.succs[i]] = true;
+                stack.push_back (block.succs[i]);
+            }
+        }
+    }
+
+    size_t removed = std::count (reached.begin (), reached.end (), false);
+    if (removed == 0)
+        return 0;
+
+    // Cut edges out of dead blocks and delete their values
+    for (uint32_t b = 0; b < count; ++b)
+    {
+        if (reached[b])
+            continue;
+
+        const SsaBlock& block = func.blocks[b];
+        for (uint32_t i = 0; i < succ_count (block); ++i)
+        {
+            uint32_t succ = block.succs[i];
+            if (!reached[succ])
+                continue;
+            for (size_t p = func.blocks[succ].preds.size (); p-- > 0;)
+                if (func.blocks[succ].preds[p] == b)
+                    remove_pred (func, succ, p);
+        }
+
+        for (uint32_t v : block.insts)
+        {
+            func.insts[v].op = SsaOp::NOP;
+            func.insts[v].args.clear ();
+        }
+    }
+
+    // Renumber the survivors
+    std::vector<uint32_t> new_id (count, NO_VALUE);
+    std::vector<SsaBlock> blocks;
+    blocks.reserve (count - removed);
+    for (uint32_t b = 0; b < count; ++b)
+    {
+        if (reached[b])
+        {
+            new_id[b] = static_cast<uint32_t> (blocks.size ());
+            blocks.push_back (std::move (func.blocks[b]));
+        }
+    }
+
+    for (uint32_t b = 0; b < blocks.size (); ++b)
+    {
+        SsaBlock& block = blocks[b];
+        for (uint32_t i = 0; i < succ_count (block); ++i)
+            block.succs[i] = new_id[block.succs[i]];
+        for (auto& pred : block.preds)
+            pred = new_id[pred];
+        for (uint32_t v : block.insts)
+            func.insts[v].block = b;
+    }
+
+    func.blocks = std::move (blocks);
+    return removed;
+}
+
+std::vector<uint32_t> compute_idoms (const SsaFunction& func)
+{
+    size_t count = func.blocks.size ();
+
+    // Reverse postorder by iterative DFS
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> rpo_index (count, NO_VALUE);
+    std::vector<std::pair<uint32_t, uint32_t>> stack {{0, 0}};
+    order.reserve (count);
+    rpo_index[0] = 0;
+
+    while (!stack.empty ())
+    {
+        auto& [b, next] = stack.back ();
+        const SsaBlock& block = func.blocks[b];
+        if (next < succ_count (block))
+        {
+            uint32_t succ = block.succs[next++];
+            if (rpo_index[succ] == NO_VALUE)
+            {
+                rpo_index[succ] = 0;
+                stack.emplace_back (succ, 0);
+            }
+        }
+        else
+        {
+            order.push_back (b);
+            stack.pop_back ();
+        }
+    }
+
+    std::reverse (order.begin (), order.end ());
+    for (uint32_t i = 0; i < order.size (); ++i)
+        rpo_index[order[i]] = i;
+
+    std::vector<uint32_t> idom (count, NO_VALUE);
+    idom[0] = 0;
+
+    auto intersect = [&] (uint32_t a, uint32_t b)
+    {
+        while (a != b)
+        {
+            while (rpo_index[a] > rpo_index[b])
+                a = idom[a];
+            while (rpo_index[b] > rpo_index[a])
+                b = idom[b];
+        }
+        return a;
+    };
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (uint32_t b : order)
+        {
+            if (b == 0)
+                continue;
+
+            uint32_t new_idom = NO_VALUE;
+            for (uint32_t pred : func.blocks[b].preds)
+            {
+                if (idom[pred] == NO_VALUE)
+                    continue;
+                new_idom = new_idom == NO_VALUE ? pred : intersect (pred, new_idom);
+            }
+
+            if (idom[b] != new_idom)
+            {
+                idom[b] = new_idom;
+                changed = true;
+            }
+        }
+    }
+
+    return idom;
+}
+
+size_t live_insts (const SsaProgram& prog)
+{
+    size_t count = 0;
+    for (const auto& func : prog.functions)
+        for (const auto& block : func.blocks)
+            count += block.insts.size ();
+    return count;
+}
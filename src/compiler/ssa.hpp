@@ -0,0 +1,192 @@
+/**
+ * @file ssa.hpp
+ * @brief Mid-level IR: a control flow graph of blocks in SSA form.
+ *
+ * Codegen builds one SsaFunction per Function straight from the AST, the
+ * passes in ssa_opt.hpp rewrite it under -O, and it is then lowered to MIR.
+ * Every instruction defines exactly one value, named by its index into
+ * SsaFunction::insts: an int, or for the vector ops four int lanes that
+ * only the loop vectorizer creates. Block 0 is the entry.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ast.hpp"
+
+class ThreadPool;
+
+static constexpr uint32_t NO_VALUE = UINT32_MAX;
+
+enum class SsaOp : uint8_t
+{
+    CONST,          // imm
+    PARAM,          // imm = parameter index
+    ADD, SUB, MUL, DIV,
+    EQ, NE, LT, GT, // && and || are lowered to branches
+    NEG, NOT,
+    CALL,           // imm = symbol, args = arguments
+    PHI,            // args[i] flows in from the block's preds[i]
+    NOP,            // Removed, no longer in any block
+
+    // Four int lanes, lane l standing for iteration 4k + l of a loop
+    VSPLAT,         // args[0] in every lane
+    VSTEP,          // args[0] + l * imm in lane l
+    VSCALAR,        // args[0] in lane 0, zero in the others
+    VADD, VSUB, VMUL,
+    VREDUCE         // Int: the sum of the lanes of args[0]
+};
+
+/**
+ * Vector values a function may hold: codegen gives each its own xmm
+ * register, keeping one for scratch
+ */
+static constexpr size_t MAX_VECTOR_VALUES = 15;
+
+/**
+ * Whether op is one of the vector ops above
+ */
+inline bool is_vector_op (SsaOp op)
+{
+    return op >= SsaOp::VSPLAT;
+}
+
+struct SsaInst
+{
+    SsaOp op;
+    int32_t imm = 0;
+    uint32_t block = 0;
+    std::vector<uint32_t> args;
+};
+
+enum class SsaExit : uint8_t
+{
+    JUMP,           // To succs[0]
+    BRANCH,         // To succs[0] if value is nonzero, else succs[1]
+    RETURN,         // value, or NO_VALUE when control falls off the end
+    SWITCH          // To succs[i + 1] if value is cases[i], else succs[0]
+};
+
+struct SsaBlock
+{
+    std::vector<uint32_t> insts;    // Phis first, then in evaluation order
+    std::vector<uint32_t> preds;
+    SsaExit exit = SsaExit::RETURN;
+    uint32_t value = NO_VALUE;
+    std::vector<uint32_t> succs {0, 0};
+    std::vector<int32_t> cases {};  // SWITCH: distinct, in source order
+};
+
+struct SsaFunction
+{
+    std::string name;
+    uint32_t param_count = 0;
+    std::vector<SsaInst> insts;
+    std::vector<SsaBlock> blocks;
+};
+
+struct SsaProgram
+{
+    std::vector<SsaFunction> functions;
+    std::vector<std::string> symbols;   // Call targets
+};
+
+/**
+ * Number of successors of a block (0, 1, 2, or a switch's cases and default)
+ * Several may be the same block, each edge is then one entry in its preds.
+ */
+inline uint32_t succ_count (const SsaBlock& block)
+{
+    switch (block.exit)
+    {
+        case SsaExit::JUMP:   return 1;
+        case SsaExit::BRANCH: return 2;
+        case SsaExit::RETURN: return 0;
+        case SsaExit::SWITCH: return static_cast<uint32_t> (block.cases.size ()) + 1;
+    }
+    return 0;
+}
+
+/**
+ * Make block a plain jump to target, dropping any switch cases
+ */
+inline void set_jump (SsaBlock& block, uint32_t target)
+{
+    block.exit = SsaExit::JUMP;
+    block.value = NO_VALUE;
+    block.succs.assign ({target, 0});
+    block.cases.clear ();
+}
+
+/**
+ * Build SSA for every function
+ * Variables are renamed on the fly while walking the AST, following Braun
+ * et al., "Simple and Efficient Construction of SSA Form". Loop headers stay
+ * unsealed until their back edge is known. Throws GenError on unknown
+ * variables and on more than 6 parameters or arguments.
+ *
+ * With a pool, functions are built in parallel. Call targets are numbered
+ * in source order either way, so the result does not depend on the pool.
+ */
+SsaProgram build_ssa (const Program& program, ThreadPool* pool = nullptr);
+
+/**
+ * One function on its own: a program of just func, whose symbols are the
+ * targets of its calls in the order they first appear
+ */
+SsaProgram build_ssa (const Function& func);
+
+/**
+ * Concatenate one-function programs in order, renumbering their call
+ * targets into one symbol table (the parts are moved from)
+ */
+SsaProgram merge_parts (std::vector<SsaProgram>& parts);
+
+/**
+ * Which values hold four lanes: the vector ops but VREDUCE, and phis
+ * merging them
+ */
+std::vector<bool> vector_values (const SsaFunction& func);
+
+/**
+ * Whether v must run where it is: calls, and divisions whose divisor is not
+ * a constant other than 0 and -1 (they may trap)
+ */
+bool has_effects (const SsaFunction& func, uint32_t v);
+
+/**
+ * Redirect uses: every value v with forward[v] != v is replaced by
+ * forward[v] (chains are followed) and deleted from its block
+ */
+void replace_values (SsaFunction& func, std::vector<uint32_t>& forward);
+
+/**
+ * Replace phis whose operands are all one value (or the phi itself)
+ * Returns the number of phis removed.
+ */
+size_t remove_trivial_phis (SsaFunction& func);
+
+/**
+ * Drop the edge into block target from its pred index, with the phi operands
+ */
+void remove_pred (SsaFunction& func, uint32_t target, size_t index);
+
+/**
+ * Delete blocks not reachable from the entry and renumber the rest, keeping
+ * their order. Returns the number of blocks deleted.
+ */
+size_t remove_unreachable_blocks (SsaFunction& func);
+
+/**
+ * Immediate dominator of every block (the entry is its own)
+ * Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm". Expects
+ * every block to be reachable.
+ */
+std::vector<uint32_t> compute_idoms (const SsaFunction& func);
+
+/**
+ * Instructions still placed in a block, over every function
+ */
+size_t live_insts (const SsaProgram& prog);
@@ -0,0 +1,783 @@
+/**
+ * @file ssa_opt.cpp
+ * @brief SCCP, GVN, dead code elimination and CFG cleanup over SSA
+ */
+
+#include "ssa_opt.hpp"
+#include "ipo.hpp"
+#include "optimizer.hpp"
+#include "thread_pool.hpp"
+#include "time_report.hpp"
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+
+namespace
+{
+
+/**
+ * Evaluate an SSA operator on constants, reusing the AST folding rules
+ * Returns nullopt when the result is not a compile-time constant.
+ */
+std::optional<int> fold (SsaOp op, int l, int r)
+{
+    switch (op)
+    {
+        case SsaOp::ADD: return fold_binary (BinaryOp::Op::ADD, l, r);
+        case SsaOp::SUB: return fold_binary (BinaryOp::Op::SUB, l, r);
+        case SsaOp::MUL: return fold_binary (BinaryOp::Op::MUL, l, r);
+        case SsaOp::DIV: return fold_binary (BinaryOp::Op::DIV, l, r);
+        case SsaOp::EQ:  return fold_binary (BinaryOp::Op::EQ,  l, r);
+        case SsaOp::NE:  return fold_binary (BinaryOp::Op::NE,  l, r);
+        case SsaOp::LT:  return fold_binary (BinaryOp::Op::LT,  l, r);
+        case SsaOp::GT:  return fold_binary (BinaryOp::Op::GT,  l, r);
+        case SsaOp::NEG: return fold_unary (UnaryOp::Op::NEGATE, l);
+        case SsaOp::NOT: return fold_unary (UnaryOp::Op::NOT, l);
+        default:         return std::nullopt;
+    }
+}
+
+bool is_commutative (SsaOp op)
+{
+    return op == SsaOp::ADD || op == SsaOp::MUL || op == SsaOp::EQ
+        || op == SsaOp::NE;
+}
+
+/**
+ * Keep phis at the head of every block after values were rewritten
+ */
+void sort_phis_first (SsaFunction& func)
+{
+    for (auto& block : func.blocks)
+        std::stable_partition (block.insts.begin (), block.insts.end (),
+                               [&func] (uint32_t v)
+        {
+            return func.insts[v].op == SsaOp::PHI;
+        });
+}
+
+/********** SCCP **********/
+struct Lattice
+{
+    enum class State : uint8_t
+    {
+        TOP,            // No evidence yet
+        CONST,
+        BOTTOM          // Not a constant
+    };
+
+    State state = State::TOP;
+    int32_t value = 0;
+
+    static Lattice constant (int32_t v) { return {State::CONST, v}; }
+    static Lattice bottom () { return {State::BOTTOM, 0}; }
+
+    bool is_top () const { return state == State::TOP; }
+    bool is_const () const { return state == State::CONST; }
+    bool is_const (int32_t v) const { return state == State::CONST && value == v; }
+    bool is_bottom () const { return state == State::BOTTOM; }
+
+    bool operator == (const Lattice&) const = default;
+
+    Lattice meet (const Lattice& other) const
+    {
+        if (is_top ())
+            return other;
+        if (other.is_top () || *this == other)
+            return *this;
+        return bottom ();
+    }
+};
+
+class Propagator
+{
+public:
+    explicit Propagator (SsaFunction& func)
+        : func_ (func), lat_ (func.insts.size ()),
+          users_ (func.insts.size ()), exit_users_ (func.insts.size ()),
+          block_live_ (func.blocks.size (), false),
+          first_edge_ (func.blocks.size () + 1, 0)
+    {
+        for (uint32_t b = 0; b < func.blocks.size (); ++b)
+            first_edge_[b + 1] = first_edge_[b] + std::max (succ_count (func.blocks[b]), 2u);
+        edge_live_.assign (first_edge_.back (), false);
+
+        for (uint32_t b = 0; b < func.blocks.size (); ++b)
+        {
+            const SsaBlock& block = func.blocks[b];
+            for (uint32_t v : block.insts)
+                for (uint32_t arg : func.insts[v].args)
+                    users_[arg].push_back (v);
+            if (block.value != NO_VALUE)
+                exit_users_[block.value].push_back (b);
+        }
+    }
+
+    size_t run ();
+
+private:
+    SsaFunction& func_;
+    std::vector<Lattice> lat_;
+    std::vector<std::vector<uint32_t>> users_;
+    std::vector<std::vector<uint32_t>> exit_users_;     // Blocks testing it
+    std::vector<bool> block_live_;
+    std::vector<uint32_t> first_edge_;                  // Per block, into edge_live_
+    std::vector<bool> edge_live_;                       // Per successor slot
+
+    bool edge_live (uint32_t b, uint32_t slot) const
+    {
+        return edge_live_[first_edge_[b] + slot];
+    }
+
+    std::vector<std::pair<uint32_t, uint32_t>> flow_work_;  // (block, slot)
+    std::vector<uint32_t> ssa_work_;
+
+    bool edge_from (uint32_t pred, uint32_t block) const;
+    Lattice evaluate (uint32_t v) const;
+    void visit_inst (uint32_t v);
+    void visit_exit (uint32_t b);
+    void visit_block (uint32_t b);
+    size_t rewrite ();
+};
+
+/**
+ * An executable edge runs from pred to block
+ */
+bool Propagator::edge_from (uint32_t pred, uint32_t block) const
+{
+    const SsaBlock& p = func_.blocks[pred];
+    for (uint32_t i = 0; i < succ_count (p); ++i)
+        if (p.succs[i] == block && edge_live (pred, i))
+            return true;
+    return false;
+}
+
+Lattice Propagator::evaluate (uint32_t v) const
+{
+    const SsaInst& inst = func_.insts[v];
+
+    switch (inst.op)
+    {
+        case SsaOp::CONST:
+            return Lattice::constant (inst.imm);
+        case SsaOp::PARAM:
+        case SsaOp::CALL:
+            return Lattice::bottom ();
+        case SsaOp::NOP:
+            return {};
+        case SsaOp::PHI:
+        {
+            const auto& preds = func_.blocks[inst.block].preds;
+            Lattice result;
+            for (size_t i = 0; i < inst.args.size (); ++i)
+                if (edge_from (preds[i], inst.block))
+                    result = result.meet (lat_[inst.args[i]]);
+            return result;
+        }
+        case SsaOp::VSPLAT:
+        case SsaOp::VSTEP:
+        case SsaOp::VSCALAR:
+        case SsaOp::VADD:
+        case SsaOp::VSUB:
+        case SsaOp::VMUL:
+        case SsaOp::VREDUCE:
+            return Lattice::bottom ();
+        case SsaOp::NEG:
+        case SsaOp::NOT:
+        {
+            const Lattice& a = lat_[inst.args[0]];
+            if (!a.is_const ())
+                return a;
+            auto val = fold (inst.op, a.value, 0);
+            return val ? Lattice::constant (*val) : Lattice::bottom ();
+        }
+        default:
+            break;
+    }
+
+    const Lattice& l = lat_[inst.args[0]];
+    const Lattice& r = lat_[inst.args[1]];
+
+    // Results decided by one side alone
+    if (inst.op == SsaOp::MUL && (l.is_const (0) || r.is_const (0)))
+        return Lattice::constant (0);
+
+    if (l.is_top () || r.is_top ())
+        return {};
+    if (l.is_bottom () || r.is_bottom ())
+        return Lattice::bottom ();
+
+    auto val = fold (inst.op, l.value, r.value);
+    return val ? Lattice::constant (*val) : Lattice::bottom ();
+}
+
+void Propagator::visit_inst (uint32_t v)
+{
+    // Meet with the old value so a value only ever moves down
+    Lattice next = lat_[v].meet (evaluate (v));
+    if (next != lat_[v])
+    {
+        lat_[v] = next;
+        ssa_work_.push_back (v);
+    }
+}
+
+void Propagator::visit_exit (uint32_t b)
+{
+    const SsaBlock& block = func_.blocks[b];
+    if (block.exit == SsaExit::JUMP)
+        flow_work_.emplace_back (b, 0);
+    else if (block.exit == SsaExit::BRANCH)
+    {
+        const Lattice& cond = lat_[block.value];
+        if (cond.is_const ())
+            flow_work_.emplace_back (b, cond.value != 0 ? 0 : 1);
+        else if (cond.is_bottom ())
+        {
+            flow_work_.emplace_back (b, 0);
+            flow_work_.emplace_back (b, 1);
+        }
+    }
+    else if (block.exit == SsaExit::SWITCH)
+    {
+        const Lattice& val = lat_[block.value];
+        if (val.is_const ())
+        {
+            auto it = std::find (block.cases.begin (), block.cases.end (), val.value);
+            uint32_t slot = it == block.cases.end () ? 0 : 1 + static_cast<uint32_t> (it - block.cases.begin ());
+            flow_work_.emplace_back (b, slot);
+        }
+        else if (val.is_bottom ())
+            for (uint32_t slot = 0; slot < succ_count (block); ++slot)
+                flow_work_.emplace_back (b, slot);
+    }
+}
+
+void Propagator::visit_block (uint32_t b)
+{
+    block_live_[b] = true;
+    for (uint32_t v : func_.blocks[b].insts)
+        visit_inst (v);
+    visit_exit (b);
+}
+
+size_t Propagator::run ()
+{
+    visit_block (0);
+
+    while (!flow_work_.empty () || !ssa_work_.empty ())
+    {
+        while (!flow_work_.empty ())
+        {
+            auto [b, slot] = flow_work_.back ();
+            flow_work_.pop_back ();
+            if (edge_live (b, slot))
+                continue;
+            edge_live_[first_edge_[b] + slot] = true;
+
+            // First visit evaluates everything, later ones only the phis
+            // that gained an operand
+            uint32_t succ = func_.blocks[b].succs[slot];
+            if (!block_live_[succ])
+                visit_block (succ);
+            else
+            {
+                for (uint32_t v : func_.blocks[succ].insts)
+                {
+                    if (func_.insts[v].op != SsaOp::PHI)
+                        break;
+                    visit_inst (v);
+                }
+            }
+        }
+
+        while (!ssa_work_.empty ())
+        {
+            uint32_t v = ssa_work_.back ();
+            ssa_work_.pop_back ();
+            for (uint32_t user : users_[v])
+                if (block_live_[func_.insts[user].block])
+                    visit_inst (user);
+            for (uint32_t b : exit_users_[v])
+                if (block_live_[b])
+                    visit_exit (b);
+        }
+    }
+
+    return rewrite ();
+}
+
+size_t Propagator::rewrite ()
+{
+    size_t changed = 0;
+
+    for (uint32_t b = 0; b < func_.blocks.size (); ++b)
+    {
+        if (!block_live_[b])
+            continue;
+
+        // Branches and switches with one executable edge become jumps
+        SsaBlock& block = func_.blocks[b];
+        uint32_t count = succ_count (block);
+        uint32_t live = 0;
+        for (uint32_t slot = 0; slot < count; ++slot)
+            live += edge_live (b, slot);
+        if (count > 1 && live == 1)
+        {
+            uint32_t taken = NO_VALUE;
+            for (uint32_t slot = 0; slot < count; ++slot)
+            {
+                if (edge_live (b, slot))
+                {
+                    taken = block.succs[slot];
+                    continue;
+                }
+                const auto& preds = func_.blocks[block.succs[slot]].preds;
+                auto it = std::find (preds.begin (), preds.end (), b);
+                remove_pred (func_, block.succs[slot], it - preds.begin ());
+            }
+            set_jump (block, taken);
+            ++changed;
+        }
+
+        for (uint32_t v : block.insts)
+        {
+            SsaInst& inst = func_.insts[v];
+            if (lat_[v].is_const () && inst.op != SsaOp::CONST)
+            {
+                inst.op = SsaOp::CONST;
+                inst.imm = lat_[v].value;
+                inst.args.clear ();
+                ++changed;
+            }
+        }
+    }
+
+    sort_phis_first (func_);
+    changed += remove_unreachable_blocks (func_);
+    changed += remove_trivial_phis (func_);
+    return changed;
+}
+
+/********** GVN **********/
+struct ValueKey
+{
+    SsaOp op;
+    int32_t imm;
+    uint32_t a;
+    uint32_t b;
+
+    bool operator == (const ValueKey&) const = default;
+};
+
+struct ValueKeyHash
+{
+    size_t operator () (const ValueKey& k) const
+    {
+        uint64_t h = static_cast<uint64_t> (k.op) * 0x9E3779B97F4A7C15ull;
+        h ^= static_cast<uint32_t> (k.imm) + 0x9E3779B9u + (h << 6) + (h >> 2);
+        h ^= k.a + 0x9E3779B9u + (h << 6) + (h >> 2);
+        h ^= k.b + 0x9E3779B9u + (h << 6) + (h >> 2);
+        return static_cast<size_t> (h);
+    }
+};
+
+} // namespace
+
+size_t propagate_constants (SsaFunction& func)
+{
+    Propagator propagator {func};
+    return propagator.run ();
+}
+
+size_t number_values (SsaFunction& func)
+{
+    std::vector<uint32_t> idom = compute_idoms (func);
+    std::vector<std::vector<uint32_t>> children (func.blocks.size ());
+    for (uint32_t b = 1; b < func.blocks.size (); ++b)
+        if (idom[b] != NO_VALUE)
+            children[idom[b]].push_back (b);
+
+    std::vector<uint32_t> forward (func.insts.size ());
+    std::iota (forward.begin (), forward.end (), 0);
+
+    // Scoped table: entries are popped when leaving the dominator subtree
+    std::unordered_map<ValueKey, uint32_t, ValueKeyHash> table;
+    std::vector<ValueKey> scope;
+    std::vector<std::pair<uint32_t, size_t>> stack;     // (block, next child)
+    std::vector<size_t> marks;
+    size_t replaced = 0;
+
+    auto enter = [&] (uint32_t b)
+    {
+        marks.push_back (scope.size ());
+        for (uint32_t v : func.blocks[b].insts)
+        {
+            const SsaInst& inst = func.insts[v];
+            // Vector values stay inside the loop they were made for: their
+            // registers are not preserved across calls
+            if (inst.op == SsaOp::PHI || inst.op == SsaOp::CALL
+                || inst.op == SsaOp::PARAM || is_vector_op (inst.op))
+                continue;
+
+            ValueKey key {inst.op, inst.imm, NO_VALUE, NO_VALUE};
+            if (inst.args.size () > 0)
+                key.a = forward[inst.args[0]];
+            if (inst.args.size () > 1)
+                key.b = forward[inst.args[1]];
+
+            if (is_commutative (key.op) && key.a > key.b)
+                std::swap (key.a, key.b);
+            if (key.op == SsaOp::GT)
+            {
+                key.op = SsaOp::LT;
+                std::swap (key.a, key.b);
+            }
+
+            auto [it, inserted] = table.try_emplace (key, v);
+            if (inserted)
+                scope.push_back (key);
+            else
+            {
+                forward[v] = it->second;
+                ++replaced;
+            }
+        }
+    };
+
+    enter (0);
+    stack.emplace_back (0, 0);
+    while (!stack.empty ())
+    {
+        auto& [b, next] = stack.back ();
+        if (next < children[b].size ())
+        {
+            uint32_t child = children[b][next++];
+            enter (child);
+            stack.emplace_back (child, 0);
+            continue;
+        }
+
+        for (size_t i = marks.back (); i < scope.size (); ++i)
+            table.erase (scope[i]);
+        scope.resize (marks.back ());
+        marks.pop_back ();
+        stack.pop_back ();
+    }
+
+    if (replaced > 0)
+        replace_values (func, forward);
+    return replaced;
+}
+
+size_t eliminate_dead_code (SsaFunction& func)
+{
+    std::vector<bool> live (func.insts.size (), false);
+    std::vector<uint32_t> work;
+
+    auto mark = [&] (uint32_t v)
+    {
+        if (!live[v])
+        {
+            live[v] = true;
+            work.push_back (v);
+        }
+    };
+
+    // Roots: control flow, calls and divisions that may trap
+    for (const auto& block : func.blocks)
+    {
+        if (block.value != NO_VALUE)
+            mark (block.value);
+
+        for (uint32_t v : block.insts)
+        {
+            if (has_effects (func, v))
+                mark (v);
+        }
+    }
+
+    while (!work.empty ())
+    {
+        uint32_t v = work.back ();
+        work.pop_back ();
+        for (uint32_t arg : func.insts[v].args)
+            mark (arg);
+    }
+
+    size_t removed = 0;
+    for (auto& block : func.blocks)
+    {
+        removed += std::erase_if (block.insts, [&] (uint32_t v)
+        {
+            if (live[v])
+                return false;
+            func.insts[v].op = SsaOp::NOP;
+            func.insts[v].args.clear ();
+            return true;
+        });
+    }
+    return removed;
+}
+
+size_t simplify_cfg (SsaFunction& func)
+{
+    auto pred_index = [&func] (uint32_t block, uint32_t pred)
+    {
+        const auto& preds = func.blocks[block].preds;
+        return static_cast<size_t> (std::find (preds.begin (), preds.end (), pred)
+                                    - preds.begin ());
+    };
+    auto has_phis = [&func] (uint32_t b)
+    {
+        const auto& insts = func.blocks[b].insts;
+        return !insts.empty () && func.insts[insts[0]].op == SsaOp::PHI;
+    };
+
+    size_t total = 0;
+    size_t changed = 1;
+    while (changed > 0)
+    {
+        changed = 0;
+        changed += remove_trivial_phis (func);
+
+        for (uint32_t b = 0; b < func.blocks.size (); ++b)
+        {
+            SsaBlock& block = func.blocks[b];
+
+            // Branch to the same block twice
+            if (block.exit == SsaExit::BRANCH && block.succs[0] == block.succs[1])
+            {
+                block.exit = SsaExit::JUMP;
+                block.value = NO_VALUE;
+                remove_pred (func, block.succs[0], pred_index (block.succs[0], b));
+                ++changed;
+            }
+
+            // Switch cases that go where the default goes
+            if (block.exit == SsaExit::SWITCH)
+            {
+                uint32_t fallback = block.succs[0];
+                size_t kept = 0;
+                for (size_t i = 0; i < block.cases.size (); ++i)
+                {
+                    if (block.succs[i + 1] == fallback)
+                    {
+                        remove_pred (func, fallback, pred_index (fallback, b));
+                        ++changed;
+                        continue;
+                    }
+                    block.cases[kept] = block.cases[i];
+                    block.succs[kept + 1] = block.succs[i + 1];
+                    ++kept;
+                }
+                block.cases.resize (kept);
+                block.succs.resize (kept + 1);
+                if (kept == 0)
+                {
+                    set_jump (block, fallback);
+                    ++changed;
+                }
+            }
+
+            // Empty block that only jumps on: send its preds straight through,
+            // unless one of them already reaches the target with a different
+            // operand for some phi
+            if (b != 0 && block.insts.empty () && block.exit == SsaExit::JUMP
+                && block.succs[0] != b && !block.preds.empty ())
+            {
+                uint32_t target = block.succs[0];
+                auto& target_preds = func.blocks[target].preds;
+                size_t from_b = pred_index (target, b);
+                bool clash = std::any_of (block.preds.begin (), block.preds.end (),
+                                          [&] (uint32_t p)
+                {
+                    size_t from_p = pred_index (target, p);
+                    if (from_p == target_preds.size ())
+                        return false;
+                    for (uint32_t v : func.blocks[target].insts)
+                    {
+                        const SsaInst& phi = func.insts[v];
+                        if (phi.op != SsaOp::PHI)
+                            break;
+                        if (phi.args[from_p] != phi.args[from_b])
+                            return true;
+                    }
+                    return false;
+                });
+
+                if (!clash)
+                {
+                    size_t index = from_b;
+                    for (uint32_t v : func.blocks[target].insts)
+                    {
+                        SsaInst& phi = func.insts[v];
+                        if (phi.op != SsaOp::PHI)
+                            break;
+                        uint32_t arg = phi.args[index];
+                        phi.args.erase (phi.args.begin () + index);
+                        phi.args.insert (phi.args.end (), block.preds.size (), arg);
+                    }
+                    target_preds.erase (target_preds.begin () + index);
+
+                    for (uint32_t p : block.preds)
+                    {
+                        SsaBlock& pred = func.blocks[p];
+                        for (uint32_t i = 0; i < succ_count (pred); ++i)
+                            if (pred.succs[i] == b)
+                                pred.succs[i] = target;
+                        target_preds.push_back (p);
+                    }
+                    block.preds.clear ();
+                    ++changed;
+                    continue;
+                }
+            }
+
+            // Merge a jump target that has no other pred
+            while (block.exit == SsaExit::JUMP)
+            {
+                uint32_t s = block.succs[0];
+                SsaBlock& succ = func.blocks[s];
+                if (s == b || s == 0 || succ.preds.size () != 1 || has_phis (s))
+                    break;
+
+                for (uint32_t v : succ.insts)
+                    func.insts[v].block = b;
+                block.insts.insert (block.insts.end (), succ.insts.begin (),
+                                    succ.insts.end ());
+                block.exit = succ.exit;
+                block.value = succ.value;
+                block.succs = succ.succs;
+                block.cases = succ.cases;
+
+                for (uint32_t i = 0; i < succ_count (block); ++i)
+                    for (auto& pred : func.blocks[block.succs[i]].preds)
+                        if (pred == s)
+                            pred = b;
+
+                succ.insts.clear ();
+                succ.preds.clear ();
+                succ.exit = SsaExit::RETURN;
+                succ.value = NO_VALUE;
+                succ.cases.clear ();
+                ++changed;
+            }
+        }
+
+        changed += remove_unreachable_blocks (func);
+        total += changed;
+    }
+    return total;
+}
+
+void optimize_scalar (SsaFunction& func)
+{
+    for (int round = 0; round < 4; ++round)
+    {
+        size_t changed = propagate_constants (func);
+        changed += number_values (func);
+        changed += eliminate_dead_code (func);
+        changed += simplify_cfg (func);
+        if (changed == 0)
+            break;
+    }
+}
+
+void optimize_ssa (SsaFunction& func, const LoopOptions& loops)
+{
+    optimize_scalar (func);
+    if (optimize_loops (func, loops) != 0)
+        optimize_scalar (func);
+}
+
+void optimize_ssa (SsaProgram& prog, const LoopOptions& loops, ThreadPool* pool,
+                   TimeReport* report)
+{
+    optimize_ssa_program (prog, pool, report);
+    std::vector<uint32_t> functions (prog.functions.size ());
+    for (size_t i = 0; i < functions.size (); ++i)
+        functions[i] = static_cast<uint32_t> (i);
+    optimize_ssa_functions (prog, functions, loops, pool, report);
+}
+
+void optimize_ssa_program (SsaProgram& prog, ThreadPool* pool, TimeReport* report)
+{
+    auto scalar = [&prog] (size_t i) { optimize_scalar (prog.functions[i]); };
+    auto count_insts = [&prog] (TimeReport::Phase& phase)
+    {
+        if (phase.active ())
+            phase.count ("ssa_insts", static_cast<int64_t> (live_insts (prog)));
+    };
+
+    {
+        TimeReport::Phase phase {report, "ssa_scalar"};
+        for_each_index (pool, prog.functions.size (), scalar);
+        count_insts (phase);
+    }
+
+    {
+        TimeReport::Phase phase {report, "ssa_tail_recursion"};
+        phase.count ("calls", static_cast<int64_t> (eliminate_tail_recursion (prog)));
+        count_insts (phase);
+    }
+
+    {
+        // Each round turns at least one parameter into a constant
+        TimeReport::Phase phase {report, "ssa_arguments"};
+        size_t rounds = 0;
+        while (propagate_arguments (prog) != 0)
+        {
+            for_each_index (pool, prog.functions.size (), scalar);
+            ++rounds;
+        }
+        phase.count ("rounds", static_cast<int64_t> (rounds));
+        count_insts (phase);
+    }
+
+    {
+        TimeReport::Phase phase {report, "ssa_inline"};
+        phase.count ("inlined", static_cast<int64_t> (inline_calls (prog)));
+        count_insts (phase);
+    }
+
+    {
+        TimeReport::Phase phase {report, "ssa_dead_functions"};
+        phase.count ("removed", static_cast<int64_t> (remove_dead_functions (prog)));
+        phase.count ("functions", static_cast<int64_t> (prog.functions.size ()));
+    }
+}
+
+void optimize_ssa_functions (SsaProgram& prog, const std::vector<uint32_t>& functions,
+                             const LoopOptions& loops, ThreadPool* pool, TimeReport* report)
+{
+    auto count_insts = [&prog] (TimeReport::Phase& phase)
+    {
+        if (phase.active ())
+            phase.count ("ssa_insts", static_cast<int64_t> (live_insts (prog)));
+    };
+
+    // optimize_ssa per function: scalar cleanup, then loops and their cleanup
+    std::vector<uint8_t> changed (functions.size ());
+    {
+        TimeReport::Phase phase {report, "ssa_scalar_after_inline"};
+        for_each_index (pool, functions.size (), [&] (size_t i)
+        {
+            optimize_scalar (prog.functions[functions[i]]);
+        });
+        count_insts (phase);
+    }
+    {
+        TimeReport::Phase phase {report, "ssa_loops"};
+        for_each_index (pool, functions.size (), [&] (size_t i)
+        {
+            changed[i] = optimize_loops (prog.functions[functions[i]], loops) != 0;
+        });
+        for_each_index (pool, functions.size (), [&] (size_t i)
+        {
+            if (changed[i])
+                optimize_scalar (prog.functions[functions[i]]);
+        });
+        count_insts (phase);
+    }
+}
@@ -0,0 +1,79 @@
+/**
+ * @file ssa_opt.hpp
+ * @brief Optimization passes over the SSA IR (run under -O).
+ *
+ * Each pass returns how many values or blocks it changed, 0 meaning the
+ * function is untouched.
+ */
+
+#pragma once
+
+#include "ssa.hpp"
+#include "loop_opt.hpp"
+
+class TimeReport;
+
+/**
+ * Sparse conditional constant propagation (Wegman and Zadeck)
+ * Values are assumed constant until proven otherwise, and only edges that
+ * can execute feed phis, so constants flow through loops and branches.
+ * Constant values become CONST, branches on constants become jumps and
+ * blocks that never execute are deleted.
+ */
+size_t propagate_constants (SsaFunction& func);
+
+/**
+ * Global value numbering over the dominator tree
+ * A value computing the same operation on the same operands as one that
+ * dominates it is replaced by it. Calls and vector values are never merged.
+ */
+size_t number_values (SsaFunction& func);
+
+/**
+ * Delete values nothing observable depends on
+ * Returns, branches, calls and divisions that may trap keep their operands
+ * alive. With SSA this also removes dead stores: an unused assignment is
+ * just an unused value.
+ */
+size_t eliminate_dead_code (SsaFunction& func);
+
+/**
+ * Fold branches with equal targets, bypass empty blocks and merge blocks
+ * into a lone predecessor
+ */
+size_t simplify_cfg (SsaFunction& func);
+
+/**
+ * Run the passes above until none makes progress
+ */
+void optimize_scalar (SsaFunction& func);
+
+/**
+ * optimize_scalar, then the loop passes of loop_opt.hpp and, if they changed
+ * anything, optimize_scalar again
+ */
+void optimize_ssa (SsaFunction& func, const LoopOptions& loops = {});
+
+/**
+ * Also runs the interprocedural passes of ipo.hpp before the loop passes:
+ * tail recursion to loops, argument propagation, inlining and removal of
+ * unreachable functions
+ *
+ * With a pool, the per-function passes run in parallel; the
+ * interprocedural ones stay serial. The result does not depend on the pool.
+ * With a report, each pass is recorded as a phase.
+ */
+void optimize_ssa (SsaProgram& prog, const LoopOptions& loops = {},
+                   ThreadPool* pool = nullptr, TimeReport* report = nullptr);
+
+/**
+ * The two halves of optimize_ssa on a program: first the whole-program part
+ * (scalar passes, then the interprocedural ones), after which no function's
+ * code depends on another's; then the per-function part (scalar cleanup,
+ * loops) on the given functions only
+ */
+void optimize_ssa_program (SsaProgram& prog, ThreadPool* pool = nullptr,
+                           TimeReport* report = nullptr);
+void optimize_ssa_functions (SsaProgram& prog, const std::vector<uint32_t>& functions,
+                             const LoopOptions& loops = {}, ThreadPool* pool = nullptr,
+                             TimeReport* report = nullptr);
@@ -0,0 +1,121 @@
+/**
+ * @file time_report.cpp
+ * @brief Phase timing and its JSON form
+ */
+
+#include "time_report.hpp"
+#include <cstdio>
+#include <sys/resource.h>
+
+namespace
+{
+
+/**
+ * JSON string literal for text
+ */
+void put_string (std::string& out, std::string_view text)
+{
+    out += '"';
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += c;
+        }
+        else if (static_cast<unsigned char> (c) < 0x20)
+        {
+            char escape[8];
+            std::snprintf (escape, sizeof (escape), "\\u%04x", c);
+            out += escape;
+        }
+        else
+            out += c;
+    }
+    out += '"';
+}
+
+void put_field (std::string& out, std::string_view key, int64_t value)
+{
+    out += ", ";
+    put_string (out, key);
+    out += ": ";
+    out += std::to_string (value);
+}
+
+} // namespace
+
+TimeReport::Phase::Phase (TimeReport* report, std::string_view name)
+    : report_ (report)
+{
+    if (!report_)
+        return;
+    record_.name = name;
+    watch_.start ();
+}
+
+TimeReport::Phase::~Phase ()
+{
+    if (!report_)
+        return;
+    record_.ns = watch_.pause ();
+    record_.peak_rss_kb = peak_rss_kb ();
+    report_->phases_.push_back (std::move (record_));
+}
+
+void TimeReport::Phase::count (std::string_view key, int64_t value)
+{
+    if (report_)
+        record_.counts.emplace_back (key, value);
+}
+
+ns_t TimeReport::total_ns () const
+{
+    ns_t total = 0;
+    for (const auto& phase : phases_)
+        total += phase.ns;
+    return total;
+}
+
+std::string TimeReport::to_json () const
+{
+    std::string out = "{\"file\": ";
+    put_string (out, file_);
+    put_field (out, "total_ns", total_ns ());
+    put_field (out, "peak_rss_kb", phases_.empty () ? peak_rss_kb ()
+                                                    : phases_.back ().peak_rss_kb);
+    out += ", \"phases\": [";
+
+    for (size_t i = 0; i < phases_.size (); ++i)
+    {
+        const PhaseRecord& phase = phases_[i];
+        out += i == 0 ? "\n    {\"name\": " : ",\n    {\"name\": ";
+        put_string (out, phase.name);
+        put_field (out, "ns", phase.ns);
+        put_field (out, "peak_rss_kb", phase.peak_rss_kb);
+        for (const auto& [key, value] : phase.counts)
+            put_field (out, key, value);
+        out += '}';
+    }
+    out += phases_.empty () ? "]}" : "\n  ]}";
+    return out;
+}
+
+int64_t peak_rss_kb ()
+{
+    struct rusage usage {};
+    getrusage (RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;         // KiB on Linux
+}
+
+std::string reports_to_json (const std::vector<TimeReport>& reports)
+{
+    std::string out = "{\"files\": [";
+    for (size_t i = 0; i < reports.size (); ++i)
+    {
+        out += i == 0 ? "\n  " : ",\n  ";
+        out += reports[i].to_json ();
+    }
+    out += reports.empty () ? "]}\n" : "\n]}\n";
+    return out;
+}
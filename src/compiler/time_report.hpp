@@ -0,0 +1,90 @@
+/**
+ * @file time_report.hpp
+ * @brief Per-phase compile time, memory and size counters (--time-report).
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "timer.hpp"
+
+/**
+ * One timed phase and what it produced
+ */
+struct PhaseRecord
+{
+    std::string name;
+    ns_t ns = 0;
+    int64_t peak_rss_kb = 0;        // Process peak after the phase
+    std::vector<std::pair<std::string, int64_t>> counts;
+};
+
+/**
+ * Phases of one file's compilation, in the order they ran
+ *
+ * Phases are opened with Phase objects. Every function taking a
+ * TimeReport* accepts nullptr, in which case Phase does nothing and reads no
+ * clock; callers skip computing counts when !phase.active ().
+ */
+class TimeReport
+{
+public:
+    /**
+     * Times a phase from construction to destruction, then records it
+     */
+    class Phase
+    {
+    public:
+        Phase (TimeReport* report, std::string_view name);
+        ~Phase ();
+
+        Phase (const Phase&) = delete;
+        Phase& operator = (const Phase&) = delete;
+
+        bool active () const { return report_ != nullptr; }
+
+        /**
+         * Attach a count (tokens, instructions...) to the phase
+         */
+        void count (std::string_view key, int64_t value);
+
+    private:
+        TimeReport* report_;
+        PhaseRecord record_;
+        Stopwatch watch_;
+    };
+
+    explicit TimeReport (std::string file = {})
+        : file_ (std::move (file)) {}
+
+    const std::vector<PhaseRecord>& phases () const { return phases_; }
+
+    /**
+     * Sum of every phase's time
+     */
+    ns_t total_ns () const;
+
+    /**
+     * {"file": ..., "total_ns": ..., "peak_rss_kb": ..., "phases": [{"name":
+     * ..., "ns": ..., "peak_rss_kb": ..., <counts>}, ...]}
+     */
+    std::string to_json () const;
+
+private:
+    std::string file_;
+    std::vector<PhaseRecord> phases_;
+};
+
+/**
+ * Peak resident set size of the process so far, in KiB
+ */
+int64_t peak_rss_kb ();
+
+/**
+ * {"files": [<report>, ...]}, the form --time-report writes
+ */
+std::string reports_to_json (const std::vector<TimeReport>& reports);
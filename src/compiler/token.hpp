@@ -29,6 +29,10 @@ enum class TokenType
     RETURN,
     IF,
     WHILE,
+    SWITCH,
+    CASE,
+    DEFAULT,
+    BREAK,
 
     // Operators
     ADD_OP,    // +
@@ -54,7 +58,8 @@ enum class TokenType
     R_PAREN,   // )
     L_BRACE,   // {
     R_BRACE,   // }
-    COMMA      // ,
+    COMMA,     // ,
+    COLON      // :
 };
 
 
@@ -0,0 +1,56 @@
+/**
+ * @file token_buffer.hpp
+ * @brief Owns source bytes together with the tokens that view into them.
+ */
+
+#pragma once
+
+#include <span>
+#include <string_view>
+#include <vector>
+#include "file_utils.hpp"
+#include "token.hpp"
+
+/**
+ * Source text plus its token array
+ *
+ * Token lexemes are string_views into the source, so both are kept in one
+ * object. The source is a SourceBuffer (usually a file mapping) whose bytes
+ * never move, which keeps every lexeme valid when the buffer is moved.
+ * Copying is disabled since a copy would have to re-point every lexeme.
+ */
+class TokenBuffer
+{
+private:
+    friend class Lexer;
+
+    SourceBuffer source_ {};
+    std::vector<Token> tokens_ {};
+
+public:
+    TokenBuffer () = default;
+
+    explicit TokenBuffer (SourceBuffer&& source)
+        : source_ (std::move (source)) {}
+
+    TokenBuffer (TokenBuffer&&) = default;
+    TokenBuffer& operator = (TokenBuffer&&) = default;
+    TokenBuffer (const TokenBuffer&) = delete;
+    TokenBuffer& operator = (const TokenBuffer&) = delete;
+
+    /**
+     * Source the lexemes point into
+     */
+    std::string_view source () const
+    {
+        return source_.view ();
+    }
+
+    /**
+     * Borrow the token array
+     */
+    std::span<const Token> tokens () const
+    {
+        return tokens_;
+    }
+};
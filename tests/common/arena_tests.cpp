@@ -0,0 +1,140 @@
+/**
+ * @file arena_tests.cpp
+ * @brief Tests for the Arena bump allocator
+ */
+
+#include <testbench.hpp>
+#include <arena.hpp>
+#include <cstdint>
+#include <string>
+
+/**
+ * Helper: counts destructor calls
+ */
+struct DtorCounter
+{
+    int* count;
+    ~DtorCounter () { ++*count; }
+};
+
+/**
+ * make: constructs values that can be read back
+ */
+bool arena_make_basic ()
+{
+    Arena arena;
+    int* a = arena.make<int> (1);
+    int* b = arena.make<int> (2);
+    std::string* s = arena.make<std::string> ("arena");
+
+    return *a == 1 && *b == 2 && *s == "arena" && a != b;
+}
+
+/**
+ * allocate: respects requested alignment
+ */
+bool arena_alignment ()
+{
+    Arena arena;
+    arena.allocate (1, 1);
+    void* p = arena.allocate (8, 64);
+
+    return reinterpret_cast<uintptr_t> (p) % 64 == 0;
+}
+
+/**
+ * allocate: requests larger than a block still succeed
+ */
+bool arena_oversized ()
+{
+    Arena arena;
+    int* small = arena.make<int> (7);
+    auto* big = static_cast<char*> (arena.allocate (1 << 20, 1));
+    big[0] = 'a';
+    big[(1 << 20) - 1] = 'z';
+    int* after = arena.make<int> (8);
+
+    return *small == 7 && *after == 8
+        && big[0] == 'a' && big[(1 << 20) - 1] == 'z';
+}
+
+/**
+ * release: runs destructors of non-trivial objects
+ */
+bool arena_runs_dtors ()
+{
+    int count = 0;
+    {
+        Arena arena;
+        for (int i = 0; i < 1000; ++i)
+            arena.make<DtorCounter> (&count);
+    }
+
+    return count == 1000;
+}
+
+/**
+ * move: pointers into a moved arena stay valid
+ */
+bool arena_move_keeps_ptrs ()
+{
+    int count = 0;
+    Arena src;
+    int* val = src.make<int> (42);
+    src.make<DtorCounter> (&count);
+
+    Arena dst {std::move (src)};
+    src.release ();
+
+    bool ok = *val == 42 && count == 0;
+    dst.release ();
+
+    return ok && count == 1;
+}
+
+/**
+ * reset: runs destructors, then hands the same blocks out again
+ */
+bool arena_reset_reuses ()
+{
+    int count = 0;
+    Arena arena;
+    int* first = arena.make<int> (1);
+    for (int i = 0; i < 40000; ++i)
+        arena.make<DtorCounter> (&count);
+    arena.allocate (1 << 20, 1);
+    size_t reserved = arena.bytes_reserved ();
+
+    arena.reset ();
+    bool ok = count == 40000 && arena.bytes_used () == 0
+           && arena.bytes_reserved () == reserved;
+
+    int* again = arena.make<int> (2);
+    for (int i = 0; i < 40000; ++i)
+        arena.make<DtorCounter> (&count);
+
+    return ok && again == first && *again == 2 && arena.bytes_reserved () == reserved;
+}
+
+/**
+ * Entry
+ */
+int main (int argc, char* argv[])
+{
+    Testbench tb {};
+    if (!tb.parse_args (argc, argv))
+        return 1;
+
+    tb.add_family ("arena",
+    {
+        {arena_make_basic,          "arena make basic"},
+        {arena_alignment,           "arena alignment"},
+        {arena_oversized,           "arena oversized allocation"},
+        {arena_runs_dtors,          "arena runs destructors"},
+        {arena_move_keeps_ptrs,     "arena move keeps pointers"},
+        {arena_reset_reuses,        "arena reset reuses blocks"},
+    });
+
+    tb.run_tests ();
+    tb.print_results ();
+}
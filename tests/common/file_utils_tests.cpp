@@ -6,7 +6,11 @@
 #include <iostream>
 #include <testbench.hpp>
 #include <file_utils.hpp>
+#include <chrono>
+#include <csignal>
 #include <string>
+#include <thread>
+#include <pthread.h>
 
 inline const char* out_path = "out/test.txt";
 
@@ -50,6 +54,103 @@ bool fts_nested_bad_path ()
     return result.empty ();
 }
 
+/**
+ * file_to_buffer: regular file is mapped and matches file_to_string
+ */
+bool ftb_mapped ()
+{
+    std::string error;
+    SourceBuffer buffer = file_to_buffer ("examples/txt/sentence.txt", error);
+
+    return buffer.is_mapped () && error.empty ()
+        && buffer.view () == "This is a \nnew line.";
+}
+
+/**
+ * file_to_buffer: bad path returns empty buffer and the reason
+ */
+bool ftb_bad_path ()
+{
+    std::string error;
+    SourceBuffer buffer = file_to_buffer ("bad/path", error);
+
+    return buffer.view ().empty () && !buffer.is_mapped ()
+        && error == "Could not open bad/path";
+}
+
+/**
+ * file_to_buffer: data survives a move
+ */
+bool ftb_move ()
+{
+    std::string error;
+    SourceBuffer buffer = file_to_buffer ("examples/txt/statement.txt", error);
+    const char* data = buffer.view ().data ();
+
+    SourceBuffer moved {std::move (buffer)};
+
+    return moved.view ().data () == data
+        && moved.view () == "int x = 5;"
+        && buffer.view ().empty ();
+}
+
+/**
+ * SourceBuffer: unmappable input falls back to read ()
+ */
+bool ftb_read_fallback ()
+{
+    int fds[2];
+    if (pipe (fds) != 0)
+        return false;
+
+    std::string str {"int main () { return 0; }"};
+    if (write (fds[1], str.data (), str.size ()) != static_cast<ssize_t> (str.size ()))
+        return false;
+    close (fds[1]);
+
+    SourceBuffer buffer;
+    bool ok = buffer.load (fds[0]);
+    close (fds[0]);
+
+    return ok && !buffer.is_mapped () && buffer.view () == str;
+}
+
+/**
+ * SourceBuffer: a signal interrupting read () is retried, not a failure
+ */
+bool ftb_read_interrupted ()
+{
+    int fds[2];
+    if (pipe (fds) != 0)
+        return false;
+
+    // No SA_RESTART, so the blocked read () returns EINTR
+    struct sigaction action {};
+    action.sa_handler = [] (int) {};
+    struct sigaction old {};
+    sigaction (SIGUSR1, &action, &old);
+
+    std::string str {"int main () { return 0; }"};
+    pthread_t reader = pthread_self ();
+    std::thread writer {[&]
+    {
+        std::this_thread::sleep_for (std::chrono::milliseconds {50});
+        pthread_kill (reader, SIGUSR1);
+        std::this_thread::sleep_for (std::chrono::milliseconds {50});
+        ssize_t written = write (fds[1], str.data (), str.size ());
+        (void) written;
+        close (fds[1]);
+    }};
+
+    SourceBuffer buffer;
+    bool ok = buffer.load (fds[0]);
+    writer.join ();
+    close (fds[0]);
+    sigaction (SIGUSR1, &old, nullptr);
+
+    return ok && buffer.view () == str;
+}
+
 /**
  * string_to_file: basic functionality
  */
@@ -57,11 +158,12 @@ bool stf_basic ()
 {
     std::string str {"This is just a test..."};
 
-    string_to_file (str, out_path);
-    std::cout << file_to_string ("out/test.txt") << std::endl;
+    std::string path = Testbench::worker_path (out_path);
+    string_to_file (str, path);
+    std::cout << file_to_string (path) << std::endl;
     std::cout << str << std::endl;
 
-    return (file_to_string ("out/test.txt") == str);
+    return (file_to_string (path) == str);
 }
 
 /**
@@ -71,19 +173,48 @@ bool stf_spaces ()
 {
     std::string str {"This \nis\t\t just a test..."};
 
-    string_to_file (str, out_path);
-    std::cout << file_to_string ("out/test.txt") << std::endl;
+    std::string path = Testbench::worker_path (out_path);
+    string_to_file (str, path);
+    std::cout << file_to_string (path) << std::endl;
     std::cout << str << std::endl;
 
-    return (file_to_string ("out/test.txt") == str);
+    return (file_to_string (path) == str);
+}
+
+/**
+ * string_to_file: unwritable path reports failure
+ */
+bool stf_bad_path ()
+{
+    return string_to_file ("x", "/no/such/dir/file.txt") == false
+        && string_to_file ("x", Testbench::worker_path (out_path)) == true;
+}
+
+/**
+ * project_root: always a directory, so paths can be appended
+ */
+bool fp_root_slash ()
+{
+    return !project_root ().empty () && project_root ().back () == '/';
+}
+
+/**
+ * get_full_path: relative paths are appended to the root
+ */
+bool fp_relative ()
+{
+    return get_full_path ("examples/txt/statement.txt")
+        == project_root () + "examples/txt/statement.txt";
 }
 
 /**
  * Entry
  */
-int main ()
+int main (int argc, char* argv[])
 {
     Testbench tb {};
+    if (!tb.parse_args (argc, argv))
+        return 1;
 
     tb.add_family ("file_to_string",
     {
@@ -93,13 +224,27 @@ int main ()
         {fts_nested_bad_path,   "fts nested bad path"},
     });
 
+    tb.add_family ("file_to_buffer",
+    {
+        {ftb_mapped,            "ftb mapped file"},
+        {ftb_bad_path,          "ftb bad path"},
+        {ftb_move,              "ftb data survives move"},
+        {ftb_read_fallback,     "ftb read fallback"},
+        {ftb_read_interrupted,  "ftb read interrupted"},
+    });
+
     tb.add_family ("string_to_file",
     {
         {stf_basic,             "stf basic functionality"},
         {stf_spaces,            "stf spaces"},
+        {stf_bad_path,          "stf bad path"},
     }, {"file_to_string"});
 
-    // TODO: Add global file path tests
+    tb.add_family ("full_path",
+    {
+        {fp_root_slash,         "fp root ends in slash"},
+        {fp_relative,           "fp relative to root"},
+    });
 
     tb.run_tests ();
     tb.print_results ();
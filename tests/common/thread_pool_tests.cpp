@@ -0,0 +1,172 @@
+/**
+ * @file thread_pool_tests.cpp
+ * @brief Tests for the ThreadPool worker pool
+ */
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <testbench.hpp>
+#include <thread_pool.hpp>
+
+/**
+ * submit: every future gets its own task's result
+ */
+bool tp_results ()
+{
+    ThreadPool pool {4};
+    std::vector<std::future<int>> results;
+    for (int i = 0; i < 100; ++i)
+        results.push_back (pool.submit ([i] { return i * i; }));
+
+    for (int i = 0; i < 100; ++i)
+        if (results[i].get () != i * i)
+            return false;
+    return true;
+}
+
+/**
+ * submit: an exception reaches the caller through the future
+ */
+bool tp_exception ()
+{
+    ThreadPool pool {2};
+    std::future<int> result = pool.submit ([] () -> int { throw std::runtime_error ("x"); });
+    try
+    {
+        result.get ();
+        return false;
+    }
+    catch (const std::runtime_error&)
+    {
+        return true;
+    }
+}
+
+/**
+ * destructor: queued tasks all run before the workers exit
+ */
+bool tp_drains_queue ()
+{
+    std::atomic<int> count = 0;
+    {
+        ThreadPool pool {3};
+        for (int i = 0; i < 1000; ++i)
+            pool.submit ([&count] { ++count; });
+    }
+    return count == 1000;
+}
+
+/**
+ * tasks run on the workers, not the submitting thread
+ */
+bool tp_worker_threads ()
+{
+    ThreadPool pool {2};
+    std::thread::id caller = std::this_thread::get_id ();
+    return pool.submit ([caller] { return std::this_thread::get_id () != caller; }).get ();
+}
+
+/**
+ * constructor: 0 threads means one per hardware thread
+ */
+bool tp_default_size ()
+{
+    ThreadPool pool {};
+    return pool.size () == ThreadPool::default_threads () && pool.size () >= 1;
+}
+
+/**
+ * parallel_for: every index runs exactly once
+ */
+bool pf_each_index ()
+{
+    ThreadPool pool {4};
+    std::vector<std::atomic<int>> hits (1000);
+    pool.parallel_for (hits.size (), [&hits] (size_t i) { ++hits[i]; });
+
+    for (const auto& hit : hits)
+        if (hit != 1)
+            return false;
+    return true;
+}
+
+/**
+ * parallel_for: nested loops inside workers finish, waiting workers help
+ */
+bool pf_nested ()
+{
+    ThreadPool pool {2};
+    std::atomic<int> count = 0;
+    pool.parallel_for (16, [&] (size_t)
+    {
+        pool.parallel_for (100, [&count] (size_t) { ++count; });
+    });
+    return count == 1600;
+}
+
+/**
+ * parallel_for: the first exception by index reaches the caller, after
+ * every other index ran
+ */
+bool pf_exception ()
+{
+    ThreadPool pool {3};
+    std::atomic<int> count = 0;
+    try
+    {
+        pool.parallel_for (100, [&count] (size_t i)
+        {
+            if (i == 10 || i == 90)
+                throw std::runtime_error (std::to_string (i));
+            ++count;
+        });
+        return false;
+    }
+    catch (const std::runtime_error& e)
+    {
+        // Each chunk stops at its own failure
+        return std::string {e.what ()} == "10" && count > 0 && count < 98;
+    }
+}
+
+/**
+ * for_each_index: without a pool it is a plain loop on the caller
+ */
+bool fei_serial ()
+{
+    std::vector<size_t> order;
+    for_each_index (nullptr, 5, [&order] (size_t i) { order.push_back (i); });
+    return order == std::vector<size_t> {0, 1, 2, 3, 4};
+}
+
+/**
+ * Entry
+ */
+int main (int argc, char* argv[])
+{
+    Testbench tb {};
+    if (!tb.parse_args (argc, argv))
+        return 1;
+
+    tb.add_family ("thread_pool",
+    {
+        {tp_results,            "tp results in order"},
+        {tp_exception,          "tp exception through future"},
+        {tp_drains_queue,       "tp destructor drains queue"},
+        {tp_worker_threads,     "tp runs on workers"},
+        {tp_default_size,       "tp default size"},
+    });
+
+    tb.add_family ("parallel_for",
+    {
+        {pf_each_index,         "pf each index once"},
+        {pf_nested,             "pf nested"},
+        {pf_exception,          "pf first exception"},
+        {fei_serial,            "for_each_index serial"},
+    }, {"thread_pool"});
+
+    tb.run_tests ();
+    tb.print_results ();
+}
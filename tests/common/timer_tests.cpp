@@ -0,0 +1,91 @@
+/**
+ * @file timer_tests.cpp
+ * @brief Tests for the Stopwatch
+ */
+
+#include <testbench.hpp>
+#include <timer.hpp>
+
+/**
+ * Spin until the clock has moved by at least ns
+ */
+static void spin (ns_t ns)
+{
+    ns_t start = get_time_ns ();
+    while (get_time_ns () - start < ns) {}
+}
+
+/**
+ * A new stopwatch reads 0, pausing it changes nothing
+ */
+bool sw_new_is_zero ()
+{
+    Stopwatch watch;
+    bool ok = watch.read () == 0 && watch.pause () == 0;
+    return ok && watch.read () == 0;
+}
+
+/**
+ * Intervals accumulate at nanosecond resolution
+ */
+bool sw_accumulates ()
+{
+    Stopwatch watch;
+    watch.start ();
+    spin (20000);
+    ns_t first = watch.pause ();
+    spin (20000);           // Paused, not counted
+    watch.start ();
+    spin (20000);
+    ns_t second = watch.pause ();
+
+    return first >= 20000 && second >= 20000 && watch.read () == first + second
+        && watch.read () < first + second + 20000;
+}
+
+/**
+ * start while running keeps the first start, read includes the open interval
+ */
+bool sw_running ()
+{
+    Stopwatch watch;
+    watch.start ();
+    spin (10000);
+    watch.start ();
+    ns_t running = watch.read ();
+    return running >= 10000 && watch.pause () >= running;
+}
+
+/**
+ * reset goes back to 0
+ */
+bool sw_reset ()
+{
+    Stopwatch watch;
+    watch.start ();
+    spin (1000);
+    watch.pause ();
+    watch.reset ();
+    return watch.read () == 0 && watch.read_ms () == 0;
+}
+
+/**
+ * Entry
+ */
+int main (int argc, char* argv[])
+{
+    Testbench tb {};
+    if (!tb.parse_args (argc, argv))
+        return 1;
+
+    tb.add_family ("stopwatch",
+    {
+        {sw_new_is_zero,        "stopwatch new is zero"},
+        {sw_accumulates,        "stopwatch accumulates"},
+        {sw_running,            "stopwatch running read"},
+        {sw_reset,              "stopwatch reset"},
+    });
+
+    tb.run_tests ();
+    tb.print_results ();
+}
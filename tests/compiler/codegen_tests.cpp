@@ -5,16 +5,741 @@
 
 #include "testbench.hpp"
 #include "codegen.hpp"
+#include "emitter.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "optimizer.hpp"
+#include "peephole.hpp"
+#include "frame.hpp"
+#include "encoder.hpp"
+#include "elf.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <elf.h>
+#include <cstring>
+#include "file_utils.hpp"
+#include <iostream>
+
+/**
+ * Emitter: operands are comma separated, immediates formatted in place
+ */
+bool em_operands ()
+{
+    Emitter out;
+    out.ins ("ret");
+    out.ins ("pop", "rax");
+    out.ins ("mov", "ebx", -42);
+
+    return out.view () == "    ret\n    pop rax\n    mov ebx, -42\n";
+}
+
+/**
+ * Emitter: stack operands and labels
+ */
+bool em_mem_label ()
+{
+    Emitter out;
+    out.ins ("mov", Mem {-32}, "edi");
+    out.ins ("mov", "eax", Mem {8});
+    out.ins ("jmp", Label {7});
+    out.label (Label {3, ".Lfunc_"});
+
+    return out.view () == "    mov DWORD PTR [rbp - 32], edi\n"
+                          "    mov eax, DWORD PTR [rbp + 8]\n"
+                          "    jmp .L7\n"
+                          ".Lfunc_3:\n";
+}
+
+/**
+ * print_asm: renders operands at their widths
+ */
+bool mir_print ()
+{
+    MProgram prog;
+    prog.symbols.push_back ("f");
+    prog.functions.push_back (MFunction {"main", {
+        MInst {Opcode::MOV, {Operand::make_mem (-4), Operand::make_reg (Reg::R9)}},
+        MInst {Opcode::SETE, {Operand::make_reg (Reg::RSI, Width::B8)}},
+        MInst {Opcode::LEA, {Operand::make_reg (Reg::RSP, Width::B64),
+                             Operand::make_mem (-24, Width::B64)}},
+        MInst {Opcode::CALL, {Operand::make_symbol (0)}},
+        MInst {Opcode::LABEL, {Operand::make_label (5)}},
+        MInst {Opcode::RET},
+    }});
+
+    Emitter out;
+    print_asm (prog, out);
+
+    return out.view () == ".intel_syntax noprefix\n.global main\n\n"
+                          "main:\n"
+                          "    mov DWORD PTR [rbp - 4], r9d\n"
+                          "    sete sil\n"
+                          "    lea rsp, [rbp - 24]\n"
+                          "    call f\n"
+                          ".L5:\n"
+                          "    ret\n";
+}
+
+/**
+ * Codegen: lowers into one MFunction per function, calls by symbol
+ */
+bool mir_lowering ()
+{
+    Lexer lexer {"int f () { return 1; } int main () { return f () + 1; }", false};
+    Parser parser {lexer.get_tokens ()};
+    Codegen cg {parser.parse ()};
+    const MProgram& mir = cg.get_mir ();
+
+    if (mir.functions.size () != 2 || mir.symbols.size () != 1)
+        return false;
+
+    const auto& code = mir.functions[1].code;
+    for (const auto& inst : code)
+        if (inst.op == Opcode::CALL)
+            return mir.symbols[inst.ops[0].value] == "f"
+                && code.back ().op == Opcode::RET;
+
+    return false;
+}
+
+/**
+ * lowering: a returned call becomes a jump, with the arguments in place
+ * and no frame left behind
+ */
+bool mir_tail_call ()
+{
+    Lexer lexer {"int f (int x, int y) { return x - y; }"
+                 "int main () { int a = f (1, 2); return f (a, 3); }", false};
+    Parser parser {lexer.get_tokens ()};
+    Codegen cg {parser.parse ()};
+    const auto& code = cg.get_mir ().functions[1].code;
+
+    auto tail = std::find_if (code.begin (), code.end (), [] (const MInst& inst)
+    {
+        return inst.op == Opcode::TAIL_CALL;
+    });
+    if (tail == code.end () || tail - code.begin () < 3 || tail->ops[1].value != 2)
+        return false;
+
+    // ... mov esi, 3 / pop rbp / jmp f
+    return tail[-1].op == Opcode::POP && tail[-1].ops[0].is_reg (Reg::RBP)
+        && tail[-2] == MInst {Opcode::MOV, {Operand::make_reg (Reg::RSI),
+                                            Operand::make_imm (3)}}
+        && std::count_if (code.begin (), code.end (), [] (const MInst& inst)
+           {
+               return inst.op == Opcode::CALL;
+           }) == 1;
+}
+
+/**
+ * print_asm: lea addresses and three-operand imul
+ */
+bool mir_print_address ()
+{
+    auto reg = [] (Reg r) { return Operand::make_reg (r); };
+
+    MProgram prog;
+    prog.functions.push_back (MFunction {"main", {
+        MInst {Opcode::LEA, {reg (Reg::RAX), reg (Reg::RCX), reg (Reg::RDX).scaled (4)}},
+        MInst {Opcode::LEA, {reg (Reg::RAX), reg (Reg::R8), Operand::make_imm (-8)}},
+        MInst {Opcode::IMUL_IMM, {reg (Reg::RSI), reg (Reg::RDI), Operand::make_imm (100)}},
+        MInst {Opcode::SAR, {reg (Reg::RDX), Operand::make_imm (2)}},
+    }});
+
+    Emitter out;
+    print_asm (prog, out);
+
+    return out.view () == ".intel_syntax noprefix\n.global main\n\n"
+                          "main:\n"
+                          "    lea eax, [rcx + rdx*4]\n"
+                          "    lea eax, [r8 - 8]\n"
+                          "    imul esi, edi, 100\n"
+                          "    sar edx, 2\n";
+}
+
+/**
+ * Count opcodes in the first function's code
+ */
+size_t count_op (const MProgram& mir, Opcode op)
+{
+    size_t count = 0;
+    for (const auto& inst : mir.functions[0].code)
+        count += inst.op == op;
+    return count;
+}
+
+/**
+ * isel: constant factors become shifts, lea and imul with an immediate
+ */
+bool is_mul_const ()
+{
+    Lexer lexer {"int f (int a) { return a * 8 - a * 5 - a * 100 - a * 24; }"
+                 "int main () { return f (1); }", false};
+    Parser parser {lexer.get_tokens ()};
+    Codegen cg {parser.parse ()};
+    const MProgram& mir = cg.get_mir ();
+
+    return count_op (mir, Opcode::IMUL) == 0 && count_op (mir, Opcode::IMUL_IMM) == 1
+        && count_op (mir, Opcode::SHL) == 2 && count_op (mir, Opcode::LEA) >= 2;
+}
+
+/**
+ * isel: constant divisors never reach idiv, except 0 and -1
+ */
+bool is_div_const ()
+{
+    Lexer lexer {"int f (int a) { return a / 7 + a / 16 + a / 1 + a / 0; }"
+                 "int main () { return f (1); }", false};
+    Parser parser {lexer.get_tokens ()};
+    Codegen cg {parser.parse ()};
+    const MProgram& mir = cg.get_mir ();
+
+    return count_op (mir, Opcode::IDIV) == 1 && count_op (mir, Opcode::IMUL_WIDE) == 1
+        && count_op (mir, Opcode::SAR) == 3;
+}
+
+/**
+ * isel: a + b * 4 is one lea
+ */
+bool is_scaled_index ()
+{
+    Lexer lexer {"int f (int a, int b) { return a + b * 4; }"
+                 "int main () { return f (1, 2); }", false};
+    Parser parser {lexer.get_tokens ()};
+    Codegen cg {parser.parse ()};
+
+    for (const auto& inst : cg.get_mir ().functions[0].code)
+        if (inst.op == Opcode::LEA)
+            return inst.ops[2].is_reg () && inst.ops[2].scale == 4
+                && count_op (cg.get_mir (), Opcode::ADD) == 0;
+    return false;
+}
+
+/**
+ * regalloc: leaf functions keep values in caller-saved registers and save
+ * no callee-saved ones
+ */
+bool ra_leaf_no_saves ()
+{
+    Lexer lexer {"int add (int a, int b) { int c = a + b; return c; }"
+                 "int main () { return add (1, 2); }", false};
+    Parser parser {lexer.get_tokens ()};
+    Codegen cg {parser.parse ()};
+
+    for (const auto& inst : cg.get_mir ().functions[0].code)
+    {
+        if (inst.op == Opcode::PUSH && !inst.ops[0].is_reg (Reg::RBP))
+            return false;
+        for (const auto& operand : inst.ops)
+            if (operand.is_vreg () || operand.is_frame () || operand.is_mem ())
+                return false;
+    }
+    return true;
+}
+
+/**
+ * regalloc: spilled values with disjoint lifetimes share a frame slot
+ */
+bool ra_slot_reuse ()
+{
+    // Two groups of values that are each live across a call, one after the
+    // other. Each group alone needs more registers than are callee-saved.
+    std::string group_a, group_b, sum_a = "0", sum_b = "0";
+    for (int i = 0; i < 12; ++i)
+    {
+        std::string a = "a" + std::to_string (i), b = "b" + std::to_string (i);
+        group_a += "int " + a + " = f (" + std::to_string (i) + ");";
+        group_b += "int " + b + " = f (" + std::to_string (i) + ");";
+        sum_a += " + " + a;
+        sum_b += " + " + b;
+    }
+    std::string src = "int f (int x) { return x; }"
+                      "int main () {" + group_a + "int s = f (" + sum_a + ");"
+                      + group_b + "return f (s + " + sum_b + "); }";
+
+    Lexer lexer {src, false};
+    Parser parser {lexer.get_tokens ()};
+    Codegen cg {parser.parse ()};
+    const MFunction& main_func = cg.get_mir ().functions[1];
+
+    return main_func.frame_slots > 0 && main_func.frame_slots < 12;
+}
+
+/**
+ * frame: 4-byte slots, aligned reservation only around calls
+ */
+bool fr_layout ()
+{
+    auto make = [] (bool with_call)
+    {
+        MFunction func {"f", {
+            MInst {Opcode::MOV, {Operand::make_frame (0), Operand::make_imm (1)}},
+            MInst {Opcode::MOV, {Operand::make_frame (2), Operand::make_imm (2)}},
+            MInst {Opcode::RET},
+        }};
+        func.frame_slots = 3;
+        if (with_call)
+            func.code.insert (func.code.begin () + 2, MInst {Opcode::CALL,
+                {Operand::make_symbol (0), Operand::make_imm (0)}});
+        lower_frame (func);
+        return func;
+    };
+
+    MFunction leaf = make (false);
+    MFunction caller = make (true);
+    MInst reserve {Opcode::SUB, {Operand::make_reg (Reg::RSP, Width::B64),
+                                 Operand::make_imm (16)}};
+
+    // Leaf: no frame pointer, the stores go straight into the red zone
+    return leaf.code.size () == 3
+        && leaf.code[0].ops[0] == Operand::make_mem (-4, Width::B32, Reg::RSP)
+        && leaf.code[1].ops[0] == Operand::make_mem (-12, Width::B32, Reg::RSP)
+        && caller.code[2] == reserve
+        && caller.code[4].ops[0] == Operand::make_mem (-12);
+}
+
+/**
+ * frame: a tail call leaves through the epilogue, and does not count as a
+ * call that needs the frame
+ */
+bool fr_tail_call ()
+{
+    auto r64 = [] (Reg r) { return Operand::make_reg (r, Width::B64); };
+
+    MFunction func {"f", {
+        MInst {Opcode::MOV, {Operand::make_reg (Reg::RBX), Operand::make_imm (1)}},
+        MInst {Opcode::MOV, {Operand::make_reg (Reg::RDI), Operand::make_reg (Reg::RBX)}},
+        MInst {Opcode::TAIL_CALL, {Operand::make_symbol (0), Operand::make_imm (1)}},
+    }};
+    lower_frame (func);
+
+    return func.code.size () == 5
+        && func.code[0] == MInst {Opcode::PUSH, {r64 (Reg::RBX)}}
+        && func.code[3] == MInst {Opcode::POP, {r64 (Reg::RBX)}}
+        && func.code[4].op == Opcode::TAIL_CALL;
+}
+
+/**
+ * peephole: push/pop becomes a move, jump to the next label is dropped
+ */
+bool ph_push_pop_jump ()
+{
+    auto reg = [] (Reg r) { return Operand::make_reg (r, Width::B64); };
+
+    MFunction func {"f", {
+        MInst {Opcode::PUSH, {reg (Reg::RBX)}},
+        MInst {Opcode::POP, {reg (Reg::RDI)}},
+        MInst {Opcode::JMP, {Operand::make_label (1)}},
+        MInst {Opcode::LABEL, {Operand::make_label (0)}},
+        MInst {Opcode::LABEL, {Operand::make_label (1)}},
+        MInst {Opcode::RET},
+    }};
+    peephole (func);
+
+    return func.code.size () == 4
+        && func.code[0] == MInst {Opcode::MOV, {Operand::make_reg (Reg::RDI),
+                                                Operand::make_reg (Reg::RBX)}}
+        && func.code[1].op == Opcode::LABEL;
+}
+
+/**
+ * peephole: setcc/movzx/test/je fuses into one inverted branch
+ */
+bool ph_fuse_branch ()
+{
+    auto r32 = [] (Reg r) { return Operand::make_reg (r); };
+    Operand bl = Operand::make_reg (Reg::RBX, Width::B8);
+
+    MFunction func {"f", {
+        MInst {Opcode::CMP, {r32 (Reg::RBX), r32 (Reg::R12)}},
+        MInst {Opcode::SETL, {bl}},
+        MInst {Opcode::MOVZX, {r32 (Reg::RBX), bl}},
+        MInst {Opcode::TEST, {r32 (Reg::RBX), r32 (Reg::RBX)}},
+        MInst {Opcode::JE, {Operand::make_label (0)}},
+        MInst {Opcode::MOV, {r32 (Reg::RBX), Operand::make_imm (1)}},
+        MInst {Opcode::LABEL, {Operand::make_label (0)}},
+        MInst {Opcode::MOV, {r32 (Reg::RBX), Operand::make_imm (2)}},
+        MInst {Opcode::RET},
+    }};
+    peephole (func);
+
+    return func.code.size () == 6
+        && func.code[1] == MInst {Opcode::JGE, {Operand::make_label (0)}};
+}
+
+/**
+ * peephole: mov/add becomes lea unless a flag reader follows
+ */
+bool ph_lea ()
+{
+    auto r32 = [] (Reg r) { return Operand::make_reg (r); };
+
+    MFunction func {"f", {
+        MInst {Opcode::MOV, {r32 (Reg::RAX), r32 (Reg::RDI)}},
+        MInst {Opcode::ADD, {r32 (Reg::RAX), r32 (Reg::RSI)}},
+        MInst {Opcode::MOV, {r32 (Reg::RCX), r32 (Reg::RDI)}},
+        MInst {Opcode::SUB, {r32 (Reg::RCX), Operand::make_imm (3)}},
+        MInst {Opcode::MOV, {r32 (Reg::RDX), r32 (Reg::RDI)}},
+        MInst {Opcode::ADD, {r32 (Reg::RDX), Operand::make_imm (1)}},
+        MInst {Opcode::JE, {Operand::make_label (0)}},
+        MInst {Opcode::LABEL, {Operand::make_label (0)}},
+        MInst {Opcode::RET},
+    }};
+    peephole (func);
+
+    return func.code.size () == 7
+        && func.code[0] == MInst {Opcode::LEA, {r32 (Reg::RAX), r32 (Reg::RDI),
+                                                r32 (Reg::RSI)}}
+        && func.code[1] == MInst {Opcode::LEA, {r32 (Reg::RCX), r32 (Reg::RDI),
+                                                Operand::make_imm (-3)}}
+        && func.code[2].op == Opcode::MOV;
+}
+
+/**
+ * encoder: REX prefixes, SIB bytes, rbp displacements and byte registers
+ */
+bool enc_forms ()
+{
+    auto r32 = [] (Reg r) { return Operand::make_reg (r); };
+    auto r64 = [] (Reg r) { return Operand::make_reg (r, Width::B64); };
+
+    MProgram prog;
+    prog.functions.push_back (MFunction {"main", {
+        MInst {Opcode::PUSH, {r64 (Reg::RBP)}},
+        MInst {Opcode::MOV, {r64 (Reg::RBP), r64 (Reg::RSP)}},
+        MInst {Opcode::PUSH, {r64 (Reg::R12)}},
+        MInst {Opcode::MOV, {Operand::make_mem (-20), r32 (Reg::R9)}},
+        MInst {Opcode::LEA, {r32 (Reg::RAX), r32 (Reg::R13), r32 (Reg::RCX).scaled (8)}},
+        MInst {Opcode::ADD, {r32 (Reg::RBX), Operand::make_imm (1000)}},
+        MInst {Opcode::SETL, {Operand::make_reg (Reg::RSI, Width::B8)}},
+        MInst {Opcode::IMUL_IMM, {r32 (Reg::RDX), r32 (Reg::R8), Operand::make_imm (-3)}},
+        MInst {Opcode::RET},
+    }});
+    MachineCode code = encode (prog);
+
+    const std::vector<uint8_t> expected =
+    {
+        0x55,
+        0x48, 0x89, 0xE5,
+        0x41, 0x54,
+        0x44, 0x89, 0x4D, 0xEC,
+        0x41, 0x8D, 0x44, 0xCD, 0x00,
+        0x81, 0xC3, 0xE8, 0x03, 0x00, 0x00,
+        0x40, 0x0F, 0x9C, 0xC6,
+        0x41, 0x6B, 0xD0, 0xFD,
+        0xC3,
+    };
+    return code.text == expected && code.functions[0].size == expected.size ();
+}
+
+/**
+ * encoder: SSE vector forms, with and without REX, and their assembly text
+ */
+bool enc_sse ()
+{
+    auto r32 = [] (Reg r) { return Operand::make_reg (r); };
+    auto xmm = [] (uint32_t n) { return Operand::make_xmm (n); };
+
+    MProgram prog;
+    prog.functions.push_back (MFunction {"main", {
+        MInst {Opcode::MOVD, {xmm (1), r32 (Reg::RAX)}},
+        MInst {Opcode::MOVD, {r32 (Reg::R9), xmm (10)}},
+        MInst {Opcode::PSHUFD, {xmm (8), xmm (2), Operand::make_imm (0x4E)}},
+        MInst {Opcode::PINSRD, {xmm (3), r32 (Reg::R11), Operand::make_imm (2)}},
+        MInst {Opcode::PADDD, {xmm (0), xmm (9)}},
+        MInst {Opcode::PSUBD, {xmm (5), xmm (6)}},
+        MInst {Opcode::PMULLD, {xmm (12), xmm (4)}},
+        MInst {Opcode::MOVDQA, {xmm (VECTOR_SCRATCH), xmm (7)}},
+    }});
+    MachineCode code = encode (prog);
+    Emitter out;
+    print_asm (prog, out);
+
+    const std::vector<uint8_t> expected =
+    {
+        0x66, 0x0F, 0x6E, 0xC8,
+        0x66, 0x45, 0x0F, 0x7E, 0xD1,
+        0x66, 0x44, 0x0F, 0x70, 0xC2, 0x4E,
+        0x66, 0x41, 0x0F, 0x3A, 0x22, 0xDB, 0x02,
+        0x66, 0x41, 0x0F, 0xFE, 0xC1,
+        0x66, 0x0F, 0xFA, 0xEE,
+        0x66, 0x44, 0x0F, 0x38, 0x40, 0xE4,
+        0x66, 0x44, 0x0F, 0x6F, 0xFF,
+    };
+    return code.text == expected
+        && out.view ().ends_with ("    movd xmm1, eax\n"
+                                  "    movd r9d, xmm10\n"
+                                  "    pshufd xmm8, xmm2, 78\n"
+                                  "    pinsrd xmm3, r11d, 2\n"
+                                  "    paddd xmm0, xmm9\n"
+                                  "    psubd xmm5, xmm6\n"
+                                  "    pmulld xmm12, xmm4\n"
+                                  "    movdqa xmm15, xmm7\n");
+}
+
+/**
+ * encoder: jumps stay short in range and grow to rel32 past 127 bytes,
+ * calls out of the program become relocations
+ */
+bool enc_jumps_calls ()
+{
+    auto label = [] (uint32_t id) { return Operand::make_label (id); };
+
+    std::vector<MInst> code {
+        MInst {Opcode::JE, {label (0)}},
+        MInst {Opcode::JMP, {label (1)}},
+        MInst {Opcode::LABEL, {label (0)}},
+    };
+    for (int i = 0; i < 30; ++i)        // 5 bytes each
+        code.push_back (MInst {Opcode::MOV, {Operand::make_reg (Reg::RAX),
+                                             Operand::make_imm (i)}});
+    code.push_back (MInst {Opcode::LABEL, {label (1)}});
+    code.push_back (MInst {Opcode::CALL, {Operand::make_symbol (0)}});
+    code.push_back (MInst {Opcode::RET});
+
+    MProgram prog;
+    prog.symbols.push_back ("external");
+    prog.functions.push_back (MFunction {"main", code});
+    MachineCode mc = encode (prog);
+
+    // je +5 (over the jmp), jmp rel32 +150
+    const auto& t = mc.text;
+    return t.size () == 2 + 5 + 150 + 5 + 1
+        && t[0] == 0x74 && t[1] == 0x05
+        && t[2] == 0xE9 && t[3] == 150 && t[4] == 0
+        && mc.relocations.size () == 1 && mc.relocations[0].offset == 158
+        && mc.relocations[0].addend == -4;
+}
+
+/**
+ * encoder: tail calls are jmp rel32, to a function of the program or
+ * through a relocation
+ */
+bool enc_tail_call ()
+{
+    auto call = [] (uint32_t symbol)
+    {
+        return MInst {Opcode::TAIL_CALL, {Operand::make_symbol (symbol), Operand::make_imm (0)}};
+    };
+
+    MProgram prog;
+    prog.symbols = {"f", "external"};
+    prog.functions.push_back (MFunction {"f", {MInst {Opcode::RET}}});
+    prog.functions.push_back (MFunction {"main", {call (0), call (1)}});
+    MachineCode mc = encode (prog);
+
+    // jmp f is short like any near jump: -3 from the end of the first jmp.
+    // The external one keeps rel32 for its relocation
+    const auto& t = mc.text;
+    return t.size () == 8
+        && t[1] == 0xEB && t[2] == 0xFD
+        && t[3] == 0xE9
+        && mc.relocations.size () == 1 && mc.relocations[0].offset == 4
+        && mc.relocations[0].symbol == 1;
+}
+
+/**
+ * elf: header fields and the symbol table split into locals then globals
+ */
+bool elf_object ()
+{
+    Lexer lexer {"int f () { return 1; } int main () { return f (); }", false};
+    Parser parser {lexer.get_tokens ()};
+    Codegen cg {parser.parse ()};
+    std::string object = cg.get_object ();
+
+    Elf64_Ehdr ehdr;
+    std::memcpy (&ehdr, object.data (), sizeof (ehdr));
+    if (std::memcmp (ehdr.e_ident, ELFMAG, SELFMAG) != 0 || ehdr.e_type != ET_REL
+        || ehdr.e_machine != EM_X86_64
+        || ehdr.e_shoff + ehdr.e_shnum * sizeof (Elf64_Shdr) != object.size ())
+        return false;
+
+    for (uint16_t s = 0; s < ehdr.e_shnum; ++s)
+    {
+        Elf64_Shdr shdr;
+        std::memcpy (&shdr, object.data () + ehdr.e_shoff + s * sizeof (shdr),
+                     sizeof (shdr));
+        if (shdr.sh_type != SHT_SYMTAB)
+            continue;
+
+        // null, f (local), main (global)
+        Elf64_Sym main_sym;
+        std::memcpy (&main_sym, object.data () + shdr.sh_offset + 2 * sizeof (main_sym),
+                     sizeof (main_sym));
+        return shdr.sh_size == 3 * sizeof (Elf64_Sym) && shdr.sh_info == 2
+            && ELF64_ST_BIND (main_sym.st_info) == STB_GLOBAL && main_sym.st_value > 0;
+    }
+    return false;
+}
+
+/**
+ * peephole: instruction counts over examples/ must not regress
+ */
+bool ph_example_counts ()
+{
+    struct Case { const char* path; size_t max_insts; };
+    static const Case cases[] =
+    {
+        {"examples/return/return.c",            5},
+        {"examples/arithmetic/arithmetic.c",    5},
+        {"examples/conditional/conditional.c",  5},
+        {"examples/loop/loop.c",                16},
+    };
+
+    bool ok = true;
+    for (const auto& c : cases)
+    {
+        Lexer lexer {c.path};
+        Parser parser {lexer.get_tokens ()};
+        Program prog = parser.parse ();
+        Optimizer opt;
+        opt.optimize (prog);
+
+        Codegen cg {prog, true};
+        size_t before = inst_count (cg.get_mir ());
+        peephole (cg.get_mir ());
+        size_t after = inst_count (cg.get_mir ());
+
+        std::cout << c.path << ": " << before << " -> " << after << std::endl;
+        ok = ok && after < before && after <= c.max_insts;
+    }
+    return ok;
+}
+
+/**
+ * Many functions calling each other, including calls to undefined ones
+ */
+std::string many_functions (int count)
+{
+    std::string source;
+    for (int i = 0; i < count; ++i)
+    {
+        std::string n = std::to_string (i);
+        std::string callee = i % 5 == 0 ? "ext" + n : "f" + std::to_string (i / 2);
+        source += "int f" + n + " (int a, int b) { int s = 0; int i = 0;"
+                  " while (i < a) { s = s + i * " + std::to_string (i % 9 + 1)
+                + " / 4; if (s > b || i == 3) { s = s - b; } i = i + 1; }"
+                  " if (a > 1) { return " + callee + " (a - 1, s); }"
+                  " return s + " + n + "; }\n";
+    }
+    return source + "int main () { return f" + std::to_string (count - 1) + " (5, 7); }";
+}
+
+/**
+ * Assembly and object of source, on pool if given
+ */
+std::pair<std::string, std::string> compile_with (const std::string& source, bool optimize,
+                                                  ThreadPool* pool)
+{
+    Lexer lexer {source, false};
+    Parser parser {lexer.get_tokens ()};
+    Program prog = parser.parse ();
+    if (optimize)
+        Optimizer {}.optimize (prog, pool);
+
+    Codegen cg {prog, optimize, {}, pool};
+    if (optimize)
+        peephole (cg.get_mir (), pool);
+    return {std::string {cg.get_assembly ()}, cg.get_object ()};
+}
+
+/**
+ * parallel: per-function work on a pool gives byte-identical output
+ */
+bool par_matches_serial ()
+{
+    std::string source = many_functions (300);
+    ThreadPool pool {4};
+    for (bool optimize : {false, true})
+        if (compile_with (source, optimize, &pool) != compile_with (source, optimize, nullptr))
+            return false;
+    return true;
+}
+
+/**
+ * parallel: the first failing function in source order is reported
+ */
+bool par_first_error ()
+{
+    std::string source = many_functions (50)
+                       + " int g (int x) { return y; }"
+                       + " int h (int x) { return z; }";
+    ThreadPool pool {4};
+    try
+    {
+        compile_with (source, false, &pool);
+        return false;
+    }
+    catch (const GenError& e)
+    {
+        return std::string {e.what ()}.find ("'y'") != std::string::npos;
+    }
+}
 
 /**
  * Entry
  */
-int main ()
+int main (int argc, char* argv[])
 {
     Testbench tb {};
+    if (!tb.parse_args (argc, argv))
+        return 1;
 
     // Too lazy to do these... full compiler tests should be enough
 
+    tb.add_family ("emitter",
+    {
+        {em_operands,       "emitter operands"},
+        {em_mem_label,      "emitter memory and labels"},
+    });
+
+    tb.add_family ("mir",
+    {
+        {mir_print,         "mir print"},
+        {mir_lowering,      "mir lowering"},
+        {mir_tail_call,     "mir tail call"},
+        {mir_print_address, "mir print addresses"},
+    }, {"emitter"});
+
+    tb.add_family ("isel",
+    {
+        {is_mul_const,      "isel constant factors"},
+        {is_div_const,      "isel constant divisors"},
+        {is_scaled_index,   "isel scaled index"},
+    }, {"mir"});
+
+    tb.add_family ("regalloc",
+    {
+        {ra_leaf_no_saves,  "regalloc leaf saves nothing"},
+        {ra_slot_reuse,     "regalloc spill slot reuse"},
+        {fr_layout,         "frame layout"},
+        {fr_tail_call,      "frame tail call"},
+    }, {"mir"});
+
+    tb.add_family ("encoder",
+    {
+        {enc_forms,         "encoder instruction forms"},
+        {enc_sse,           "encoder sse forms"},
+        {enc_jumps_calls,   "encoder jumps and calls"},
+        {enc_tail_call,     "encoder tail calls"},
+        {elf_object,        "elf object layout"},
+    }, {"mir"});
+
+    tb.add_family ("peephole",
+    {
+        {ph_push_pop_jump,  "peephole push/pop and jump"},
+        {ph_fuse_branch,    "peephole fuse compare and branch"},
+        {ph_lea,            "peephole mov and add to lea"},
+        {ph_example_counts, "peephole example instruction counts"},
+    }, {"mir"});
+
+    tb.add_family ("parallel",
+    {
+        {par_matches_serial, "parallel matches serial"},
+        {par_first_error,   "parallel first error"},
+    }, {"encoder", "peephole"});
+
     tb.run_tests ();
     tb.print_results ();
 }
\ No newline at end of file
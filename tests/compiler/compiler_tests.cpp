@@ -1,21 +1,31 @@
 /**
  * @file compiler_tests.cpp
- * @brief Full compiler pipeline (source -> asm -> run) tests
+ * @brief Full compiler pipeline (source -> asm or object -> run) tests
  */
 
 #include "testbench.hpp"
 #include "lexer.hpp"
 #include "parser.hpp"
 #include "codegen.hpp"
+#include "driver.hpp"
 #include "optimizer.hpp"
+#include "peephole.hpp"
+#include "jit.hpp"
+#include "thread_pool.hpp"
+#include <optional>
 #include "file_utils.hpp"
 #include <sys/wait.h>
 
 static bool g_optimize = false;
+static unsigned g_level = 2;        // -O1: only the passes of -O1
+static bool g_object = false;       // -c: link the encoder's object, no assembler
+static bool g_jit = false;          // --run: call main in-process, no files
+static ThreadPool* g_pool = nullptr;    // -j: per-function work on a pool
 
 /**
  * Compile source string through pipeline, assemble, run, return exit code.
- * Returns -1 on failure.  Respects the global g_optimize flag.
+ * Returns -1 on failure.  Respects the global g_optimize, g_object and g_jit
+ * flags; the JIT result is truncated to 8 bits like an exit code.
  */
 int run_source (const std::string& source)
 {
@@ -23,18 +33,30 @@ int run_source (const std::string& source)
     Parser parser {lexer.get_tokens ()};
     Program prog = parser.parse ();
 
+    CompileOptions options;
+    set_opt_level (options, g_optimize ? g_level : 0);
     if (g_optimize)
     {
-        Optimizer opt;
-        opt.optimize (prog);
+        Optimizer opt {g_level};
+        opt.optimize (prog, g_pool);
     }
 
-    Codegen cg {prog};
+    Codegen cg {prog, g_optimize, options.loops, g_pool};
+    if (g_optimize)
+        peephole (cg.get_mir (), g_pool);
+
+    if (g_jit)
+        return JitModule {cg.get_mir ()}.run_main () & 0xFF;
 
-    std::string asm_path = get_full_path ("out/test.s");
-    std::string bin_path = get_full_path ("out/test");
+    // Tests run concurrently, each worker links and runs its own files
+    std::string asm_path = get_full_path (Testbench::worker_path (g_object ? "out/test.o"
+                                                                           : "out/test.s"));
+    std::string bin_path = get_full_path (Testbench::worker_path ("out/test"));
 
-    string_to_file (cg.get_assembly (), asm_path);
+    if (g_object)
+        string_to_file (cg.get_object (), asm_path);
+    else
+        string_to_file (cg.get_assembly (), asm_path);
 
     std::string assemble_cmd = "g++ " + asm_path + " -o " + bin_path + " 2>/dev/null";
     if (system (assemble_cmd.data ()) != 0)
@@ -255,6 +277,482 @@ bool com_nested_calls ()
     ) == 42;
 }
 
+/********** Register allocation tests **********/
+bool com_live_across_call ()
+{
+    return run_source
+    (
+        "int inc (int x) { return x + 1; }"
+        "int main () {"
+        "    int a = 10;"
+        "    int b = 20;"
+        "    int c = inc (a) + inc (b);"
+        "    return a + b + c;"
+        "}"
+    ) == 62;
+}
+
+bool com_params_swapped ()
+{
+    return run_source
+    (
+        "int sub (int a, int b) { return a - b; }"
+        "int flip (int a, int b) { return sub (b, a); }"
+        "int main () { return flip (8, 50); }"
+    ) == 42;
+}
+
+bool com_spill ()
+{
+    // More simultaneously live values than allocatable registers
+    return run_source
+    (
+        "int id (int x) { return x; }"
+        "int main () {"
+        "    int v0 = 1;  int v1 = 2;  int v2 = 3;  int v3 = 4;  int v4 = 5;"
+        "    int v5 = 6;  int v6 = 7;  int v7 = 8;  int v8 = 9;  int v9 = 10;"
+        "    int v10 = 11; int v11 = 12; int v12 = 13; int v13 = 14; int v14 = 15;"
+        "    int v15 = 16; int v16 = 17; int v17 = 18; int v18 = 19; int v19 = 20;"
+        "    int s = id (1);"
+        "    return s + v0 + v1 + v2 + v3 + v4 + v5 + v6 + v7 + v8 + v9"
+        "             + v10 + v11 + v12 + v13 + v14 + v15 + v16 + v17 + v18"
+        "             + v19 - 170;"
+        "}"
+    ) == 41;
+}
+
+/********** SSA tests **********/
+bool com_loop_swap ()
+{
+    // Loop phis feeding each other
+    return run_source
+    (
+        "int main () {"
+        "    int a = 1; int b = 2; int i = 0;"
+        "    while (i < 5) { int t = a; a = b; b = t; i = i + 1; }"
+        "    return a * 10 + b;"
+        "}"
+    ) == 21;
+}
+
+bool com_loop_exit_value ()
+{
+    // The exit reads the header value, not the one sent around the loop
+    return run_source
+    (
+        "int main () {"
+        "    int i = 0; int last = 0;"
+        "    while (i < 7) { last = i; i = i + 1; }"
+        "    return last * 10 + i;"
+        "}"
+    ) == 67;
+}
+
+bool com_const_local ()
+{
+    return run_source
+    (
+        "int scale (int x) { int k = 3; int unused = x * 9; return x * k; }"
+        "int main () {"
+        "    int n = 4; int r = 0;"
+        "    if (n == 4) { r = scale (n); }"
+        "    return r;"
+        "}"
+    ) == 12;
+}
+
+/********** Loop optimization tests **********/
+bool com_unroll_nested ()
+{
+    // Inner loop: 8 iterations, invariant i * 7, induction multiply j * 3
+    return run_source
+    (
+        "int main () {"
+        "    int total = 0; int i = 0;"
+        "    while (i < 6) { int j = 0;"
+        "        while (j < 8) { total = total + i * 7 + j * 3; j = j + 1; }"
+        "        i = i + 1; }"
+        "    return total - 1300;"
+        "}"
+    ) == 44;
+}
+
+bool com_unroll_countdown ()
+{
+    return run_source
+    (
+        "int main () {"
+        "    int k = 10; int s = 0;"
+        "    while (k > 1) { s = s + k * 2; k = k - 1; }"
+        "    return s;"
+        "}"
+    ) == 108;
+}
+
+bool com_strength_variable_start ()
+{
+    return run_source
+    (
+        "int f (int i, int n) { int s = 0;"
+        "    while (i < n) { s = s + 3 * i; i = i + 2; } return s; }"
+        "int main () { return f (1, 10); }"
+    ) == 75;
+}
+
+/********** Vectorization tests **********/
+bool com_vec_remainder ()
+{
+    // 23 iterations: 20 four lanes at a time, 3 in the scalar loop
+    return run_source
+    (
+        "int f (int a) { int i = 0; int s = 0;"
+        "    while (i < 23) { s = s + i * a - 1; i = i + 1; } return s; }"
+        "int main () { return f (3) - 700; }"
+    ) == 36;
+}
+
+bool com_vec_countdown ()
+{
+    return run_source
+    (
+        "int main () {"
+        "    int k = 40; int s = 0;"
+        "    while (k > 1) { s = s + k * k; k = k - 3; }"
+        "    return s - 7750;"
+        "}"
+    ) == 180;
+}
+
+bool com_vec_call_between ()
+{
+    // The vector registers of the inner loop are dead at the call
+    return run_source
+    (
+        "int g (int x) { if (x > 1000) { return g (x - 1000); } return x + 1; }"
+        "int main () {"
+        "    int total = 0; int i = 0;"
+        "    while (i < 5) { int j = 0;"
+        "        while (j < 12) { total = total + j * i; j = j + 1; }"
+        "        total = g (total); i = i + 1; }"
+        "    return total;"
+        "}"
+    ) == 153;
+}
+
+bool com_vec_wraparound ()
+{
+    // Lane products and the sum overflow like the scalar loop's
+    return run_source
+    (
+        "int main () {"
+        "    int i = 0; int s = 0;"
+        "    while (i < 200) { s = s + i * i * i * 7919; i = i + 1; }"
+        "    return s;"
+        "}"
+    ) == 240;
+}
+
+/********** Interprocedural tests **********/
+bool com_recursion ()
+{
+    return run_source
+    (
+        "int fact (int n) { if (n < 2) { return 1; } return n * fact (n - 1); }"
+        "int main () { return fact (5); }"
+    ) == 120;
+}
+
+bool com_mutual_recursion ()
+{
+    return run_source
+    (
+        "int odd (int n) { if (n == 0) { return 0; } return even (n - 1); }"
+        "int even (int n) { if (n == 0) { return 1; } return odd (n - 1); }"
+        "int main () { return even (10) * 10 + odd (7); }"
+    ) == 11;
+}
+
+bool com_inline_returns ()
+{
+    // Several returns merge into one value at the call site
+    return run_source
+    (
+        "int clamp (int x, int lo, int hi) {"
+        "    if (x < lo) { return lo; } if (x > hi) { return hi; } return x; }"
+        "int main () {"
+        "    int i = 0; int s = 0;"
+        "    while (i < 10) { s = s + clamp (i, 2, 6); i = i + 1; }"
+        "    return s;"
+        "}"
+    ) == 42;
+}
+
+bool com_inline_loop_callee ()
+{
+    return run_source
+    (
+        "int tri (int n) { int s = 0; while (n > 0) { s = s + n; n = n - 1; } return s; }"
+        "int main () { int i = 0; int s = 0;"
+        "    while (i < 5) { s = s + tri (i); i = i + 1; }"
+        "    return s;"
+        "}"
+    ) == 20;
+}
+
+bool com_constant_argument ()
+{
+    // k is 3 at every call, x is not
+    return run_source
+    (
+        "int scale (int x, int k) { return x * k + k; }"
+        "int twice (int x) { return scale (scale (x, 3), 3); }"
+        "int main () { return twice (4) + twice (1); }"
+    ) == 69;
+}
+
+/********** Short-circuit tests **********/
+bool com_short_circuit_division ()
+{
+    // The right sides would divide by zero
+    return run_source
+    (
+        "int main () { int z = 0; int s = 0;"
+        "    if (z != 0 && 10 / z > 1) { s = 100; }"
+        "    if (z == 0 || 10 / z > 1) { s = s + 2; }"
+        "    return s + (z > 0 && 7 / z) + !(z != 0 && 1 / z); }"
+    ) == 3;
+}
+
+bool com_short_circuit_recursion ()
+{
+    // down only stops because || does not evaluate its right side at 0
+    return run_source
+    (
+        "int down (int n, int s) { return n == 0 || down (n - 1, s + n) + s; }"
+        "int count (int n) { int i = 0; int c = 0;"
+        "    while (i < n && !(i > 5 && c > 20)) { c = c + i; i = i + 1; } return c; }"
+        "int main () { return down (4, 0) + count (100); }"
+    ) == 22;
+}
+
+/********** Tail call tests **********/
+
+bool com_tail_recursion_deep ()
+{
+    // Ten million frames would not fit the stack, a loop or a jump needs none
+    return run_source
+    (
+        "int sum (int n, int acc) { if (n == 0) { return acc; }"
+        "    return sum (n - 1, acc + n - (acc / 1000) * 1000); }"
+        "int gcd (int a, int b) { if (b == 0) { return a; } return gcd (b, a - (a / b) * b); }"
+        "int main () { return sum (10000000, 0) / 8 + gcd (1071, 462); }"
+    ) == 146;
+}
+
+bool com_tail_mutual_recursion ()
+{
+    // Each jumps to the other, with a frame needed for the call in between
+    return run_source
+    (
+        "int id (int x) { return x; }"
+        "int odd (int n) { if (n == 0) { return 0; } return even (n - 1); }"
+        "int even (int n) { if (n == 0) { return 1; } int m = id (n); return odd (m - 1); }"
+        "int main () { return even (3000001) * 10 + odd (3000001) + id (7); }"
+    ) == 8;
+}
+
+/********** Switch tests **********/
+
+bool com_switch_table ()
+{
+    // Dense: a jump table, with a hole and two values sharing a body
+    return run_source
+    (
+        "int dense (int x) { switch (x) { case 0: return 10; case 1: return 11;"
+        "    case 2: case 3: return 23; case 5: return 15; default: return 99; } }"
+        "int main () { int t = 0; int i = -3;"
+        "    while (i < 8) { t = t + dense (i); i = i + 1; } return t - 700; }"
+    ) == 232;
+}
+
+bool com_switch_sparse ()
+{
+    // Sparse and negative values: a compare tree, no default
+    return run_source
+    (
+        "int sparse (int x) { int r = 0; switch (x) { case -1000: r = 1; break;"
+        "    case 7: r = 2; break; case 100: r = 3; break; case 5000: r = 4; break;"
+        "    case 90000: r = 5; break; case -7: r = 6; break; } return r; }"
+        "int main () { return sparse (-1000) + sparse (7) * 2 + sparse (100) * 3"
+        "    + sparse (5000) * 4 + sparse (90000) * 5 + sparse (-7) * 6 + sparse (8)"
+        "    + sparse (0); }"
+    ) == 91;
+}
+
+bool com_switch_loop ()
+{
+    // Every case updates s, so the loop header's phis come from five preds
+    return run_source
+    (
+        "int main () { int i = 0; int s = 0; while (i < 20) {"
+        "    switch (i - (i / 6) * 6) { case 0: s = s + 1; break; case 1: s = s + 10; break;"
+        "        case 2: s = s * 2; break; case 3: s = s - 3; break;"
+        "        default: s = s + i; break; }"
+        "    i = i + 1; } return s - (s / 200) * 200; }"
+    ) == 55;
+}
+
+bool com_switch_extremes ()
+{
+    // A table just below INT_MAX, and INT_MIN on its own
+    return run_source
+    (
+        "int f (int x) { switch (x) { case 2147483647: return 1; case 2147483646: return 2;"
+        "    case 2147483644: return 3; case 2147483645: return 4;"
+        "    case -2147483648: return 5; } return 6; }"
+        "int main () { return f (2147483647) + f (2147483646) * 2 + f (2147483645) * 3"
+        "    + f (2147483644) * 4 + f (2147483643) * 5 + f (-2147483647 - 1) * 6"
+        "    + f (-2147483647); }"
+    ) == 95;
+}
+
+bool com_switch_if_chain ()
+{
+    // With -O2 the chain becomes a switch, the same answers either way
+    return run_source
+    (
+        "int chain (int x) { if (x == 1) { return 5; } if (x == 2) { return 6; }"
+        "    if (4 == x) { return 7; } if (x == 3) { return 8; } return 9; }"
+        "int main () { int i = 0; int t = 0;"
+        "    while (i < 6) { t = t * 3 + chain (i); i = i + 1; } return t - (t / 256) * 256; }"
+    ) == 40;
+}
+
+/********** JIT tests **********/
+
+/**
+ * Helper: JIT a source string without -O
+ */
+JitModule jit (const std::string& source)
+{
+    Lexer lexer {source, false};
+    Parser parser {lexer.get_tokens ()};
+    Codegen cg {parser.parse ()};
+    return JitModule {cg.get_mir ()};
+}
+
+bool jit_named_function ()
+{
+    // Results are full ints, not exit codes
+    JitModule module = jit ("int mul (int a, int b) { return a * b; }"
+                            "int main () { return mul (6, 7); }");
+    return module.call ("mul", {-300, 1000}) == -300000 && module.run_main () == 42
+        && module.lookup ("mul") != nullptr && module.lookup ("nope") == nullptr;
+}
+
+bool jit_six_arguments ()
+{
+    JitModule module = jit ("int f (int a, int b, int c, int d, int e, int g)"
+                            "{ return a - b + c - d + e - g * 1000; }"
+                            "int main () { return 0; }");
+    return module.call ("f", {1, 2, 3, 4, 5, 6}) == 1 - 2 + 3 - 4 + 5 - 6000;
+}
+
+bool jit_missing_function ()
+{
+    JitModule module = jit ("int main () { return 1; }");
+    try
+    {
+        module.call ("missing");
+        return false;
+    }
+    catch (const GenError&)
+    {
+        return true;
+    }
+}
+
+/**
+ * A call must pass exactly the function's parameters
+ */
+bool jit_argument_count ()
+{
+    JitModule module = jit ("int mul (int a, int b) { return a * b; }"
+                            "int main () { return mul (6, 7); }");
+    for (auto args : {std::initializer_list<int> {}, std::initializer_list<int> {6},
+                      std::initializer_list<int> {6, 7, 8}})
+    {
+        try
+        {
+            module.call ("mul", args);
+            return false;
+        }
+        catch (const GenError&)
+        {
+        }
+    }
+    return module.call ("mul", {6, 7}) == 42;
+}
+
+/**
+ * After -O, functions are compiled for the program's own calls: f has its
+ * parameter replaced by 4, so only main can be called
+ */
+bool jit_specialized ()
+{
+    Lexer lexer {"int f (int x) { return x * 3 + 1; }"
+                 "int main () { return f (4) + f (4); }", false};
+    Parser parser {lexer.get_tokens ()};
+    Codegen cg {parser.parse (), true};
+    JitModule module {cg.get_mir ()};
+    try
+    {
+        module.call ("f", {10});
+        return false;
+    }
+    catch (const GenError&)
+    {
+        return module.run_main () == 26;
+    }
+}
+
+/********** Instruction selection tests **********/
+bool com_const_divisors ()
+{
+    // Shifts and magic multipliers against idiv, extreme dividends included
+    return run_source
+    (
+        "int f (int x) { return x / 7 + x / (-3) + x / 16 + x / (-8) + x / 641"
+        "    + x / 2147483647 + x / (-100) + x / 2 + x / 6; }"
+        "int g (int x) { return x * 9 + x * (-6) + x * 12 + x * 100 + x * (-1)"
+        "    + x * 65536 + 40 * x + x * 7; }"
+        "int main () { int x = -100000; int s = 0;"
+        "    while (x < 100000) { s = s + f (x) + g (x); x = x + 997; }"
+        "    s = s + f (2147483647) + f (-2147483647 - 1) + g (2147483647);"
+        "    return s == -1814135592; }"
+    ) == 1;
+}
+
+bool com_scaled_index ()
+{
+    return run_source
+    (
+        "int f (int a, int b) { return a + b * 4 + (b * 8 + a) + 2 * a; }"
+        "int main () { return f (3, 2) + f (-1, 5); }"
+    ) == 92;
+}
+
+bool com_constant_left ()
+{
+    // Compares and subtractions with the constant first
+    return run_source
+    (
+        "int f (int a) { int s = 0; if (3 < a) { s = s + 1; } if (9 > a) { s = s + 2; }"
+        "    return s + (100 - a); }"
+        "int main () { return f (5) + f (1) * 2 + f (20) - 200; }"
+    ) == 181;
+}
+
 /**
  * Entry
  */
@@ -264,10 +762,28 @@ int main (int argc, char* argv[])
     {
         if (std::string {argv[i]} == "-O")
             g_optimize = true;
+        else if (std::string {argv[i]} == "-O1")
+        {
+            g_optimize = true;
+            g_level = 1;
+        }
+        else if (std::string {argv[i]} == "-c")
+            g_object = true;
+        else if (std::string {argv[i]} == "--run")
+            g_jit = true;
     }
 
+    std::optional<ThreadPool> pool;
+    for (int i = 1; i < argc; ++i)
+        if (std::string {argv[i]} == "-j")
+            g_pool = &pool.emplace (4);
+
     Testbench tb {};
-    std::cout << "Optimizations: " << (g_optimize ? "ON" : "OFF") << std::endl;
+    if (!tb.parse_args (argc, argv))
+        return 1;
+    std::cout << "Optimizations: " << (!g_optimize ? "OFF" : g_level == 1 ? "-O1" : "ON")
+              << ", output: " << (g_jit ? "jit" : g_object ? "object" : "assembly")
+              << (g_pool ? ", parallel" : "") << std::endl;
 
     tb.add_family ("pipeline",
     {
@@ -326,6 +842,81 @@ int main (int argc, char* argv[])
         {com_nested_calls,      "nested calls"},
     }, {"return"});
 
+    tb.add_family ("registers",
+    {
+        {com_live_across_call,  "live across call"},
+        {com_params_swapped,    "params swapped"},
+        {com_spill,             "spill"},
+    }, {"functions", "variables"});
+
+    tb.add_family ("ssa",
+    {
+        {com_loop_swap,         "loop swap"},
+        {com_loop_exit_value,   "loop exit value"},
+        {com_const_local,       "constant local"},
+    }, {"loops", "functions"});
+
+    tb.add_family ("loop_opt",
+    {
+        {com_unroll_nested,             "unroll nested loop"},
+        {com_unroll_countdown,          "unroll countdown"},
+        {com_strength_variable_start,   "strength reduce variable start"},
+    }, {"ssa"});
+
+    tb.add_family ("vectorize",
+    {
+        {com_vec_remainder,             "vectorize with remainder"},
+        {com_vec_countdown,             "vectorize countdown"},
+        {com_vec_call_between,          "vectorize call between loops"},
+        {com_vec_wraparound,            "vectorize wraparound"},
+    }, {"loop_opt"});
+
+    tb.add_family ("ipo",
+    {
+        {com_recursion,                 "recursion"},
+        {com_mutual_recursion,          "mutual recursion"},
+        {com_inline_returns,            "inline several returns"},
+        {com_inline_loop_callee,        "inline callee with loop"},
+        {com_constant_argument,         "constant argument"},
+    }, {"functions"});
+
+    tb.add_family ("short_circuit",
+    {
+        {com_short_circuit_division,    "short circuit division"},
+        {com_short_circuit_recursion,   "short circuit recursion"},
+    }, {"functions", "loops"});
+
+    tb.add_family ("tail_call",
+    {
+        {com_tail_recursion_deep,       "deep tail recursion"},
+        {com_tail_mutual_recursion,     "mutual tail calls"},
+    }, {"functions", "loops"});
+
+    tb.add_family ("switch",
+    {
+        {com_switch_table,              "switch jump table"},
+        {com_switch_sparse,             "switch compare tree"},
+        {com_switch_loop,               "switch in a loop"},
+        {com_switch_extremes,           "switch extreme values"},
+        {com_switch_if_chain,           "if chain as switch"},
+    }, {"functions", "loops"});
+
+    tb.add_family ("jit",
+    {
+        {jit_named_function,            "jit named function"},
+        {jit_six_arguments,             "jit six arguments"},
+        {jit_missing_function,          "jit missing function"},
+        {jit_argument_count,            "jit argument count"},
+        {jit_specialized,               "jit specialized program"},
+    }, {"functions"});
+
+    tb.add_family ("isel",
+    {
+        {com_const_divisors,            "constant divisors and factors"},
+        {com_scaled_index,              "scaled index"},
+        {com_constant_left,             "constant on the left"},
+    }, {"functions"});
+
     tb.run_tests ();
     tb.print_results ();
 }
@@ -0,0 +1,334 @@
+/**
+ * @file driver_tests.cpp
+ * @brief Tests for whole-file and batch compilation
+ */
+
+#include "testbench.hpp"
+#include "driver.hpp"
+#include "file_utils.hpp"
+#include <filesystem>
+#include <string>
+#include <vector>
+
+static const std::vector<std::string> examples = {
+    "examples/arithmetic/arithmetic.c",
+    "examples/conditional/conditional.c",
+    "examples/loop/loop.c",
+    "examples/nested_loop/nested_loop.c",
+    "examples/return/return.c",
+    "examples/strided/strided.c",
+};
+
+/**
+ * output_path: extension swapped, directory kept or replaced
+ */
+bool op_paths ()
+{
+    return output_path ("examples/loop/loop.c", false) == "examples/loop/loop.s"
+        && output_path ("examples/loop/loop.c", true) == "examples/loop/loop.o"
+        && output_path ("examples/loop/loop.c", false, "out") == "out/loop.s"
+        && output_path ("/a/b/c.c", true, "out/") == "out/c.o"
+        && output_path ("dir.v/file", false) == "dir.v/file.s"
+        && output_path ("file", false, "out") == "out/file.s";
+}
+
+/**
+ * read_manifest: comments, blank lines and whitespace are skipped
+ */
+bool rm_basic ()
+{
+    string_to_file ("# inputs\n"
+                    "examples/loop/loop.c\n"
+                    "\n"
+                    "   examples/return/return.c  \r\n"
+                    "  # indented comment\n"
+                    "examples/strided/strided.c", "out/driver_manifest.txt");
+
+    std::vector<std::string> paths = read_manifest ("out/driver_manifest.txt");
+    return paths == std::vector<std::string> {"examples/loop/loop.c",
+                                              "examples/return/return.c",
+                                              "examples/strided/strided.c"};
+}
+
+/**
+ * read_manifest: a missing manifest lists nothing
+ */
+bool rm_missing ()
+{
+    return read_manifest ("out/no_such_manifest.txt").empty ();
+}
+
+/**
+ * compile_file: writes the output, reports progress and no errors
+ */
+bool cf_success ()
+{
+    CompileResult result = compile_file ({"examples/return/return.c", "out/driver_return.s"},
+                                         {});
+    return result.ok && result.errors.empty ()
+        && result.messages == "Parsing successful: 1 function(s)\n"
+        && file_to_string ("out/driver_return.s").find ("main:") != std::string::npos;
+}
+
+/**
+ * compile_file: parse errors are collected, not printed or thrown
+ */
+bool cf_parse_error ()
+{
+    string_to_file ("int main () { return 1 }", "out/driver_bad.c");
+    CompileResult result = compile_file ({"out/driver_bad.c", "out/driver_bad.s"}, {});
+    return !result.ok && result.errors.starts_with ("Parse error [1:");
+}
+
+/**
+ * compile_file: an unreadable input is an error in the result, not on stderr
+ */
+bool cf_missing_input ()
+{
+    CompileResult result = compile_file ({"out/driver_missing.c", "out/driver_missing.s"}, {});
+    return !result.ok && result.errors == "Could not open out/driver_missing.c\n"
+        && result.messages.empty ();
+}
+
+/**
+ * run_file: main's result comes back, nothing written
+ */
+bool rf_value ()
+{
+    CompileOptions options;
+    options.optimize = true;
+    CompileResult result = run_file ("examples/loop/loop.c", options);
+    return result.ok && result.value == 45;
+}
+
+/**
+ * compile_source: same bytes as compile_file, and a workspace reused across
+ * inputs (a parse error included) changes nothing
+ */
+bool cs_matches_file ()
+{
+    Workspace workspace;
+    std::string output;
+    for (int round = 0; round < 2; ++round)
+    {
+        for (const auto& path : examples)
+        {
+            for (bool object : {false, true})
+            {
+                CompileOptions options;
+                options.optimize = round == 1;
+                options.object = object;
+                if (!compile_file ({path, "out/driver_source.out"}, options).ok
+                    || !compile_source (file_to_string (path), options, output, &workspace).ok
+                    || output != file_to_string ("out/driver_source.out"))
+                    return false;
+            }
+        }
+        if (compile_source ("int main () { return }", {}, output, &workspace).ok)
+            return false;
+    }
+    return workspace.arena.bytes_reserved () > 0 && workspace.arena.bytes_used () == 0;
+}
+
+/**
+ * File name of an example's output, for a flat output directory
+ */
+std::string output_name (const std::string& path, bool object)
+{
+    std::string out = output_path (path, object);
+    return out.substr (out.rfind ('/') + 1);
+}
+
+/**
+ * compile_batch: same output as compiling one at a time, results in job
+ * order, one failure does not stop the rest
+ */
+bool cb_matches_serial ()
+{
+    CompileOptions options;
+    options.optimize = true;
+
+    std::vector<CompileJob> jobs;
+    std::vector<std::string> serial;
+    for (const auto& path : examples)
+    {
+        std::string name = output_name (path, false);
+        compile_file ({path, "out/driver_s_" + name}, options);
+        serial.push_back (file_to_string ("out/driver_s_" + name));
+        jobs.push_back ({path, "out/driver_p_" + name});
+    }
+    jobs.insert (jobs.begin () + 2, {"out/driver_bad.c", "out/driver_bad.s"});
+    serial.insert (serial.begin () + 2, "");
+
+    std::vector<CompileResult> results = compile_batch (jobs, options, 4);
+
+    if (results.size () != jobs.size () || results[2].ok)
+        return false;
+    for (size_t i = 0; i < jobs.size (); ++i)
+        if (i != 2 && (!results[i].ok || file_to_string (jobs[i].out_path) != serial[i]))
+            return false;
+    return true;
+}
+
+/**
+ * compile_batch: objects in parallel, more threads than jobs
+ */
+bool cb_objects ()
+{
+    CompileOptions options;
+    options.object = true;
+
+    std::vector<CompileJob> jobs;
+    for (const auto& path : examples)
+        jobs.push_back ({path, "out/driver_" + output_name (path, true)});
+
+    for (const auto& result : compile_batch (jobs, options, 16))
+        if (!result.ok)
+            return false;
+    for (const auto& job : jobs)
+        if (!file_to_string (job.out_path).starts_with ("\x7f" "ELF"))
+            return false;
+    return true;
+}
+
+/**
+ * compile_batch: inputs mapped to one output (the same name from two
+ * directories into one --out-dir) fail instead of racing on it
+ */
+bool cb_duplicate_outputs ()
+{
+    std::filesystem::create_directories (get_full_path ("out/driver_dup"));
+    string_to_file ("int main () { return 7; }", "out/driver_dup/return.c");
+    const std::string first = "examples/return/return.c", second = "out/driver_dup/return.c";
+    std::vector<CompileJob> jobs = {
+        {first, output_path (first, false, "out/driver_dup")},
+        {"examples/loop/loop.c", "out/driver_dup_loop.s"},
+        {second, output_path (second, false, "out/./driver_dup")},
+    };
+    std::vector<CompileResult> results = compile_batch (jobs, {}, 2);
+
+    return results.size () == 3 && results[1].ok && !results[0].ok && !results[2].ok
+        && results[0].errors == "Output out/driver_dup/return.s is also written for "
+                                "out/driver_dup/return.c\n"
+        && results[2].errors == "Output out/./driver_dup/return.s is also written for "
+                                "examples/return/return.c\n";
+}
+
+/**
+ * Phase names of a report, in order
+ */
+std::vector<std::string> phase_names (const TimeReport& report)
+{
+    std::vector<std::string> names;
+    for (const auto& phase : report.phases ())
+        names.push_back (phase.name);
+    return names;
+}
+
+/**
+ * Count of a phase by key, -1 if missing
+ */
+int64_t phase_count (const TimeReport& report, const std::string& phase,
+                     const std::string& key)
+{
+    for (const auto& record : report.phases ())
+        if (record.name == phase)
+            for (const auto& [name, value] : record.counts)
+                if (name == key)
+                    return value;
+    return -1;
+}
+
+/**
+ * time report: every phase of -O in order, with its counts
+ */
+bool tr_phases ()
+{
+    CompileOptions options;
+    options.optimize = true;
+    options.time_report = true;
+    CompileResult result = compile_file ({"examples/loop/loop.c", "out/driver_loop.s"},
+                                         options);
+
+    const TimeReport& report = result.report;
+    return result.ok
+        && phase_names (report) == std::vector<std::string> {
+               "lex", "parse", "ast_fold", "ssa_build", "ssa_scalar", "ssa_tail_recursion",
+               "ssa_arguments", "ssa_inline", "ssa_dead_functions", "ssa_scalar_after_inline", "ssa_loops",
+               "lower", "peephole", "output"}
+        && phase_count (report, "lex", "tokens") == 75
+        && phase_count (report, "parse", "ast_nodes") > 0
+        && phase_count (report, "lower", "spills") == 0
+        && phase_count (report, "output", "bytes")
+               == static_cast<int64_t> (file_to_string ("out/driver_loop.s").size ())
+        && report.total_ns () > 0 && report.phases ().back ().peak_rss_kb > 0;
+}
+
+/**
+ * time report: nothing is recorded unless asked for
+ */
+bool tr_off ()
+{
+    CompileResult result = compile_file ({"examples/loop/loop.c", "out/driver_loop_off.s"}, {});
+    return result.ok && result.report.phases ().empty ();
+}
+
+/**
+ * time report: JSON shape, strings escaped
+ */
+bool tr_json ()
+{
+    TimeReport report {"dir/\"odd\".c"};
+    {
+        TimeReport::Phase phase {&report, "lex"};
+        phase.count ("tokens", 3);
+    }
+    std::string json = reports_to_json ({report});
+    return json.starts_with ("{\"files\": [\n  {\"file\": \"dir/\\\"odd\\\".c\", \"total_ns\": ")
+        && json.find ("{\"name\": \"lex\", \"ns\": ") != std::string::npos
+        && json.find (", \"tokens\": 3}") != std::string::npos
+        && json.ends_with ("\n  ]}\n]}\n");
+}
+
+/**
+ * Entry
+ */
+int main (int argc, char* argv[])
+{
+    Testbench tb {};
+    if (!tb.parse_args (argc, argv))
+        return 1;
+
+    tb.add_family ("paths",
+    {
+        {op_paths,              "output path"},
+        {rm_basic,              "read manifest"},
+        {rm_missing,            "read missing manifest"},
+    });
+
+    tb.add_family ("compile_file",
+    {
+        {cf_success,            "compile file success"},
+        {cf_parse_error,        "compile file parse error"},
+        {cf_missing_input,      "compile file missing input"},
+        {rf_value,              "run file value"},
+        {cs_matches_file,       "compile source matches file"},
+    });
+
+    tb.add_family ("compile_batch",
+    {
+        {cb_matches_serial,     "batch matches serial"},
+        {cb_objects,            "batch objects"},
+        {cb_duplicate_outputs,  "batch duplicate outputs"},
+    }, {"compile_file"});
+
+    tb.add_family ("time_report",
+    {
+        {tr_phases,             "time report phases"},
+        {tr_off,                "time report off"},
+        {tr_json,               "time report json"},
+    }, {"compile_file"});
+
+    tb.run_tests ();
+    tb.print_results ();
+}
@@ -0,0 +1,197 @@
+/**
+ * @file flat_ast_tests.cpp
+ * @brief Tests for the flat (struct-of-arrays) AST
+ */
+
+#include <testbench.hpp>
+#include <lexer.hpp>
+#include <parser.hpp>
+#include <optimizer.hpp>
+#include <flat_ast.hpp>
+#include <string>
+
+/**
+ * Helper: lex and parse a source string
+ */
+Program parse_source (const std::string& src)
+{
+    Lexer lexer {src, false};
+    Parser parser {lexer.get_tokens ()};
+    return parser.parse ();
+}
+
+/**
+ * Helper: structural equality of two flat programs
+ */
+bool flat_equal (const FlatProgram& a, const FlatProgram& b)
+{
+    return a.exprs.kind == b.exprs.kind
+        && a.exprs.op == b.exprs.op
+        && a.exprs.value == b.exprs.value
+        && a.exprs.lhs == b.exprs.lhs
+        && a.exprs.rhs == b.exprs.rhs
+        && a.stmts.kind == b.stmts.kind
+        && a.stmts.name == b.stmts.name
+        && a.stmts.expr == b.stmts.expr
+        && a.stmts.block == b.stmts.block
+        && a.block_stmts == b.block_stmts
+        && a.call_args == b.call_args
+        && a.case_values == b.case_values
+        && a.params == b.params
+        && a.names == b.names;
+}
+
+static const char* sample =
+    "int add (int a, int b) { return a + b; }"
+    "int main () {"
+    "    int x = 2 * 3;"
+    "    while (x < 10) { x = x + 1; }"
+    "    if (x == 10) { return add (x, -1); }"
+    "    return !x;"
+    "}";
+
+/**
+ * flatten: every operand is stored before its parent
+ */
+bool flat_post_order ()
+{
+    FlatProgram flat = flatten (parse_source (sample));
+    const FlatExprs& e = flat.exprs;
+
+    for (NodeId i = 0; i < e.size (); ++i)
+    {
+        if ((e.kind[i] == ExprKind::UNARY || e.kind[i] == ExprKind::BINARY)
+            && e.lhs[i] >= i)
+            return false;
+        if (e.kind[i] == ExprKind::BINARY && e.rhs[i] >= i)
+            return false;
+        if (e.kind[i] == ExprKind::CALL)
+            for (NodeId a = 0; a < e.rhs[i]; ++a)
+                if (flat.call_args[e.lhs[i] + a] >= i)
+                    return false;
+    }
+
+    return e.size () == 21 && flat.functions.size () == 2;
+}
+
+/**
+ * flatten: identifiers are interned once
+ */
+bool flat_interned_names ()
+{
+    FlatProgram flat = flatten (parse_source (sample));
+
+    size_t x_count = 0;
+    for (const auto& name : flat.names)
+        if (name == "x")
+            ++x_count;
+
+    return x_count == 1
+        && flat.names[flat.functions[0].name] == "add"
+        && flat.functions[0].param_count == 2;
+}
+
+/**
+ * unflatten: round trip preserves structure
+ */
+bool flat_round_trip ()
+{
+    FlatProgram flat = flatten (parse_source (sample));
+    Program back = unflatten (flat);
+
+    return flat_equal (flat, flatten (back));
+}
+
+/**
+ * fold_constants: matches the pointer tree optimizer
+ */
+bool flat_fold_matches_optimizer ()
+{
+    const char* src =
+        "int main () {"
+        "    int x = 2 * 3 + (4 - 1);"
+        "    if (1 < 0) { return 99; }"
+        "    if (2 + 2) { x = x + 10 / 2; }"
+        "    while (x < 5 * 4) { x = x + -(3 - 2); }"
+        "    return x + 7 / 0;"
+        "}";
+
+    Program tree = parse_source (src);
+    Optimizer opt;
+    opt.optimize (tree);
+
+    FlatProgram flat = flatten (parse_source (src));
+    fold_constants (flat);
+
+    // Re-flatten both so dead nodes left in the flat arrays are dropped
+    return flat_equal (flatten (tree), flatten (unflatten (flat)));
+}
+
+/**
+ * Switches survive a round trip, and fold to the selected body as the
+ * pointer tree optimizer does
+ */
+bool flat_switch ()
+{
+    const char* src =
+        "int main () {"
+        "    int x = 3;"
+        "    switch (x) { case 1: case 2: x = 4; break; default: x = 5; break; }"
+        "    switch (2 * 3) { case -1: return 1; case 6: { x = x + 1; } break; }"
+        "    switch (7) { case 1: return 2; }"
+        "    return x;"
+        "}";
+
+    FlatProgram flat = flatten (parse_source (src));
+    if (!flat_equal (flat, flatten (unflatten (flat))) || flat.case_values.size () != 5)
+        return false;
+
+    Program tree = parse_source (src);
+    Optimizer opt;
+    opt.optimize (tree);
+    fold_constants (flat);
+    return flat_equal (flatten (tree), flatten (unflatten (flat)));
+}
+
+/**
+ * fold_constants: folds nested chain to a single literal
+ */
+bool flat_fold_literal ()
+{
+    FlatProgram flat = flatten (parse_source (
+        "int main () { return 1 + 2 * 3 - 4; }"));
+    fold_constants (flat);
+
+    NodeId ret = flat.block_stmts[flat.blocks[flat.functions[0].body].first];
+    NodeId root = flat.stmts.expr[ret];
+
+    return flat.exprs.kind[root] == ExprKind::INT_LITERAL
+        && flat.exprs.value[root] == 3;
+}
+
+/**
+ * Entry
+ */
+int main (int argc, char* argv[])
+{
+    Testbench tb {};
+    if (!tb.parse_args (argc, argv))
+        return 1;
+
+    tb.add_family ("flatten",
+    {
+        {flat_post_order,               "flatten post-order layout"},
+        {flat_interned_names,           "flatten interned names"},
+        {flat_round_trip,               "unflatten round trip"},
+    });
+
+    tb.add_family ("fold",
+    {
+        {flat_fold_literal,             "fold chain to literal"},
+        {flat_fold_matches_optimizer,   "fold matches pointer optimizer"},
+        {flat_switch,                   "switch round trip and fold"},
+    }, {"flatten"});
+
+    tb.run_tests ();
+    tb.print_results ();
+}
@@ -0,0 +1,340 @@
+/**
+ * @file function_cache_tests.cpp
+ * @brief Tests for the on-disk function cache and its use by compile_file
+ */
+
+#include "testbench.hpp"
+#include "driver.hpp"
+#include "file_utils.hpp"
+#include "function_cache.hpp"
+#include "lexer.hpp"
+#include <cstring>
+#include <filesystem>
+#include <string>
+
+/**
+ * Empty cache directory under out/
+ */
+std::string fresh_dir (const std::string& name)
+{
+    std::filesystem::remove_all (get_full_path ("out/" + name));
+    return "out/" + name;
+}
+
+/**
+ * A function with a label, a call and a spill slot, labels from first_label
+ */
+MFunction sample_function (uint32_t first_label)
+{
+    MFunction func;
+    func.name = "f";
+    func.vreg_count = 3;
+    func.frame_slots = 2;
+    func.spills = 1;
+    func.code.push_back (MInst {Opcode::LABEL, {Operand::make_label (first_label)}});
+    func.code.push_back (MInst {Opcode::CALL, {Operand::make_symbol (1),
+                                               Operand::make_imm (0)}});
+    func.code.push_back (MInst {Opcode::JMP, {Operand::make_label (first_label + 1)}});
+    func.code.push_back (MInst {Opcode::LABEL, {Operand::make_label (first_label + 1)}});
+    func.code.push_back (MInst {Opcode::RET});
+    return func;
+}
+
+uint64_t lexed_hash (const std::string& source)
+{
+    Lexer lexer {source, false};
+    return hash_tokens (lexer.get_tokens ());
+}
+
+/**
+ * Compile source with the cache, returning the output and the progress
+ * messages
+ */
+std::string compile_cached (const std::string& source, bool optimize, FunctionCache* cache,
+                            std::string* messages = nullptr)
+{
+    std::string input = Testbench::worker_path ("out/cache_input.c");
+    std::string output = Testbench::worker_path ("out/cache_output.s");
+    string_to_file (source, input);
+    CompileOptions options;
+    options.optimize = optimize;
+    options.cache = cache;
+    CompileResult result = compile_file ({input, output}, options);
+    if (messages)
+        *messages = result.messages;
+    return result.ok ? file_to_string (output) : "";
+}
+
+static const std::string PROGRAM =
+    "int add (int a, int b) { return a + b; }\n"
+    "int twice (int a) { return add (a, a); }\n"
+    "int loop (int n) { int s = 0; while (n > 0) { s = s + twice (n); n = n - 1; } return s; }\n"
+    "int main () { return loop (10) + twice (3); }\n";
+
+static const std::string EDITED =
+    "int add (int a, int b) { return a + b; }\n"
+    "int twice (int a) { return add (a, a); }\n"
+    "int loop (int n) { int s = 1; while (n > 0) { s = s + twice (n); n = n - 1; } return s; }\n"
+    "int main () { return loop (10) + twice (3); }\n";
+
+/********** Hashes **********/
+/**
+ * hash_tokens: layout and comments do not matter, tokens do
+ */
+bool ht_tokens ()
+{
+    uint64_t a = lexed_hash ("int f () { return 1; }");
+    return a == lexed_hash ("int  f()\n{\n    return 1;\n}")
+        && a != lexed_hash ("int f () { return 2; }")
+        && a != lexed_hash ("int g () { return 1; }")
+        && a != lexed_hash ("int f () { return 1 + 0; }");
+}
+
+/**
+ * function_key: the same content keys differently under other flags
+ */
+bool fk_flags ()
+{
+    LoopOptions no_unroll;
+    no_unroll.unroll_factor = 1;
+    uint64_t key = function_key (7, true, {});
+    return key == function_key (7, true, {})
+        && key != function_key (7, false, {})
+        && key != function_key (7, true, no_unroll)
+        && key != function_key (8, true, {})
+        && function_key (7, false, {}) == function_key (7, false, no_unroll);
+}
+
+/********** Storage **********/
+/**
+ * Entries come back relocated to label 0 with their own symbol list, from
+ * memory and after a save from disk
+ */
+bool fc_round_trip ()
+{
+    std::string dir = fresh_dir ("cache_round_trip");
+    MFunction func = sample_function (40);
+    MFunction relative = sample_function (0);
+    relative.code[1].ops[0] = Operand::make_symbol (0);
+    std::vector<std::string> symbols {"main", "g"};
+
+    FunctionCache cache {dir};
+    if (cache.find (5))
+        return false;
+    cache.insert (5, func, 40, 2, symbols);
+
+    auto same = [&] (const std::optional<CachedFunction>& entry)
+    {
+        return entry && entry->label_count == 2
+            && entry->symbols == std::vector<std::string> {"g"}
+            && entry->func.name == "f" && entry->func.code == relative.code
+            && entry->func.vreg_count == 3 && entry->func.frame_slots == 2
+            && entry->func.spills == 1;
+    };
+    if (!same (cache.find (5)) || !cache.save ())
+        return false;
+
+    FunctionCache reopened {dir};
+    return same (reopened.find (5)) && !reopened.find (6) && reopened.size () == 1;
+}
+
+/**
+ * Two caches on one directory (two compiler processes) keep both sets of
+ * entries
+ */
+bool fc_two_writers ()
+{
+    std::string dir = fresh_dir ("cache_two_writers");
+    FunctionCache first {dir};
+    FunctionCache second {dir};
+    first.insert (1, sample_function (2), 2, 2, {"main", "g"});
+    second.insert (2, sample_function (2), 2, 2, {"main", "h"});
+    if (!first.save () || !second.save ())
+        return false;
+
+    FunctionCache reopened {dir};
+    return reopened.size () == 2 && reopened.find (1) && reopened.find (2)
+        && reopened.find (2)->symbols == std::vector<std::string> {"h"};
+}
+
+/**
+ * Many entries: the index grows and every one is still found
+ */
+bool fc_many ()
+{
+    std::string dir = fresh_dir ("cache_many");
+    {
+        FunctionCache cache {dir};
+        for (uint64_t key = 1; key <= 5000; ++key)
+            cache.insert (key * 0x9e3779b97f4a7c15ull, sample_function (2), 2, 2,
+                          {"main", "g"});
+        if (!cache.save ())
+            return false;
+    }
+
+    FunctionCache cache {dir};
+    for (uint64_t key = 1; key <= 5000; ++key)
+        if (!cache.find (key * 0x9e3779b97f4a7c15ull))
+            return false;
+    return cache.size () == 5000 && !cache.find (12345);
+}
+
+/**
+ * Damaged files are ignored and replaced on the next save
+ */
+bool fc_corrupt ()
+{
+    std::string dir = fresh_dir ("cache_corrupt");
+    {
+        FunctionCache cache {dir};
+        cache.insert (3, sample_function (2), 2, 2, {"main", "g"});
+        cache.save ();
+    }
+    string_to_file ("not an index", dir + "/index");
+
+    FunctionCache cache {dir};
+    if (cache.find (3) || cache.size () != 0)
+        return false;
+    cache.insert (4, sample_function (2), 2, 2, {"main", "g"});
+    return cache.save () && FunctionCache {dir}.find (4).has_value ();
+}
+
+/**
+ * An index whose every slot holds some other key is searched once around,
+ * not forever; one claiming more entries than slots is ignored
+ */
+bool fc_full_index ()
+{
+    std::string dir = fresh_dir ("cache_full_index");
+    {
+        FunctionCache cache {dir};
+        cache.insert (3, sample_function (2), 2, 2, {"main", "g"});
+        cache.save ();
+    }
+
+    // Header: magic, stamp, count, capacity; then (key, offset, size) slots
+    std::string index = file_to_string (dir + "/index");
+    uint64_t header[4];
+    std::memcpy (header, index.data (), sizeof (header));
+    for (uint64_t i = 0; i < header[3]; ++i)
+    {
+        uint64_t key = 1000 + i;
+        std::memcpy (index.data () + sizeof (header) + i * 3 * sizeof (uint64_t), &key,
+                     sizeof (key));
+    }
+    string_to_file (index, dir + "/index");
+
+    FunctionCache full {dir};
+    if (full.find (3) || full.find (7))
+        return false;
+    full.insert (7, sample_function (2), 2, 2, {"main", "g"});
+    if (!full.save () || !FunctionCache {dir}.find (7))
+        return false;
+
+    index = file_to_string (dir + "/index");
+    std::memcpy (header, index.data (), sizeof (header));
+    header[2] = header[3];
+    std::memcpy (index.data (), header, sizeof (header));
+    string_to_file (index, dir + "/index");
+    return FunctionCache {dir}.size () == 0;
+}
+
+/********** Compiling through the cache **********/
+/**
+ * Without -O: a second compile reuses every function, an edit recompiles
+ * only the edited one, and the output always matches an uncached compile
+ */
+bool cc_unoptimized ()
+{
+    std::string dir = fresh_dir ("cache_unoptimized");
+    std::string fresh = compile_cached (PROGRAM, false, nullptr);
+    std::string fresh_edited = compile_cached (EDITED, false, nullptr);
+
+    std::string messages;
+    FunctionCache cache {dir};
+    bool ok = compile_cached (PROGRAM, false, &cache, &messages) == fresh
+           && messages.find ("Reused 0 of 4") != std::string::npos && cache.save ();
+
+    FunctionCache reopened {dir};
+    ok = ok && compile_cached (PROGRAM, false, &reopened, &messages) == fresh
+            && messages.find ("Reused 4 of 4") != std::string::npos;
+    ok = ok && compile_cached (EDITED, false, &reopened, &messages) == fresh_edited
+            && messages.find ("Reused 3 of 4") != std::string::npos;
+    return ok && !fresh.empty ();
+}
+
+/**
+ * With -O: functions are keyed after inlining, output matches uncached
+ */
+bool cc_optimized ()
+{
+    std::string dir = fresh_dir ("cache_optimized");
+    std::string fresh = compile_cached (PROGRAM, true, nullptr);
+    std::string fresh_edited = compile_cached (EDITED, true, nullptr);
+
+    std::string messages;
+    FunctionCache cache {dir};
+    bool ok = compile_cached (PROGRAM, true, &cache, &messages) == fresh && cache.save ();
+    ok = ok && compile_cached (PROGRAM, true, &cache, &messages) == fresh
+            && messages.find ("Reused 0 of") == std::string::npos;
+    ok = ok && compile_cached (EDITED, true, &cache, &messages) == fresh_edited;
+    return ok && !fresh.empty ()
+        && compile_cached (PROGRAM, false, &cache) == compile_cached (PROGRAM, false, nullptr);
+}
+
+/**
+ * The examples compile to the same output with a warm cache
+ */
+bool cc_examples ()
+{
+    std::string dir = fresh_dir ("cache_examples");
+    FunctionCache cache {dir};
+    for (const char* path : {"examples/loop/loop.c", "examples/nested_loop/nested_loop.c",
+                             "examples/strided/strided.c", "examples/conditional/conditional.c"})
+    {
+        for (bool optimize : {false, true})
+        {
+            std::string source = file_to_string (path);
+            std::string fresh = compile_cached (source, optimize, nullptr);
+            if (fresh.empty () || compile_cached (source, optimize, &cache) != fresh
+                || compile_cached (source, optimize, &cache) != fresh)
+                return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Entry
+ */
+int main (int argc, char* argv[])
+{
+    Testbench tb {};
+    if (!tb.parse_args (argc, argv))
+        return 1;
+
+    tb.add_family ("hashes",
+    {
+        {ht_tokens,             "token hash"},
+        {fk_flags,              "function key flags"},
+    });
+
+    tb.add_family ("storage",
+    {
+        {fc_round_trip,         "round trip"},
+        {fc_two_writers,        "two writers"},
+        {fc_many,               "many entries"},
+        {fc_corrupt,            "corrupt index"},
+        {fc_full_index,         "full index"},
+    });
+
+    tb.add_family ("compile",
+    {
+        {cc_unoptimized,        "unoptimized reuse"},
+        {cc_optimized,          "optimized reuse"},
+        {cc_examples,           "examples"},
+    }, {"storage"});
+
+    tb.run_tests ();
+    tb.print_results ();
+}
@@ -7,6 +7,7 @@
 #include <iostream>
 #include <testbench.hpp>
 #include <lexer.hpp>
+#include <stdexcept>
 #include <string>
 
 /**
@@ -54,15 +55,20 @@ bool gt_int_literal ()
  */
 bool gt_keywords ()
 {
-    Lexer lexer {"int return if while", false};
+    Lexer lexer {"int return if while switch case default break :", false};
     auto tokens = lexer.get_tokens ();
 
-    return tokens.size () == 5
+    return tokens.size () == 10
         && tokens[0].type == TokenType::INT_TYPE
         && tokens[1].type == TokenType::RETURN
         && tokens[2].type == TokenType::IF
         && tokens[3].type == TokenType::WHILE
-        && tokens[4].type == TokenType::END_OF_FILE;
+        && tokens[4].type == TokenType::SWITCH
+        && tokens[5].type == TokenType::CASE
+        && tokens[6].type == TokenType::DEFAULT
+        && tokens[7].type == TokenType::BREAK
+        && tokens[8].type == TokenType::COLON
+        && tokens[9].type == TokenType::END_OF_FILE;
 }
 
 /**
@@ -213,12 +219,138 @@ bool gt_full_file ()
         && tokens[5].type == TokenType::END_OF_FILE;
 }
 
+/**
+ * get_tokens: runs longer than one SIMD chunk
+ */
+bool gt_long_runs ()
+{
+    std::string ident (70, 'a');
+    ident += "_Z9";
+    std::string number (40, '7');
+    std::string src = ident + std::string (45, ' ') + number
+                    + std::string (20, ' ') + "\n" + std::string (37, '\t')
+                    + "while";
+
+    Lexer lexer {src, false};
+    auto tokens = lexer.get_tokens ();
+
+    return tokens.size () == 4
+        && tokens[0].type == TokenType::IDENTIFIER
+        && tokens[0].lexeme == ident
+        && tokens[1].type == TokenType::INT_LITERAL
+        && tokens[1].lexeme == number
+        && tokens[1].start.col == 119
+        && tokens[2].type == TokenType::WHILE
+        && tokens[2].start.line == 2
+        && tokens[2].start.col == 38;
+}
+
+/**
+ * get_tokens: several newlines inside one whitespace run
+ */
+bool gt_multi_newline_run ()
+{
+    Lexer lexer {"x\n\n  \n   \n     y", false};
+    auto tokens = lexer.get_tokens ();
+
+    return tokens.size () == 3
+        && tokens[1].lexeme == "y"
+        && tokens[1].start.line == 5
+        && tokens[1].start.col == 6;
+}
+
+/**
+ * get_tokens: non-ASCII bytes are UNKNOWN and end identifiers
+ */
+bool gt_non_ascii ()
+{
+    Lexer lexer {"abc\xC3\xA9" "def", false};
+    auto tokens = lexer.get_tokens ();
+
+    return tokens.size () == 5
+        && tokens[0].lexeme == "abc"
+        && tokens[1].type == TokenType::UNKNOWN
+        && tokens[2].type == TokenType::UNKNOWN
+        && tokens[3].lexeme == "def";
+}
+
+/**
+ * take_tokens: lexemes stay valid after the lexer and buffer move
+ */
+bool tt_outlives_lexer ()
+{
+    TokenBuffer buffer;
+    {
+        Lexer lexer {"int x", false};
+        buffer = lexer.take_tokens ();
+    }
+    TokenBuffer moved {std::move (buffer)};
+    auto tokens = moved.tokens ();
+
+    return tokens.size () == 3
+        && tokens[0].lexeme == "int"
+        && tokens[1].lexeme == "x"
+        && tokens[1].lexeme.data () == moved.source ().data () + 4;
+}
+
+/**
+ * take_tokens: the spent lexer refuses to lex again instead of returning
+ * an empty stream
+ */
+bool tt_spent_lexer ()
+{
+    Lexer lexer {"int x", false};
+    TokenBuffer buffer = lexer.take_tokens ();
+    int refused = 0;
+    for (int attempt = 0; attempt < 3; ++attempt)
+    {
+        try
+        {
+            if (attempt == 0)
+                lexer.get_tokens ();
+            else if (attempt == 1)
+                lexer.take_tokens ();
+            else
+                lexer.next_token ();
+        }
+        catch (const std::logic_error&)
+        {
+            ++refused;
+        }
+    }
+    return refused == 3 && buffer.tokens ().size () == 3;
+}
+
+/**
+ * next_token: pulls the same tokens as get_tokens, then repeats EOF
+ */
+bool nt_matches_get_tokens ()
+{
+    std::string src = "int main () {\n  return x == 42;\n}";
+    Lexer whole {src, false};
+    auto expected = whole.get_tokens ();
+
+    Lexer lazy {src, false};
+    for (const auto& want : expected)
+    {
+        Token got = lazy.next_token ();
+        if (got.type != want.type || got.lexeme != want.lexeme
+            || got.start.line != want.start.line
+            || got.start.col != want.start.col)
+            return false;
+    }
+
+    return lazy.next_token ().type == TokenType::END_OF_FILE;
+}
+
 /**
  * Entry
  */
-int main ()
+int main (int argc, char* argv[])
 {
     Testbench tb {};
+    if (!tb.parse_args (argc, argv))
+        return 1;
 
     tb.add_family ("get_tokens",
     {
@@ -233,8 +365,22 @@ int main ()
         {gt_unknown,            "gt unknown token"},
         {gt_full_statement,     "gt full statement"},
         {gt_full_file,          "gt full file"},
+        {gt_long_runs,          "gt long runs"},
+        {gt_multi_newline_run,  "gt multi newline run"},
+        {gt_non_ascii,          "gt non-ascii bytes"},
     });
 
+    tb.add_family ("take_tokens",
+    {
+        {tt_outlives_lexer,     "tt outlives lexer"},
+        {tt_spent_lexer,        "tt spent lexer"},
+    }, {"get_tokens"});
+
+    tb.add_family ("next_token",
+    {
+        {nt_matches_get_tokens, "nt matches get_tokens"},
+    }, {"get_tokens"});
+
     tb.run_tests ();
     tb.print_results ();
 }
@@ -3,6 +3,7 @@
  * @brief Isolated tests for the Optimizer class
  */
 
+#include <algorithm>
 #include <testbench.hpp>
 #include <parser.hpp>
 #include <optimizer.hpp>
@@ -685,12 +686,171 @@ bool if_non_const_preserved ()
         && stmt_is<IfStmt> (stmts[0]);
 }
 
+/********** PASS MANAGER **********/
+/**
+ * Helper: parse source, kept alive by the returned lexer's tokens
+ */
+Program parse_source (Lexer& lexer)
+{
+    Parser parser {lexer.get_tokens ()};
+    return parser.parse ();
+}
+
+/**
+ * Levels: -O1 keeps code after a return and dead loops, -O2 removes them
+ */
+bool pm_levels ()
+{
+    std::string source = "int f (int x) { while (0) { x = 1; } return x; x = 2; return 3; }";
+    Lexer l1 {source, false}, l2 {source, false};
+    Program o1 = parse_source (l1), o2 = parse_source (l2);
+    Optimizer {1}.optimize (o1);
+    Optimizer {2}.optimize (o2);
+
+    auto& s1 = o1.functions[0].body.statements;
+    auto& s2 = o2.functions[0].body.statements;
+    return s1.size () == 4 && stmt_is<WhileStmt> (s1[0])
+        && s2.size () == 1 && stmt_is<ReturnStmt> (s2[0]);
+}
+
+/**
+ * enable: a pass switched off does not run, the others still do
+ */
+bool pm_enable ()
+{
+    Lexer lexer {"int f () { if (1 + 1) { return 1; } return 0; }", false};
+    Program prog = parse_source (lexer);
+    Optimizer opt;
+    if (!opt.passes ().enable ("branches", false) || opt.passes ().enable ("nope", false)
+        || opt.passes ().enabled ("branches", 2) || !opt.passes ().enabled ("fold", 1)
+        || opt.passes ().enabled ("unreachable", 1))
+        return false;
+    opt.optimize (prog);
+
+    auto& stmts = prog.functions[0].body.statements;
+    return stmts.size () == 2 && stmt_is<IfStmt> (stmts[0])
+        && expr_is<IntLiteral> (*std::get<IfStmt> (stmts[0].node).condition)
+        && opt.passes ().names () == std::vector<std::string_view> {"fold", "branches",
+                                                                    "unreachable", "switches"};
+}
+
+/**
+ * Drops expression statements, to plug in
+ */
+class DropExprStmts : public AstPass
+{
+public:
+    std::string_view name () const override { return "drop"; }
+
+    Rewrite stmt (Stmt& stmt) const override
+    {
+        return stmt_is<ExprStmt> (stmt) ? Rewrite::REMOVED : Rewrite::KEPT;
+    }
+};
+
+/**
+ * add: a new pass runs after the built-in ones, nested blocks included,
+ * until nothing changes
+ */
+bool pm_plugged_pass ()
+{
+    Lexer lexer {"int g () { return 1; } "
+                 "int f (int x) { g (); while (x) { g (); x = x - 1; g (); } return x; }",
+                 false};
+    Program prog = parse_source (lexer);
+    Optimizer opt;
+    opt.passes ().add (std::make_unique<DropExprStmts> (), 2);
+    opt.optimize (prog);
+
+    auto& stmts = prog.functions[1].body.statements;
+    return stmts.size () == 2 && stmt_is<WhileStmt> (stmts[0])
+        && std::get<WhileStmt> (stmts[0].node).body->statements.size () == 1;
+}
+
+/**
+ * run: nothing to do is no change, no round and no reallocation
+ */
+bool pm_unchanged ()
+{
+    Lexer lexer {"int f (int x) { int y = x; while (y > 0) { y = y - 1; } return y; }", false};
+    Program prog = parse_source (lexer);
+    Optimizer opt;
+    auto& stmts = prog.functions[0].body.statements;
+    const Stmt* data = stmts.data ();
+    size_t capacity = stmts.capacity ();
+
+    size_t rounds = opt.passes ().run (prog.functions[0], 2);
+    return rounds == 0 && stmts.data () == data && stmts.capacity () == capacity
+        && stmts.size () == 3;
+}
+
+/********** SWITCHES **********/
+/**
+ * A switch on a constant becomes the body it selects, or the default
+ */
+bool switch_constant ()
+{
+    Lexer lexer {"int f (int x) { switch (1 + 1) { case 1: return 1; case 2: x = 2; break;"
+                 " default: return 3; } switch (7) { case 1: return 4; } return x; }", false};
+    Program prog = parse_source (lexer);
+    Optimizer {1}.optimize (prog);
+
+    auto& stmts = prog.functions[0].body.statements;
+    return stmts.size () == 2 && stmt_is<Block> (stmts[0])
+        && stmt_is<Assignment> (std::get<Block> (stmts[0].node).statements[0])
+        && stmt_is<ReturnStmt> (stmts[1]);
+}
+
+/**
+ * -O2 turns a run of tests of one variable into a switch, up to a body
+ * that writes the variable; -O1 leaves the ifs
+ */
+bool switch_from_if_chain ()
+{
+    std::string source = "int f (int x) { int y = 0;"
+                         " if (x == 1) { y = 5; } if (2 == x) { y = 6; } if (x == 3) { x = 0; }"
+                         " if (x == 4) { y = 8; } return x + y; }";
+    Lexer l1 {source, false}, l2 {source, false};
+    Program o1 = parse_source (l1), o2 = parse_source (l2);
+    Optimizer {1}.optimize (o1);
+    Optimizer {2}.optimize (o2);
+
+    auto& s2 = o2.functions[0].body.statements;
+    if (o1.functions[0].body.statements.size () != 6 || s2.size () != 4
+        || !stmt_is<SwitchStmt> (s2[1]) || !stmt_is<IfStmt> (s2[2]))
+        return false;
+
+    const auto& sw = std::get<SwitchStmt> (s2[1].node);
+    return sw.cases.size () == 3 && !sw.default_body
+        && sw.cases[0].values == std::vector<int> {1}
+        && sw.cases[1].values == std::vector<int> {2}
+        && sw.cases[2].values == std::vector<int> {3};
+}
+
+/**
+ * Too short a run, a repeated value or another variable stays an if chain
+ */
+bool switch_chain_kept ()
+{
+    Lexer lexer {"int f (int x, int z) { if (x == 1) { return 1; } if (x == 2) { return 2; }"
+                 " if (z == 3) { return 3; } if (z == 4) { return 4; } if (z == 4) { return 5; }"
+                 " return 0; }", false};
+    Program prog = parse_source (lexer);
+    Optimizer {2}.optimize (prog);
+
+    auto& stmts = prog.functions[0].body.statements;
+    return stmts.size () == 6
+        && std::all_of (stmts.begin (), stmts.begin () + 5, stmt_is<IfStmt>);
+}
+
 /**
  * Entry
  */
-int main ()
+int main (int argc, char* argv[])
 {
     Testbench tb {};
+    if (!tb.parse_args (argc, argv))
+        return 1;
 
     tb.add_family ("Constant Folding",
     {
@@ -721,6 +881,21 @@ int main ()
         {if_non_const_preserved,        "if (x): IfStmt preserved"},
     }, {"Constant Folding"});
 
+    tb.add_family ("Pass Manager",
+    {
+        {pm_levels,                     "-O1 and -O2 pass sets"},
+        {pm_enable,                     "passes switched off"},
+        {pm_plugged_pass,               "added pass runs"},
+        {pm_unchanged,                  "no change, no rewrite"},
+    }, {"Dead Branch Removal"});
+
+    tb.add_family ("Switches",
+    {
+        {switch_constant,               "switch on a constant"},
+        {switch_from_if_chain,          "if chain to switch"},
+        {switch_chain_kept,             "if chain kept"},
+    }, {"Pass Manager"});
+
     tb.run_tests ();
     tb.print_results ();
 }
@@ -7,6 +7,7 @@
 #include <iostream>
 #include <testbench.hpp>
 #include <parser.hpp>
+#include <flat_ast.hpp>
 #include <string>
 
 /**
@@ -713,12 +714,134 @@ bool parse_full_program ()
         && stmt_is<ReturnStmt> (prog.functions[0].body.statements[2]);
 }
 
+/********** SWITCH TESTS **********/
+/**
+ * Helper: parse a source string, kept alive by the lexer's tokens
+ */
+Program parse_source (Lexer& lexer)
+{
+    Parser parser {lexer};
+    return parser.parse ();
+}
+
+/**
+ * Helper: the parse error message for a source string, empty if it parses
+ */
+std::string parse_error (const std::string& source)
+{
+    Lexer lexer {source, false};
+    try
+    {
+        parse_source (lexer);
+    }
+    catch (const ParseError& e)
+    {
+        return e.what ();
+    }
+    return "";
+}
+
+/**
+ * Labels with nothing between them share a body, the break is consumed
+ */
+bool parse_switch ()
+{
+    Lexer lexer {"int f (int x) { switch (x) { case 1: case -2: x = 3; break;"
+                 " default: return 4; case 5: { x = 6; } break; } return x; }", false};
+    Program prog = parse_source (lexer);
+
+    auto& stmts = prog.functions[0].body.statements;
+    if (stmts.size () != 2 || !stmt_is<SwitchStmt> (stmts[0]))
+        return false;
+
+    const auto& sw = std::get<SwitchStmt> (stmts[0].node);
+    return expr_is<Identifier> (*sw.value)
+        && sw.cases.size () == 2
+        && sw.cases[0].values == std::vector<int> {1, -2}
+        && sw.cases[0].body->statements.size () == 1
+        && sw.cases[1].values == std::vector<int> {5}
+        && sw.cases[1].body->statements.size () == 1
+        && sw.default_body && sw.default_body->statements.size () == 1;
+}
+
+/**
+ * There is no fallthrough, duplicates and stray breaks are errors
+ */
+bool parse_switch_errors ()
+{
+    auto fails = [] (const std::string& body, const std::string& what)
+    {
+        return parse_error ("int f (int x) { " + body + " return 0; }").find (what)
+            != std::string::npos;
+    };
+    return fails ("switch (x) { case 1: x = 2; case 2: break; }", "falls through")
+        && fails ("switch (x) { case 1: break; case 1: break; }", "duplicate case")
+        && fails ("switch (x) { default: break; default: break; }", "duplicate default")
+        && fails ("switch (x) { x = 1; }", "expected 'case'")
+        && fails ("switch (x) { case 2147483648: break; }", "out of range")
+        && fails ("while (x) { break; }", "'break'")
+        && parse_error ("int f (int x) { switch (x) { case 1: x = 2; } return x; }").empty ();
+}
+
+/********** STREAMING TESTS **********/
+/**
+ * Streaming parse from a lexer matches parsing a full token array
+ */
+bool parse_streaming_matches_buffered ()
+{
+    std::string src =
+        "int add (int a, int b) { return a + b; }"
+        "int main () {"
+        "    int x = 1;"
+        "    while (x < 10) { x = add (x, 2) * 3; }"
+        "    if (!x) { foo (); }"
+        "    return x;"
+        "}";
+
+    Lexer buffered_lexer {src, false};
+    Parser buffered {buffered_lexer.get_tokens ()};
+    FlatProgram a = flatten (buffered.parse ());
+
+    Lexer streaming_lexer {src, false};
+    Parser streaming {streaming_lexer};
+    FlatProgram b = flatten (streaming.parse ());
+
+    return a.exprs.kind == b.exprs.kind
+        && a.exprs.value == b.exprs.value
+        && a.stmts.kind == b.stmts.kind
+        && a.stmts.name == b.stmts.name
+        && a.block_stmts == b.block_stmts
+        && a.names == b.names;
+}
+
+/**
+ * Streaming parse reports error locations
+ */
+bool parse_streaming_error_location ()
+{
+    Lexer lexer {"int main () {\n    return 1\n}", false};
+
+    try
+    {
+        Parser parser {lexer};
+        parser.parse ();
+    }
+    catch (const ParseError& e)
+    {
+        return e.loc.line == 3 && e.loc.col == 1;
+    }
+
+    return false;
+}
+
 /**
  * Entry
  */
-int main ()
+int main (int argc, char* argv[])
 {
     Testbench tb {};
+    if (!tb.parse_args (argc, argv))
+        return 1;
 
     tb.add_family ("Expressions",
     {
@@ -753,6 +876,18 @@ int main ()
         {parse_func_call,               "parse func call"},
     }, {"Expressions"});
 
+    tb.add_family ("Switch",
+    {
+        {parse_switch,                  "parse switch"},
+        {parse_switch_errors,           "switch errors"},
+    });
+
+    tb.add_family ("Streaming",
+    {
+        {parse_streaming_matches_buffered,  "streaming matches buffered"},
+        {parse_streaming_error_location,    "streaming error location"},
+    }, {"Statements", "Functions"});
+
     tb.add_family ("Integration",
     {
         {parse_full_program,            "parse full program"},
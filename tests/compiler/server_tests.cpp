@@ -0,0 +1,356 @@
+/**
+ * @file server_tests.cpp
+ * @brief Tests for the compile server and its client
+ */
+
+#include "testbench.hpp"
+#include "driver.hpp"
+#include "file_utils.hpp"
+#include "server.hpp"
+#include <atomic>
+#include <filesystem>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * Socket of the calling test's worker, so tests can run concurrently
+ */
+static std::string socket_path ()
+{
+    return Testbench::worker_path ("out/server_tests.sock");
+}
+
+static const std::vector<std::string> examples = {
+    "examples/arithmetic/arithmetic.c",
+    "examples/conditional/conditional.c",
+    "examples/loop/loop.c",
+    "examples/nested_loop/nested_loop.c",
+    "examples/strided/strided.c",
+};
+
+/**
+ * A server listening on the worker's socket, running on its own thread until
+ * destroyed
+ */
+struct RunningServer
+{
+    CompileServer server;
+    bool listening = false;
+    std::thread thread {};
+
+    explicit RunningServer (size_t threads = 2, const CompileOptions& defaults = {})
+        : server {socket_path (), defaults, threads}
+    {
+        std::string error;
+        listening = server.listen (error);
+        if (listening)
+            thread = std::thread {[this] { server.run (); }};
+    }
+
+    ~RunningServer ()
+    {
+        server.stop ();
+        if (thread.joinable ())
+            thread.join ();
+    }
+};
+
+/**
+ * What compile_source makes of the file, for comparison
+ */
+std::string expected (const std::string& path, const CompileOptions& options)
+{
+    std::string output;
+    return compile_source (file_to_string (path), options, output).ok ? output : "";
+}
+
+/**
+ * Send one request, false unless it compiled to want
+ */
+bool compiles_to (int fd, const std::string& path, const CompileOptions& options,
+                  const std::string& want, uint32_t unroll_factor = 0)
+{
+    CompileResult result;
+    std::string output;
+    return request_compile (fd, file_to_string (path), options, result, output, unroll_factor)
+        && result.ok && result.errors.empty () && !want.empty () && output == want;
+}
+
+/**
+ * Requests on one connection come back as compile_source would produce
+ * them, for every flag combination
+ */
+bool sv_matches_source ()
+{
+    RunningServer running;
+    int fd = connect_server (socket_path ());
+    if (!running.listening || fd < 0)
+        return false;
+
+    bool ok = true;
+    for (const auto& path : examples)
+    {
+        for (int flags = 0; flags < 4; ++flags)
+        {
+            CompileOptions options;
+            options.optimize = flags & 1;
+            options.object = flags & 2;
+            ok = ok && compiles_to (fd, path, options, expected (path, options));
+        }
+    }
+    CompileOptions no_unroll;
+    no_unroll.optimize = true;
+    no_unroll.loops.unroll_factor = 1;
+    ok = ok && compiles_to (fd, "examples/loop/loop.c", no_unroll,
+                            expected ("examples/loop/loop.c", no_unroll), 1);
+    close (fd);
+    return ok;
+}
+
+/**
+ * A request without an unroll factor keeps the server's, and an -O1
+ * request leaves the loop passes on for the -O2 ones after it
+ */
+bool sv_server_defaults ()
+{
+    CompileOptions no_unroll;
+    no_unroll.loops.unroll_factor = 1;
+    RunningServer running {2, no_unroll};
+    int fd = connect_server (socket_path ());
+    if (!running.listening || fd < 0)
+        return false;
+
+    // Unrolled by 4, not vectorized
+    const std::string path = Testbench::worker_path ("out/server_unroll.c");
+    string_to_file ("int f (int a) { int i = 0; int s = 0;"
+                    "while (i < 12) { s = s * a + i; i = i + 1; } return s; }"
+                    "int main () { return f (3); }", path);
+    CompileOptions level_1, level_2 = no_unroll;
+    set_opt_level (level_1, 1);
+    set_opt_level (level_2, 2);
+    CompileOptions unrolled;
+    set_opt_level (unrolled, 2);
+
+    bool ok = compiles_to (fd, path, level_2, expected (path, level_2))
+           && compiles_to (fd, path, level_1, expected (path, level_1))
+           && compiles_to (fd, path, level_2, expected (path, level_2))
+           && compiles_to (fd, path, level_2, expected (path, unrolled), 4)
+           && expected (path, level_2) != expected (path, unrolled);
+    close (fd);
+    return ok;
+}
+
+/**
+ * Several clients at once each get their own answers
+ */
+bool sv_concurrent ()
+{
+    RunningServer running {4};
+    if (!running.listening)
+        return false;
+
+    CompileOptions options;
+    options.optimize = true;
+    std::vector<std::string> wants;
+    for (const auto& path : examples)
+        wants.push_back (expected (path, options));
+
+    // Client threads are not test workers, so the socket is chosen here
+    std::string socket = socket_path ();
+    std::atomic<int> failures = 0;
+    std::vector<std::thread> clients;
+    for (int client = 0; client < 6; ++client)
+    {
+        clients.emplace_back ([&, client]
+        {
+            int fd = connect_server (socket);
+            for (int i = 0; i < 10; ++i)
+            {
+                size_t which = static_cast<size_t> (client + i) % examples.size ();
+                if (fd < 0 || !compiles_to (fd, examples[which], options, wants[which]))
+                    ++failures;
+            }
+            if (fd >= 0)
+                close (fd);
+        });
+    }
+    for (auto& client : clients)
+        client.join ();
+    return failures == 0 && running.server.served () == 60;
+}
+
+/**
+ * Idle connections and a half-sent request, more of them than workers, do
+ * not keep other clients waiting, and each can still send a request later
+ */
+bool sv_idle_connections ()
+{
+    RunningServer running {2};
+    if (!running.listening)
+        return false;
+
+    // A starved client fails its recv instead of hanging the test
+    auto connect = [] ()
+    {
+        int fd = connect_server (socket_path ());
+        timeval timeout {5, 0};
+        if (fd >= 0)
+            setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout));
+        return fd;
+    };
+
+    std::vector<int> idle;
+    for (int i = 0; i < 4; ++i)
+        idle.push_back (connect ());
+
+    const std::string path = "examples/loop/loop.c";
+    const std::string source = file_to_string (path);
+    const std::string want = expected (path, {});
+    ServeRequest request;
+    request.source_size = static_cast<uint32_t> (source.size ());
+    int partial = connect ();
+    bool ok = partial >= 0 && send (partial, &request, 8, MSG_NOSIGNAL) == 8;
+
+    int fd = connect ();
+    ok = ok && fd >= 0 && compiles_to (fd, path, {}, want);
+    for (int other : idle)
+        ok = ok && other >= 0 && compiles_to (other, path, {}, want);
+
+    // The rest of the header and the source complete the request
+    ServeResponse response;
+    std::string output;
+    const char* rest = reinterpret_cast<const char*> (&request) + 8;
+    ok = ok && send (partial, rest, sizeof (request) - 8, MSG_NOSIGNAL) == sizeof (request) - 8
+            && send (partial, source.data (), source.size (), MSG_NOSIGNAL)
+                   == static_cast<ssize_t> (source.size ())
+            && recv (partial, &response, sizeof (response), MSG_WAITALL) == sizeof (response)
+            && response.ok && response.errors_size == 0
+            && response.output_size == want.size ();
+
+    for (int other : idle)
+        if (other >= 0)
+            close (other);
+    for (int other : {partial, fd})
+        if (other >= 0)
+            close (other);
+    return ok;
+}
+
+/**
+ * A parse error is an answer like any other, the connection stays usable
+ */
+bool sv_parse_error ()
+{
+    RunningServer running;
+    int fd = connect_server (socket_path ());
+    if (!running.listening || fd < 0)
+        return false;
+
+    CompileResult result;
+    std::string output;
+    bool ok = request_compile (fd, "int main () { return 1 }", {}, result, output)
+           && !result.ok && result.errors.starts_with ("Parse error [1:") && output.empty ();
+    ok = ok && compiles_to (fd, "examples/loop/loop.c", {},
+                            expected ("examples/loop/loop.c", {}));
+    close (fd);
+    return ok;
+}
+
+/**
+ * A malformed request closes its connection only
+ */
+bool sv_malformed ()
+{
+    RunningServer running;
+    int bad = connect_server (socket_path ());
+    if (!running.listening || bad < 0)
+        return false;
+
+    ServeRequest request;
+    request.magic = 0;
+    char byte;
+    bool closed = send (bad, &request, sizeof (request), MSG_NOSIGNAL) == sizeof (request)
+               && recv (bad, &byte, 1, 0) == 0;
+    close (bad);
+
+    int fd = connect_server (socket_path ());
+    bool ok = closed && fd >= 0
+           && compiles_to (fd, "examples/loop/loop.c", {}, expected ("examples/loop/loop.c", {}));
+    if (fd >= 0)
+        close (fd);
+    return ok;
+}
+
+/**
+ * One server per socket; stop returns with a client still connected and
+ * removes the socket
+ */
+bool sv_stop ()
+{
+    int idle = -1;
+    {
+        RunningServer running;
+        if (!running.listening)
+            return false;
+
+        CompileServer second {socket_path (), {}, 1};
+        std::string error;
+        if (second.listen (error) || error.find ("already listening") == std::string::npos)
+            return false;
+        idle = connect_server (socket_path ());
+    }
+
+    bool ok = idle >= 0 && !std::filesystem::exists (get_full_path (socket_path ()))
+           && connect_server (socket_path ()) < 0;
+    if (idle >= 0)
+        close (idle);
+    return ok;
+}
+
+/**
+ * A socket file left behind by a dead server is replaced
+ */
+bool sv_stale_socket ()
+{
+    string_to_file ("", socket_path ());
+    RunningServer running;
+    int fd = connect_server (socket_path ());
+    bool ok = running.listening && fd >= 0
+           && compiles_to (fd, "examples/loop/loop.c", {}, expected ("examples/loop/loop.c", {}));
+    if (fd >= 0)
+        close (fd);
+    return ok;
+}
+
+/**
+ * Entry
+ */
+int main (int argc, char* argv[])
+{
+    Testbench tb {};
+    if (!tb.parse_args (argc, argv))
+        return 1;
+
+    tb.add_family ("requests",
+    {
+        {sv_matches_source,     "matches compile_source"},
+        {sv_server_defaults,    "server defaults"},
+        {sv_concurrent,         "concurrent clients"},
+        {sv_idle_connections,   "idle connections"},
+        {sv_parse_error,        "parse error"},
+        {sv_malformed,          "malformed request"},
+    });
+
+    tb.add_family ("lifetime",
+    {
+        {sv_stop,               "stop"},
+        {sv_stale_socket,       "stale socket"},
+    }, {"requests"});
+
+    tb.run_tests ();
+    tb.print_results ();
+}
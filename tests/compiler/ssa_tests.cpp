@@ -0,0 +1,772 @@
+/**
+ * @file ssa_tests.cpp
+ * @brief Isolated tests for SSA construction and the SSA passes
+ */
+
+#include "testbench.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "ssa.hpp"
+#include "ssa_opt.hpp"
+#include "loop_opt.hpp"
+#include "ipo.hpp"
+#include "optimizer.hpp"
+#include <algorithm>
+#include <climits>
+#include <string>
+
+/**
+ * Helper: build SSA for a source string
+ */
+SsaProgram build (const std::string& source)
+{
+    Lexer lexer {source, false};
+    Parser parser {lexer.get_tokens ()};
+    return build_ssa (parser.parse ());
+}
+
+/**
+ * Helper: values with the given op still in a block
+ */
+size_t count_op (const SsaFunction& func, SsaOp op)
+{
+    size_t count = 0;
+    for (const auto& block : func.blocks)
+        for (uint32_t v : block.insts)
+            if (func.insts[v].op == op)
+                ++count;
+    return count;
+}
+
+/**
+ * Helper: the value the function's only return block returns
+ */
+const SsaInst* returned (const SsaFunction& func)
+{
+    const SsaInst* result = nullptr;
+    for (const auto& block : func.blocks)
+    {
+        if (block.exit == SsaExit::RETURN && block.value != NO_VALUE)
+        {
+            if (result)
+                return nullptr;
+            result = &func.insts[block.value];
+        }
+    }
+    return result;
+}
+
+/********** CONSTRUCTION **********/
+
+/**
+ * Straight-line reassignment renames instead of storing
+ */
+bool ssa_straight_line ()
+{
+    SsaProgram prog = build ("int main () { int x = 1; x = x + 2; return x; }");
+    const SsaFunction& func = prog.functions[0];
+
+    // Code after the return would land in block 1
+    return func.blocks.size () == 2 && func.blocks[1].preds.empty ()
+        && func.blocks[0].exit == SsaExit::RETURN
+        && count_op (func, SsaOp::PHI) == 0
+        && count_op (func, SsaOp::ADD) == 1;
+}
+
+/**
+ * A variable written in a loop gets one phi in the header, none elsewhere
+ */
+bool ssa_loop_phi ()
+{
+    SsaProgram prog = build ("int main () { int i = 0; int k = 7;"
+                             "while (i < k) { i = i + 1; } return i; }");
+    const SsaFunction& func = prog.functions[0];
+
+    // k is never reassigned, so its header phi was trivial
+    if (count_op (func, SsaOp::PHI) != 1)
+        return false;
+
+    const SsaBlock& header = func.blocks[1];
+    const SsaInst& phi = func.insts[header.insts[0]];
+    return phi.op == SsaOp::PHI && phi.args.size () == 2
+        && header.preds.size () == 2 && header.exit == SsaExit::BRANCH;
+}
+
+/**
+ * Phi operands line up with the block's preds
+ */
+bool ssa_if_phi ()
+{
+    SsaProgram prog = build ("int main () { int x = 1; if (x) { x = 2; } return x; }");
+    const SsaFunction& func = prog.functions[0];
+
+    const SsaInst* phi = returned (func);
+    if (!phi || phi->op != SsaOp::PHI)
+        return false;
+
+    const SsaBlock& join = func.blocks[phi->block];
+    for (size_t i = 0; i < join.preds.size (); ++i)
+    {
+        const SsaInst& arg = func.insts[phi->args[i]];
+        int expected = join.preds[i] == 0 ? 1 : 2;
+        if (arg.op != SsaOp::CONST || arg.imm != expected)
+            return false;
+    }
+    return join.preds.size () == 2;
+}
+
+/**
+ * Dominators of an if inside a loop
+ */
+bool ssa_idoms ()
+{
+    SsaProgram prog = build ("int main () { int i = 0;"
+                             "while (i < 3) { if (i) { i = i + 1; } i = i + 1; }"
+                             "return i; }");
+    const SsaFunction& func = prog.functions[0];
+    std::vector<uint32_t> idom = compute_idoms (func);
+
+    // 0 entry, 1 header, 2 body, 3 then, 4 join, 5 exit, 6 after the return
+    return func.blocks.size () == 7 && idom[6] == NO_VALUE
+        && idom[1] == 0 && idom[2] == 1 && idom[3] == 2
+        && idom[4] == 2 && idom[5] == 1;
+}
+
+/**
+ * && in a condition branches past its right side, nothing is materialized
+ */
+bool ssa_short_circuit_cond ()
+{
+    SsaProgram prog = build ("int f (int a, int b) { if (a > 0 && b / a > 1) { return 1; }"
+                             "    return 0; }");
+    const SsaFunction& func = prog.functions[0];
+
+    // Entry tests a > 0, block 1 divides, block 2 is the then branch
+    const SsaBlock& entry = func.blocks[0];
+    const SsaBlock& rhs = func.blocks[1];
+    return entry.exit == SsaExit::BRANCH && entry.succs[0] == 1
+        && rhs.exit == SsaExit::BRANCH && rhs.succs[0] == 2
+        && entry.succs[1] == rhs.succs[1]
+        && func.insts[entry.value].op == SsaOp::GT
+        && count_op (func, SsaOp::DIV) == 1
+        && func.insts[rhs.insts[0]].op == SsaOp::DIV && count_op (func, SsaOp::PHI) == 0;
+}
+
+/**
+ * || as a value joins 1 from the short edge with the right side's result
+ */
+bool ssa_short_circuit_value ()
+{
+    SsaProgram prog = build ("int f (int a, int b) { return a || b; }");
+    const SsaFunction& func = prog.functions[0];
+
+    const SsaInst* phi = returned (func);
+    if (!phi || phi->op != SsaOp::PHI || phi->args.size () != 2)
+        return false;
+
+    const SsaInst& right = func.insts[phi->args[0]];
+    const SsaInst& decided = func.insts[phi->args[1]];
+    return right.op == SsaOp::NE && right.block == 1
+        && decided.op == SsaOp::CONST && decided.imm == 1;
+}
+
+bool ssa_unknown_variable ()
+{
+    try
+    {
+        build ("int main () { return y; }");
+        return false;
+    }
+    catch (const std::exception&)
+    {
+        return true;
+    }
+}
+
+/********** PASSES **********/
+
+/**
+ * A constant local propagates into its uses
+ */
+bool sccp_local ()
+{
+    SsaProgram prog = build ("int main () { int k = 3; int n = k * 4; return n + k; }");
+    SsaFunction& func = prog.functions[0];
+    optimize_ssa (func);
+
+    const SsaInst* result = returned (func);
+    return result && result->op == SsaOp::CONST && result->imm == 15
+        && count_op (func, SsaOp::MUL) == 0;
+}
+
+/**
+ * Constants flow around a loop: k is reassigned the same value
+ */
+bool sccp_through_loop ()
+{
+    SsaProgram prog = build ("int f (int n) { int k = 5; int i = 0;"
+                             "while (i < n) { k = 5; i = i + 1; }"
+                             "return k; }");
+    SsaFunction& func = prog.functions[0];
+    propagate_constants (func);
+
+    const SsaInst* result = returned (func);
+    return result && result->op == SsaOp::CONST && result->imm == 5;
+}
+
+/**
+ * A branch on a constant disappears along with the dead side
+ */
+bool sccp_branch ()
+{
+    SsaProgram prog = build ("int f (int a) { int mode = 2; int r = a;"
+                             "if (mode == 1) { r = f (a); } return r; }");
+    SsaFunction& func = prog.functions[0];
+    optimize_ssa (func);
+
+    return func.blocks.size () == 1 && count_op (func, SsaOp::CALL) == 0
+        && count_op (func, SsaOp::PHI) == 0;
+}
+
+/**
+ * Division by zero is never folded
+ */
+bool sccp_div_by_zero ()
+{
+    SsaProgram prog = build ("int main () { int z = 0; int x = 5 / z; return x; }");
+    SsaFunction& func = prog.functions[0];
+    optimize_ssa (func);
+
+    return count_op (func, SsaOp::DIV) == 1;
+}
+
+/**
+ * Folding wraps like the generated code, and INT_MIN / -1 is left to trap
+ * at run time as idiv does (the AST folds share the same helpers)
+ */
+bool sccp_wraparound ()
+{
+    SsaProgram prog = build ("int main () { int a = 0 - 2147483647 - 1; int b = 0 - 1;"
+                             "int c = 65536 * 65536 + (2147483647 + 1) - a;"
+                             "return a / b + c; }");
+    SsaFunction& func = prog.functions[0];
+    optimize_ssa (func);
+
+    return count_op (func, SsaOp::DIV) == 1
+        && fold_binary (BinaryOp::Op::ADD, INT_MAX, 1) == INT_MIN
+        && fold_binary (BinaryOp::Op::MUL, 65536, 65536) == 0
+        && fold_binary (BinaryOp::Op::DIV, INT_MIN, -1) == std::nullopt
+        && fold_unary (UnaryOp::Op::NEGATE, INT_MIN) == INT_MIN;
+}
+
+/**
+ * GVN merges repeated and commuted expressions
+ */
+bool gvn_common ()
+{
+    SsaProgram prog = build ("int f (int a, int b) {"
+                             "int x = a * b + 1; int y = b * a + 1;"
+                             "int p = a < b; int q = b > a;"
+                             "return x - y + p + q; }");
+    SsaFunction& func = prog.functions[0];
+    number_values (func);
+    eliminate_dead_code (func);
+
+    return count_op (func, SsaOp::MUL) == 1 && count_op (func, SsaOp::LT) == 1
+        && count_op (func, SsaOp::GT) == 0 && count_op (func, SsaOp::ADD) == 3;
+}
+
+/**
+ * Values are only merged with ones that dominate them
+ */
+bool gvn_dominance ()
+{
+    SsaProgram prog = build ("int f (int a) { int r = 0;"
+                             "if (a) { r = a * 7; } int s = a * 7; return r + s; }");
+    SsaFunction& func = prog.functions[0];
+    number_values (func);
+
+    return count_op (func, SsaOp::MUL) == 2;
+}
+
+/**
+ * Overwritten and unused values go, calls stay
+ */
+bool dce_dead_stores ()
+{
+    SsaProgram prog = build ("int g (int x) { return x; }"
+                             "int f (int a) { int x = a * 3; x = a + 1; int u = a - 9;"
+                             "g (a); return x; }");
+    SsaFunction& func = prog.functions[1];
+    size_t removed = eliminate_dead_code (func);
+
+    return removed >= 3 && count_op (func, SsaOp::MUL) == 0
+        && count_op (func, SsaOp::SUB) == 0 && count_op (func, SsaOp::CALL) == 1;
+}
+
+/**
+ * A branch around nothing folds away, leaving straight-line code
+ */
+bool cfg_empty_if ()
+{
+    SsaProgram prog = build ("int f (int a) { int x = a + 1;"
+                             "if (a < 3) { int y = x * 2; } return x; }");
+    SsaFunction& func = prog.functions[0];
+    optimize_ssa (func);
+
+    return func.blocks.size () == 1 && count_op (func, SsaOp::LT) == 0;
+}
+
+/********** LOOPS **********/
+
+/**
+ * Helper: optimized SSA with only the given loop passes
+ */
+SsaFunction optimized (const std::string& source, const LoopOptions& loops,
+                       size_t index = 0)
+{
+    SsaProgram prog = build (source);
+    optimize_ssa (prog.functions[index], loops);
+    return std::move (prog.functions[index]);
+}
+
+/**
+ * Helper: values with the given op inside the function's loops
+ */
+size_t count_in_loops (const SsaFunction& func, SsaOp op)
+{
+    std::vector<bool> seen (func.blocks.size (), false);
+    size_t count = 0;
+    for (const Loop& loop : find_loops (func))
+    {
+        for (uint32_t b : loop.blocks)
+        {
+            if (seen[b])
+                continue;
+            seen[b] = true;
+            for (uint32_t v : func.blocks[b].insts)
+                if (func.insts[v].op == op)
+                    ++count;
+        }
+    }
+    return count;
+}
+
+/**
+ * A nested while gives two loops, the inner one first
+ */
+bool loop_nest ()
+{
+    SsaProgram prog = build ("int f (int n) { int i = 0; int s = 0;"
+                             "while (i < n) { int j = 0;"
+                             "while (j < n) { s = s + j; j = j + 1; } i = i + 1; }"
+                             "return s; }");
+    std::vector<Loop> loops = find_loops (prog.functions[0]);
+
+    return loops.size () == 2 && loops[0].blocks.size () < loops[1].blocks.size ()
+        && loops[1].contains[loops[0].header] && !loops[0].contains[loops[1].header]
+        && loops[0].preheader != NO_VALUE && loops[0].latch != NO_VALUE;
+}
+
+/**
+ * An inner loop entered straight from the outer header gets a preheader
+ */
+bool loop_preheaders ()
+{
+    SsaProgram prog = build ("int f (int n) { int i = 0; int s = 0;"
+                             "while (i < n) { int j = 0;"
+                             "while (j < n) { s = s + j; j = j + 1; } i = i + 1; }"
+                             "return s; }");
+    SsaFunction& func = prog.functions[0];
+
+    // The empty outer body merges into the outer header
+    number_values (func);
+    simplify_cfg (func);
+
+    size_t missing = 0;
+    for (const Loop& loop : find_loops (func))
+        missing += loop.preheader == NO_VALUE;
+
+    size_t inserted = insert_preheaders (func);
+    for (const Loop& loop : find_loops (func))
+        if (loop.preheader == NO_VALUE)
+            return false;
+    return missing == 1 && inserted == 1;
+}
+
+/**
+ * A product of values fixed across the loop moves before it
+ */
+bool licm_hoist ()
+{
+    LoopOptions only {true, false, 0, 64, false};
+    SsaFunction func = optimized ("int f (int a, int b, int n) { int i = 0; int s = 0;"
+                                  "while (i < n) { s = s + a * b; i = i + 1; }"
+                                  "return s; }", only);
+
+    return count_op (func, SsaOp::MUL) == 1 && count_in_loops (func, SsaOp::MUL) == 0;
+}
+
+/**
+ * A division that may trap stays in a loop that might not run
+ */
+bool licm_keeps_division ()
+{
+    LoopOptions only {true, false, 0, 64, false};
+    SsaFunction func = optimized ("int f (int a, int b, int n) { int i = 0; int s = 0;"
+                                  "while (i < n) { s = s + a / b; i = i + 1; }"
+                                  "return s; }", only);
+
+    return count_in_loops (func, SsaOp::DIV) == 1;
+}
+
+/**
+ * i * 12 becomes a second variable stepped by 12
+ */
+bool sr_multiply ()
+{
+    LoopOptions only {false, true, 0, 64, false};
+    SsaFunction func = optimized ("int f (int n) { int i = 0; int s = 0;"
+                                  "while (i < n) { s = s + i * 12; i = i + 1; }"
+                                  "return s; }", only);
+
+    return count_op (func, SsaOp::MUL) == 0 && count_op (func, SsaOp::PHI) == 3;
+}
+
+/**
+ * A start only known at run time is scaled once, before the loop
+ */
+bool sr_variable_start ()
+{
+    LoopOptions only {false, true, 0, 64, false};
+    SsaFunction func = optimized ("int f (int i, int n) { int s = 0;"
+                                  "while (i < n) { s = s + 3 * i; i = i + 2; }"
+                                  "return s; }", only);
+
+    return count_op (func, SsaOp::MUL) == 1 && count_in_loops (func, SsaOp::MUL) == 0;
+}
+
+/**
+ * 12 iterations unroll by 4: one test per 4 copies of the body
+ */
+bool unroll_factor ()
+{
+    LoopOptions only {false, false, 4, 64, false};
+    SsaFunction func = optimized ("int f (int a) { int i = 0; int s = 0;"
+                                  "while (i < 12) { s = s + a; i = i + 1; }"
+                                  "return s; }", only);
+
+    return count_in_loops (func, SsaOp::ADD) == 8 && count_in_loops (func, SsaOp::LT) == 1;
+}
+
+/**
+ * The factor is the largest one up to the limit dividing the trip count
+ */
+bool unroll_divisor ()
+{
+    // 9 iterations: 3 divides, 4 does not
+    LoopOptions only {false, false, 4, 64, false};
+    SsaFunction func = optimized ("int f (int a) { int i = 10; int s = 0;"
+                                  "while (i > 1) { s = s + a; i = i - 1; }"
+                                  "return s; }", only);
+
+    return count_in_loops (func, SsaOp::ADD) == 3 && count_in_loops (func, SsaOp::SUB) == 3;
+}
+
+/**
+ * Unknown and prime trip counts, and oversized bodies, stay rolled
+ */
+bool unroll_skips ()
+{
+    LoopOptions only {false, false, 4, 64, false};
+    SsaFunction unknown = optimized ("int f (int n) { int i = 0; int s = 0;"
+                                     "while (i < n) { s = s + i; i = i + 1; }"
+                                     "return s; }", only);
+    SsaFunction prime = optimized ("int f (int a) { int i = 0; int s = 0;"
+                                   "while (i < 7) { s = s + a; i = i + 1; }"
+                                   "return s; }", only);
+
+    LoopOptions small {false, false, 4, 4, false};
+    SsaFunction big = optimized ("int f (int a) { int i = 0; int s = 0;"
+                                 "while (i < 8) { s = s + a * a - 1; i = i + 1; }"
+                                 "return s; }", small);
+
+    return count_in_loops (unknown, SsaOp::ADD) == 2
+        && count_in_loops (prime, SsaOp::ADD) == 2
+        && count_in_loops (big, SsaOp::ADD) == 2;
+}
+
+/**
+ * A sum over 16 iterations runs 4 lanes at a time and is reduced once;
+ * no remainder loop is left
+ */
+bool vec_sum ()
+{
+    LoopOptions only {false, false, 0, 64, true};
+    SsaFunction func = optimized ("int f (int a) { int i = 0; int s = 0;"
+                                  "while (i < 16) { s = s + i * a; i = i + 1; }"
+                                  "return s; }", only);
+
+    return find_loops (func).size () == 1 && count_op (func, SsaOp::VREDUCE) == 1
+        && count_in_loops (func, SsaOp::VMUL) == 1 && count_in_loops (func, SsaOp::MUL) == 0;
+}
+
+/**
+ * 18 iterations: 16 in the vector loop, the scalar loop runs the other 2
+ */
+bool vec_remainder ()
+{
+    LoopOptions only {false, false, 0, 64, true};
+    SsaFunction func = optimized ("int f (int a) { int i = 20; int s = 0;"
+                                  "while (i > 2) { s = s - a; i = i - 1; }"
+                                  "return s; }", only);
+
+    return find_loops (func).size () == 2 && count_op (func, SsaOp::VREDUCE) == 1
+        && count_in_loops (func, SsaOp::VSUB) == 1 && count_in_loops (func, SsaOp::SUB) == 2;
+}
+
+/**
+ * Unknown and short trip counts, sums read elsewhere in the body and
+ * loops needing too many vector registers stay scalar
+ */
+bool vec_skips ()
+{
+    LoopOptions only {false, false, 0, 64, true};
+    SsaFunction unknown = optimized ("int f (int n) { int i = 0; int s = 0;"
+                                     "while (i < n) { s = s + i; i = i + 1; }"
+                                     "return s; }", only);
+    SsaFunction short_trip = optimized ("int f (int a) { int i = 0; int s = 0;"
+                                        "while (i < 7) { s = s + a; i = i + 1; }"
+                                        "return s; }", only);
+    SsaFunction reread = optimized ("int f (int a) { int i = 0; int s = 1;"
+                                    "while (i < 16) { s = s + s; i = i + 1; }"
+                                    "return s; }", only);
+    // Two sums of products fit in the registers, three do not
+    SsaFunction pair = optimized ("int f (int a, int b) { int i = 0; int s = 0; int t = 0;"
+                                  "while (i < 16) { s = s + i * a; t = t + i * b; i = i + 1; }"
+                                  "return s + t; }", only);
+    SsaFunction wide = optimized ("int f (int a, int b, int c) { int i = 0;"
+                                  "int s = 0; int t = 0; int u = 0;"
+                                  "while (i < 16) { s = s + i * a; t = t + i * b;"
+                                  "u = u + i * c; i = i + 1; }"
+                                  "return s + t + u; }", only);
+
+    return count_op (unknown, SsaOp::VREDUCE) == 0
+        && count_op (short_trip, SsaOp::VREDUCE) == 0
+        && count_op (reread, SsaOp::VREDUCE) == 0
+        && count_op (pair, SsaOp::VREDUCE) == 2
+        && count_op (wide, SsaOp::VREDUCE) == 0;
+}
+
+/********** INTERPROCEDURAL **********/
+
+/**
+ * Helper: index of the named function
+ */
+uint32_t function_index (const SsaProgram& prog, const std::string& name)
+{
+    for (uint32_t f = 0; f < prog.functions.size (); ++f)
+        if (prog.functions[f].name == name)
+            return f;
+    return NO_VALUE;
+}
+
+/**
+ * Self and mutual recursion are found, callees come first
+ */
+bool ipo_call_graph ()
+{
+    SsaProgram prog = build ("int leaf (int x) { return x + 1; }"
+                             "int self (int n) { return self (n - 1); }"
+                             "int even (int n) { return odd (n - 1); }"
+                             "int odd (int n) { return even (n - 1) + leaf (n); }"
+                             "int main () { return odd (3) + self (2); }");
+    CallGraph graph = build_call_graph (prog);
+
+    std::vector<uint32_t> position (prog.functions.size ());
+    for (uint32_t i = 0; i < graph.bottom_up.size (); ++i)
+        position[graph.bottom_up[i]] = i;
+
+    uint32_t leaf = function_index (prog, "leaf");
+    uint32_t even = function_index (prog, "even");
+    uint32_t odd = function_index (prog, "odd");
+    uint32_t main = function_index (prog, "main");
+    return graph.bottom_up.size () == 5
+        && !graph.recursive[leaf] && !graph.recursive[main]
+        && graph.recursive[function_index (prog, "self")]
+        && graph.recursive[even] && graph.recursive[odd]
+        && position[leaf] < position[odd] && position[odd] < position[main]
+        && graph.call_sites[odd] == 2;
+}
+
+/**
+ * A parameter gets the constant only when every call agrees
+ */
+bool ipo_arguments ()
+{
+    SsaProgram prog = build ("int scale (int x, int k) { return x * k; }"
+                             "int main (int a) { int b = scale (a, 8);"
+                             "return scale (2, 8) + scale (b, 8); }");
+    size_t replaced = propagate_arguments (prog);
+
+    const SsaFunction& scale = prog.functions[function_index (prog, "scale")];
+    return replaced == 1 && count_op (scale, SsaOp::PARAM) == 1;
+}
+
+/**
+ * Main is called from outside, so its parameters never change
+ */
+bool ipo_arguments_main ()
+{
+    SsaProgram prog = build ("int main (int argc) { if (argc) { return main (0); }"
+                             "return 1; }");
+    return propagate_arguments (prog) == 0;
+}
+
+/**
+ * A small helper disappears into its caller and folds with its arguments
+ */
+bool ipo_inline ()
+{
+    SsaProgram prog = build ("int clamp (int x, int hi) { if (x > hi) { return hi; }"
+                             "return x; }"
+                             "int main () { return clamp (40, 10) + clamp (3, 10); }");
+    optimize_ssa (prog);
+
+    const SsaInst* result = returned (prog.functions[0]);
+    return prog.functions.size () == 1 && count_op (prog.functions[0], SsaOp::CALL) == 0
+        && result && result->op == SsaOp::CONST && result->imm == 13;
+}
+
+/**
+ * Recursive and oversized callees are left as calls
+ */
+bool ipo_inline_limits ()
+{
+    SsaProgram prog = build ("int fact (int n) { if (n < 2) { return 1; }"
+                             "return n * fact (n - 1); }"
+                             "int big (int a, int b) { int x = a * b; x = x * a + b; x = x * b - a;"
+                             "x = x / (a + 1); x = x * x + a; return x * b; }"
+                             "int main (int a) { return fact (a) + big (a, 2) + big (2, a); }");
+    InlineOptions small {4, 0, 4, 1024};
+    size_t inlined = inline_calls (prog, small);
+
+    const SsaFunction& main = prog.functions[function_index (prog, "main")];
+    return inlined == 0 && count_op (main, SsaOp::CALL) == 3;
+}
+
+/**
+ * A returned self call becomes a jump to a loop header whose phis stand
+ * for the parameters
+ */
+bool ipo_tail_recursion ()
+{
+    SsaProgram prog = build ("int sum (int n, int acc) { if (n == 0) { return acc; }"
+                             "return sum (n - 1, acc + n); }"
+                             "int main (int a) { return sum (a, 0); }");
+    size_t replaced = eliminate_tail_recursion (prog);
+
+    const SsaFunction& sum = prog.functions[function_index (prog, "sum")];
+    const SsaBlock& entry = sum.blocks[0];
+    return replaced == 1 && count_op (sum, SsaOp::CALL) == 0
+        && count_op (sum, SsaOp::PHI) == 2
+        && entry.exit == SsaExit::JUMP && entry.succs[0] == 1
+        && std::all_of (entry.insts.begin (), entry.insts.end (), [&sum] (uint32_t v)
+           {
+               return sum.insts[v].op == SsaOp::PARAM;
+           })
+        && !build_call_graph (prog).recursive[function_index (prog, "sum")];
+}
+
+/**
+ * Calls whose value is still used, and calls to other functions, stay
+ */
+bool ipo_tail_recursion_kept ()
+{
+    SsaProgram prog = build ("int fact (int n) { if (n < 2) { return 1; }"
+                             "return n * fact (n - 1); }"
+                             "int even (int n) { if (n == 0) { return 1; } return odd (n - 1); }"
+                             "int odd (int n) { if (n == 0) { return 0; } return even (n - 1); }"
+                             "int main (int a) { return fact (a) + even (a); }");
+    return eliminate_tail_recursion (prog) == 0
+        && count_op (prog.functions[function_index (prog, "fact")], SsaOp::CALL) == 1;
+}
+
+/**
+ * Functions main no longer reaches are dropped
+ */
+bool ipo_dead_functions ()
+{
+    SsaProgram prog = build ("int unused (int x) { return x; }"
+                             "int used (int x) { return x + 1; }"
+                             "int main (int a) { return used (a); }");
+    size_t removed = remove_dead_functions (prog);
+
+    return removed == 1 && prog.functions.size () == 2
+        && function_index (prog, "unused") == NO_VALUE;
+}
+
+/**
+ * Entry
+ */
+int main (int argc, char* argv[])
+{
+    Testbench tb {};
+    if (!tb.parse_args (argc, argv))
+        return 1;
+
+    tb.add_family ("ssa",
+    {
+        {ssa_straight_line,     "ssa straight line"},
+        {ssa_loop_phi,          "ssa loop phi"},
+        {ssa_if_phi,            "ssa if phi"},
+        {ssa_idoms,             "ssa dominators"},
+        {ssa_short_circuit_cond,  "ssa short circuit condition"},
+        {ssa_short_circuit_value, "ssa short circuit value"},
+        {ssa_unknown_variable,  "ssa unknown variable"},
+    });
+
+    tb.add_family ("ssa_opt",
+    {
+        {sccp_local,            "sccp constant local"},
+        {sccp_through_loop,     "sccp through loop"},
+        {sccp_branch,           "sccp constant branch"},
+        {sccp_div_by_zero,      "sccp keeps division by zero"},
+        {sccp_wraparound,       "sccp wraps, keeps INT_MIN / -1"},
+        {gvn_common,            "gvn common subexpressions"},
+        {gvn_dominance,         "gvn respects dominance"},
+        {dce_dead_stores,       "dce dead stores"},
+        {cfg_empty_if,          "cfg empty if"},
+    }, {"ssa"});
+
+    tb.add_family ("loop_opt",
+    {
+        {loop_nest,             "loop nest"},
+        {loop_preheaders,       "loop preheaders"},
+        {licm_hoist,            "licm hoists invariant product"},
+        {licm_keeps_division,   "licm keeps trapping division"},
+        {sr_multiply,           "sr induction multiply"},
+        {sr_variable_start,     "sr variable start"},
+        {unroll_factor,         "unroll by factor"},
+        {unroll_divisor,        "unroll by divisor"},
+        {unroll_skips,          "unroll skips"},
+        {vec_sum,               "vectorize sum"},
+        {vec_remainder,         "vectorize remainder"},
+        {vec_skips,             "vectorize skips"},
+    }, {"ssa_opt"});
+
+    tb.add_family ("ipo",
+    {
+        {ipo_call_graph,        "ipo call graph"},
+        {ipo_arguments,         "ipo constant arguments"},
+        {ipo_arguments_main,    "ipo keeps main parameters"},
+        {ipo_inline,            "ipo inline small helper"},
+        {ipo_inline_limits,     "ipo inline limits"},
+        {ipo_dead_functions,    "ipo dead functions"},
+        {ipo_tail_recursion,    "ipo tail recursion to loop"},
+        {ipo_tail_recursion_kept, "ipo tail recursion kept"},
+    }, {"ssa_opt"});
+
+    tb.run_tests ();
+    tb.print_results ();
+}
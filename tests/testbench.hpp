@@ -1,17 +1,30 @@
 /**
  * @file test_result.h
  * @brief Helper for tests
+ *
+ * Tests run on --jobs N worker threads (default: one per core), a family
+ * once the families it depends on are done. --shard i/n runs the i-th of n
+ * disjoint slices of the tests (1 <= i <= n), chosen by a hash of the test's
+ * family and name so a slice stays the same as tests are added elsewhere.
+ * Results list every test with its duration.
  */
 
 #include <string>
 #include <iostream>
 #include <ostream>
+#include <sstream>
 #include <vector>
+#include <deque>
 #include <algorithm>
 #include <functional>
 #include <unordered_set>
 #include <unordered_map>
 #include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
 #include <timer.hpp>
 
 /**
@@ -34,8 +47,10 @@ struct Test
 {
     std::string name;
     std::function<bool ()> func;
-    TestStatus status;
+    TestStatus status = NONE;
     ms_t timeout = 0;  // per-test override (0 = use testbench default)
+    ms_t elapsed = 0;
+    bool selected = true;   // in this run's shard
 
     Test (std::function<bool ()> func, const std::string& name,
           ms_t timeout = 0)
@@ -87,6 +102,8 @@ struct TestFamily
 
     bool evaluated = false;
     bool all_passed = true;
+    bool started = false;
+    size_t pending = 0;     // Selected tests not finished yet
 };
 
 /**
@@ -98,6 +115,16 @@ private:
     std::vector <TestFamily> families {};
     bool dependency_cycle = true;
     ms_t default_timeout = 5000;  // default 5s per test
+    size_t jobs = 0;              // 0 = one per hardware thread
+    size_t shard_index = 0;
+    size_t shard_count = 1;
+    ms_t wall_time = 0;
+    size_t threads_used = 1;
+
+    std::mutex mutex {};
+    std::condition_variable work_ready {};
+    std::deque <std::pair <size_t, size_t>> queue {};      // (family, test)
+    size_t done_families = 0;                              // Evaluated families
 
     /**
      * Find family index by name, or -1
@@ -111,94 +138,195 @@ private:
     }
 
     /**
-     * Run tests for a single family
+     * Worker index of the calling thread
+     */
+    static size_t& current_worker ()
+    {
+        static thread_local size_t index = 0;
+        return index;
+    }
+
+    /**
+     * Stable hash of a test's family and name, for sharding
+     */
+    static uint64_t test_hash (const std::string& family, const std::string& name)
+    {
+        uint64_t hash = 0xcbf29ce484222325;
+        for (char c : family + "/" + name)
+        {
+            hash ^= static_cast <unsigned char> (c);
+            hash *= 0x100000001b3;
+        }
+        return hash;
+    }
+
+    /**
+     * Run one test, timing it against its limit
      */
-    void run_family (TestFamily& family)
+    void run_test (Test& test)
     {
-        if (family.evaluated) return;
+        test.status = TestStatus::STARTED;
 
-        for (auto& test : family.tests)
-            test.status = TestStatus::NONE;
+        ms_t limit = test.timeout > 0
+                   ? test.timeout
+                   : default_timeout;
 
-        family.all_passed = true;
-        std::vector<TestFamily> failed_deps {};
+        bool result = false;
+        ms_t start = get_time_ms ();
 
-        // Check dependencies
-        for (const auto& dep : family.depends_on)
+        try
         {
-            int idx = find_family (dep);
-            if (idx < 0) continue;
+            result = test.func ();
+        }
+        catch (const std::exception& e)
+        {
+            std::ostringstream msg;
+            msg << "Test " << test.name
+                << " Error: " << e.what () << "\n";
+            std::cerr << msg.str () << std::flush;
+            test.status = TestStatus::ERROR;
+        }
+        catch (...)
+        {
+            std::ostringstream msg;
+            msg << "Test " << test.name
+                << " threw unknown exception\n";
+            std::cerr << msg.str () << std::flush;
+            test.status = TestStatus::ERROR;
+        }
 
-            TestFamily& dep_family = families[idx];
-            if (!dep_family.evaluated)
-                run_family (dep_family);
+        test.elapsed = get_time_ms () - start;
 
-            if (!dep_family.all_passed)
-                failed_deps.push_back (dep_family);
+        // Tests are not interrupted, an overrun is reported once it returns
+        if (test.elapsed > limit)
+            test.status = TestStatus::TIMEOUT;
+        else if (!result && test.status != TestStatus::ERROR)
+            test.status = TestStatus::FAIL;
+        else if (result)
+            test.status = TestStatus::PASS;
+    }
+
+    /**
+     * Whether every family the family depends on is done
+     */
+    bool ready (const TestFamily& family) const
+    {
+        for (const auto& dep : family.depends_on)
+        {
+            int idx = find_family (dep);
+            if (idx >= 0 && !families[idx].evaluated)
+                return false;
         }
+        return true;
+    }
 
-        if (!failed_deps.empty ())
+    /**
+     * Queue the tests of every family whose dependencies are done; a family
+     * with nothing selected is done at once. Called with mutex held.
+     */
+    void start_ready ()
+    {
+        bool progress = true;
+        while (progress)
         {
-            std::cerr << "\033[33mWARN --- family \""
-                        << family.name
-                        << "\" depends on failed: ";
-            for (size_t i = 0; i < failed_deps.size (); ++i)
+            progress = false;
+            for (size_t f = 0; f < families.size (); ++f)
             {
-                if (i > 0) std::cerr << ", ";
-                std::cerr << "\"" << failed_deps[i].name << "\"";
+                TestFamily& family = families[f];
+                if (family.started || !ready (family))
+                    continue;
+
+                family.started = true;
+                warn_failed_deps (family);
+                for (size_t t = 0; t < family.tests.size (); ++t)
+                {
+                    if (!family.tests[t].selected)
+                        continue;
+                    queue.push_back ({f, t});
+                    ++family.pending;
+                }
+                if (family.pending == 0)
+                {
+                    family.evaluated = true;
+                    progress = true;
+                }
             }
-            std::cerr << "\033[0m" << std::endl;
         }
+    }
+
+    /**
+     * Warn when a family runs although families it depends on failed
+     */
+    void warn_failed_deps (const TestFamily& family) const
+    {
+        std::vector <std::string> failed_deps {};
+        for (const auto& dep : family.depends_on)
+        {
+            int idx = find_family (dep);
+            if (idx >= 0 && !families[idx].all_passed)
+                failed_deps.push_back (dep);
+        }
+        if (failed_deps.empty ())
+            return;
 
-        // Run tests sequentially with timeout check
-        for (auto& test : family.tests)
+        std::ostringstream msg;
+        msg << "\033[33mWARN --- family \""
+            << family.name
+            << "\" depends on failed: ";
+        for (size_t i = 0; i < failed_deps.size (); ++i)
         {
-            test.status = TestStatus::STARTED;
+            if (i > 0) msg << ", ";
+            msg << "\"" << failed_deps[i] << "\"";
+        }
+        msg << "\033[0m\n";
+        std::cerr << msg.str () << std::flush;
+    }
 
-            ms_t limit = test.timeout > 0
-                       ? test.timeout
-                       : default_timeout;
+    /**
+     * Recount the evaluated families. Called with mutex held.
+     */
+    void count_done ()
+    {
+        done_families = static_cast <size_t> (std::count_if (families.begin (), families.end (),
+            [] (const TestFamily& family) { return family.evaluated; }));
+    }
 
-            bool result = false;
-            ms_t start = get_time_ms ();
+    /**
+     * Take queued tests until every family is done
+     */
+    void work (size_t worker)
+    {
+        current_worker () = worker;
 
-            try
-            {
-                result = test.func ();
-            }
-            catch (const std::exception& e)
-            {
-                std::cerr << "Test " << test.name
-                          << " Error: " << e.what () << std::endl;
-                test.status = TestStatus::ERROR;
-            }
-            catch (...)
+        std::unique_lock <std::mutex> lock {mutex};
+        while (true)
+        {
+            work_ready.wait (lock, [this]
             {
-                std::cerr << "Test " << test.name
-                          << " threw unknown exception" << std::endl;
-                test.status = TestStatus::ERROR;
-            }
+                return !queue.empty () || done_families == families.size ();
+            });
+            if (queue.empty ())
+                return;
 
-            ms_t elapsed = get_time_ms () - start;
+            auto [f, t] = queue.front ();
+            queue.pop_front ();
+            lock.unlock ();
 
-            if (elapsed > limit)
-            {
-                test.status = TestStatus::TIMEOUT;
-                family.all_passed = false;
-            }
-            else if (!result)
-            {
+            Test& test = families[f].tests[t];
+            run_test (test);
+
+            lock.lock ();
+            TestFamily& family = families[f];
+            if (test.status != TestStatus::PASS)
                 family.all_passed = false;
-                if (test.status != TestStatus::ERROR)
-                    test.status = TestStatus::FAIL;
-            }
-            else
+            if (--family.pending == 0)
             {
-                test.status = TestStatus::PASS;
+                family.evaluated = true;
+                start_ready ();
+                count_done ();
+                work_ready.notify_all ();
             }
         }
-
-        family.evaluated = true;
     }
 
     /**
@@ -286,6 +414,80 @@ public:
         default_timeout = ms;
     }
 
+    /**
+     * Set the number of tests run at once (0 = one per hardware thread)
+     */
+    void set_jobs (size_t n)
+    {
+        jobs = n;
+    }
+
+    /**
+     * Run only slice index (0-based) of count
+     */
+    void set_shard (size_t index, size_t count)
+    {
+        shard_index = index;
+        shard_count = count;
+    }
+
+    /**
+     * Take --jobs N and --shard i/n from the command line, other arguments
+     * are left to the caller
+     * Returns false, with a message, if a value is malformed
+     */
+    bool parse_args (int argc, char* argv[])
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg {argv[i]};
+            if (arg != "--jobs" && arg != "--shard")
+                continue;
+
+            std::string value = i + 1 < argc ? argv[++i] : "";
+            char* end = nullptr;
+            unsigned long n = std::strtoul (value.c_str (), &end, 10);
+            if (arg == "--jobs" && !value.empty () && *end == '\0')
+            {
+                set_jobs (n);
+                continue;
+            }
+            unsigned long count = *end == '/' ? std::strtoul (end + 1, &end, 10) : 0;
+            if (arg == "--shard" && *end == '\0' && n >= 1 && n <= count)
+            {
+                set_shard (n - 1, count);
+                continue;
+            }
+
+            std::cerr << "\033[31mERROR --- bad value for " << arg << ": \""
+                      << value << "\"\033[0m" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Index of the worker running the calling test, 0 to jobs - 1: tests that
+     * write files name them after it, so concurrent tests never share one
+     */
+    static size_t worker ()
+    {
+        return current_worker ();
+    }
+
+    /**
+     * path with the worker index before its extension:
+     * "out/test.s" on worker 2 is "out/test_2.s"
+     */
+    static std::string worker_path (const std::string& path)
+    {
+        size_t slash = path.rfind ('/');
+        size_t dot = path.rfind ('.');
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+            dot = path.size ();
+        return path.substr (0, dot) + "_" + std::to_string (worker ()) + path.substr (dot);
+    }
+
     /**
      * Add a test to the default (unnamed) family
      */
@@ -316,7 +518,8 @@ public:
     }
 
     /**
-     * Run all families in order, checking dependencies
+     * Run the shard's tests on the worker threads, each family once the
+     * families it depends on are done
      * Return true if run success
      * 
      * @note Intended to be called once.
@@ -328,9 +531,42 @@ public:
         if (!validate_dependencies ())
             return false;
 
+        size_t selected = 0;
         for (auto& family : families)
-            run_family (family);
-        
+        {
+            family.evaluated = family.started = false;
+            family.all_passed = true;
+            family.pending = 0;
+            for (auto& test : family.tests)
+            {
+                test.status = TestStatus::NONE;
+                test.selected = test_hash (family.name, test.name) % shard_count == shard_index;
+                selected += test.selected;
+            }
+        }
+
+        size_t threads = jobs > 0 ? jobs : std::max (1u, std::thread::hardware_concurrency ());
+        threads = std::max <size_t> (1, std::min (threads, selected));
+        ms_t start = get_time_ms ();
+
+        {
+            std::lock_guard <std::mutex> lock {mutex};
+            queue.clear ();
+            start_ready ();
+            count_done ();
+        }
+
+        // The calling thread is worker 0
+        std::vector <std::thread> workers {};
+        for (size_t w = 1; w < threads; ++w)
+            workers.emplace_back ([this, w] { work (w); });
+        work (0);
+        for (auto& thread : workers)
+            thread.join ();
+        current_worker () = 0;
+
+        wall_time = get_time_ms () - start;
+        threads_used = threads;
         return true;
     }
 
@@ -347,30 +583,43 @@ public:
             return;
         }
 
-        for (size_t f = 0; f < families.size (); ++f)
+        size_t run = 0;
+        size_t passed = 0;
+        const Test* slowest = nullptr;
+        bool first = true;
+
+        for (const auto& family : families)
         {
-            const auto& family = families[f];
+            if (std::none_of (family.tests.begin (), family.tests.end (),
+                              [] (const Test& test) { return test.selected; }))
+                continue;
 
-            if (!family.name.empty ())
-            {
-                if (f > 0)
-                    std::cout << "\n";
+            if (!first)
+                std::cout << "\n";
+            first = false;
 
-                std::cout << "--- " << family.name << " ---"
-                          << std::endl;
-            }
+            if (!family.name.empty ())
+                std::cout << "--- " << family.name << " ---" << std::endl;
 
-            for (size_t i = 0; i < family.tests.size (); ++i)
+            for (const auto& test : family.tests)
             {
-                std::cout << family.tests[i];
-                if (i < family.tests.size () - 1)
-                    std::cout << std::endl;
+                if (!test.selected)
+                    continue;
+                std::cout << test << " (" << test.elapsed << " ms)" << std::endl;
+
+                ++run;
+                passed += test.status == TestStatus::PASS;
+                if (!slowest || test.elapsed > slowest->elapsed)
+                    slowest = &test;
             }
-
-            if (f < families.size () - 1)
-                std::cout << std::endl;
         }
-        
+
+        std::cout << "\n" << passed << "/" << run << " passed in " << wall_time
+                  << " ms on " << threads_used << (threads_used == 1 ? " job" : " jobs");
+        if (shard_count > 1)
+            std::cout << ", shard " << shard_index + 1 << "/" << shard_count;
+        if (slowest)
+            std::cout << ", slowest: " << slowest->name << " (" << slowest->elapsed << " ms)";
         std::cout << "\n=======================" << std::endl;
     }
 };